@@ -25,6 +25,7 @@
 struct apr_array_header_t;
 struct apr_hash_t;
 struct md_json_t;
+struct md_data_t;
 struct md_cert_t;
 struct md_job_t;
 struct md_pkey_t;
@@ -117,6 +118,8 @@ struct md_t {
     int must_staple;                /* certificates should set the OCSP Must Staple extension */
     int stapling;                   /* if OCSP stapling is enabled */
     int watched;                    /* if certificate is supervised (renew or expiration warning) */
+
+    const struct md_dns_set_t *domain_set; /* the domains as a set, once frozen, or NULL */
 };
 
 #define MD_KEY_ACCOUNT          "account"
@@ -136,9 +139,11 @@ struct md_t {
 #define MD_KEY_CERTIFICATE      "certificate"
 #define MD_KEY_CHALLENGE        "challenge"
 #define MD_KEY_CHALLENGES       "challenges"
+#define MD_KEY_CLEANUP          "cleanup"
 #define MD_KEY_CMD_DNS01        "cmd-dns-01"
 #define MD_KEY_DNS01_VERSION    "cmd-dns-01-version"
 #define MD_KEY_COMPLETE         "complete"
+#define MD_KEY_COMPLETED        "completed"
 #define MD_KEY_CONTACT          "contact"
 #define MD_KEY_CONTACTS         "contacts"
 #define MD_KEY_CSR              "csr"
@@ -177,6 +182,8 @@ struct md_t {
 #define MD_KEY_MESSAGE          "message"
 #define MD_KEY_MUST_STAPLE      "must-staple"
 #define MD_KEY_NAME             "name"
+#define MD_KEY_NAMES            "names"
+#define MD_KEY_NAMES_DONE       "names-done"
 #define MD_KEY_NEXT_RUN         "next-run"
 #define MD_KEY_NOTIFIED         "notified"
 #define MD_KEY_NOTIFIED_RENEWED "notified-renewed"
@@ -194,6 +201,7 @@ struct md_t {
 #define MD_KEY_PROXY_URL        "proxy-url"
 #define MD_KEY_READY            "ready"
 #define MD_KEY_REGISTRATION     "registration"
+#define MD_KEY_REMOVED          "removed"
 #define MD_KEY_RENEW            "renew"
 #define MD_KEY_RENEW_AT         "renew-at"
 #define MD_KEY_RENEW_MODE       "renew-mode"
@@ -207,6 +215,7 @@ struct md_t {
 #define MD_KEY_SERIAL           "serial"
 #define MD_KEY_SHA256_FINGERPRINT  "sha256-fingerprint"
 #define MD_KEY_STAPLING         "stapling"
+#define MD_KEY_STARTED          "started"
 #define MD_KEY_STATE            "state"
 #define MD_KEY_STATE_DESCR      "state-descr"
 #define MD_KEY_STATUS           "status"
@@ -231,6 +240,60 @@ struct md_t {
 #define MD_KEY_WHEN             "when"
 #define MD_KEY_WARN_WINDOW      "warn-window"
 
+/* Key paths of the MD_KEYs read and written for md.json, job.json and the
+ * status, see md_json_path_t. */
+struct md_json_path_t;
+extern const struct md_json_path_t MD_P_ARI_RENEWALS;
+extern const struct md_json_path_t MD_P_CA_ACCOUNT;
+extern const struct md_json_path_t MD_P_CA_AGREEMENT;
+extern const struct md_json_path_t MD_P_CA_CERTS;
+extern const struct md_json_path_t MD_P_CA_CHALLENGES;
+extern const struct md_json_path_t MD_P_CA_PROTO;
+extern const struct md_json_path_t MD_P_CA_URL;
+extern const struct md_json_path_t MD_P_CA_URLS;
+extern const struct md_json_path_t MD_P_CERT;
+extern const struct md_json_path_t MD_P_CERT_FILES;
+extern const struct md_json_path_t MD_P_CMD_DNS01;
+extern const struct md_json_path_t MD_P_CONTACTS;
+extern const struct md_json_path_t MD_P_DOMAINS;
+extern const struct md_json_path_t MD_P_EAB;
+extern const struct md_json_path_t MD_P_EAB_HMAC;
+extern const struct md_json_path_t MD_P_EAB_KID;
+extern const struct md_json_path_t MD_P_ERROR;
+extern const struct md_json_path_t MD_P_ERRORS;
+extern const struct md_json_path_t MD_P_FINISHED;
+extern const struct md_json_path_t MD_P_ISSUER_NAME;
+extern const struct md_json_path_t MD_P_ISSUER_URI;
+extern const struct md_json_path_t MD_P_LAST;
+extern const struct md_json_path_t MD_P_LAST_RUN;
+extern const struct md_json_path_t MD_P_LOG;
+extern const struct md_json_path_t MD_P_MUST_STAPLE;
+extern const struct md_json_path_t MD_P_NAME;
+extern const struct md_json_path_t MD_P_NEXT_RUN;
+extern const struct md_json_path_t MD_P_NOTIFIED;
+extern const struct md_json_path_t MD_P_NOTIFIED_RENEWED;
+extern const struct md_json_path_t MD_P_PKEY;
+extern const struct md_json_path_t MD_P_PKEY_FILES;
+extern const struct md_json_path_t MD_P_PROFILE;
+extern const struct md_json_path_t MD_P_PROFILE_MANDATORY;
+extern const struct md_json_path_t MD_P_PROTO_ACME_TLS_1;
+extern const struct md_json_path_t MD_P_PROXY_CA_CERTS;
+extern const struct md_json_path_t MD_P_PROXY_URL;
+extern const struct md_json_path_t MD_P_RENEW;
+extern const struct md_json_path_t MD_P_RENEWAL;
+extern const struct md_json_path_t MD_P_RENEW_MODE;
+extern const struct md_json_path_t MD_P_RENEW_WINDOW;
+extern const struct md_json_path_t MD_P_REQUIRE_HTTPS;
+extern const struct md_json_path_t MD_P_SERIAL;
+extern const struct md_json_path_t MD_P_SHA256_FINGERPRINT;
+extern const struct md_json_path_t MD_P_STAPLING;
+extern const struct md_json_path_t MD_P_STATE;
+extern const struct md_json_path_t MD_P_STATE_DESCR;
+extern const struct md_json_path_t MD_P_TRANSITIVE;
+extern const struct md_json_path_t MD_P_VALID_FROM;
+extern const struct md_json_path_t MD_P_WARN_WINDOW;
+extern const struct md_json_path_t MD_P_WATCHED;
+
 /* Check if a string member of a new MD (n) has 
  * a value and if it differs from the old MD o
  */
@@ -311,6 +374,12 @@ md_t *md_copy(apr_pool_t *p, const md_t *src);
 struct md_json_t *md_to_json(const md_t *md, apr_pool_t *p);
 md_t *md_from_json(struct md_json_t *json, apr_pool_t *p);
 
+/**
+ * Make the managed domain from md.json as stored, without building a JSON tree
+ * in between. Gives APR_EINVAL if the data is not valid JSON.
+ */
+apr_status_t md_from_data(md_t **pmd, const struct md_data_t *data, apr_pool_t *p);
+
 /**
  * Same as md_to_json(), but with sensitive fields stripped.
  */
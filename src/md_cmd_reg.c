@@ -72,15 +72,6 @@ md_cmd_t MD_RegAddCmd = {
 /**************************************************************************************************/
 /* command: list */
 
-static int list_add_md(void *baton, md_reg_t *reg, md_t *md)
-{
-    apr_array_header_t *mdlist = baton;
-    
-    (void)reg;
-    APR_ARRAY_PUSH(mdlist, const md_t *) = md;
-    return 1;
-}
-
 static int md_name_cmp(const void *v1, const void *v2)
 {
     return strcmp((*(const md_t**)v1)->name, (*(const md_t**)v2)->name);
@@ -88,9 +79,10 @@ static int md_name_cmp(const void *v1, const void *v2)
 
 static apr_status_t cmd_reg_list(md_cmd_ctx *ctx, const md_cmd_t *cmd)
 {
-    apr_array_header_t *mdlist = apr_array_make(ctx->p, 5, sizeof(md_t *));
+    apr_array_header_t *mdlist;
     const char *name;
     const md_t *md;
+    apr_status_t rv;
     int i;
     
     (void)cmd;
@@ -109,8 +101,9 @@ static apr_status_t cmd_reg_list(md_cmd_ctx *ctx, const md_cmd_t *cmd)
         }
     }
     else {
-        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE4, 0, ctx->p, "list do");
-        md_reg_do(list_add_md, mdlist, ctx->reg, ctx->p);
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE4, 0, ctx->p, "list all");
+        rv = md_reg_get_all(&mdlist, ctx->reg, ctx->p);
+        if (APR_SUCCESS != rv) return rv;
         qsort(mdlist->elts, (size_t)mdlist->nelts, sizeof(md_t *), md_name_cmp);
     
         for (i = 0; i < mdlist->nelts; ++i) {
@@ -296,7 +289,7 @@ out:
 
 static apr_status_t cmd_reg_drive(md_cmd_ctx *ctx, const md_cmd_t *cmd)
 {
-    apr_array_header_t *mdlist = apr_array_make(ctx->p, 5, sizeof(md_t *));
+    apr_array_header_t *mdlist;
     md_t *md;
     apr_status_t rv;
     int i;
@@ -304,6 +297,7 @@ static apr_status_t cmd_reg_drive(md_cmd_ctx *ctx, const md_cmd_t *cmd)
     (void)cmd;
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE4, 0, ctx->p, "drive do");
     if (ctx->argc > 0) {
+        mdlist = apr_array_make(ctx->p, ctx->argc, sizeof(md_t *));
         for (i = 0; i < ctx->argc; ++i) {
             md = md_reg_get(ctx->reg, ctx->argv[i], ctx->p);
             if (!md) {
@@ -314,7 +308,7 @@ static apr_status_t cmd_reg_drive(md_cmd_ctx *ctx, const md_cmd_t *cmd)
         }
     }
     else {
-        md_reg_do(list_add_md, mdlist, ctx->reg, ctx->p);
+        if (APR_SUCCESS != (rv = md_reg_get_all(&mdlist, ctx->reg, ctx->p))) return rv;
         qsort(mdlist->elts, (size_t)mdlist->nelts, sizeof(md_t *), md_name_cmp);
     }   
     
@@ -124,18 +124,20 @@ static md_cmd_t RemoveCmd = {
 /**************************************************************************************************/
 /* command: store list */
 
-static int list_md(void *baton, md_store_t *store, md_t *md, apr_pool_t *ptemp)
-{
-    (void)store;
-    (void)ptemp;
-    md_cmd_print_md(baton, md);
-    return 1;
-}
-
 static apr_status_t cmd_list(md_cmd_ctx *ctx, const md_cmd_t *cmd)
 {
+    apr_array_header_t *mds;
+    apr_status_t rv;
+    int i;
+
     (void)cmd;
-    return md_store_md_iter(list_md, ctx, ctx->store, ctx->p, MD_SG_DOMAINS, "*");
+    rv = md_store_md_load_all(&mds, ctx->store, ctx->p, MD_SG_DOMAINS, "*", 
+                              MD_STORE_BULK_WORKERS);
+    if (APR_SUCCESS != rv) return rv;
+    for (i = 0; i < mds->nelts; ++i) {
+        md_cmd_print_md(ctx, APR_ARRAY_IDX(mds, i, const md_t*));
+    }
+    return APR_SUCCESS;
 }
 
 static md_cmd_t ListCmd = {
@@ -34,6 +34,9 @@
 
 int md_contains(const md_t *md, const char *domain, int case_sensitive)
 {
+    if (md->domain_set && !case_sensitive) {
+        return md_dns_set_match(md->domain_set, domain) != NULL;
+    }
     if (md_array_str_index(md->domains, domain, 0, case_sensitive) >= 0) {
         return 1;
     }
@@ -100,22 +103,27 @@ int md_is_covered_by_alt_names(const md_t *md, const struct apr_array_header_t*
     return 0;
 }
 
+static void md_init(md_t *md, apr_pool_t *p)
+{
+    md->domains = apr_array_make(p, 5, sizeof(const char *));
+    md->contacts = apr_array_make(p, 5, sizeof(const char *));
+    md->renew_mode = MD_RENEW_DEFAULT;
+    md->require_https = MD_REQUIRE_UNSET;
+    md->must_staple = -1;
+    md->transitive = -1;
+    md->acme_tls_1_domains = apr_array_make(p, 5, sizeof(const char *));
+    md->stapling = -1;
+    md->profile_mandatory = -1;
+    md->ari_renewals = -1;
+    md->defn_name = "unknown";
+    md->defn_line_number = 0;
+}
+
 md_t *md_create_empty(apr_pool_t *p)
 {
     md_t *md = apr_pcalloc(p, sizeof(*md));
     if (md) {
-        md->domains = apr_array_make(p, 5, sizeof(const char *));
-        md->contacts = apr_array_make(p, 5, sizeof(const char *));
-        md->renew_mode = MD_RENEW_DEFAULT;
-        md->require_https = MD_REQUIRE_UNSET;
-        md->must_staple = -1;
-        md->transitive = -1;
-        md->acme_tls_1_domains = apr_array_make(p, 5, sizeof(const char *));
-        md->stapling = -1;
-        md->profile_mandatory = -1;
-        md->ari_renewals = -1;
-        md->defn_name = "unknown";
-        md->defn_line_number = 0;
+        md_init(md, p);
     }
     return md;
 }
@@ -176,14 +184,29 @@ md_t *md_get_by_domain(struct apr_array_header_t *mds, const char *domain)
 
 md_t *md_get_by_dns_overlap(struct apr_array_header_t *mds, const md_t *md)
 {
-    int i;
-    for (i = 0; i < mds->nelts; ++i) {
-        md_t *o = APR_ARRAY_IDX(mds, i, md_t *);
-        if (strcmp(o->name, md->name) && md_common_name(o, md)) {
-            return o;
+    md_dns_set_t *domains;
+    md_t *o, *found = NULL;
+    apr_pool_t *ptemp;
+    int i, j;
+    
+    if (!md->domains || mds->nelts <= 0 
+        || APR_SUCCESS != apr_pool_create(&ptemp, mds->pool)) {
+        return NULL;
+    }
+    /* same as md_common_name(o, md), without comparing all pairs of names */
+    domains = md_dns_set_of(ptemp, md->domains);
+    for (i = 0; i < mds->nelts && !found; ++i) {
+        o = APR_ARRAY_IDX(mds, i, md_t *);
+        if (!strcmp(o->name, md->name) || !o->domains) continue;
+        for (j = 0; j < o->domains->nelts; ++j) {
+            if (md_dns_set_match(domains, APR_ARRAY_IDX(o->domains, j, const char*))) {
+                found = o;
+                break;
+            }
         }
     }
-    return NULL;
+    apr_pool_destroy(ptemp);
+    return found;
 }
 
 int md_cert_count(const md_t *md)
@@ -223,6 +246,8 @@ md_t *md_copy(apr_pool_t *p, const md_t *src)
         }
         md->acme_tls_1_domains = apr_array_copy(p, src->acme_tls_1_domains);
         md->pks = md_pkeys_spec_clone(p, src->pks);
+        /* the copy's domains may change */
+        md->domain_set = NULL;
     }    
     return md;   
 }
@@ -270,148 +295,301 @@ md_t *md_clone(apr_pool_t *p, const md_t *src)
 /**************************************************************************************************/
 /* format conversion */
 
+/* key paths of md.json, job.json and the status, compiled once, see md.h */
+const md_json_path_t MD_P_ARI_RENEWALS = MD_JSON_PATH1(MD_KEY_ARI_RENEWALS);
+const md_json_path_t MD_P_CA_ACCOUNT = MD_JSON_PATH2(MD_KEY_CA, MD_KEY_ACCOUNT);
+const md_json_path_t MD_P_CA_AGREEMENT = MD_JSON_PATH2(MD_KEY_CA, MD_KEY_AGREEMENT);
+const md_json_path_t MD_P_CA_CERTS = MD_JSON_PATH1(MD_KEY_CA_CERTS);
+const md_json_path_t MD_P_CA_CHALLENGES = MD_JSON_PATH2(MD_KEY_CA, MD_KEY_CHALLENGES);
+const md_json_path_t MD_P_CA_PROTO = MD_JSON_PATH2(MD_KEY_CA, MD_KEY_PROTO);
+const md_json_path_t MD_P_CA_URL = MD_JSON_PATH2(MD_KEY_CA, MD_KEY_URL);
+const md_json_path_t MD_P_CA_URLS = MD_JSON_PATH2(MD_KEY_CA, MD_KEY_URLS);
+const md_json_path_t MD_P_CERT = MD_JSON_PATH1(MD_KEY_CERT);
+const md_json_path_t MD_P_CERT_FILES = MD_JSON_PATH1(MD_KEY_CERT_FILES);
+const md_json_path_t MD_P_CMD_DNS01 = MD_JSON_PATH1(MD_KEY_CMD_DNS01);
+const md_json_path_t MD_P_CONTACTS = MD_JSON_PATH1(MD_KEY_CONTACTS);
+const md_json_path_t MD_P_DOMAINS = MD_JSON_PATH1(MD_KEY_DOMAINS);
+const md_json_path_t MD_P_EAB = MD_JSON_PATH1(MD_KEY_EAB);
+const md_json_path_t MD_P_EAB_HMAC = MD_JSON_PATH2(MD_KEY_EAB, MD_KEY_HMAC);
+const md_json_path_t MD_P_EAB_KID = MD_JSON_PATH2(MD_KEY_EAB, MD_KEY_KID);
+const md_json_path_t MD_P_ERROR = MD_JSON_PATH1(MD_KEY_ERROR);
+const md_json_path_t MD_P_ERRORS = MD_JSON_PATH1(MD_KEY_ERRORS);
+const md_json_path_t MD_P_FINISHED = MD_JSON_PATH1(MD_KEY_FINISHED);
+const md_json_path_t MD_P_ISSUER_NAME = MD_JSON_PATH1(MD_KEY_ISSUER_NAME);
+const md_json_path_t MD_P_ISSUER_URI = MD_JSON_PATH1(MD_KEY_ISSUER_URI);
+const md_json_path_t MD_P_LAST = MD_JSON_PATH1(MD_KEY_LAST);
+const md_json_path_t MD_P_LAST_RUN = MD_JSON_PATH1(MD_KEY_LAST_RUN);
+const md_json_path_t MD_P_LOG = MD_JSON_PATH1(MD_KEY_LOG);
+const md_json_path_t MD_P_MUST_STAPLE = MD_JSON_PATH1(MD_KEY_MUST_STAPLE);
+const md_json_path_t MD_P_NAME = MD_JSON_PATH1(MD_KEY_NAME);
+const md_json_path_t MD_P_NEXT_RUN = MD_JSON_PATH1(MD_KEY_NEXT_RUN);
+const md_json_path_t MD_P_NOTIFIED = MD_JSON_PATH1(MD_KEY_NOTIFIED);
+const md_json_path_t MD_P_NOTIFIED_RENEWED = MD_JSON_PATH1(MD_KEY_NOTIFIED_RENEWED);
+const md_json_path_t MD_P_PKEY = MD_JSON_PATH1(MD_KEY_PKEY);
+const md_json_path_t MD_P_PKEY_FILES = MD_JSON_PATH1(MD_KEY_PKEY_FILES);
+const md_json_path_t MD_P_PROFILE = MD_JSON_PATH1(MD_KEY_PROFILE);
+const md_json_path_t MD_P_PROFILE_MANDATORY = MD_JSON_PATH1(MD_KEY_PROFILE_MANDATORY);
+const md_json_path_t MD_P_PROTO_ACME_TLS_1 = MD_JSON_PATH2(MD_KEY_PROTO, MD_KEY_ACME_TLS_1);
+const md_json_path_t MD_P_PROXY_CA_CERTS = MD_JSON_PATH1(MD_KEY_PROXY_CA_CERTS);
+const md_json_path_t MD_P_PROXY_URL = MD_JSON_PATH1(MD_KEY_PROXY_URL);
+const md_json_path_t MD_P_RENEW = MD_JSON_PATH1(MD_KEY_RENEW);
+const md_json_path_t MD_P_RENEWAL = MD_JSON_PATH1(MD_KEY_RENEWAL);
+const md_json_path_t MD_P_RENEW_MODE = MD_JSON_PATH1(MD_KEY_RENEW_MODE);
+const md_json_path_t MD_P_RENEW_WINDOW = MD_JSON_PATH1(MD_KEY_RENEW_WINDOW);
+const md_json_path_t MD_P_REQUIRE_HTTPS = MD_JSON_PATH1(MD_KEY_REQUIRE_HTTPS);
+const md_json_path_t MD_P_SERIAL = MD_JSON_PATH1(MD_KEY_SERIAL);
+const md_json_path_t MD_P_SHA256_FINGERPRINT = MD_JSON_PATH1(MD_KEY_SHA256_FINGERPRINT);
+const md_json_path_t MD_P_STAPLING = MD_JSON_PATH1(MD_KEY_STAPLING);
+const md_json_path_t MD_P_STATE = MD_JSON_PATH1(MD_KEY_STATE);
+const md_json_path_t MD_P_STATE_DESCR = MD_JSON_PATH1(MD_KEY_STATE_DESCR);
+const md_json_path_t MD_P_TRANSITIVE = MD_JSON_PATH1(MD_KEY_TRANSITIVE);
+const md_json_path_t MD_P_VALID_FROM = MD_JSON_PATH1(MD_KEY_VALID_FROM);
+const md_json_path_t MD_P_WARN_WINDOW = MD_JSON_PATH1(MD_KEY_WARN_WINDOW);
+const md_json_path_t MD_P_WATCHED = MD_JSON_PATH1(MD_KEY_WATCHED);
+
 md_json_t *md_to_json(const md_t *md, apr_pool_t *p)
 {
     md_json_t *json = md_json_create(p);
     if (json) {
         apr_array_header_t *domains = md_array_str_compact(p, md->domains, 0);
-        md_json_sets(md->name, json, MD_KEY_NAME, NULL);
-        md_json_setsa(domains, json, MD_KEY_DOMAINS, NULL);
-        md_json_setsa(md->contacts, json, MD_KEY_CONTACTS, NULL);
-        md_json_setl(md->transitive, json, MD_KEY_TRANSITIVE, NULL);
-        md_json_sets(md->ca_account, json, MD_KEY_CA, MD_KEY_ACCOUNT, NULL);
-        md_json_sets(md->ca_proto, json, MD_KEY_CA, MD_KEY_PROTO, NULL);
-        md_json_sets(md->ca_effective, json, MD_KEY_CA, MD_KEY_URL, NULL);
+        md_json_psets(md->name, json, &MD_P_NAME);
+        md_json_psetsa(domains, json, &MD_P_DOMAINS);
+        md_json_psetsa(md->contacts, json, &MD_P_CONTACTS);
+        md_json_psetl(md->transitive, json, &MD_P_TRANSITIVE);
+        md_json_psets(md->ca_account, json, &MD_P_CA_ACCOUNT);
+        md_json_psets(md->ca_proto, json, &MD_P_CA_PROTO);
+        md_json_psets(md->ca_effective, json, &MD_P_CA_URL);
         if (md->ca_urls && !apr_is_empty_array(md->ca_urls)) {
-            md_json_setsa(md->ca_urls, json, MD_KEY_CA, MD_KEY_URLS, NULL);
+            md_json_psetsa(md->ca_urls, json, &MD_P_CA_URLS);
         }
-        md_json_sets(md->ca_agreement, json, MD_KEY_CA, MD_KEY_AGREEMENT, NULL);
+        md_json_psets(md->ca_agreement, json, &MD_P_CA_AGREEMENT);
         if (!md_pkeys_spec_is_empty(md->pks)) {
-            md_json_setj(md_pkeys_spec_to_json(md->pks, p), json, MD_KEY_PKEY, NULL);
+            md_json_psetj(md_pkeys_spec_to_json(md->pks, p), json, &MD_P_PKEY);
         }
-        md_json_setl(md->state, json, MD_KEY_STATE, NULL);
+        md_json_psetl(md->state, json, &MD_P_STATE);
         if (md->state_descr)
-            md_json_sets(md->state_descr, json, MD_KEY_STATE_DESCR, NULL);
-        md_json_setl(md->renew_mode, json, MD_KEY_RENEW_MODE, NULL);
+            md_json_psets(md->state_descr, json, &MD_P_STATE_DESCR);
+        md_json_psetl(md->renew_mode, json, &MD_P_RENEW_MODE);
         if (md->renew_window)
-            md_json_sets(md_timeslice_format(md->renew_window, p), json, MD_KEY_RENEW_WINDOW, NULL);
+            md_json_psets(md_timeslice_format(md->renew_window, p), json, &MD_P_RENEW_WINDOW);
         if (md->warn_window)
-            md_json_sets(md_timeslice_format(md->warn_window, p), json, MD_KEY_WARN_WINDOW, NULL);
+            md_json_psets(md_timeslice_format(md->warn_window, p), json, &MD_P_WARN_WINDOW);
         if (md->ca_challenges && md->ca_challenges->nelts > 0) {
             apr_array_header_t *na;
             na = md_array_str_compact(p, md->ca_challenges, 0);
-            md_json_setsa(na, json, MD_KEY_CA, MD_KEY_CHALLENGES, NULL);
+            md_json_psetsa(na, json, &MD_P_CA_CHALLENGES);
         }
         switch (md->require_https) {
             case MD_REQUIRE_TEMPORARY:
-                md_json_sets(MD_KEY_TEMPORARY, json, MD_KEY_REQUIRE_HTTPS, NULL);
+                md_json_psets(MD_KEY_TEMPORARY, json, &MD_P_REQUIRE_HTTPS);
                 break;
             case MD_REQUIRE_PERMANENT:
-                md_json_sets(MD_KEY_PERMANENT, json, MD_KEY_REQUIRE_HTTPS, NULL);
+                md_json_psets(MD_KEY_PERMANENT, json, &MD_P_REQUIRE_HTTPS);
                 break;
             default:
                 break;
         }
-        md_json_setb(md->must_staple > 0, json, MD_KEY_MUST_STAPLE, NULL);
-        md_json_setsa(md->acme_tls_1_domains, json, MD_KEY_PROTO, MD_KEY_ACME_TLS_1, NULL);
-        if (md->cert_files) md_json_setsa(md->cert_files, json, MD_KEY_CERT_FILES, NULL);
-        if (md->pkey_files) md_json_setsa(md->pkey_files, json, MD_KEY_PKEY_FILES, NULL);
-        md_json_setb(md->stapling > 0, json, MD_KEY_STAPLING, NULL);
-        if (md->dns01_cmd) md_json_sets(md->dns01_cmd, json, MD_KEY_CMD_DNS01, NULL);
-        if (md->proxy_url) md_json_sets(md->proxy_url, json, MD_KEY_PROXY_URL, NULL);
-        if (md->ca_certs) md_json_sets(md->ca_certs, json, MD_KEY_CA_CERTS, NULL);
-        if (md->proxy_ca_certs) md_json_sets(md->proxy_ca_certs, json, MD_KEY_PROXY_CA_CERTS, NULL);
+        md_json_psetb(md->must_staple > 0, json, &MD_P_MUST_STAPLE);
+        md_json_psetsa(md->acme_tls_1_domains, json, &MD_P_PROTO_ACME_TLS_1);
+        if (md->cert_files) md_json_psetsa(md->cert_files, json, &MD_P_CERT_FILES);
+        if (md->pkey_files) md_json_psetsa(md->pkey_files, json, &MD_P_PKEY_FILES);
+        md_json_psetb(md->stapling > 0, json, &MD_P_STAPLING);
+        if (md->dns01_cmd) md_json_psets(md->dns01_cmd, json, &MD_P_CMD_DNS01);
+        if (md->proxy_url) md_json_psets(md->proxy_url, json, &MD_P_PROXY_URL);
+        if (md->ca_certs) md_json_psets(md->ca_certs, json, &MD_P_CA_CERTS);
+        if (md->proxy_ca_certs) md_json_psets(md->proxy_ca_certs, json, &MD_P_PROXY_CA_CERTS);
         if (md->ca_eab_kid && strcmp("none", md->ca_eab_kid)) {
-            md_json_sets(md->ca_eab_kid, json, MD_KEY_EAB, MD_KEY_KID, NULL);
-            if (md->ca_eab_hmac) md_json_sets(md->ca_eab_hmac, json, MD_KEY_EAB, MD_KEY_HMAC, NULL);
+            md_json_psets(md->ca_eab_kid, json, &MD_P_EAB_KID);
+            if (md->ca_eab_hmac) md_json_psets(md->ca_eab_hmac, json, &MD_P_EAB_HMAC);
         }
-        if (md->profile) md_json_sets(md->profile, json, MD_KEY_PROFILE, NULL);
-        md_json_setb(md->profile_mandatory > 0, json, MD_KEY_PROFILE_MANDATORY, NULL);
-        md_json_setb(md->ari_renewals > 0, json, MD_KEY_ARI_RENEWALS, NULL);
+        if (md->profile) md_json_psets(md->profile, json, &MD_P_PROFILE);
+        md_json_psetb(md->profile_mandatory > 0, json, &MD_P_PROFILE_MANDATORY);
+        md_json_psetb(md->ari_renewals > 0, json, &MD_P_ARI_RENEWALS);
         return json;
     }
     return NULL;
 }
 
+static md_require_t require_https_parse(const char *s)
+{
+    if (s && !strcmp(MD_KEY_TEMPORARY, s)) return MD_REQUIRE_TEMPORARY;
+    if (s && !strcmp(MD_KEY_PERMANENT, s)) return MD_REQUIRE_PERMANENT;
+    return MD_REQUIRE_OFF;
+}
+
 md_t *md_from_json(md_json_t *json, apr_pool_t *p)
 {
     const char *s;
     md_t *md = md_create_empty(p);
     if (md) {
-        md->name = md_json_dups(p, json, MD_KEY_NAME, NULL);            
-        md_json_dupsa(md->domains, p, json, MD_KEY_DOMAINS, NULL);
-        md_json_dupsa(md->contacts, p, json, MD_KEY_CONTACTS, NULL);
-        md->ca_account = md_json_dups(p, json, MD_KEY_CA, MD_KEY_ACCOUNT, NULL);
-        md->ca_proto = md_json_dups(p, json, MD_KEY_CA, MD_KEY_PROTO, NULL);
-        md->ca_effective = md_json_dups(p, json, MD_KEY_CA, MD_KEY_URL, NULL);
-        if (md_json_has_key(json, MD_KEY_CA, MD_KEY_URLS, NULL)) {
+        md->name = md_json_pdups(p, json, &MD_P_NAME);            
+        md_json_pdupsa(md->domains, p, json, &MD_P_DOMAINS);
+        md_json_pdupsa(md->contacts, p, json, &MD_P_CONTACTS);
+        md->ca_account = md_json_pdups(p, json, &MD_P_CA_ACCOUNT);
+        md->ca_proto = md_json_pdups(p, json, &MD_P_CA_PROTO);
+        md->ca_effective = md_json_pdups(p, json, &MD_P_CA_URL);
+        if (md_json_phas(json, &MD_P_CA_URLS)) {
             md->ca_urls = apr_array_make(p, 5, sizeof(const char*));
-            md_json_dupsa(md->ca_urls, p, json, MD_KEY_CA, MD_KEY_URLS, NULL);
+            md_json_pdupsa(md->ca_urls, p, json, &MD_P_CA_URLS);
         }
         else if (md->ca_effective) {
             /* compat for old format where we had only a single url */
             md->ca_urls = apr_array_make(p, 5, sizeof(const char*));
             APR_ARRAY_PUSH(md->ca_urls, const char*) = md->ca_effective;
         }
-        md->ca_agreement = md_json_dups(p, json, MD_KEY_CA, MD_KEY_AGREEMENT, NULL);
-        if (md_json_has_key(json, MD_KEY_PKEY, NULL)) {
-            md->pks = md_pkeys_spec_from_json(md_json_getj(json, MD_KEY_PKEY, NULL), p);
+        md->ca_agreement = md_json_pdups(p, json, &MD_P_CA_AGREEMENT);
+        if (md_json_phas(json, &MD_P_PKEY)) {
+            md->pks = md_pkeys_spec_from_json(md_json_pgetj(json, &MD_P_PKEY), p);
         }
-        md->state = (md_state_t)md_json_getl(json, MD_KEY_STATE, NULL);
-        md->state_descr = md_json_dups(p, json, MD_KEY_STATE_DESCR, NULL);
+        md->state = (md_state_t)md_json_pgetl(json, &MD_P_STATE);
+        md->state_descr = md_json_pdups(p, json, &MD_P_STATE_DESCR);
         if (MD_S_EXPIRED_DEPRECATED == md->state) md->state = MD_S_COMPLETE;
-        md->renew_mode = (int)md_json_getl(json, MD_KEY_RENEW_MODE, NULL);
+        md->renew_mode = (int)md_json_pgetl(json, &MD_P_RENEW_MODE);
         md->domains = md_array_str_compact(p, md->domains, 0);
-        md->transitive = (int)md_json_getl(json, MD_KEY_TRANSITIVE, NULL);
-        s = md_json_gets(json, MD_KEY_RENEW_WINDOW, NULL);
+        md->transitive = (int)md_json_pgetl(json, &MD_P_TRANSITIVE);
+        s = md_json_pgets(json, &MD_P_RENEW_WINDOW);
         md_timeslice_parse(&md->renew_window, p, s, MD_TIME_LIFE_NORM);
-        s = md_json_gets(json, MD_KEY_WARN_WINDOW, NULL);
+        s = md_json_pgets(json, &MD_P_WARN_WINDOW);
         md_timeslice_parse(&md->warn_window, p, s, MD_TIME_LIFE_NORM);
-        if (md_json_has_key(json, MD_KEY_CA, MD_KEY_CHALLENGES, NULL)) {
+        if (md_json_phas(json, &MD_P_CA_CHALLENGES)) {
             md->ca_challenges = apr_array_make(p, 5, sizeof(const char*));
-            md_json_dupsa(md->ca_challenges, p, json, MD_KEY_CA, MD_KEY_CHALLENGES, NULL);
-        }
-        md->require_https = MD_REQUIRE_OFF;
-        s = md_json_gets(json, MD_KEY_REQUIRE_HTTPS, NULL);
-        if (s && !strcmp(MD_KEY_TEMPORARY, s)) {
-            md->require_https = MD_REQUIRE_TEMPORARY;
+            md_json_pdupsa(md->ca_challenges, p, json, &MD_P_CA_CHALLENGES);
         }
-        else if (s && !strcmp(MD_KEY_PERMANENT, s)) {
-            md->require_https = MD_REQUIRE_PERMANENT;
-        }
-        md->must_staple = (int)md_json_getb(json, MD_KEY_MUST_STAPLE, NULL);
-        md_json_dupsa(md->acme_tls_1_domains, p, json, MD_KEY_PROTO, MD_KEY_ACME_TLS_1, NULL);
+        md->require_https = require_https_parse(md_json_pgets(json, &MD_P_REQUIRE_HTTPS));
+        md->must_staple = (int)md_json_pgetb(json, &MD_P_MUST_STAPLE);
+        md_json_pdupsa(md->acme_tls_1_domains, p, json, &MD_P_PROTO_ACME_TLS_1);
             
-        if (md_json_has_key(json, MD_KEY_CERT_FILES, NULL)) {
+        if (md_json_phas(json, &MD_P_CERT_FILES)) {
             md->cert_files = apr_array_make(p, 3, sizeof(char*));
             md->pkey_files = apr_array_make(p, 3, sizeof(char*));
-            md_json_dupsa(md->cert_files, p, json, MD_KEY_CERT_FILES, NULL);
-            md_json_dupsa(md->pkey_files, p, json, MD_KEY_PKEY_FILES, NULL);
+            md_json_pdupsa(md->cert_files, p, json, &MD_P_CERT_FILES);
+            md_json_pdupsa(md->pkey_files, p, json, &MD_P_PKEY_FILES);
         }
-        md->stapling = (int)md_json_getb(json, MD_KEY_STAPLING, NULL);
-        md->dns01_cmd = md_json_dups(p, json, MD_KEY_CMD_DNS01, NULL);
-        md->proxy_url = md_json_dups(p, json, MD_KEY_PROXY_URL, NULL);
-        md->ca_certs = md_json_dups(p, json, MD_KEY_CA_CERTS, NULL);
-        md->proxy_ca_certs = md_json_dups(p, json, MD_KEY_PROXY_CA_CERTS, NULL);
-        if (md_json_has_key(json, MD_KEY_EAB, NULL)) {
-            md->ca_eab_kid = md_json_dups(p, json, MD_KEY_EAB, MD_KEY_KID, NULL);
-            md->ca_eab_hmac = md_json_dups(p, json, MD_KEY_EAB, MD_KEY_HMAC, NULL);
+        md->stapling = (int)md_json_pgetb(json, &MD_P_STAPLING);
+        md->dns01_cmd = md_json_pdups(p, json, &MD_P_CMD_DNS01);
+        md->proxy_url = md_json_pdups(p, json, &MD_P_PROXY_URL);
+        md->ca_certs = md_json_pdups(p, json, &MD_P_CA_CERTS);
+        md->proxy_ca_certs = md_json_pdups(p, json, &MD_P_PROXY_CA_CERTS);
+        if (md_json_phas(json, &MD_P_EAB)) {
+            md->ca_eab_kid = md_json_pdups(p, json, &MD_P_EAB_KID);
+            md->ca_eab_hmac = md_json_pdups(p, json, &MD_P_EAB_HMAC);
         }
 
-        md->profile_mandatory = (int)md_json_getb(json, MD_KEY_PROFILE_MANDATORY, NULL);
-        if (md_json_has_key(json, MD_KEY_PROFILE, NULL))
-            md->profile = md_json_dups(p, json, MD_KEY_PROFILE, NULL);
-        md->ari_renewals = (int)md_json_getb(json, MD_KEY_ARI_RENEWALS, NULL);
+        md->profile_mandatory = (int)md_json_pgetb(json, &MD_P_PROFILE_MANDATORY);
+        if (md_json_phas(json, &MD_P_PROFILE))
+            md->profile = md_json_pdups(p, json, &MD_P_PROFILE);
+        md->ari_renewals = (int)md_json_pgetb(json, &MD_P_ARI_RENEWALS);
         return md;
     }
     return NULL;
 }
 
+/* md.json decoded into an md_t, with the values that need converting on the side */
+typedef struct {
+    md_t md;
+    int state;
+    const char *renew_window;
+    const char *warn_window;
+    const char *require_https;
+    md_json_t *pkey;
+} md_decoded_t;
+
+static const md_json_field_t MD_CA_FIELDS[] = {
+    MD_JSON_FIELD(STR, MD_KEY_ACCOUNT, md_decoded_t, md.ca_account),
+    MD_JSON_FIELD(STR, MD_KEY_PROTO, md_decoded_t, md.ca_proto),
+    MD_JSON_FIELD(STR, MD_KEY_URL, md_decoded_t, md.ca_effective),
+    MD_JSON_FIELD(STRA, MD_KEY_URLS, md_decoded_t, md.ca_urls),
+    MD_JSON_FIELD(STR, MD_KEY_AGREEMENT, md_decoded_t, md.ca_agreement),
+    MD_JSON_FIELD(STRA, MD_KEY_CHALLENGES, md_decoded_t, md.ca_challenges),
+    MD_JSON_FIELD_END
+};
+
+static const md_json_field_t MD_PROTO_FIELDS[] = {
+    MD_JSON_FIELD(STRA, MD_KEY_ACME_TLS_1, md_decoded_t, md.acme_tls_1_domains),
+    MD_JSON_FIELD_END
+};
+
+static const md_json_field_t MD_EAB_FIELDS[] = {
+    MD_JSON_FIELD(STR, MD_KEY_KID, md_decoded_t, md.ca_eab_kid),
+    MD_JSON_FIELD(STR, MD_KEY_HMAC, md_decoded_t, md.ca_eab_hmac),
+    MD_JSON_FIELD_END
+};
+
+static const md_json_field_t MD_FIELDS[] = {
+    MD_JSON_FIELD(STR, MD_KEY_NAME, md_decoded_t, md.name),
+    MD_JSON_FIELD(STRA, MD_KEY_DOMAINS, md_decoded_t, md.domains),
+    MD_JSON_FIELD(STRA, MD_KEY_CONTACTS, md_decoded_t, md.contacts),
+    MD_JSON_FIELD(INT, MD_KEY_TRANSITIVE, md_decoded_t, md.transitive),
+    MD_JSON_FIELD_SUB(MD_KEY_CA, MD_CA_FIELDS),
+    MD_JSON_FIELD(JSON, MD_KEY_PKEY, md_decoded_t, pkey),
+    MD_JSON_FIELD(INT, MD_KEY_STATE, md_decoded_t, state),
+    MD_JSON_FIELD(STR, MD_KEY_STATE_DESCR, md_decoded_t, md.state_descr),
+    MD_JSON_FIELD(INT, MD_KEY_RENEW_MODE, md_decoded_t, md.renew_mode),
+    MD_JSON_FIELD(STR, MD_KEY_RENEW_WINDOW, md_decoded_t, renew_window),
+    MD_JSON_FIELD(STR, MD_KEY_WARN_WINDOW, md_decoded_t, warn_window),
+    MD_JSON_FIELD(STR, MD_KEY_REQUIRE_HTTPS, md_decoded_t, require_https),
+    MD_JSON_FIELD(BOOL, MD_KEY_MUST_STAPLE, md_decoded_t, md.must_staple),
+    MD_JSON_FIELD_SUB(MD_KEY_PROTO, MD_PROTO_FIELDS),
+    MD_JSON_FIELD(STRA, MD_KEY_CERT_FILES, md_decoded_t, md.cert_files),
+    MD_JSON_FIELD(STRA, MD_KEY_PKEY_FILES, md_decoded_t, md.pkey_files),
+    MD_JSON_FIELD(BOOL, MD_KEY_STAPLING, md_decoded_t, md.stapling),
+    MD_JSON_FIELD(STR, MD_KEY_CMD_DNS01, md_decoded_t, md.dns01_cmd),
+    MD_JSON_FIELD(STR, MD_KEY_PROXY_URL, md_decoded_t, md.proxy_url),
+    MD_JSON_FIELD(STR, MD_KEY_CA_CERTS, md_decoded_t, md.ca_certs),
+    MD_JSON_FIELD(STR, MD_KEY_PROXY_CA_CERTS, md_decoded_t, md.proxy_ca_certs),
+    MD_JSON_FIELD_SUB(MD_KEY_EAB, MD_EAB_FIELDS),
+    MD_JSON_FIELD(STR, MD_KEY_PROFILE, md_decoded_t, md.profile),
+    MD_JSON_FIELD(BOOL, MD_KEY_PROFILE_MANDATORY, md_decoded_t, md.profile_mandatory),
+    MD_JSON_FIELD(BOOL, MD_KEY_ARI_RENEWALS, md_decoded_t, md.ari_renewals),
+    MD_JSON_FIELD_END
+};
+
+apr_status_t md_from_data(md_t **pmd, const md_data_t *data, apr_pool_t *p)
+{
+    md_decoded_t *dec;
+    md_json_t *json;
+    md_t *md;
+    apr_status_t rv;
+
+    *pmd = NULL;
+    dec = apr_pcalloc(p, sizeof(*dec));
+    md = &dec->md;
+    md_init(md, p);
+    /* md_from_json() has these as 0 when missing */
+    md->renew_mode = md->transitive = md->must_staple = md->stapling = 0;
+    md->profile_mandatory = md->ari_renewals = 0;
+
+    rv = md_json_decode(dec, MD_FIELDS, data->data, data->len, p);
+    if (APR_SUCCESS != rv) {
+        /* not for the decoder, the JSON parser has the final word */
+        if (APR_SUCCESS != (rv = md_json_readd(&json, p, data->data, data->len))) return rv;
+        *pmd = md_from_json(json, p);
+        return APR_SUCCESS;
+    }
+
+    if (!md->ca_urls && md->ca_effective) {
+        /* compat for old format where we had only a single url */
+        md->ca_urls = apr_array_make(p, 5, sizeof(const char*));
+        APR_ARRAY_PUSH(md->ca_urls, const char*) = md->ca_effective;
+    }
+    if (dec->pkey) md->pks = md_pkeys_spec_from_json(dec->pkey, p);
+    md->state = (md_state_t)dec->state;
+    if (MD_S_EXPIRED_DEPRECATED == md->state) md->state = MD_S_COMPLETE;
+    md->domains = md_array_str_compact(p, md->domains, 0);
+    md_timeslice_parse(&md->renew_window, p, dec->renew_window, MD_TIME_LIFE_NORM);
+    md_timeslice_parse(&md->warn_window, p, dec->warn_window, MD_TIME_LIFE_NORM);
+    md->require_https = require_https_parse(dec->require_https);
+    if (!md->cert_files) md->pkey_files = NULL;
+    else if (!md->pkey_files) md->pkey_files = apr_array_make(p, 3, sizeof(char*));
+    *pmd = md;
+    return APR_SUCCESS;
+}
+
 md_json_t *md_to_public_json(const md_t *md, apr_pool_t *p)
 {
     md_json_t *json = md_to_json(md, p);
-    if (md_json_has_key(json, MD_KEY_EAB, MD_KEY_HMAC, NULL)) {
-        md_json_sets("***", json, MD_KEY_EAB, MD_KEY_HMAC, NULL);
+    if (md_json_phas(json, &MD_P_EAB_HMAC)) {
+        md_json_psets("***", json, &MD_P_EAB_HMAC);
     }
     return json;
 }
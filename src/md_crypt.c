@@ -622,6 +622,22 @@ void md_pkey_free(md_pkey_t *pkey)
     pkey_cleanup(pkey);
 }
 
+md_pkey_t *md_pkey_share(md_pkey_t *pkey, apr_pool_t *p)
+{
+    md_pkey_t *shared = make_pkey(p);
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L \
+    || (defined(LIBRESSL_VERSION_NUMBER) \
+        && LIBRESSL_VERSION_NUMBER < 0x2070000f)
+    CRYPTO_add(&pkey->pkey->references, 1, CRYPTO_LOCK_EVP_PKEY);
+#else
+    EVP_PKEY_up_ref(pkey->pkey);
+#endif
+    shared->pkey = pkey->pkey;
+    apr_pool_cleanup_register(p, shared, pkey_cleanup, apr_pool_cleanup_null);
+    return shared;
+}
+
 void *md_pkey_get_EVP_PKEY(struct md_pkey_t *pkey)
 {
     return pkey->pkey;
@@ -102,6 +102,12 @@ md_pkeys_spec_t *md_pkeys_spec_from_json(struct md_json_t *json, apr_pool_t *p);
 
 apr_status_t md_pkey_gen(md_pkey_t **ppkey, apr_pool_t *p, md_pkey_spec_t *key_props);
 void md_pkey_free(md_pkey_t *pkey);
+/**
+ * Get another reference to the key in `pkey`, released when pool `p` is destroyed.
+ * The key material itself is freed (and cleared by the crypto library) when the
+ * last reference is gone.
+ */
+md_pkey_t *md_pkey_share(md_pkey_t *pkey, apr_pool_t *p);
 
 const char *md_pkey_get_rsa_e64(md_pkey_t *pkey, apr_pool_t *p);
 const char *md_pkey_get_rsa_n64(md_pkey_t *pkey, apr_pool_t *p);
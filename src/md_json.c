@@ -15,6 +15,7 @@
  */
  
 #include <assert.h>
+#include <errno.h>
 #include <apr_lib.h>
 #include <apr_strings.h>
 #include <apr_buckets.h>
@@ -324,6 +325,49 @@ static const char *md_json_type_name(const md_json_t *json)
     return "unknown";
 }
 
+/**************************************************************************************************/
+/* values, the same for key lists and key paths */
+
+static int jget_b(json_t *j)
+{
+    return j? json_is_true(j) : 0;
+}
+
+static long jget_l(json_t *j)
+{
+    return (long)((j && json_is_number(j))? json_integer_value(j) : 0L);
+}
+
+static const char *jget_s(json_t *j)
+{
+    return (j && json_is_string(j))? json_string_value(j) : NULL;
+}
+
+static apr_status_t jdupsa(apr_array_header_t *a, apr_pool_t *p, json_t *j)
+{
+    size_t index;
+    json_t *val;
+
+    if (!j || !json_is_array(j)) return APR_ENOENT;
+    apr_array_clear(a);
+    json_array_foreach(j, index, val) {
+        if (json_is_string(val)) {
+            APR_ARRAY_PUSH(a, const char *) = apr_pstrdup(p, json_string_value(val));
+        }
+    }
+    return APR_SUCCESS;
+}
+
+static void jsetsa(json_t *j, apr_array_header_t *a)
+{
+    int i;
+
+    json_array_clear(j);
+    for (i = 0; i < a->nelts; ++i) {
+        json_array_append_new(j, json_string(APR_ARRAY_IDX(a, i, const char*)));
+    }
+}
+
 /**************************************************************************************************/
 /* booleans */
 
@@ -336,7 +380,7 @@ int md_json_getb(const md_json_t *json, ...)
     j = jselect(json, ap);
     va_end(ap);
 
-    return j? json_is_true(j) : 0;
+    return jget_b(j);
 }
 
 apr_status_t md_json_setb(int value, md_json_t *json, ...)
@@ -386,7 +430,7 @@ long md_json_getl(const md_json_t *json, ...)
     va_start(ap, json);
     j = jselect(json, ap);
     va_end(ap);
-    return (long)((j && json_is_number(j))? json_integer_value(j) : 0L);
+    return jget_l(j);
 }
 
 apr_status_t md_json_setl(long value, md_json_t *json, ...)
@@ -412,19 +456,19 @@ const char *md_json_gets(const md_json_t *json, ...)
     j = jselect(json, ap);
     va_end(ap);
 
-    return (j && json_is_string(j))? json_string_value(j) : NULL;
+    return jget_s(j);
 }
 
 const char *md_json_dups(apr_pool_t *p, const md_json_t *json, ...)
 {
-    json_t *j;
+    const char *s;
     va_list ap;
     
     va_start(ap, json);
-    j = jselect(json, ap);
+    s = jget_s(jselect(json, ap));
     va_end(ap);
 
-    return (j && json_is_string(j))? apr_pstrdup(p, json_string_value(j)) : NULL;
+    return s? apr_pstrdup(p, s) : NULL;
 }
 
 apr_status_t md_json_sets(const char *value, md_json_t *json, ...)
@@ -893,26 +937,13 @@ apr_status_t md_json_dupsa(apr_array_header_t *a, apr_pool_t *p, md_json_t *json
     j = jselect(json, ap);
     va_end(ap);
 
-    if (j && json_is_array(j)) {
-        size_t index;
-        json_t *val;
-        
-        apr_array_clear(a);
-        json_array_foreach(j, index, val) {
-            if (json_is_string(val)) {
-                APR_ARRAY_PUSH(a, const char *) = apr_pstrdup(p, json_string_value(val));
-            }
-        }
-        return APR_SUCCESS;
-    }
-    return APR_ENOENT;
+    return jdupsa(a, p, j);
 }
 
 apr_status_t md_json_setsa(apr_array_header_t *a, md_json_t *json, ...)
 {
     json_t *nj, *j;
     va_list ap;
-    int i;
     
     va_start(ap, json);
     j = jselect(json, ap);
@@ -933,13 +964,146 @@ apr_status_t md_json_setsa(apr_array_header_t *a, md_json_t *json, ...)
         j = nj; 
     }
     
-    json_array_clear(j);
-    for (i = 0; i < a->nelts; ++i) {
-        json_array_append_new(j, json_string(APR_ARRAY_IDX(a, i, const char*)));
+    jsetsa(j, a);
+    return APR_SUCCESS;
+}
+
+/**************************************************************************************************/
+/* compiled key paths */
+
+/* Key lengths are known, jansson >= 2.14 then looks up keys without strlen() */
+#if defined(JANSSON_VERSION_HEX) && JANSSON_VERSION_HEX >= 0x020e00
+#define PATH_GET(j, path, i)        json_object_getn((j), (path)->keys[i], (path)->lens[i])
+#define PATH_SET_NEW(j, path, i, v) json_object_setn_new((j), (path)->keys[i], (path)->lens[i], (v))
+#else
+#define PATH_GET(j, path, i)        json_object_get((j), (path)->keys[i])
+#define PATH_SET_NEW(j, path, i, v) json_object_set_new((j), (path)->keys[i], (v))
+#endif
+
+static json_t *jpselect(const md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = json->j;
+    int i;
+    
+    for (i = 0; j && i < path->nkeys; ++i) {
+        j = PATH_GET(j, path, i);
+    }
+    return j;
+}
+
+static json_t *jpselect_parent(int create, md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = json->j, *jn;
+    int i;
+    
+    for (i = 0; j && i + 1 < path->nkeys; ++i) {
+        if (!json_is_object(j)) return NULL;
+        jn = PATH_GET(j, path, i);
+        if (!jn && create) {
+            jn = json_object();
+            PATH_SET_NEW(j, path, i, jn);
+        }
+        j = jn;
+    }
+    return (j && json_is_object(j))? j : NULL;
+}
+
+static apr_status_t jpselect_set_new(json_t *val, md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j;
+    
+    j = jpselect_parent(1, json, path);
+    if (!j || PATH_SET_NEW(j, path, path->nkeys - 1, val)) {
+        if (!j) json_decref(val);
+        return APR_EINVAL;
     }
     return APR_SUCCESS;
 }
 
+int md_json_phas(const md_json_t *json, const md_json_path_t *path)
+{
+    return jpselect(json, path) != NULL;
+}
+
+int md_json_pgetb(const md_json_t *json, const md_json_path_t *path)
+{
+    return jget_b(jpselect(json, path));
+}
+
+apr_status_t md_json_psetb(int value, md_json_t *json, const md_json_path_t *path)
+{
+    return jpselect_set_new(json_boolean(value), json, path);
+}
+
+long md_json_pgetl(const md_json_t *json, const md_json_path_t *path)
+{
+    return jget_l(jpselect(json, path));
+}
+
+apr_status_t md_json_psetl(long value, md_json_t *json, const md_json_path_t *path)
+{
+    return jpselect_set_new(json_integer(value), json, path);
+}
+
+const char *md_json_pgets(const md_json_t *json, const md_json_path_t *path)
+{
+    return jget_s(jpselect(json, path));
+}
+
+const char *md_json_pdups(apr_pool_t *p, const md_json_t *json, const md_json_path_t *path)
+{
+    const char *s = jget_s(jpselect(json, path));
+    return s? apr_pstrdup(p, s) : NULL;
+}
+
+apr_status_t md_json_psets(const char *value, md_json_t *json, const md_json_path_t *path)
+{
+    return jpselect_set_new(json_string(value), json, path);
+}
+
+md_json_t *md_json_pgetj(md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = jpselect(json, path);
+    
+    if (j) {
+        json_incref(j);
+        return json_create(json->p, j);
+    }
+    return NULL;
+}
+
+apr_status_t md_json_psetj(const md_json_t *value, md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j;
+    
+    if (value) {
+        json_incref(value->j);
+        return jpselect_set_new(value->j, json, path);
+    }
+    j = jpselect_parent(0, json, path);
+    if (j) json_object_del(j, path->keys[path->nkeys - 1]);
+    return APR_SUCCESS;
+}
+
+apr_status_t md_json_pdupsa(apr_array_header_t *a, apr_pool_t *p,
+                            const md_json_t *json, const md_json_path_t *path)
+{
+    return jdupsa(a, p, jpselect(json, path));
+}
+
+apr_status_t md_json_psetsa(apr_array_header_t *a, md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j;
+    
+    j = jpselect(json, path);
+    if (!j || !json_is_array(j)) {
+        j = json_array();
+        if (APR_SUCCESS != jpselect_set_new(j, json, path)) return APR_EINVAL;
+    }
+    jsetsa(j, a);
+    return APR_SUCCESS;
+}
+
 /**************************************************************************************************/
 /* formatting, parsing */
 
@@ -1179,6 +1343,593 @@ apr_status_t md_json_readf(md_json_t **pjson, apr_pool_t *p, const char *fpath)
     return (j && *pjson) ? APR_SUCCESS : APR_EINVAL;
 }
 
+/**************************************************************************************************/
+/* schema decoding */
+
+#define MD_JSON_DECODE_MAX_DEPTH    64
+
+typedef struct {
+    const char *s;
+    const char *end;
+    apr_pool_t *p;
+    int depth;
+} md_json_dec_t;
+
+static apr_status_t dec_skip(md_json_dec_t *d);
+static apr_status_t dec_object(md_json_dec_t *d, void *obj, const md_json_field_t *fields);
+
+static int dec_peek(md_json_dec_t *d)
+{
+    while (d->s < d->end 
+           && (*d->s == ' ' || *d->s == '\t' || *d->s == '\n' || *d->s == '\r')) {
+        ++d->s;
+    }
+    return (d->s < d->end)? (unsigned char)*d->s : -1;
+}
+
+static apr_status_t dec_literal(md_json_dec_t *d, const char *lit, apr_size_t len)
+{
+    if ((apr_size_t)(d->end - d->s) < len || memcmp(d->s, lit, len)) return APR_EINVAL;
+    d->s += len;
+    return APR_SUCCESS;
+}
+
+static int dec_utf8_valid(const unsigned char *s, apr_size_t len)
+{
+    const unsigned char *end = s + len;
+    unsigned int cp;
+    int i, n;
+    
+    while (s < end) {
+        if (*s < 0x80) {
+            ++s;
+            continue;
+        }
+        if (*s >= 0xC2 && *s <= 0xDF) { n = 1; cp = *s & 0x1F; }
+        else if ((*s & 0xF0) == 0xE0) { n = 2; cp = *s & 0x0F; }
+        else if (*s >= 0xF0 && *s <= 0xF4) { n = 3; cp = *s & 0x07; }
+        else return 0;
+        if (end - s <= n) return 0;
+        for (i = 1; i <= n; ++i) {
+            if ((s[i] & 0xC0) != 0x80) return 0;
+            cp = (cp << 6) | (s[i] & 0x3F);
+        }
+        if ((n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000) 
+            || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            return 0;
+        }
+        s += n + 1;
+    }
+    return 1;
+}
+
+static int dec_hex4(const char *s, unsigned int *pcp)
+{
+    unsigned int cp = 0;
+    int i;
+    
+    for (i = 0; i < 4; ++i) {
+        cp <<= 4;
+        if (s[i] >= '0' && s[i] <= '9') cp |= (unsigned int)(s[i] - '0');
+        else if (s[i] >= 'a' && s[i] <= 'f') cp |= (unsigned int)(s[i] - 'a' + 10);
+        else if (s[i] >= 'A' && s[i] <= 'F') cp |= (unsigned int)(s[i] - 'A' + 10);
+        else return 0;
+    }
+    *pcp = cp;
+    return 1;
+}
+
+static char *dec_utf8_put(char *o, unsigned int cp)
+{
+    if (cp < 0x80) {
+        *o++ = (char)cp;
+    }
+    else if (cp < 0x800) {
+        *o++ = (char)(0xC0 | (cp >> 6));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000) {
+        *o++ = (char)(0xE0 | (cp >> 12));
+        *o++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }
+    else {
+        *o++ = (char)(0xF0 | (cp >> 18));
+        *o++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *o++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *o++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return o;
+}
+
+/* Escapes never take less room than what they stand for, `len` bytes are enough. */
+static apr_status_t dec_unescape(const char **pout, const char *s, apr_size_t len, 
+                                 apr_pool_t *p)
+{
+    const char *end = s + len;
+    char *buf, *o;
+    unsigned int cp, lo;
+    
+    buf = o = apr_palloc(p, len + 1);
+    while (s < end) {
+        if (*s != '\\') {
+            *o++ = *s++;
+            continue;
+        }
+        ++s;
+        switch (*s++) {
+            case '"': *o++ = '"'; break;
+            case '\\': *o++ = '\\'; break;
+            case '/': *o++ = '/'; break;
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'u':
+                if (end - s < 4 || !dec_hex4(s, &cp)) return APR_EINVAL;
+                s += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (end - s < 6 || s[0] != '\\' || s[1] != 'u' || !dec_hex4(s + 2, &lo)
+                        || lo < 0xDC00 || lo > 0xDFFF) {
+                        return APR_EINVAL;
+                    }
+                    s += 6;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                }
+                else if (cp == 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) {
+                    /* jansson does not take NUL or lone surrogates either */
+                    return APR_EINVAL;
+                }
+                o = dec_utf8_put(o, cp);
+                break;
+            default:
+                return APR_EINVAL;
+        }
+    }
+    *o = '\0';
+    *pout = buf;
+    return APR_SUCCESS;
+}
+
+/* Get the string at d->s, unescaped and copied into the pool if `ps` is given. Unless
+ * `copy` is set, a string without escapes is given as it is in the data, with `plen`
+ * as its length. */
+static apr_status_t dec_string(md_json_dec_t *d, const char **ps, apr_size_t *plen, int copy)
+{
+    const char *start = d->s + 1, *s = start, *out;
+    int escaped = 0, high = 0;
+    apr_status_t rv;
+    
+    while (s < d->end && *s != '"') {
+        if (*s == '\\') {
+            escaped = 1;
+            if (++s >= d->end) return APR_EINVAL;
+        }
+        else if ((unsigned char)*s < 0x20) {
+            return APR_EINVAL;
+        }
+        else if ((unsigned char)*s >= 0x80) {
+            high = 1;
+        }
+        ++s;
+    }
+    if (s >= d->end) return APR_EINVAL;
+    d->s = s + 1;
+    if (high && !dec_utf8_valid((const unsigned char*)start, (apr_size_t)(s - start))) {
+        return APR_EINVAL;
+    }
+    if (escaped) {
+        /* checks the escapes, even when the string is not wanted */
+        rv = dec_unescape(&out, start, (apr_size_t)(s - start), d->p);
+        if (APR_SUCCESS != rv) return rv;
+        if (ps) *ps = out;
+        if (plen) *plen = strlen(out);
+    }
+    else {
+        if (ps) *ps = copy? apr_pstrmemdup(d->p, start, (apr_size_t)(s - start)) : start;
+        if (plen) *plen = (apr_size_t)(s - start);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t dec_number(md_json_dec_t *d, int *pis_int, apr_int64_t *pn)
+{
+    const char *s = d->s;
+    char buf[32];
+    int is_int = 1;
+    
+    if (s < d->end && *s == '-') ++s;
+    if (s < d->end && *s == '0') {
+        ++s;
+    }
+    else if (s < d->end && *s >= '1' && *s <= '9') {
+        while (s < d->end && apr_isdigit(*s)) ++s;
+    }
+    else {
+        return APR_EINVAL;
+    }
+    if (s < d->end && *s == '.') {
+        is_int = 0;
+        if (++s >= d->end || !apr_isdigit(*s)) return APR_EINVAL;
+        while (s < d->end && apr_isdigit(*s)) ++s;
+    }
+    if (s < d->end && (*s == 'e' || *s == 'E')) {
+        is_int = 0;
+        if (++s < d->end && (*s == '+' || *s == '-')) ++s;
+        if (s >= d->end || !apr_isdigit(*s)) return APR_EINVAL;
+        while (s < d->end && apr_isdigit(*s)) ++s;
+    }
+    *pis_int = is_int;
+    *pn = 0;
+    if (is_int) {
+        /* jansson refuses integers it cannot hold, leave those to it */
+        if ((apr_size_t)(s - d->s) >= sizeof(buf)) return APR_EINVAL;
+        memcpy(buf, d->s, (apr_size_t)(s - d->s));
+        buf[s - d->s] = '\0';
+        errno = 0;
+        *pn = apr_strtoi64(buf, NULL, 10);
+        if (errno) return APR_EINVAL;
+    }
+    d->s = s;
+    return APR_SUCCESS;
+}
+
+/* Skip an array or, with `pa` given, collect its strings. */
+static apr_status_t dec_array(md_json_dec_t *d, apr_array_header_t **pa)
+{
+    const char *s;
+    apr_status_t rv = APR_SUCCESS;
+    int c;
+    
+    if (++d->depth > MD_JSON_DECODE_MAX_DEPTH) return APR_EINVAL;
+    ++d->s;
+    if (pa) {
+        if (!*pa) *pa = apr_array_make(d->p, 5, sizeof(const char*));
+        apr_array_clear(*pa);
+    }
+    c = dec_peek(d);
+    if (c == ']') {
+        ++d->s;
+        goto leave;
+    }
+    while (1) {
+        if (pa && c == '"') {
+            if (APR_SUCCESS != (rv = dec_string(d, &s, NULL, 1))) goto leave;
+            APR_ARRAY_PUSH(*pa, const char*) = s;
+        }
+        else if (APR_SUCCESS != (rv = dec_skip(d))) {
+            goto leave;
+        }
+        c = dec_peek(d);
+        if (c == ']') {
+            ++d->s;
+            break;
+        }
+        if (c != ',') {
+            rv = APR_EINVAL;
+            goto leave;
+        }
+        ++d->s;
+        c = dec_peek(d);
+    }
+leave:
+    --d->depth;
+    return rv;
+}
+
+static apr_status_t dec_skip(md_json_dec_t *d)
+{
+    apr_int64_t n;
+    int c, is_int;
+    
+    c = dec_peek(d);
+    switch (c) {
+        case '{': return dec_object(d, NULL, NULL);
+        case '[': return dec_array(d, NULL);
+        case '"': return dec_string(d, NULL, NULL, 0);
+        case 't': return dec_literal(d, "true", 4);
+        case 'f': return dec_literal(d, "false", 5);
+        case 'n': return dec_literal(d, "null", 4);
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) return dec_number(d, &is_int, &n);
+            return APR_EINVAL;
+    }
+}
+
+static apr_status_t dec_field(md_json_dec_t *d, void *obj, const md_json_field_t *f, int c)
+{
+    void *member = (char*)obj + f->offset;
+    const char *start;
+    apr_int64_t n;
+    int is_int;
+    json_t *j;
+    json_error_t error;
+    apr_status_t rv;
+    
+    switch (f->type) {
+        case MD_JSON_FIELD_STR:
+            if (c == '"') return dec_string(d, (const char**)member, NULL, 1);
+            break;
+        case MD_JSON_FIELD_STRA:
+            if (c == '[') return dec_array(d, (apr_array_header_t**)member);
+            break;
+        case MD_JSON_FIELD_INT:
+            *(int*)member = 0;
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                if (APR_SUCCESS != (rv = dec_number(d, &is_int, &n))) return rv;
+                if (is_int) *(int*)member = (int)n;
+                return APR_SUCCESS;
+            }
+            break;
+        case MD_JSON_FIELD_BOOL:
+            *(int*)member = (c == 't');
+            break;
+        case MD_JSON_FIELD_OBJ:
+            if (c == '{') return dec_object(d, obj, f->sub);
+            break;
+        case MD_JSON_FIELD_JSON:
+            start = d->s;
+            if (APR_SUCCESS != (rv = dec_skip(d))) return rv;
+            j = json_loadb(start, (size_t)(d->s - start), JSON_DECODE_ANY, &error);
+            if (!j) return APR_EINVAL;
+            *(md_json_t**)member = json_create(d->p, j);
+            return APR_SUCCESS;
+    }
+    return dec_skip(d);
+}
+
+/* Decode the object at d->s into `obj`, or skip it if `fields` is NULL. */
+static apr_status_t dec_object(md_json_dec_t *d, void *obj, const md_json_field_t *fields)
+{
+    const md_json_field_t *f;
+    const char *key;
+    apr_size_t klen;
+    apr_status_t rv = APR_SUCCESS;
+    int c;
+    
+    if (++d->depth > MD_JSON_DECODE_MAX_DEPTH) return APR_EINVAL;
+    ++d->s;
+    c = dec_peek(d);
+    if (c == '}') {
+        ++d->s;
+        goto leave;
+    }
+    while (1) {
+        if (c != '"') {
+            rv = APR_EINVAL;
+            goto leave;
+        }
+        if (APR_SUCCESS != (rv = dec_string(d, &key, &klen, 0))) goto leave;
+        if (dec_peek(d) != ':') {
+            rv = APR_EINVAL;
+            goto leave;
+        }
+        ++d->s;
+        c = dec_peek(d);
+        for (f = fields; f && f->key; ++f) {
+            if (f->klen == klen && !memcmp(f->key, key, klen)) break;
+        }
+        rv = (f && f->key)? dec_field(d, obj, f, c) : dec_skip(d);
+        if (APR_SUCCESS != rv) goto leave;
+        c = dec_peek(d);
+        if (c == '}') {
+            ++d->s;
+            break;
+        }
+        if (c != ',') {
+            rv = APR_EINVAL;
+            goto leave;
+        }
+        ++d->s;
+        c = dec_peek(d);
+    }
+leave:
+    --d->depth;
+    return rv;
+}
+
+apr_status_t md_json_decode(void *obj, const md_json_field_t *fields, 
+                            const char *data, apr_size_t len, apr_pool_t *p)
+{
+    md_json_dec_t d;
+    apr_status_t rv;
+    
+    d.s = data;
+    d.end = data + len;
+    d.p = p;
+    d.depth = 0;
+    if (dec_peek(&d) != '{') return APR_EINVAL;
+    if (APR_SUCCESS != (rv = dec_object(&d, obj, fields))) return rv;
+    /* like jansson, nothing but whitespace may follow */
+    return (dec_peek(&d) < 0)? APR_SUCCESS : APR_EINVAL;
+}
+
+/**************************************************************************************************/
+/* streaming output */
+
+#define MD_JSON_STREAM_MAX_DEPTH    32
+#define MD_JSON_STREAM_CHUNK        (16 * 1024)
+
+struct md_json_stream_t {
+    apr_bucket_brigade *bb;
+    md_json_fmt_t fmt;
+    md_json_stream_flush_cb *flush;
+    void *baton;
+    apr_status_t rv;                /* first error encountered, sticky */
+    apr_size_t pending;             /* bytes written since the last flush */
+    int depth;
+    char closer[MD_JSON_STREAM_MAX_DEPTH];  /* '}' or ']' per open level */
+    int count[MD_JSON_STREAM_MAX_DEPTH];    /* values written per open level */
+};
+
+apr_status_t md_json_stream_make(md_json_stream_t **pstream, apr_pool_t *p, md_json_fmt_t fmt,
+                                 apr_bucket_brigade *bb, 
+                                 md_json_stream_flush_cb *flush, void *baton)
+{
+    md_json_stream_t *stream;
+
+    stream = apr_pcalloc(p, sizeof(*stream));
+    stream->bb = bb;
+    stream->fmt = fmt;
+    stream->flush = flush;
+    stream->baton = baton;
+    stream->rv = APR_SUCCESS;
+    *pstream = stream;
+    return APR_SUCCESS;
+}
+
+static void stream_write(md_json_stream_t *stream, const char *buffer, apr_size_t len)
+{
+    if (APR_SUCCESS == stream->rv && len > 0) {
+        stream->rv = apr_brigade_write(stream->bb, NULL, NULL, buffer, len);
+        stream->pending += len;
+    }
+}
+
+static void stream_newline(md_json_stream_t *stream, int depth)
+{
+    static const char spaces[] = "                                ";
+    int n = 2 * depth;
+
+    stream_write(stream, "\n", 1);
+    for (; n > 0; n -= (int)sizeof(spaces) - 1) {
+        stream_write(stream, spaces, (apr_size_t)((n < (int)sizeof(spaces) - 1)? 
+                                                  n : (int)sizeof(spaces) - 1));
+    }
+}
+
+/* Values dumped by jansson are indented as if at top level, move them
+ * to the depth of the stream. */
+static int stream_dump_cb(const char *buffer, size_t len, void *baton)
+{
+    md_json_stream_t *stream = baton;
+    const char *nl;
+
+    if (stream->fmt != MD_JSON_FMT_COMPACT) {
+        while (len > 0 && (nl = memchr(buffer, '\n', len))) {
+            stream_write(stream, buffer, (apr_size_t)(nl - buffer));
+            stream_newline(stream, stream->depth);
+            len -= (size_t)(nl - buffer) + 1;
+            buffer = nl + 1;
+        }
+    }
+    stream_write(stream, buffer, len);
+    return (APR_SUCCESS == stream->rv)? 0 : -1;
+}
+
+static void stream_dump(md_json_stream_t *stream, json_t *j)
+{
+    if (APR_SUCCESS != stream->rv) return;
+    if (json_dump_callback(j, stream_dump_cb, stream, fmt_to_flags(stream->fmt)|JSON_ENCODE_ANY)
+        && APR_SUCCESS == stream->rv) {
+        stream->rv = APR_EGENERAL;
+    }
+}
+
+static void stream_value_start(md_json_stream_t *stream, const char *key)
+{
+    json_t *jkey;
+
+    if (stream->depth > 0) {
+        if (stream->count[stream->depth-1]++ > 0) stream_write(stream, ",", 1);
+        if (stream->fmt != MD_JSON_FMT_COMPACT) stream_newline(stream, stream->depth);
+        if (stream->closer[stream->depth-1] == '}') {
+            if (!key) {
+                if (APR_SUCCESS == stream->rv) stream->rv = APR_EINVAL;
+                return;
+            }
+            jkey = json_string(key);
+            if (!jkey) {
+                if (APR_SUCCESS == stream->rv) stream->rv = APR_ENOMEM;
+                return;
+            }
+            stream_dump(stream, jkey);
+            json_decref(jkey);
+            stream_write(stream, ": ", (stream->fmt == MD_JSON_FMT_COMPACT)? 1 : 2);
+        }
+    }
+}
+
+static apr_status_t stream_value_end(md_json_stream_t *stream)
+{
+    if (APR_SUCCESS == stream->rv && stream->flush 
+        && (stream->pending >= MD_JSON_STREAM_CHUNK || stream->depth == 0)) {
+        stream->rv = stream->flush(stream->baton, stream->bb);
+        stream->pending = 0;
+    }
+    return stream->rv;
+}
+
+static apr_status_t stream_open(md_json_stream_t *stream, const char *key, 
+                                const char *opener, char closer)
+{
+    if (stream->depth >= MD_JSON_STREAM_MAX_DEPTH) {
+        if (APR_SUCCESS == stream->rv) stream->rv = APR_EINVAL;
+        return stream->rv;
+    }
+    stream_value_start(stream, key);
+    stream_write(stream, opener, 1);
+    stream->closer[stream->depth] = closer;
+    stream->count[stream->depth] = 0;
+    ++stream->depth;
+    return stream->rv;
+}
+
+apr_status_t md_json_stream_open_obj(md_json_stream_t *stream, const char *key)
+{
+    return stream_open(stream, key, "{", '}');
+}
+
+apr_status_t md_json_stream_open_arr(md_json_stream_t *stream, const char *key)
+{
+    return stream_open(stream, key, "[", ']');
+}
+
+apr_status_t md_json_stream_close(md_json_stream_t *stream)
+{
+    if (stream->depth <= 0) {
+        if (APR_SUCCESS == stream->rv) stream->rv = APR_EINVAL;
+        return stream->rv;
+    }
+    --stream->depth;
+    if (stream->count[stream->depth] > 0 && stream->fmt != MD_JSON_FMT_COMPACT) {
+        stream_newline(stream, stream->depth);
+    }
+    stream_write(stream, &stream->closer[stream->depth], 1);
+    return stream_value_end(stream);
+}
+
+apr_status_t md_json_stream_putj(md_json_stream_t *stream, const char *key, const md_json_t *json)
+{
+    stream_value_start(stream, key);
+    stream_dump(stream, json->j);
+    return stream_value_end(stream);
+}
+
+apr_status_t md_json_stream_puts(md_json_stream_t *stream, const char *key, const char *s)
+{
+    json_t *j = s? json_string(s) : json_null();
+
+    stream_value_start(stream, key);
+    if (j) {
+        stream_dump(stream, j);
+        json_decref(j);
+    }
+    else if (APR_SUCCESS == stream->rv) {
+        stream->rv = APR_ENOMEM;
+    }
+    return stream_value_end(stream);
+}
+
+apr_status_t md_json_stream_end(md_json_stream_t *stream)
+{
+    while (stream->depth > 0 && APR_SUCCESS == stream->rv) {
+        md_json_stream_close(stream);
+    }
+    return stream->rv;
+}
+
 /**************************************************************************************************/
 /* http get */
 
@@ -54,6 +54,43 @@ md_json_t *md_json_clone(apr_pool_t *pool, const md_json_t *json);
 int md_json_has_key(const md_json_t *json, ...);
 int md_json_is(const md_json_type_t type, md_json_t *json, ...);
 
+/**
+ * A key path compiled once, for accessors called on every (de)serialization.
+ * Declare them as constant handles, like
+ *   const md_json_path_t MD_P_CA_URL = MD_JSON_PATH2(MD_KEY_CA, MD_KEY_URL);
+ * Keys must be string literals, their lengths are taken at compile time.
+ * The md_json_p* accessors behave like the key list ones of the same name
+ * and exist only for the types md.json, job.json and the status use. The
+ * paths of the MD keys are in md.h.
+ */
+#define MD_JSON_PATH_MAX        3
+
+typedef struct md_json_path_t {
+    int nkeys;
+    const char *keys[MD_JSON_PATH_MAX];
+    size_t lens[MD_JSON_PATH_MAX];
+} md_json_path_t;
+
+#define MD_JSON_PATH1(k1)           { 1, { k1 }, { sizeof(k1)-1 } }
+#define MD_JSON_PATH2(k1, k2)       { 2, { k1, k2 }, { sizeof(k1)-1, sizeof(k2)-1 } }
+#define MD_JSON_PATH3(k1, k2, k3)   { 3, { k1, k2, k3 }, \
+                                      { sizeof(k1)-1, sizeof(k2)-1, sizeof(k3)-1 } }
+
+int md_json_phas(const md_json_t *json, const md_json_path_t *path);
+int md_json_pgetb(const md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_psetb(int value, md_json_t *json, const md_json_path_t *path);
+long md_json_pgetl(const md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_psetl(long value, md_json_t *json, const md_json_path_t *path);
+const char *md_json_pgets(const md_json_t *json, const md_json_path_t *path);
+const char *md_json_pdups(apr_pool_t *p, const md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_psets(const char *s, md_json_t *json, const md_json_path_t *path);
+md_json_t *md_json_pgetj(md_json_t *json, const md_json_path_t *path);
+/* a NULL value removes the key */
+apr_status_t md_json_psetj(const md_json_t *value, md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_pdupsa(apr_array_header_t *a, apr_pool_t *p,
+                            const md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_psetsa(apr_array_header_t *a, md_json_t *json, const md_json_path_t *path);
+
 /* boolean manipulation */
 int md_json_getb(const md_json_t *json, ...);
 apr_status_t md_json_setb(int value, md_json_t *json, ...);
@@ -126,6 +163,45 @@ apr_status_t md_json_getsa(apr_array_header_t *a, const md_json_t *json, ...);
 apr_status_t md_json_dupsa(apr_array_header_t *a, apr_pool_t *p, md_json_t *json, ...);
 apr_status_t md_json_setsa(apr_array_header_t *a, md_json_t *json, ...);
 
+/**
+ * Schema directed decoding: the members of a struct are filled from a JSON object 
+ * in a buffer, without making a jansson tree. A schema is an array of fields, ended 
+ * by MD_JSON_FIELD_END. Keys not in the schema are skipped, values of another type 
+ * than the field's leave the member alone, except that numbers and booleans then
+ * become 0, as md_json_getl() and md_json_getb() have it.
+ */
+typedef enum {
+    MD_JSON_FIELD_STR,          /* const char*, copied into the pool */
+    MD_JSON_FIELD_STRA,         /* apr_array_header_t* of const char*, made if NULL */
+    MD_JSON_FIELD_INT,          /* int */
+    MD_JSON_FIELD_BOOL,         /* int, 1 for true */
+    MD_JSON_FIELD_JSON,         /* md_json_t*, any value parsed by jansson */
+    MD_JSON_FIELD_OBJ,          /* an object, decoded into the same struct with `sub` */
+} md_json_field_type_t;
+
+typedef struct md_json_field_t {
+    const char *key;
+    size_t klen;
+    md_json_field_type_t type;
+    size_t offset;
+    const struct md_json_field_t *sub;
+} md_json_field_t;
+
+#define MD_JSON_FIELD(type, key, s, member) \
+    { key, sizeof(key)-1, MD_JSON_FIELD_##type, APR_OFFSETOF(s, member), NULL }
+#define MD_JSON_FIELD_SUB(key, fields) \
+    { key, sizeof(key)-1, MD_JSON_FIELD_OBJ, 0, fields }
+#define MD_JSON_FIELD_END   { NULL, 0, MD_JSON_FIELD_STR, 0, NULL }
+
+/**
+ * Decode the JSON object in `data` into `obj` following `fields`, allocating 
+ * from `p`. Gives APR_EINVAL when the data is not a JSON object or beyond what 
+ * the decoder handles, e.g. nesting too deep. md_json_readd() has the final say
+ * on such data.
+ */
+apr_status_t md_json_decode(void *obj, const md_json_field_t *fields, 
+                            const char *data, apr_size_t len, apr_pool_t *p);
+
 /* serialization & parsing */
 apr_status_t md_json_writeb(const md_json_t *json, md_json_fmt_t fmt, struct apr_bucket_brigade *bb);
 const char *md_json_writep(const md_json_t *json, apr_pool_t *p, md_json_fmt_t fmt);
@@ -136,6 +212,27 @@ apr_status_t md_json_fcreatex(const md_json_t *json, apr_pool_t *p, md_json_fmt_
 apr_status_t md_json_freplace(const md_json_t *json, apr_pool_t *p, md_json_fmt_t fmt, 
                               const char *fpath, apr_fileperms_t perms);
 
+/* streaming output: writes objects and arrays piece by piece into a brigade,
+ * so that large documents never need to exist as one tree. Keys are needed 
+ * for values inside objects and ignored inside arrays. Errors are sticky, 
+ * once one happened, all further calls return it. */
+typedef struct md_json_stream_t md_json_stream_t;
+
+/* Called when at least some kilobytes have been written and when the 
+ * top level value is complete. Shall pass on and empty the brigade. */
+typedef apr_status_t md_json_stream_flush_cb(void *baton, struct apr_bucket_brigade *bb);
+
+apr_status_t md_json_stream_make(md_json_stream_t **pstream, apr_pool_t *p, md_json_fmt_t fmt,
+                                 struct apr_bucket_brigade *bb, 
+                                 md_json_stream_flush_cb *flush, void *baton);
+apr_status_t md_json_stream_open_obj(md_json_stream_t *stream, const char *key);
+apr_status_t md_json_stream_open_arr(md_json_stream_t *stream, const char *key);
+apr_status_t md_json_stream_close(md_json_stream_t *stream);
+apr_status_t md_json_stream_putj(md_json_stream_t *stream, const char *key, const md_json_t *json);
+apr_status_t md_json_stream_puts(md_json_stream_t *stream, const char *key, const char *s);
+/* close all open objects and arrays */
+apr_status_t md_json_stream_end(md_json_stream_t *stream);
+
 apr_status_t md_json_readb(md_json_t **pjson, apr_pool_t *pool, struct apr_bucket_brigade *bb);
 apr_status_t md_json_readd(md_json_t **pjson, apr_pool_t *pool, const char *data, size_t data_len);
 apr_status_t md_json_readf(md_json_t **pjson, apr_pool_t *pool, const char *fpath);
@@ -0,0 +1,261 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <string.h>
+
+#include <apr_atomic.h>
+#include <apr_buckets.h>
+#include <apr_hash.h>
+#include <apr_shm.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_time.h>
+
+#include "md_metrics.h"
+
+#define METRIC_VAL_MAX      0xffffffffu
+
+typedef struct {
+    int ocsp;                           /* slot of an OCSP status, not an MD */
+    const char *labels;                 /* label set, already escaped */
+    apr_uint32_t local[MD_METRIC_COUNT]; /* values before they are shared */
+} metrics_slot_t;
+
+struct md_metrics_t {
+    apr_pool_t *p;
+    apr_array_header_t *slots;          /* metrics_slot_t */
+    apr_hash_t *slot_by_name;           /* MD name -> int slot */
+    volatile apr_uint32_t *shared;      /* MD_METRIC_COUNT values per slot */
+};
+
+typedef enum {
+    METRIC_FMT_TIME,                    /* unix timestamp, omitted when unknown */
+    METRIC_FMT_COUNT,
+    METRIC_FMT_DURATION,
+} metric_fmt_t;
+
+typedef struct {
+    md_metric_t metric;
+    int ocsp;
+    metric_fmt_t fmt;
+    const char *name;
+    const char *help;
+} metric_family_t;
+
+static const metric_family_t Families[] = {
+    { MD_METRIC_CERT_EXPIRES, 0, METRIC_FMT_TIME, "md_cert_expiry_timestamp_seconds",
+        "End of the validity of the managed domain's certificate(s)." },
+    { MD_METRIC_RENEW_AT, 0, METRIC_FMT_TIME, "md_renew_at_timestamp_seconds",
+        "When renewal of the managed domain's certificate(s) is due." },
+    { MD_METRIC_RENEWAL_RUNS, 0, METRIC_FMT_COUNT, "md_renewal_runs",
+        "Renewal runs for the managed domain." },
+    { MD_METRIC_RENEWAL_ERRORS, 0, METRIC_FMT_COUNT, "md_renewal_errors",
+        "Renewal runs for the managed domain that failed." },
+    { MD_METRIC_RENEWAL_DURATION, 0, METRIC_FMT_DURATION, "md_renewal_last_duration_seconds",
+        "Duration of the last renewal run for the managed domain." },
+    { MD_METRIC_OCSP_VALID_UNTIL, 1, METRIC_FMT_TIME, "md_ocsp_valid_until_timestamp_seconds",
+        "End of the validity of the OCSP response for the certificate." },
+    { MD_METRIC_OCSP_REFRESHES, 1, METRIC_FMT_COUNT, "md_ocsp_refreshes",
+        "OCSP requests for the certificate." },
+    { MD_METRIC_OCSP_REFRESH_ERRORS, 1, METRIC_FMT_COUNT, "md_ocsp_refresh_errors",
+        "OCSP requests for the certificate that failed." },
+    { MD_METRIC_OCSP_REFRESH_DURATION, 1, METRIC_FMT_DURATION, 
+        "md_ocsp_refresh_last_duration_seconds",
+        "Duration of the last OCSP request for the certificate." },
+    { MD_METRIC_OCSP_LAST_USED, 1, METRIC_FMT_TIME, "md_ocsp_last_used_timestamp_seconds",
+        "When a handshake last asked for the lazily renewed OCSP response, hourly." },
+};
+
+apr_status_t md_metrics_make(md_metrics_t **pmetrics, apr_pool_t *p)
+{
+    md_metrics_t *metrics;
+
+    metrics = apr_pcalloc(p, sizeof(*metrics));
+    metrics->p = p;
+    metrics->slots = apr_array_make(p, 10, sizeof(metrics_slot_t));
+    metrics->slot_by_name = apr_hash_make(p);
+    *pmetrics = metrics;
+    return APR_SUCCESS;
+}
+
+static const char *label_escape(apr_pool_t *p, const char *s)
+{
+    const char *c;
+    char *esc, *d;
+
+    if (!strpbrk(s, "\\\"\n")) return s;
+    d = esc = apr_palloc(p, 2 * strlen(s) + 1);
+    for (c = s; *c; ++c) {
+        if (*c == '\n') {
+            *d++ = '\\';
+            *d++ = 'n';
+            continue;
+        }
+        if (*c == '\\' || *c == '"') *d++ = '\\';
+        *d++ = *c;
+    }
+    *d = '\0';
+    return esc;
+}
+
+int md_metrics_add(md_metrics_t *metrics, const char *md_name, const char *ocsp_id)
+{
+    metrics_slot_t *slot;
+    int *pidx;
+
+    if (metrics->shared) return -1;
+    slot = apr_array_push(metrics->slots);
+    memset(slot, 0, sizeof(*slot));
+    if (ocsp_id) {
+        slot->ocsp = 1;
+        slot->labels = md_name?
+            apr_psprintf(metrics->p, "md=\"%s\",certid=\"%s\"", 
+                         label_escape(metrics->p, md_name), label_escape(metrics->p, ocsp_id))
+            : apr_psprintf(metrics->p, "certid=\"%s\"", label_escape(metrics->p, ocsp_id));
+    }
+    else {
+        slot->labels = apr_psprintf(metrics->p, "md=\"%s\"", label_escape(metrics->p, md_name));
+        pidx = apr_palloc(metrics->p, sizeof(*pidx));
+        *pidx = metrics->slots->nelts - 1;
+        apr_hash_set(metrics->slot_by_name, md_name, APR_HASH_KEY_STRING, pidx);
+    }
+    return metrics->slots->nelts - 1;
+}
+
+int md_metrics_get_slot(md_metrics_t *metrics, const char *md_name)
+{
+    int *pidx;
+
+    if (!metrics || !md_name) return -1;
+    pidx = apr_hash_get(metrics->slot_by_name, md_name, APR_HASH_KEY_STRING);
+    return pidx? *pidx : -1;
+}
+
+apr_status_t md_metrics_share(md_metrics_t *metrics, apr_pool_t *p)
+{
+    apr_shm_t *shm;
+    apr_uint32_t *values;
+    apr_size_t len;
+    apr_status_t rv;
+    int i;
+
+    if (metrics->shared) return APR_SUCCESS;
+    len = (apr_size_t)(metrics->slots->nelts? metrics->slots->nelts : 1) 
+          * MD_METRIC_COUNT * sizeof(apr_uint32_t);
+    rv = apr_shm_create(&shm, len, NULL, p);
+    if (APR_SUCCESS != rv) return rv;
+
+    values = apr_shm_baseaddr_get(shm);
+    memset(values, 0, len);
+    for (i = 0; i < metrics->slots->nelts; ++i) {
+        memcpy(values + (apr_size_t)i * MD_METRIC_COUNT,
+               APR_ARRAY_IDX(metrics->slots, i, metrics_slot_t).local, 
+               MD_METRIC_COUNT * sizeof(apr_uint32_t));
+    }
+    metrics->shared = values;
+    return APR_SUCCESS;
+}
+
+int md_metrics_is_shared(md_metrics_t *metrics)
+{
+    return metrics && metrics->shared;
+}
+
+static volatile apr_uint32_t *metric_value(md_metrics_t *metrics, int slot, md_metric_t metric)
+{
+    if (!metrics || slot < 0 || slot >= metrics->slots->nelts 
+        || metric < 0 || metric >= MD_METRIC_COUNT) return NULL;
+    if (metrics->shared) return metrics->shared + (apr_size_t)slot * MD_METRIC_COUNT + metric;
+    return &APR_ARRAY_IDX(metrics->slots, slot, metrics_slot_t).local[metric];
+}
+
+void md_metrics_set(md_metrics_t *metrics, int slot, md_metric_t metric, apr_uint32_t val)
+{
+    volatile apr_uint32_t *pval = metric_value(metrics, slot, metric);
+    if (pval) apr_atomic_set32(pval, val);
+}
+
+void md_metrics_set_time(md_metrics_t *metrics, int slot, md_metric_t metric, apr_time_t t)
+{
+    apr_time_t secs = (t > 0)? apr_time_sec(t) : 0;
+    md_metrics_set(metrics, slot, metric, 
+                   (secs > METRIC_VAL_MAX)? METRIC_VAL_MAX : (apr_uint32_t)secs);
+}
+
+void md_metrics_set_duration(md_metrics_t *metrics, int slot, md_metric_t metric, 
+                             apr_interval_time_t duration)
+{
+    apr_interval_time_t msecs = (duration > 0)? apr_time_as_msec(duration) : 0;
+    md_metrics_set(metrics, slot, metric, 
+                   (msecs > METRIC_VAL_MAX)? METRIC_VAL_MAX : (apr_uint32_t)msecs);
+}
+
+void md_metrics_inc(md_metrics_t *metrics, int slot, md_metric_t metric)
+{
+    volatile apr_uint32_t *pval = metric_value(metrics, slot, metric);
+    if (pval) apr_atomic_inc32(pval);
+}
+
+apr_uint32_t md_metrics_get(md_metrics_t *metrics, int slot, md_metric_t metric)
+{
+    volatile apr_uint32_t *pval = metric_value(metrics, slot, metric);
+    return pval? apr_atomic_read32(pval) : 0;
+}
+
+static apr_status_t write_family(md_metrics_t *metrics, const metric_family_t *family, 
+                                 apr_bucket_brigade *bb)
+{
+    const metrics_slot_t *slot;
+    apr_uint32_t val;
+    apr_status_t rv;
+    int i;
+
+    rv = apr_brigade_printf(bb, NULL, NULL, "# TYPE %s %s\n# HELP %s %s\n",
+                            family->name, (family->fmt == METRIC_FMT_COUNT)? "counter" : "gauge",
+                            family->name, family->help);
+    for (i = 0; i < metrics->slots->nelts && APR_SUCCESS == rv; ++i) {
+        slot = &APR_ARRAY_IDX(metrics->slots, i, metrics_slot_t);
+        if (slot->ocsp != family->ocsp) continue;
+        val = md_metrics_get(metrics, i, family->metric);
+        switch (family->fmt) {
+            case METRIC_FMT_TIME:
+                if (val) rv = apr_brigade_printf(bb, NULL, NULL, "%s{%s} %u\n",
+                                                 family->name, slot->labels, val);
+                break;
+            case METRIC_FMT_COUNT:
+                rv = apr_brigade_printf(bb, NULL, NULL, "%s_total{%s} %u\n",
+                                        family->name, slot->labels, val);
+                break;
+            case METRIC_FMT_DURATION:
+                rv = apr_brigade_printf(bb, NULL, NULL, "%s{%s} %u.%03u\n",
+                                        family->name, slot->labels, val / 1000, val % 1000);
+                break;
+        }
+    }
+    return rv;
+}
+
+apr_status_t md_metrics_write(md_metrics_t *metrics, apr_bucket_brigade *bb)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t i;
+
+    for (i = 0; i < sizeof(Families)/sizeof(Families[0]) && APR_SUCCESS == rv; ++i) {
+        rv = write_family(metrics, &Families[i], bb);
+    }
+    if (APR_SUCCESS == rv) rv = apr_brigade_puts(bb, NULL, NULL, "# EOF\n");
+    return rv;
+}
@@ -0,0 +1,86 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef md_metrics_h
+#define md_metrics_h
+
+struct apr_bucket_brigade;
+
+/**
+ * Metrics of MDs and OCSP stapling, kept in shared memory so that every
+ * child process reports the values of the one running the watchdogs.
+ * Timestamps are kept in seconds, durations in milliseconds.
+ */
+typedef struct md_metrics_t md_metrics_t;
+
+typedef enum {
+    MD_METRIC_CERT_EXPIRES,             /* end of the earliest cert validity */
+    MD_METRIC_RENEW_AT,                 /* when renewal is due */
+    MD_METRIC_RENEWAL_RUNS,             /* renewal runs done */
+    MD_METRIC_RENEWAL_ERRORS,           /* renewal runs that failed */
+    MD_METRIC_RENEWAL_DURATION,         /* duration of the last renewal run */
+    MD_METRIC_OCSP_VALID_UNTIL,         /* end of the response validity */
+    MD_METRIC_OCSP_REFRESHES,           /* requests sent to the responder */
+    MD_METRIC_OCSP_REFRESH_ERRORS,      /* requests that failed */
+    MD_METRIC_OCSP_REFRESH_DURATION,    /* duration of the last request */
+    MD_METRIC_OCSP_LAST_USED,           /* last handshake asking for a lazy response */
+    MD_METRIC_COUNT
+} md_metric_t;
+
+apr_status_t md_metrics_make(md_metrics_t **pmetrics, apr_pool_t *p);
+
+/**
+ * Add the metrics for an MD or, when ocsp_id is not NULL, for the OCSP
+ * status of a certificate and return their slot. Slots can only be added 
+ * before the metrics are shared.
+ */
+int md_metrics_add(md_metrics_t *metrics, const char *md_name, const char *ocsp_id);
+
+/**
+ * Get the slot of the MD with the given name or -1 if there is none.
+ */
+int md_metrics_get_slot(md_metrics_t *metrics, const char *md_name);
+
+/**
+ * Move the values into anonymous shared memory, allocated from pool p. This
+ * needs to happen before child processes are created. On failure, the
+ * values stay where they are and each process only sees its own updates. 
+ */
+apr_status_t md_metrics_share(md_metrics_t *metrics, apr_pool_t *p);
+
+/**
+ * != 0 iff the values are in shared memory and seen by all child processes.
+ */
+int md_metrics_is_shared(md_metrics_t *metrics);
+
+/**
+ * Update a value. A NULL metrics or a negative slot are ignored, so that
+ * callers do not need to check if metrics are in use.
+ */
+void md_metrics_set(md_metrics_t *metrics, int slot, md_metric_t metric, apr_uint32_t val);
+void md_metrics_set_time(md_metrics_t *metrics, int slot, md_metric_t metric, apr_time_t t);
+void md_metrics_set_duration(md_metrics_t *metrics, int slot, md_metric_t metric, 
+                             apr_interval_time_t duration);
+void md_metrics_inc(md_metrics_t *metrics, int slot, md_metric_t metric);
+
+apr_uint32_t md_metrics_get(md_metrics_t *metrics, int slot, md_metric_t metric);
+
+/**
+ * Write all metrics in the OpenMetrics text format.
+ */
+apr_status_t md_metrics_write(md_metrics_t *metrics, struct apr_bucket_brigade *bb);
+
+#endif /* md_metrics_h */
@@ -38,6 +38,7 @@
 #include "md_json.h"
 #include "md_log.h"
 #include "md_http.h"
+#include "md_metrics.h"
 #include "md_json.h"
 #include "md_result.h"
 #include "md_status.h"
@@ -46,6 +47,14 @@
 #include "md_ocsp.h"
 
 #define MD_OCSP_ID_LENGTH   SHA_DIGEST_LENGTH
+
+/* Lazy status are marked as used in shared memory, at most this often per process,
+ * and only renewed by the watchdog while the mark is not older than the idle time.
+ * The watchdog saves the marks in the store, so they outlive a restart. They
+ * match the "ocsp*.json" pattern, so old ones are removed with the responses. */
+#define MD_OCSP_USED_FMT        "ocspused-%s.json"
+#define MD_OCSP_USED_MARK       apr_time_from_sec(MD_SECS_PER_HOUR)
+#define MD_OCSP_USED_IDLE       apr_time_from_sec(MD_SECS_PER_DAY)
    
 struct md_ocsp_reg_t {
     apr_pool_t *p;
@@ -59,6 +68,15 @@ struct md_ocsp_reg_t {
     md_job_notify_cb *notify;
     void *notify_ctx;
     apr_time_t min_delay;
+    md_metrics_t *metrics;          /* NULL when not in use */
+
+    /* incremental removal of old responses, only done by the watchdog */
+    apr_pool_t *gc_pool;            /* holds the names of the current sweep */
+    apr_array_header_t *gc_names;   /* store names to sweep, NULL when no sweep is on */
+    int gc_cursor;                  /* index of the next name to sweep */
+    apr_size_t gc_removed;          /* responses removed in the current/last sweep */
+    apr_time_t gc_started;
+    apr_time_t gc_completed;
 };
 
 typedef struct md_ocsp_status_t md_ocsp_status_t; 
@@ -85,6 +103,13 @@ struct md_ocsp_status_t {
     
     apr_time_t resp_mtime;
     apr_time_t resp_last_check;
+
+    int lazy;                 /* only loaded and renewed once asked for */
+    const char *used_name;    /* store file marking the use of a lazy status */
+    apr_time_t used_marked;   /* when this process last marked it */
+    apr_time_t used_saved;    /* when the watchdog last saved the mark */
+
+    int metrics_slot;         /* -1 when not in metrics */
 };
 
 typedef struct md_ocsp_id_map_t md_ocsp_id_map_t;
@@ -173,6 +198,8 @@ static apr_status_t ostat_set(md_ocsp_status_t *ostat, md_ocsp_cert_stat_t stat,
     ostat->resp_stat = stat;
     ostat->resp_valid = *valid;
     ostat->resp_mtime = mtime;
+    md_metrics_set_time(ostat->reg->metrics, ostat->metrics_slot, 
+                        MD_METRIC_OCSP_VALID_UNTIL, valid->end);
     
     ostat->errors = 0;
     ostat->next_run = md_timeperiod_slice_before_end(
@@ -263,6 +290,53 @@ cleanup:
     return rv;
 }
 
+static void ostat_save_used(md_ocsp_status_t *ostat, apr_pool_t *ptemp)
+{
+    apr_status_t rv;
+
+    rv = md_store_save_json(ostat->reg->store, ptemp, MD_SG_OCSP, ostat->md_name,
+                            ostat->used_name, md_json_create(ptemp), 0);
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp,
+                      "md[%s]: OCSP, marking %s as used", ostat->md_name, ostat->hexid);
+    }
+}
+
+/* Mark a lazy status as used, with the registry mutex held. Returns != 0 when 
+ * the watchdog, which may run in another child, cannot see the mark in shared
+ * memory and the caller has to save it, once the mutex is released. */
+static int ostat_mark_used(md_ocsp_status_t *ostat)
+{
+    apr_time_t now = apr_time_now();
+
+    if (now - ostat->used_marked < MD_OCSP_USED_MARK) return 0;
+    ostat->used_marked = now;
+    md_metrics_set_time(ostat->reg->metrics, ostat->metrics_slot, 
+                        MD_METRIC_OCSP_LAST_USED, now);
+    return (ostat->metrics_slot < 0 || !md_metrics_is_shared(ostat->reg->metrics));
+}
+
+/* Only called from the watchdog. */
+static int ostat_in_use(md_ocsp_status_t *ostat, apr_pool_t *ptemp)
+{
+    apr_time_t now = apr_time_now(), used, mtime;
+
+    if (!ostat->lazy) return 1;
+    used = apr_time_from_sec(md_metrics_get(ostat->reg->metrics, ostat->metrics_slot,
+                                            MD_METRIC_OCSP_LAST_USED));
+    if (used > 0 && now - used < MD_OCSP_USED_IDLE) {
+        if (used - ostat->used_saved >= MD_OCSP_USED_MARK) {
+            ostat->used_saved = used;
+            ostat_save_used(ostat, ptemp);
+        }
+        return 1;
+    }
+    /* not used since the start of this server, maybe in a previous generation */
+    mtime = md_store_get_modified(ostat->reg->store, MD_SG_OCSP, ostat->md_name,
+                                  ostat->used_name, ptemp);
+    return (mtime > 0 && now - mtime < MD_OCSP_USED_IDLE);
+}
+
 static apr_status_t ocsp_reg_cleanup(void *data)
 {
     md_ocsp_reg_t *reg = data;
@@ -280,7 +354,7 @@ apr_status_t md_ocsp_reg_make(md_ocsp_reg_t **preg, apr_pool_t *p, md_store_t *s
     md_ocsp_reg_t *reg;
     apr_status_t rv = APR_SUCCESS;
     
-    reg = apr_palloc(p, sizeof(*reg));
+    reg = apr_pcalloc(p, sizeof(*reg));
     if (!reg) {
         rv = APR_ENOMEM;
         goto cleanup;
@@ -296,6 +370,9 @@ apr_status_t md_ocsp_reg_make(md_ocsp_reg_t **preg, apr_pool_t *p, md_store_t *s
     
     rv = apr_thread_mutex_create(&reg->mutex, APR_THREAD_MUTEX_NESTED, p);
     if (APR_SUCCESS != rv) goto cleanup;
+    rv = apr_pool_create(&reg->gc_pool, p);
+    if (APR_SUCCESS != rv) goto cleanup;
+    apr_pool_tag(reg->gc_pool, "md_ocsp_gc");
 
     apr_pool_cleanup_register(p, reg, ocsp_reg_cleanup, apr_pool_cleanup_null);
 cleanup:
@@ -304,7 +381,7 @@ cleanup:
 }
 
 apr_status_t md_ocsp_prime(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ext_id_len,
-                           md_cert_t *cert, md_cert_t *issuer, const md_t *md)
+                           md_cert_t *cert, md_cert_t *issuer, const md_t *md, int lazy)
 {
     md_ocsp_status_t *ostat;
     const char *name;
@@ -326,6 +403,7 @@ apr_status_t md_ocsp_prime(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ex
     ostat->id = id;
     ostat->reg = reg;
     ostat->md_name = name;
+    ostat->metrics_slot = -1;
     md_data_to_hex(&ostat->hexid, 0, reg->p, &ostat->id);
     ostat->file_name = apr_psprintf(reg->p, "ocsp-%s.json", ostat->hexid);
     rv = md_cert_to_sha256_fingerprint(&ostat->hex_sha256, cert, reg->p); 
@@ -350,11 +428,18 @@ apr_status_t md_ocsp_prime(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ex
         goto cleanup;
     }
     
-    /* See, if we have something in store */
-    ocsp_status_refresh(ostat, reg->p);
+    if (lazy) {
+        /* the store is looked at on first use */
+        ostat->lazy = 1;
+        ostat->used_name = apr_psprintf(reg->p, MD_OCSP_USED_FMT, ostat->hexid);
+    }
+    else {
+        /* See, if we have something in store */
+        ocsp_status_refresh(ostat, reg->p);
+    }
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, reg->p, 
-                  "md[%s]: adding ocsp info (responder=%s)", 
-                  name, ostat->responder_url);
+                  "md[%s]: adding %socsp info (responder=%s)", 
+                  name, lazy? "lazy " : "", ostat->responder_url);
     apr_hash_set(reg->ostat_by_id, ostat->id.data, (apr_ssize_t)ostat->id.len, ostat);
     if (ext_id) {
         md_ocsp_id_map_t *id_map;
@@ -381,7 +466,7 @@ apr_status_t md_ocsp_get_status(md_ocsp_copy_der *cb, void *userdata, md_ocsp_re
     md_ocsp_id_map_t *id_map;
     const char *id;
     apr_size_t id_len;
-    int locked = 0;
+    int locked = 0, save_used = 0;
 
     (void)p;
     (void)md;
@@ -403,6 +488,7 @@ apr_status_t md_ocsp_get_status(md_ocsp_copy_der *cb, void *userdata, md_ocsp_re
     apr_thread_mutex_lock(reg->mutex);
     locked = 1;
     
+    if (ostat->lazy) save_used = ostat_mark_used(ostat);
     if (ostat->resp_der.len <= 0) {
         /* No response known, check store for new response. */
         ocsp_status_refresh(ostat, p);
@@ -438,6 +524,7 @@ apr_status_t md_ocsp_get_status(md_ocsp_copy_der *cb, void *userdata, md_ocsp_re
                   name, (long)ostat->resp_der.len);
 cleanup:
     if (locked) apr_thread_mutex_unlock(reg->mutex);
+    if (save_used) ostat_save_used(ostat, p);
     return rv;
 }
 
@@ -489,6 +576,26 @@ cleanup:
     return rv;
 }
 
+static int add_ostat_metrics(void *baton, const void *key, apr_ssize_t klen, const void *val)
+{
+    md_ocsp_reg_t *reg = baton;
+    md_ocsp_status_t *ostat = (md_ocsp_status_t *)val;
+
+    (void)key;
+    (void)klen;
+    ostat->metrics_slot = md_metrics_add(reg->metrics, ostat->md_name, ostat->hexid);
+    md_metrics_set_time(reg->metrics, ostat->metrics_slot, 
+                        MD_METRIC_OCSP_VALID_UNTIL, ostat->resp_valid.end);
+    return 1;
+}
+
+void md_ocsp_set_metrics(md_ocsp_reg_t *reg, md_metrics_t *metrics)
+{
+    /* Called during post_config. no mutex protection needed */
+    reg->metrics = metrics;
+    apr_hash_do(add_ostat_metrics, reg, reg->ostat_by_id);
+}
+
 apr_size_t md_ocsp_count(md_ocsp_reg_t *reg)
 {
     return apr_hash_count(reg->ostat_by_id);
@@ -589,6 +696,7 @@ typedef struct {
     md_ocsp_status_t *ostat;
     md_result_t *result;
     md_job_t *job;
+    apr_time_t started;
 } md_ocsp_update_t;
 
 static apr_status_t ostat_on_resp(const md_http_response_t *resp, void *baton)
@@ -745,7 +853,11 @@ static apr_status_t ostat_on_req_status(const md_http_request_t *req, apr_status
 
     (void)req;
     md_job_end_run(update->job, update->result);
+    md_metrics_inc(ostat->reg->metrics, ostat->metrics_slot, MD_METRIC_OCSP_REFRESHES);
+    md_metrics_set_duration(ostat->reg->metrics, ostat->metrics_slot, 
+                            MD_METRIC_OCSP_REFRESH_DURATION, apr_time_now() - update->started);
     if (APR_SUCCESS != status) {
+        md_metrics_inc(ostat->reg->metrics, ostat->metrics_slot, MD_METRIC_OCSP_REFRESH_ERRORS);
         ++ostat->errors;
         ostat->next_run = apr_time_now() + md_job_delay_on_errors(update->job, ostat->errors, NULL);
         md_result_printf(update->result, status, "OCSP status update failed (%d. time)",  
@@ -827,6 +939,7 @@ static apr_status_t next_todo(md_http_request_t **preq, void *baton,
             update->job = md_ocsp_job_make(ctx->reg, ostat->md_name, update->p);
             md_job_load(update->job);
             md_job_start_run(update->job, update->result, ctx->reg->store);
+            update->started = apr_time_now();
              
             if (!ostat->ocsp_req) {
                 rv = ocsp_req_make(&ostat->ocsp_req, ostat->certid);
@@ -864,7 +977,7 @@ static int select_updates(void *baton, const void *key, apr_ssize_t klen, const
     
     (void)key;
     (void)klen;
-    if (ostat->next_run <= ctx->time) {
+    if (ostat->next_run <= ctx->time && ostat_in_use(ostat, ctx->ptemp)) {
         update = apr_pcalloc(ctx->ptemp, sizeof(*update));
         update->p = ctx->ptemp;
         update->ostat = ostat;
@@ -937,6 +1050,93 @@ apr_status_t md_ocsp_remove_responses_older_than(md_ocsp_reg_t *reg, apr_pool_t
                                               MD_SG_OCSP, "*", "ocsp*.json");
 }
 
+static int gc_add_name(void *baton, const char *dir, const char *name, 
+                       md_store_vtype_t vtype, void *value, apr_pool_t *ptemp)
+{
+    apr_array_header_t *names = baton;
+
+    (void)dir;
+    (void)vtype;
+    (void)value;
+    (void)ptemp;
+    APR_ARRAY_PUSH(names, const char*) = apr_pstrdup(names->pool, name);
+    return APR_SUCCESS;
+}
+
+apr_status_t md_ocsp_remove_responses_step(md_ocsp_reg_t *reg, apr_pool_t *ptemp,
+                                           apr_time_t timestamp, int max_files)
+{
+    apr_array_header_t *names;
+    const char *name;
+    apr_status_t rv = APR_SUCCESS;
+    int removed, budget = max_files, visits = max_files;
+    
+    if (!reg->gc_names) {
+        /* start a new sweep over a snapshot of the names present now */
+        apr_pool_clear(reg->gc_pool);
+        names = apr_array_make(reg->gc_pool, 100, sizeof(const char*));
+        rv = md_store_iter_names(gc_add_name, names, reg->store, ptemp, MD_SG_OCSP, "*");
+        if (APR_SUCCESS != rv && !APR_STATUS_IS_ENOENT(rv)) goto cleanup;
+        rv = APR_SUCCESS;
+        apr_thread_mutex_lock(reg->mutex);
+        reg->gc_names = names;
+        reg->gc_cursor = 0;
+        reg->gc_removed = 0;
+        reg->gc_started = apr_time_now();
+        apr_thread_mutex_unlock(reg->mutex);
+    }
+    
+    while (reg->gc_cursor < reg->gc_names->nelts && budget > 0 && visits-- > 0) {
+        name = APR_ARRAY_IDX(reg->gc_names, reg->gc_cursor, const char*);
+        removed = 0;
+        rv = md_store_remove_some_not_modified_since(reg->store, ptemp, timestamp, 
+                                                     MD_SG_OCSP, name, "ocsp*.json",
+                                                     budget, &removed);
+        budget -= removed;
+        apr_thread_mutex_lock(reg->mutex);
+        reg->gc_removed += (apr_size_t)removed;
+        /* on APR_INCOMPLETE, the name is visited again next time */
+        if (!APR_STATUS_IS_INCOMPLETE(rv)) ++reg->gc_cursor;
+        apr_thread_mutex_unlock(reg->mutex);
+        if (APR_SUCCESS != rv && !APR_STATUS_IS_INCOMPLETE(rv)) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, 
+                          "removing old OCSP responses for %s", name);
+        }
+    }
+    
+    if (reg->gc_cursor < reg->gc_names->nelts) {
+        rv = APR_INCOMPLETE;
+    }
+    else {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, ptemp, 
+                      "removed %d old OCSP responses in %d store names",
+                      (int)reg->gc_removed, reg->gc_names->nelts);
+        apr_thread_mutex_lock(reg->mutex);
+        reg->gc_names = NULL;
+        reg->gc_completed = apr_time_now();
+        apr_thread_mutex_unlock(reg->mutex);
+        rv = APR_SUCCESS;
+    }
+cleanup:
+    return rv;
+}
+
+static void gc_status_to_json(md_json_t *json, md_ocsp_reg_t *reg, apr_pool_t *p)
+{
+    md_json_t *jgc = md_json_create(p);
+    
+    apr_thread_mutex_lock(reg->mutex);
+    if (reg->gc_names) {
+        md_json_setl(reg->gc_names->nelts, jgc, MD_KEY_NAMES, NULL);
+        md_json_setl(reg->gc_cursor, jgc, MD_KEY_NAMES_DONE, NULL);
+    }
+    md_json_setl((long)reg->gc_removed, jgc, MD_KEY_REMOVED, NULL);
+    if (reg->gc_started) md_json_set_time(reg->gc_started, jgc, MD_KEY_STARTED, NULL);
+    if (reg->gc_completed) md_json_set_time(reg->gc_completed, jgc, MD_KEY_COMPLETED, NULL);
+    apr_thread_mutex_unlock(reg->mutex);
+    md_json_setj(jgc, json, MD_KEY_CLEANUP, NULL);
+}
+
 typedef struct {
     apr_pool_t *p;
     md_ocsp_reg_t *reg;
@@ -978,6 +1178,7 @@ void  md_ocsp_get_summary(md_json_t **pjson, md_ocsp_reg_t *reg, apr_pool_t *p)
     md_json_setl(ctx.good, json, MD_KEY_GOOD, NULL);
     md_json_setl(ctx.revoked, json, MD_KEY_REVOKED, NULL);
     md_json_setl(ctx.unknown, json, MD_KEY_UNKNOWN, NULL);
+    gc_status_to_json(json, reg, p);
     *pjson = json;
 }
 
@@ -1061,6 +1262,7 @@ void md_ocsp_get_status_all(md_json_t **pjson, md_ocsp_reg_t *reg, apr_pool_t *p
         ostat = APR_ARRAY_IDX(ctx.ostats, i, md_ocsp_status_t*);
         md_json_addj(mk_jstat(ostat, reg, p), json, MD_KEY_OCSPS, NULL);
     }
+    gc_status_to_json(json, reg, p);
     *pjson = json;
 }
 
@@ -20,6 +20,7 @@
 struct md_data_t;
 struct md_job_t;
 struct md_json_t;
+struct md_metrics_t;
 struct md_result_t;
 struct md_store_t;
 struct md_timeslice_t;
@@ -43,8 +44,14 @@ apr_status_t md_ocsp_reg_make(md_ocsp_reg_t **preg, apr_pool_t *p,
 
 apr_status_t md_ocsp_init_id(struct md_data_t *id, apr_pool_t *p, const md_cert_t *cert);
 
+/**
+ * Register the certificate `x` for OCSP stapling. Unless `lazy` is set, a response
+ * in the store is loaded and the watchdog keeps it renewed. With `lazy`, this only
+ * starts once md_ocsp_get_status() has been asked for it, in any child process,
+ * and stops again when it has not been asked for a day.
+ */
 apr_status_t md_ocsp_prime(md_ocsp_reg_t *reg, const char *ext_id, apr_size_t ext_id_len,
-                           md_cert_t *x, md_cert_t *issuer, const md_t *md);
+                           md_cert_t *x, md_cert_t *issuer, const md_t *md, int lazy);
 
 typedef void md_ocsp_copy_der(const unsigned char *der, apr_size_t der_len, void *userdata);
 
@@ -56,6 +63,12 @@ apr_status_t md_ocsp_get_meta(md_ocsp_cert_stat_t *pstat, md_timeperiod_t *pvali
                               md_ocsp_reg_t *reg, const md_cert_t *cert,
                               apr_pool_t *p, const md_t *md);
 
+/**
+ * Add the OCSP status of all primed certificates to the metrics and keep them
+ * updated there. Needs to be called before the metrics are shared.
+ */
+void md_ocsp_set_metrics(md_ocsp_reg_t *reg, struct md_metrics_t *metrics);
+
 apr_size_t md_ocsp_count(md_ocsp_reg_t *reg);
 
 void md_ocsp_renew(md_ocsp_reg_t *reg, apr_pool_t *p, apr_pool_t *ptemp, apr_time_t *pnext_run);
@@ -63,6 +76,16 @@ void md_ocsp_renew(md_ocsp_reg_t *reg, apr_pool_t *p, apr_pool_t *ptemp, apr_tim
 apr_status_t md_ocsp_remove_responses_older_than(md_ocsp_reg_t *reg, apr_pool_t *p, 
                                                  apr_time_t timestamp);
 
+/**
+ * Remove stored OCSP responses older than `timestamp` incrementally. Each call
+ * continues the sweep where the previous one stopped and removes at most
+ * `max_files` responses. A new sweep starts on the call after one completed.
+ * Progress is part of the JSON summary and status under "cleanup".
+ * @return APR_SUCCESS when the sweep is complete, APR_INCOMPLETE when more remains
+ */
+apr_status_t md_ocsp_remove_responses_step(md_ocsp_reg_t *reg, apr_pool_t *ptemp,
+                                           apr_time_t timestamp, int max_files);
+
 void md_ocsp_get_summary(struct md_json_t **pjson, md_ocsp_reg_t *reg, apr_pool_t *p);
 void md_ocsp_get_status_all(struct md_json_t **pjson, md_ocsp_reg_t *reg, apr_pool_t *p);
 
@@ -22,6 +22,7 @@
 #include <apr_lib.h>
 #include <apr_hash.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
 #include <apr_uri.h>
 
 #include "md.h"
@@ -43,7 +44,11 @@ struct md_reg_t {
     apr_pool_t *p;
     struct md_store_t *store;
     struct apr_hash_t *protos;
-    struct apr_hash_t *certs;
+    struct apr_hash_t *certs;       /* md name -> reg_certs_t */
+    md_reg_memo_t *memo;            /* state kept from the previous generation or NULL */
+    apr_thread_mutex_t *certs_mutex; /* guards the generations below */
+    apr_uint32_t certs_gen;         /* bumped when certificates of any MD may have changed */
+    struct apr_hash_t *certs_gens;  /* md name -> apr_uint32_t*, bumped on changes to the MD */
     int can_http;
     int can_https;
     const char *proxy_url;
@@ -110,6 +115,7 @@ apr_status_t md_reg_create(md_reg_t **preg, apr_pool_t *p, struct md_store_t *st
     reg->store = store;
     reg->protos = apr_hash_make(p);
     reg->certs = apr_hash_make(p);
+    reg->certs_gens = apr_hash_make(p);
     reg->can_http = 1;
     reg->can_https = 1;
     reg->proxy_url = apr_pstrdup(p, proxy_url);
@@ -125,7 +131,9 @@ apr_status_t md_reg_create(md_reg_t **preg, apr_pool_t *p, struct md_store_t *st
     md_timeslice_create(&reg->renew_window, p, MD_TIME_LIFE_NORM, MD_TIME_RENEW_WINDOW_DEF); 
     md_timeslice_create(&reg->warn_window, p, MD_TIME_LIFE_NORM, MD_TIME_WARN_WINDOW_DEF); 
     
-    if (APR_SUCCESS == (rv = md_acme_protos_add(reg->protos, p))) {
+    if (APR_SUCCESS == (rv = apr_thread_mutex_create(&reg->certs_mutex, 
+                                                     APR_THREAD_MUTEX_DEFAULT, p))
+        && APR_SUCCESS == (rv = md_acme_protos_add(reg->protos, p))) {
         rv = load_props(reg, p);
     }
     
@@ -353,6 +361,19 @@ md_t *md_reg_get(md_reg_t *reg, const char *name, apr_pool_t *p)
     return NULL;
 }
 
+apr_status_t md_reg_get_all(apr_array_header_t **pmds, md_reg_t *reg, apr_pool_t *p)
+{
+    apr_status_t rv;
+    int i;
+
+    rv = md_store_md_load_all(pmds, reg->store, p, MD_SG_DOMAINS, "*", MD_STORE_BULK_WORKERS);
+    if (APR_SUCCESS != rv) return rv;
+    for (i = 0; i < (*pmds)->nelts; ++i) {
+        state_init(reg, p, APR_ARRAY_IDX(*pmds, i, md_t*));
+    }
+    return APR_SUCCESS;
+}
+
 typedef struct {
     const char *domain;
     md_t *md;
@@ -386,6 +407,7 @@ md_t *md_reg_find(md_reg_t *reg, const char *domain, apr_pool_t *p)
 
 typedef struct {
     const md_t *md_checked;
+    md_dns_set_t *domains;      /* the domains of md_checked */
     md_t *md;
     const char *s;
 } find_overlap_ctx;
@@ -394,12 +416,17 @@ static int find_overlap(void *baton, md_reg_t *reg, md_t *md)
 {
     find_overlap_ctx *ctx = baton;
     const char *overlap;
+    int i;
     
     (void)reg;
-    if ((overlap = md_common_name(ctx->md_checked, md))) {
-        ctx->md = md;
-        ctx->s = overlap;
-        return 0;
+    /* a domain of md_checked that md contains, as md_common_name() */
+    for (i = 0; i < md->domains->nelts; ++i) {
+        overlap = md_dns_set_matched_by(ctx->domains, APR_ARRAY_IDX(md->domains, i, const char*));
+        if (overlap) {
+            ctx->md = md;
+            ctx->s = overlap;
+            return 0;
+        }
     }
     return 1;
 }
@@ -409,6 +436,7 @@ md_t *md_reg_find_overlap(md_reg_t *reg, const md_t *md, const char **pdomain, a
     find_overlap_ctx ctx;
     
     ctx.md_checked = md;
+    ctx.domains = md_dns_set_of(p, md->domains);
     ctx.md = NULL;
     ctx.s = NULL;
     
@@ -575,6 +603,301 @@ apr_status_t md_reg_delete_acct(md_reg_t *reg, apr_pool_t *p, const char *acct_i
 /**************************************************************************************************/
 /* certificate related */
 
+/* The public certificates of an MD, as loaded for its certificate generation `gen`.
+ * Pubcerts handed out stay valid when the generation changes: they live in a pool 
+ * per generation and those of earlier generations are only destroyed with the
+ * record or when a new server generation takes it over from the memo. */
+typedef struct {
+    apr_pool_t *parent;
+    apr_pool_t *p;                  /* pubcerts of the current generation */
+    apr_array_header_t *retired;    /* pools of earlier generations */
+    apr_uint32_t gen;
+    int count;
+    const md_pubcert_t **pubcerts;  /* by cert index, NULL when not loaded */
+    const char *stamp;              /* of the certificate files before loading, with a memo */
+} reg_certs_t;
+
+/* What is kept of an MD from one server generation to the next. */
+typedef struct {
+    apr_pool_t *p;                  /* the entry and its certs live here */
+    apr_pool_t *vp;                 /* values of the last sync, cleared on the next */
+    const char *name;
+    reg_certs_t *certs;
+    const char *fingerprint;        /* of the configured MD when synced, or NULL */
+    const char *stamp;              /* of the store files after the sync */
+    md_state_t state;
+    const char *state_descr;
+    int renew_mode;
+    apr_array_header_t *contacts;
+    apr_array_header_t *ca_challenges;
+    const char *ca_effective;
+    const char *ca_account;
+} memo_entry_t;
+
+struct md_reg_memo_t {
+    apr_pool_t *p;
+    apr_hash_t *entries;            /* md name -> memo_entry_t */
+};
+
+md_reg_memo_t *md_reg_memo_make(apr_pool_t *p)
+{
+    md_reg_memo_t *memo = apr_pcalloc(p, sizeof(*memo));
+
+    memo->p = p;
+    memo->entries = apr_hash_make(p);
+    return memo;
+}
+
+void md_reg_set_memo(md_reg_t *reg, md_reg_memo_t *memo)
+{
+    reg->memo = memo;
+}
+
+static memo_entry_t *memo_entry_get(md_reg_memo_t *memo, const char *name)
+{
+    memo_entry_t *e;
+    apr_pool_t *ep;
+
+    e = apr_hash_get(memo->entries, name, APR_HASH_KEY_STRING);
+    if (!e) {
+        if (APR_SUCCESS != apr_pool_create(&ep, memo->p)) return NULL;
+        apr_pool_tag(ep, "md_reg_memo");
+        e = apr_pcalloc(ep, sizeof(*e));
+        e->p = ep;
+        e->name = apr_pstrdup(ep, name);
+        if (APR_SUCCESS != apr_pool_create(&e->vp, ep)) {
+            apr_pool_destroy(ep);
+            return NULL;
+        }
+        apr_hash_set(memo->entries, e->name, APR_HASH_KEY_STRING, e);
+    }
+    return e;
+}
+
+typedef struct {
+    apr_hash_t *keep;
+    apr_array_header_t *gone;
+} memo_retain_ctx;
+
+static int memo_collect_gone(void *baton, const void *key, apr_ssize_t klen, const void *val)
+{
+    memo_retain_ctx *ctx = baton;
+
+    if (!apr_hash_get(ctx->keep, key, klen)) {
+        APR_ARRAY_PUSH(ctx->gone, memo_entry_t*) = (memo_entry_t*)val;
+    }
+    return 1;
+}
+
+/* Forget all entries for MDs not in `mds`. */
+static void memo_retain(md_reg_memo_t *memo, apr_array_header_t *mds, apr_pool_t *p)
+{
+    memo_retain_ctx ctx;
+    memo_entry_t *e;
+    md_t *md;
+    int i;
+
+    ctx.keep = apr_hash_make(p);
+    ctx.gone = apr_array_make(p, 5, sizeof(memo_entry_t*));
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, md_t*);
+        apr_hash_set(ctx.keep, md->name, APR_HASH_KEY_STRING, md);
+    }
+    apr_hash_do(memo_collect_gone, &ctx, memo->entries);
+    for (i = 0; i < ctx.gone->nelts; ++i) {
+        e = APR_ARRAY_IDX(ctx.gone, i, memo_entry_t*);
+        apr_hash_set(memo->entries, e->name, APR_HASH_KEY_STRING, NULL);
+        apr_pool_destroy(e->p);
+    }
+}
+
+static const char *file_stamp(const char *fpath, apr_pool_t *p)
+{
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    memset(&finfo, 0, sizeof(finfo));
+    rv = apr_stat(&finfo, fpath, APR_FINFO_MTIME|APR_FINFO_SIZE|APR_FINFO_INODE, p);
+    if (APR_SUCCESS != rv && !APR_STATUS_IS_INCOMPLETE(rv)) {
+        return apr_psprintf(p, "%s:-", fpath);
+    }
+    return apr_psprintf(p, "%s:%" APR_UINT64_T_FMT ":%" APR_OFF_T_FMT ":%" APR_TIME_T_FMT,
+                        fpath, (apr_uint64_t)finfo.inode, finfo.size, finfo.mtime);
+}
+
+/* Describe the certificate and private key files of the MD, so that changes
+ * to them can be detected. */
+static const char *certs_stamp(md_reg_t *reg, const md_t *md, apr_pool_t *p)
+{
+    const char *stamp = "", *fpath, *kpath;
+    md_pkey_spec_t *spec;
+    int i;
+
+    for (i = 0; i < md_cert_count(md); ++i) {
+        if (md->cert_files && md->cert_files->nelts) {
+            fpath = APR_ARRAY_IDX(md->cert_files, i, const char *);
+            kpath = (md->pkey_files && i < md->pkey_files->nelts)?
+                     APR_ARRAY_IDX(md->pkey_files, i, const char *) : "?";
+        }
+        else {
+            spec = md_pkeys_spec_get(md->pks, i);
+            if (APR_SUCCESS != md_store_get_fname(&fpath, reg->store, MD_SG_DOMAINS, md->name,
+                                                  md_chain_filename(spec, p), p)) {
+                fpath = "?";
+            }
+            if (APR_SUCCESS != md_store_get_fname(&kpath, reg->store, MD_SG_DOMAINS, md->name,
+                                                  md_pkey_filename(spec, p), p)) {
+                kpath = "?";
+            }
+        }
+        stamp = apr_pstrcat(p, stamp, file_stamp(fpath, p), "\n",
+                            file_stamp(kpath, p), "\n", NULL);
+    }
+    return stamp;
+}
+
+/* Cached for certificates that are not there. */
+static const md_pubcert_t pubcert_missing;
+
+void md_reg_certs_changed(md_reg_t *reg, const char *name)
+{
+    apr_uint32_t *pgen;
+
+    apr_thread_mutex_lock(reg->certs_mutex);
+    if (!name) {
+        ++reg->certs_gen;
+    }
+    else if ((pgen = apr_hash_get(reg->certs_gens, name, APR_HASH_KEY_STRING))) {
+        ++(*pgen);
+    }
+    else {
+        pgen = apr_pcalloc(reg->p, sizeof(*pgen));
+        *pgen = 1;
+        apr_hash_set(reg->certs_gens, apr_pstrdup(reg->p, name), APR_HASH_KEY_STRING, pgen);
+    }
+    apr_thread_mutex_unlock(reg->certs_mutex);
+}
+
+apr_uint32_t md_reg_certs_gen(md_reg_t *reg, const char *name)
+{
+    apr_uint32_t *pgen, gen;
+
+    apr_thread_mutex_lock(reg->certs_mutex);
+    pgen = apr_hash_get(reg->certs_gens, name, APR_HASH_KEY_STRING);
+    /* both only ever go up, so does the sum */
+    gen = reg->certs_gen + (pgen? *pgen : 0);
+    apr_thread_mutex_unlock(reg->certs_mutex);
+    return gen;
+}
+
+static apr_status_t certs_pool_make(reg_certs_t *certs)
+{
+    apr_allocator_t *allocator;
+    apr_status_t rv;
+
+    /* Each record has its own allocator, so that the certificates of
+     * different MDs can be loaded on different threads. */
+    if (APR_SUCCESS != (rv = apr_allocator_create(&allocator))) return rv;
+    if (APR_SUCCESS != (rv = apr_pool_create_ex(&certs->p, certs->parent, NULL, allocator))) {
+        apr_allocator_destroy(allocator);
+        return rv;
+    }
+    apr_allocator_owner_set(allocator, certs->p);
+    apr_pool_tag(certs->p, "md_reg_certs");
+    return APR_SUCCESS;
+}
+
+static apr_status_t certs_reset(md_reg_t *reg, reg_certs_t *certs, const md_t *md, 
+                                apr_uint32_t gen)
+{
+    apr_pool_t *p = certs->p;
+    int memo = (certs->stamp != NULL);
+    apr_status_t rv;
+
+    /* pubcerts already handed out may still be in use */
+    if (APR_SUCCESS != (rv = certs_pool_make(certs))) return rv;
+    APR_ARRAY_PUSH(certs->retired, apr_pool_t*) = p;
+    certs->gen = gen;
+    certs->count = 0;
+    certs->pubcerts = NULL;
+    /* take the stamp before loading anything, a later change is then seen */
+    certs->stamp = memo? certs_stamp(reg, md, certs->p) : NULL;
+    return APR_SUCCESS;
+}
+
+/* Destroy the pools of earlier generations, no one is using them any more. */
+static void certs_retire(reg_certs_t *certs)
+{
+    int i;
+
+    for (i = 0; i < certs->retired->nelts; ++i) {
+        apr_pool_destroy(APR_ARRAY_IDX(certs->retired, i, apr_pool_t*));
+    }
+    apr_array_clear(certs->retired);
+}
+
+static reg_certs_t *reg_certs_get(md_reg_t *reg, const md_t *md, int i)
+{
+    reg_certs_t *certs;
+    const md_pubcert_t **pubcerts;
+    apr_uint32_t gen;
+    int count;
+
+    certs = apr_hash_get(reg->certs, md->name, APR_HASH_KEY_STRING);
+    if (reg->domains_frozen) {
+        /* no more changes to the store and nothing new to load */
+        return (certs && i < certs->count)? certs : NULL;
+    }
+    gen = md_reg_certs_gen(reg, md->name);
+    if (!certs) {
+        memo_entry_t *e = NULL;
+        apr_pool_t *parent = reg->p;
+
+        if (reg->memo && (e = memo_entry_get(reg->memo, md->name))) {
+            if (e->certs) {
+                /* Keep what the previous generation loaded, unless the
+                 * certificate files have changed since. The readers of
+                 * what it had before are gone with it. */
+                certs = e->certs;
+                certs_retire(certs);
+                if (strcmp(certs->stamp, certs_stamp(reg, md, reg->p))
+                    && APR_SUCCESS != certs_reset(reg, certs, md, gen)) {
+                    return NULL;
+                }
+                certs->gen = gen;
+                goto add;
+            }
+            parent = e->p;
+        }
+        certs = apr_pcalloc(parent, sizeof(*certs));
+        certs->parent = parent;
+        certs->retired = apr_array_make(parent, 2, sizeof(apr_pool_t*));
+        if (APR_SUCCESS != certs_pool_make(certs)) return NULL;
+        certs->gen = gen;
+        if (e) {
+            certs->stamp = certs_stamp(reg, md, certs->p);
+            e->certs = certs;
+        }
+add:
+        apr_hash_set(reg->certs, apr_pstrdup(reg->p, md->name), APR_HASH_KEY_STRING, certs);
+    }
+    if (certs->gen != gen) {
+        /* certificates may have changed, forget all we have */
+        if (APR_SUCCESS != certs_reset(reg, certs, md, gen)) return NULL;
+    }
+    if (i >= certs->count) {
+        count = md_cert_count(md);
+        if (count <= i) count = i + 1;
+        pubcerts = apr_pcalloc(certs->p, (apr_size_t)count * sizeof(*pubcerts));
+        if (certs->count > 0) {
+            memcpy(pubcerts, certs->pubcerts, (apr_size_t)certs->count * sizeof(*pubcerts));
+        }
+        certs->pubcerts = pubcerts;
+        certs->count = count;
+    }
+    return certs;
+}
+
 static apr_status_t pubcert_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
 {
     md_reg_t *reg = baton;
@@ -624,25 +947,35 @@ leave:
     return rv;
 }
 
+/* Load certificate `i` into `certs`, touching nothing else of the registry. */
+static apr_status_t reg_certs_load(md_reg_t *reg, reg_certs_t *certs, const md_t *md, int i)
+{
+    const md_pubcert_t *pubcert = NULL;
+    apr_status_t rv;
+
+    rv = md_util_pool_vdo(pubcert_load, reg, certs->p, &pubcert, MD_SG_DOMAINS, md, i, NULL);
+    if (APR_STATUS_IS_ENOENT(rv)) {
+        /* We cache it missing with an empty record */
+        pubcert = &pubcert_missing;
+        rv = APR_SUCCESS;
+    }
+    if (APR_SUCCESS == rv) certs->pubcerts[i] = pubcert;
+    return rv;
+}
+
 apr_status_t md_reg_get_pubcert(const md_pubcert_t **ppubcert, md_reg_t *reg, 
                                 const md_t *md, int i, apr_pool_t *p)
 {
     apr_status_t rv = APR_SUCCESS;
-    const md_pubcert_t *pubcert;
-    const char *name;
+    const md_pubcert_t *pubcert = NULL;
+    reg_certs_t *certs;
 
-    name = apr_psprintf(p, "%s[%d]", md->name, i);
-    pubcert = apr_hash_get(reg->certs, name, (apr_ssize_t)strlen(name));
-    if (!pubcert && !reg->domains_frozen) {
-        rv = md_util_pool_vdo(pubcert_load, reg, reg->p, &pubcert, MD_SG_DOMAINS, md, i, NULL);
-        if (APR_STATUS_IS_ENOENT(rv)) {
-            /* We cache it missing with an empty record */
-            pubcert = apr_pcalloc(reg->p, sizeof(*pubcert));
-        }
-        else if (APR_SUCCESS != rv) goto leave;
-        if (p != reg->p) name = apr_pstrdup(reg->p, name);
-        apr_hash_set(reg->certs, name, (apr_ssize_t)strlen(name), pubcert);
+    (void)p;
+    if (i < 0 || NULL == (certs = reg_certs_get(reg, md, i))) goto leave;
+    if (!certs->pubcerts[i] && !reg->domains_frozen) {
+        if (APR_SUCCESS != (rv = reg_certs_load(reg, certs, md, i))) goto leave;
     }
+    pubcert = certs->pubcerts[i];
 leave:
     if (APR_SUCCESS == rv && (!pubcert || !pubcert->certs)) {
         rv = APR_ENOENT;
@@ -651,6 +984,68 @@ leave:
     return rv;
 }
 
+typedef struct {
+    md_reg_t *reg;
+    const md_t **mds;
+    reg_certs_t **certs;
+    apr_status_t *rvs;
+} preload_ctx;
+
+static apr_status_t preload_md(void *baton, int i, apr_pool_t *p)
+{
+    preload_ctx *ctx = baton;
+    reg_certs_t *certs = ctx->certs[i];
+    apr_status_t rv = APR_SUCCESS;
+    int j;
+
+    (void)p;
+    for (j = 0; j < certs->count; ++j) {
+        if (!certs->pubcerts[j] && APR_SUCCESS != (rv = reg_certs_load(ctx->reg, certs,
+                                                                       ctx->mds[i], j))) {
+            break;
+        }
+    }
+    ctx->rvs[i] = rv;
+    return rv;
+}
+
+apr_status_t md_reg_preload_pubcerts(md_reg_t *reg, apr_array_header_t *mds,
+                                     int max_workers, apr_pool_t *p)
+{
+    preload_ctx ctx;
+    const md_t *md;
+    reg_certs_t *certs;
+    apr_status_t rv = APR_SUCCESS;
+    int i, n;
+
+    if (reg->domains_frozen) return APR_EACCES;
+    ctx.reg = reg;
+    ctx.mds = apr_pcalloc(p, (apr_size_t)(mds->nelts + 1) * sizeof(*ctx.mds));
+    ctx.certs = apr_pcalloc(p, (apr_size_t)(mds->nelts + 1) * sizeof(*ctx.certs));
+    ctx.rvs = apr_pcalloc(p, (apr_size_t)(mds->nelts + 1) * sizeof(*ctx.rvs));
+    /* Set up the cache records of all MDs here, so that the workers only
+     * ever modify the record they are loading. */
+    for (i = n = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, const md_t*);
+        if (md_cert_count(md) <= 0) continue;
+        certs = reg_certs_get(reg, md, md_cert_count(md) - 1);
+        if (!certs) continue;
+        ctx.mds[n] = md;
+        ctx.certs[n] = certs;
+        ++n;
+    }
+    md_util_parallel_do(preload_md, &ctx, n, max_workers, p);
+    /* report in the order of the MDs, whatever the order of loading was */
+    for (i = 0; i < n; ++i) {
+        if (APR_SUCCESS != ctx.rvs[i]) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, ctx.rvs[i], p,
+                          "md[%s]: loading certificates", ctx.mds[i]->name);
+            if (APR_SUCCESS == rv) rv = ctx.rvs[i];
+        }
+    }
+    return rv;
+}
+
 apr_status_t md_reg_get_cred_files(const char **pkeyfile, const char **pcertfile,
                                    md_reg_t *reg, md_store_group_t group, 
                                    const md_t *md, md_pkey_spec_t *spec, apr_pool_t *p)
@@ -789,68 +1184,190 @@ apr_status_t md_reg_set_props(md_reg_t *reg, apr_pool_t *p, int can_http, int ca
     return APR_SUCCESS;
 }
 
-static md_t *find_closest_match(apr_array_header_t *mds, const md_t *md)
-{
-    md_t *candidate, *m;
-    apr_size_t cand_n, n;
-    int i;
-    
-    candidate = md_get_by_name(mds, md->name);
-    if (!candidate) {
-        /* try to find an instance that contains all domain names from md */ 
-        for (i = 0; i < mds->nelts; ++i) {
-            m = APR_ARRAY_IDX(mds, i, md_t *);
-            if (md_contains_domains(m, md)) {
-                return m;
-            }
-        }
-        /* no matching name and no md in the list has all domains.
-         * We consider that managed domain as closest match that contains at least one
-         * domain name from md, ONLY if there is no other one that also has.
-         */
-        cand_n = 0;
-        for (i = 0; i < mds->nelts; ++i) {
-            m = APR_ARRAY_IDX(mds, i, md_t *);
-            n = md_common_name_count(md, m);
-            if (n > cand_n) {
-                candidate = m;
-                cand_n = n;
-            }
-        }
-    }
-    return candidate;
-}
+/* An MD directory found in the store, loaded on demand. */
+typedef struct {
+    const char *name;
+    int order;                  /* position in the store listing */
+    int assigned;               /* != 0 iff a configured MD uses it */
+    int loaded;                 /* != 0 iff loading was tried */
+    md_t *md;                   /* the MD in the store, NULL if not (yet) loaded */
+    apr_size_t hits;            /* domains in common with the MD being matched */
+    int last_domain;            /* index of the domain last counted in hits */
+} sync_entry_t;
 
 typedef struct {
+    md_reg_t *reg;
     apr_pool_t *p;
     apr_array_header_t *master_mds;
-    apr_array_header_t *store_names;
+    apr_array_header_t *store_entries;  /* sync_entry_t*, in listing order */
+    apr_hash_t *store_names;            /* name -> sync_entry_t* */
+    apr_hash_t *domains;                /* lower case domain -> array of sync_entry_t* */
     apr_array_header_t *maybe_new_mds;
     apr_array_header_t *new_mds;
-    apr_array_header_t *unassigned_mds;
+    int unassigned;
 } sync_ctx_v2;
 
 static int iter_add_name(void *baton, const char *dir, const char *name, 
                          md_store_vtype_t vtype, void *value, apr_pool_t *ptemp)
 {
     sync_ctx_v2 *ctx = baton;
+    sync_entry_t *entry;
     
     (void)dir;
     (void)value;
     (void)ptemp;
     (void)vtype;
-    APR_ARRAY_PUSH(ctx->store_names, const char*) = apr_pstrdup(ctx->p, name);
+    entry = apr_pcalloc(ctx->p, sizeof(*entry));
+    entry->name = apr_pstrdup(ctx->p, name);
+    entry->order = ctx->store_entries->nelts;
+    APR_ARRAY_PUSH(ctx->store_entries, sync_entry_t*) = entry;
+    apr_hash_set(ctx->store_names, entry->name, APR_HASH_KEY_STRING, entry);
     return APR_SUCCESS;
 }
 
+static md_t *sync_entry_get(sync_ctx_v2 *ctx, sync_entry_t *entry)
+{
+    if (!entry->loaded) {
+        entry->loaded = 1;
+        if (APR_SUCCESS != md_load(ctx->reg->store, MD_SG_DOMAINS, entry->name, 
+                                   &entry->md, ctx->p)) {
+            entry->md = NULL;
+        }
+    }
+    return entry->md;
+}
+
+static void sync_index_add(sync_ctx_v2 *ctx, const char *domain, sync_entry_t *entry)
+{
+    apr_array_header_t *entries;
+    char *key;
+
+    key = md_util_str_tolower(apr_pstrdup(ctx->p, domain));
+    entries = apr_hash_get(ctx->domains, key, APR_HASH_KEY_STRING);
+    if (!entries) {
+        entries = apr_array_make(ctx->p, 1, sizeof(sync_entry_t*));
+        apr_hash_set(ctx->domains, key, APR_HASH_KEY_STRING, entries);
+    }
+    APR_ARRAY_PUSH(entries, sync_entry_t*) = entry;
+}
+
+/* Load all unassigned store MDs not loaded yet and index them by domain. */
+static void sync_index_make(sync_ctx_v2 *ctx)
+{
+    apr_array_header_t *names, *loading, *datas;
+    sync_entry_t *entry;
+    md_data_t *data;
+    int i, j;
+
+    names = apr_array_make(ctx->p, ctx->unassigned, sizeof(const char*));
+    loading = apr_array_make(ctx->p, ctx->unassigned, sizeof(sync_entry_t*));
+    for (i = 0; i < ctx->store_entries->nelts; ++i) {
+        entry = APR_ARRAY_IDX(ctx->store_entries, i, sync_entry_t*);
+        if (entry->assigned || entry->loaded) continue;
+        entry->loaded = 1;
+        APR_ARRAY_PUSH(names, const char*) = entry->name;
+        APR_ARRAY_PUSH(loading, sync_entry_t*) = entry;
+    }
+    if (names->nelts > 0) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, ctx->p, 
+                      "sync MDs, loading %d unassigned store domains", (int)names->nelts);
+        md_store_load_data_all(&datas, ctx->reg->store, ctx->p, MD_SG_DOMAINS, 
+                               names, MD_FN_MD, MD_STORE_BULK_WORKERS);
+        for (i = 0; i < loading->nelts; ++i) {
+            data = APR_ARRAY_IDX(datas, i, md_data_t*);
+            if (data) md_from_data(&APR_ARRAY_IDX(loading, i, sync_entry_t*)->md, data, ctx->p);
+        }
+    }
+
+    ctx->domains = apr_hash_make(ctx->p);
+    for (i = 0; i < ctx->store_entries->nelts; ++i) {
+        entry = APR_ARRAY_IDX(ctx->store_entries, i, sync_entry_t*);
+        if (entry->assigned || !entry->md) continue;
+        for (j = 0; j < entry->md->domains->nelts; ++j) {
+            sync_index_add(ctx, APR_ARRAY_IDX(entry->md->domains, j, const char*), entry);
+        }
+    }
+}
+
+static void sync_count_hits(apr_array_header_t *entries, int domain_idx, 
+                            apr_array_header_t *touched)
+{
+    sync_entry_t *entry;
+    int i;
+
+    for (i = 0; entries && i < entries->nelts; ++i) {
+        entry = APR_ARRAY_IDX(entries, i, sync_entry_t*);
+        if (entry->assigned || entry->last_domain == domain_idx) continue;
+        if (!entry->hits) APR_ARRAY_PUSH(touched, sync_entry_t*) = entry;
+        entry->last_domain = domain_idx;
+        ++entry->hits;
+    }
+}
+
+/* Find the store MD that `md` most likely was known as before:
+ * - an unassigned store MD that contains all domains of `md`, or else
+ * - the one that has the most domains in common with `md`.
+ * The old name is usually one of the domains of `md`, which are tried
+ * first. Only when this fails are all unassigned store MDs loaded. 
+ */
+static sync_entry_t *sync_find_closest(sync_ctx_v2 *ctx, const md_t *md)
+{
+    sync_entry_t *entry, *complete = NULL, *candidate = NULL;
+    apr_array_header_t *touched;
+    const char *domain, *parent;
+    char *key;
+    md_t *m;
+    int i;
+    
+    for (i = 0; i < md->domains->nelts; ++i) {
+        domain = APR_ARRAY_IDX(md->domains, i, const char*);
+        entry = apr_hash_get(ctx->store_names, domain, APR_HASH_KEY_STRING);
+        if (entry && !entry->assigned && (m = sync_entry_get(ctx, entry)) 
+            && md_contains_domains(m, md)) {
+            return entry;
+        }
+    }
+    
+    if (!ctx->domains) sync_index_make(ctx);
+    /* count for each store MD how many domains of md it contains, 
+     * the same as md_common_name_count() does. */
+    touched = apr_array_make(ctx->p, 5, sizeof(sync_entry_t*));
+    for (i = 0; i < md->domains->nelts; ++i) {
+        domain = APR_ARRAY_IDX(md->domains, i, const char*);
+        key = md_util_str_tolower(apr_pstrdup(ctx->p, domain));
+        sync_count_hits(apr_hash_get(ctx->domains, key, APR_HASH_KEY_STRING), i + 1, touched);
+        if ((parent = strchr(key, '.'))) {
+            sync_count_hits(apr_hash_get(ctx->domains, apr_pstrcat(ctx->p, "*", parent, NULL),
+                                         APR_HASH_KEY_STRING), i + 1, touched);
+        }
+    }
+    /* first in store order that has all domains, else the first with most in common */
+    for (i = 0; i < touched->nelts; ++i) {
+        entry = APR_ARRAY_IDX(touched, i, sync_entry_t*);
+        if (entry->hits >= (apr_size_t)md->domains->nelts && md_contains_domains(entry->md, md)) {
+            if (!complete || entry->order < complete->order) complete = entry;
+        }
+        else if (!candidate || entry->hits > candidate->hits
+                 || (entry->hits == candidate->hits && entry->order < candidate->order)) {
+            candidate = entry;
+        }
+    }
+    for (i = 0; i < touched->nelts; ++i) {
+        entry = APR_ARRAY_IDX(touched, i, sync_entry_t*);
+        entry->hits = 0;
+        entry->last_domain = 0;
+    }
+    return complete? complete : candidate;
+}
+
 /* A better scaling version:
  *  1. The consistency of the MDs in 'master_mds' has already been verified. E.g.
  *     that no domain lists overlap etc.
  *  2. All MD storage that exists will be overwritten by the settings we have.
  *     And "exists" meaning that "store/MD_SG_DOMAINS/name" exists.
- *  3. For MDs that have no directory in "store/MD_SG_DOMAINS", we load all MDs
- *     outside the list of known names from MD_SG_DOMAINS. In this list, we
- *     look for the MD with the most domain overlap. 
+ *  3. For MDs that have no directory in "store/MD_SG_DOMAINS", we look among
+ *     the MDs outside the list of known names from MD_SG_DOMAINS for the MD 
+ *     with the most domain overlap. Those are loaded only when needed.
  *      - if we find it, we assume this is a rename and move the old MD to the new name.
  *      - if not, MD is completely new.
  *  4. Any MD in store that does not match the "master_mds" will just be left as is. 
@@ -858,19 +1375,21 @@ static int iter_add_name(void *baton, const char *dir, const char *name,
 apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, apr_pool_t *p) 
 {
     sync_ctx_v2 ctx;
+    sync_entry_t *entry;
     apr_status_t rv;
-    md_t *md, *oldmd;
-    const char *name;
-    int i, idx;
+    md_t *md;
+    int i;
     
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "sync MDs, start");
      
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.reg = reg;
     ctx.p = p;
     ctx.master_mds = master_mds;
-    ctx.store_names = apr_array_make(p, master_mds->nelts + 100, sizeof(const char*));
+    ctx.store_entries = apr_array_make(p, master_mds->nelts + 100, sizeof(sync_entry_t*));
+    ctx.store_names = apr_hash_make(p);
     ctx.maybe_new_mds = apr_array_make(p, master_mds->nelts, sizeof(md_t*));
     ctx.new_mds = apr_array_make(p, master_mds->nelts, sizeof(md_t*));
-    ctx.unassigned_mds = apr_array_make(p, master_mds->nelts, sizeof(md_t*));
     
     rv = md_store_iter_names(iter_add_name, &ctx, reg->store, p, MD_SG_DOMAINS, "*");
     if (APR_SUCCESS != rv) {
@@ -879,14 +1398,16 @@ apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, ap
     }
     
     /* Get all MDs that are not already present in store */
+    ctx.unassigned = ctx.store_entries->nelts;
     for (i = 0; i < ctx.master_mds->nelts; ++i) {
         md = APR_ARRAY_IDX(ctx.master_mds, i, md_t*);
-        idx = md_array_str_index(ctx.store_names, md->name, 0, 1);
-        if (idx < 0) {
+        entry = apr_hash_get(ctx.store_names, md->name, APR_HASH_KEY_STRING);
+        if (!entry) {
             APR_ARRAY_PUSH(ctx.maybe_new_mds, md_t*) = md;
         }
-        else {
-            md_array_remove_at(ctx.store_names, idx);
+        else if (!entry->assigned) {
+            entry->assigned = 1;
+            --ctx.unassigned;
         }
     }
     
@@ -894,7 +1415,7 @@ apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, ap
         /* none new */
         goto leave;
     }
-    if (ctx.store_names->nelts == 0) {
+    if (ctx.unassigned == 0) {
         /* all new */
         for (i = 0; i < ctx.maybe_new_mds->nelts; ++i) {
             md = APR_ARRAY_IDX(ctx.maybe_new_mds, i, md_t*);
@@ -906,31 +1427,23 @@ apr_status_t md_reg_sync_start(md_reg_t *reg, apr_array_header_t *master_mds, ap
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
                   "sync MDs, %d potentially new MDs detected, looking for renames among "
                   "the %d unassigned store domains", (int)ctx.maybe_new_mds->nelts,
-                  (int)ctx.store_names->nelts);
-    for (i = 0; i < ctx.store_names->nelts; ++i) {
-        name = APR_ARRAY_IDX(ctx.store_names, i, const char*);
-        if (APR_SUCCESS == md_load(reg->store, MD_SG_DOMAINS, name, &md, p)) {
-            APR_ARRAY_PUSH(ctx.unassigned_mds, md_t*) = md;
-        } 
-    }
-    
-    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
-                  "sync MDs, %d MDs maybe new, checking store", (int)ctx.maybe_new_mds->nelts);
+                  ctx.unassigned);
     for (i = 0; i < ctx.maybe_new_mds->nelts; ++i) {
         md = APR_ARRAY_IDX(ctx.maybe_new_mds, i, md_t*);
-        oldmd = find_closest_match(ctx.unassigned_mds, md);
-        if (oldmd) {
+        entry = ctx.unassigned? sync_find_closest(&ctx, md) : NULL;
+        if (entry) {
             /* found the rename, move the domains and possible staging directory */
             md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, 
-                          "sync MDs, found MD %s under previous name %s", md->name, oldmd->name);
-            rv = md_store_rename(reg->store, p, MD_SG_DOMAINS, oldmd->name, md->name);
+                          "sync MDs, found MD %s under previous name %s", md->name, entry->name);
+            rv = md_store_rename(reg->store, p, MD_SG_DOMAINS, entry->name, md->name);
             if (APR_SUCCESS != rv) {
                 md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p, 
-                              "sync MDs, renaming MD %s to %s failed", oldmd->name, md->name);
+                              "sync MDs, renaming MD %s to %s failed", entry->name, md->name);
                 /* ignore it? */
             }
-            md_store_rename(reg->store, p, MD_SG_STAGING, oldmd->name, md->name);
-            md_array_remove(ctx.unassigned_mds, oldmd);
+            md_store_rename(reg->store, p, MD_SG_STAGING, entry->name, md->name);
+            entry->assigned = 1;
+            --ctx.unassigned;
         }
         else {
             APR_ARRAY_PUSH(ctx.new_mds, md_t*) = md;
@@ -946,6 +1459,66 @@ leave:
     return rv;
 }
 
+/* Digest of the MD as configured, with all that its sync depends on. */
+static const char *md_fingerprint(md_reg_t *reg, const md_t *md, apr_pool_t *p)
+{
+    md_json_t *json;
+    md_data_t data;
+    const char *text, *digest;
+
+    json = md_to_json(md, p);
+    md_json_del(json, MD_KEY_STATE, NULL);
+    md_json_del(json, MD_KEY_STATE_DESCR, NULL);
+    text = apr_pstrcat(p, md_json_writep(json, p, MD_JSON_FMT_COMPACT),
+                       md_timeslice_format(reg->renew_window, p),
+                       md_timeslice_format(reg->warn_window, p), NULL);
+    md_data_init_str(&data, text);
+    if (APR_SUCCESS != md_crypt_sha256_digest_hex(&digest, p, &data)) return NULL;
+    return digest;
+}
+
+/* Describe the store files of the MD, so that changes to them can be detected. */
+static const char *store_stamp(md_reg_t *reg, const md_t *md, apr_pool_t *p)
+{
+    const char *fpath;
+
+    if (APR_SUCCESS != md_store_get_fname(&fpath, reg->store, MD_SG_DOMAINS, md->name,
+                                          MD_FN_MD, p)) {
+        fpath = "?";
+    }
+    return apr_pstrcat(p, file_stamp(fpath, p), "\n", certs_stamp(reg, md, p), NULL);
+}
+
+static void memo_save(memo_entry_t *e, md_reg_t *reg, const md_t *md, const char *fingerprint)
+{
+    apr_pool_t *p = e->vp;
+
+    apr_pool_clear(p);
+    e->fingerprint = apr_pstrdup(p, fingerprint);
+    e->stamp = store_stamp(reg, md, p);
+    e->state = md->state;
+    e->state_descr = md->state_descr? apr_pstrdup(p, md->state_descr) : NULL;
+    e->renew_mode = md->renew_mode;
+    e->contacts = md->contacts? md_array_str_clone(p, md->contacts) : NULL;
+    e->ca_challenges = md->ca_challenges? md_array_str_clone(p, md->ca_challenges) : NULL;
+    e->ca_effective = md->ca_effective? apr_pstrdup(p, md->ca_effective) : NULL;
+    e->ca_account = md->ca_account? apr_pstrdup(p, md->ca_account) : NULL;
+}
+
+/* Give the MD the state it had after the sync in the previous generation. */
+static void memo_restore(memo_entry_t *e, md_reg_t *reg, md_t *md, apr_pool_t *p)
+{
+    if (md->renew_window == NULL) md->renew_window = reg->renew_window;
+    if (md->warn_window == NULL) md->warn_window = reg->warn_window;
+    md->state = e->state;
+    md->state_descr = e->state_descr? apr_pstrdup(p, e->state_descr) : NULL;
+    md->renew_mode = e->renew_mode;
+    if (e->contacts) md->contacts = md_array_str_clone(p, e->contacts);
+    if (e->ca_challenges) md->ca_challenges = md_array_str_clone(p, e->ca_challenges);
+    if (e->ca_effective) md->ca_effective = apr_pstrdup(p, e->ca_effective);
+    if (e->ca_account) md->ca_account = apr_pstrdup(p, e->ca_account);
+}
+
 /** 
  * Finish syncing an MD with the store. 
  * 1. if there are changed properties (or if the MD is new), save it.
@@ -957,6 +1530,8 @@ apr_status_t md_reg_sync_finish(md_reg_t *reg, md_t *md, apr_pool_t *p, apr_pool
     apr_status_t rv;
     int changed = 1;
     md_proto_t *proto;
+    memo_entry_t *e = NULL;
+    const char *fingerprint = NULL;
     
     if (!md->ca_proto) {
         md->ca_proto = MD_PROTO_ACME;
@@ -972,6 +1547,17 @@ apr_status_t md_reg_sync_finish(md_reg_t *reg, md_t *md, apr_pool_t *p, apr_pool
     rv = proto->complete_md(md, p);
     if (APR_SUCCESS != rv) goto leave;
 
+    if (reg->memo && (fingerprint = md_fingerprint(reg, md, ptemp))
+        && (e = memo_entry_get(reg->memo, md->name))
+        && e->fingerprint && !strcmp(fingerprint, e->fingerprint)
+        && !strcmp(e->stamp, store_stamp(reg, md, ptemp))) {
+        /* neither configuration nor store changed since the last generation */
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp,
+                      "md{%s}: unchanged, reusing previous state", md->name);
+        memo_restore(e, reg, md, p);
+        goto leave;
+    }
+
     rv = state_init(reg, p, md);
     if (APR_SUCCESS != rv) goto leave;
     
@@ -1022,6 +1608,7 @@ apr_status_t md_reg_sync_finish(md_reg_t *reg, md_t *md, apr_pool_t *p, apr_pool
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "saving md %s", md->name);
         rv = md_save(reg->store, ptemp, MD_SG_DOMAINS, md, 0);
     }
+    if (APR_SUCCESS == rv && e) memo_save(e, reg, md, fingerprint);
 leave:
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "sync MDs, finish done");
     return rv;
@@ -1287,7 +1874,7 @@ static apr_status_t run_load_staging(void *baton, apr_pool_t *p, apr_pool_t *pte
     rv = run_init(baton, ptemp, &driver, md, 1, env, result, NULL);
     if (APR_SUCCESS != rv) goto out;
     
-    apr_hash_set(reg->certs, md->name, (apr_ssize_t)strlen(md->name), NULL);
+    md_reg_certs_changed(reg, md->name);
     md_result_activity_setn(result, "preloading staged to tmp");
     rv = driver->proto->preload(driver, MD_SG_TMP, result);
     if (APR_SUCCESS != rv) goto out;
@@ -1387,10 +1974,16 @@ apr_status_t md_reg_freeze_domains(md_reg_t *reg, apr_array_header_t *mds)
     for (i = 0; i < mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mds, i, md_t*);
         for (j = 0; j < md_cert_count(md); ++j) {
-            rv = md_reg_get_pubcert(&pubcert, reg, md, i, reg->p);
+            rv = md_reg_get_pubcert(&pubcert, reg, md, j, reg->p);
             if (APR_SUCCESS != rv && !APR_STATUS_IS_ENOENT(rv)) goto leave;
         }
     }
+    /* domains no longer change, index them for request time lookups */
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, md_t*);
+        md->domain_set = md_dns_set_of(reg->p, md->domains);
+    }
+    if (reg->memo) memo_retain(reg->memo, mds, reg->p);
     reg->domains_frozen = 1;
 leave:
     return rv;
@@ -1411,6 +2004,11 @@ md_job_t *md_reg_job_make(md_reg_t *reg, const char *mdomain, apr_pool_t *p)
     return md_job_make(p, reg->store, MD_SG_STAGING, mdomain, reg->min_delay);
 }
 
+md_job_reg_t *md_reg_job_reg_make(md_reg_t *reg, apr_pool_t *p)
+{
+    return md_job_reg_make(p, reg->store, MD_SG_STAGING, reg->min_delay);
+}
+
 static int get_cert_count(const md_t *md)
 {
     if (md->cert_files && md->cert_files->nelts) {
@@ -52,6 +52,23 @@ apr_status_t md_reg_create(md_reg_t **preg, apr_pool_t *pm, md_store_t *store,
 
 md_store_t *md_reg_store_get(md_reg_t *reg);
 
+/**
+ * State of MDs carried from one registry to the next, e.g. across server restarts.
+ * An MD whose configuration and files in the store did not change since it was
+ * last synced reuses its state and loaded certificates instead of checking again.
+ */
+typedef struct md_reg_memo_t md_reg_memo_t;
+
+/**
+ * Create an empty memo in `p`, which needs to outlive all registries using it.
+ */
+md_reg_memo_t *md_reg_memo_make(apr_pool_t *p);
+
+/**
+ * Have the registry use and update `memo`. Only one registry may use it at a time.
+ */
+void md_reg_set_memo(md_reg_t *reg, md_reg_memo_t *memo);
+
 apr_status_t md_reg_set_props(md_reg_t *reg, apr_pool_t *p, int can_http, int can_https);
 
 /**
@@ -84,6 +101,12 @@ md_t *md_reg_get(md_reg_t *reg, const char *name, apr_pool_t *p);
  */
 typedef int md_reg_do_cb(void *baton, md_reg_t *reg, md_t *md);
 
+/**
+ * Get all mds of the registry, loaded from the store in one go on up to
+ * MD_STORE_BULK_WORKERS threads. Will update the md->state of each.
+ */
+apr_status_t md_reg_get_all(apr_array_header_t **pmds, md_reg_t *reg, apr_pool_t *p);
+
 /**
  * Invoke callback for all mds in this registry. Order is not guaranteed.
  * If the callback returns 0, iteration stops. Returns 0 if iteration was
@@ -123,10 +146,26 @@ apr_status_t md_reg_update(md_reg_t *reg, apr_pool_t *p,
 /**
  * Get the chain of public certificates of the managed domain md, starting with the cert
  * of the domain and going up the issuers. Returns APR_ENOENT when not available. 
+ * The chain is cached in the registry. It stays valid when md_reg_certs_changed()
+ * makes the registry load a new chain, for as long as the registry lives.
  */
 apr_status_t md_reg_get_pubcert(const md_pubcert_t **ppubcert, md_reg_t *reg, 
                                 const md_t *md, int i, apr_pool_t *p);
 
+/**
+ * Announce that certificates of the MD `name`, or of all MDs with a NULL name,
+ * in the store may have changed. Pubcerts cached by the registry for them are 
+ * loaded again on next use, unless the domains are frozen. Pubcerts handed out
+ * before remain valid.
+ */
+void md_reg_certs_changed(md_reg_t *reg, const char *name);
+
+/**
+ * @return the current certificate generation of the MD `name`, changed by 
+ *         md_reg_certs_changed()
+ */
+apr_uint32_t md_reg_certs_gen(md_reg_t *reg, const char *name);
+
 /**
  * Get the filenames of private key and pubcert of the MD - if they exist.
  * @return APR_ENOENT if one or both do not exist.
@@ -165,6 +204,14 @@ apr_status_t md_reg_delete_acct(md_reg_t *reg, apr_pool_t *p, const char *acct_i
 apr_status_t md_reg_cleanup_challenges(md_reg_t *reg, apr_pool_t *p, apr_pool_t *ptemp, 
                                        apr_array_header_t *mds);
 
+/**
+ * Load the public certificates of all given MDs into the registry cache, on up to
+ * `max_workers` threads. Certificates already cached are not loaded again.
+ * @return APR_SUCCESS or the first error encountered, in the order of `mds`
+ */
+apr_status_t md_reg_preload_pubcerts(md_reg_t *reg, apr_array_header_t *mds,
+                                     int max_workers, apr_pool_t *p);
+
 /**
  * Mark all information from group MD_SG_DOMAINS as readonly, deny future modifications 
  * (MD_SG_STAGING and MD_SG_CHALLENGES remain writeable). For the given MDs, cache
@@ -306,6 +353,11 @@ void md_reg_set_warn_window_default(md_reg_t *reg, md_timeslice_t *warn_window);
 
 struct md_job_t *md_reg_job_make(md_reg_t *reg, const char *mdomain, apr_pool_t *p);
 
+/**
+ * Make a registry for the jobs driving MDs in STAGING, see md_job_reg_make().
+ */
+struct md_job_reg_t *md_reg_job_reg_make(md_reg_t *reg, apr_pool_t *p);
+
 /**
  * Acquire a cooperative, global lock on registry modifications. Will
  * do nothing if locking is not configured.
@@ -18,10 +18,13 @@
 #include <stdlib.h>
 
 #include <apr_lib.h>
+#include <apr_atomic.h>
+#include <apr_hash.h>
 #include <apr_strings.h>
 #include <apr_tables.h>
 #include <apr_time.h>
 #include <apr_date.h>
+#include <apr_thread_mutex.h>
 
 #include "md_json.h"
 #include "md.h"
@@ -53,17 +56,16 @@ static apr_status_t status_get_cert_json(md_json_t **pjson, const md_cert_t *cer
     json = md_json_create(p);
     issuer_name = md_cert_get_issuer_name(cert, p);
     if (issuer_name)
-      md_json_sets(issuer_name, json, MD_KEY_ISSUER_NAME, NULL);
+      md_json_psets(issuer_name, json, &MD_P_ISSUER_NAME);
     rv = md_cert_get_issuers_uri(&issuer_uri, cert, p);
     if (rv == APR_SUCCESS && issuer_uri)
-        md_json_sets(issuer_uri, json, MD_KEY_ISSUER_URI, NULL);
+        md_json_psets(issuer_uri, json, &MD_P_ISSUER_URI);
     valid.start = md_cert_get_not_before(cert);
     valid.end = md_cert_get_not_after(cert);
     md_json_set_timeperiod(&valid, json, MD_KEY_VALID, NULL);
-    md_json_sets(md_cert_get_serial_number(cert, p), json, MD_KEY_SERIAL, NULL);
-    md_json_sets(md_cert_get_serial_number(cert, p), json, MD_KEY_SERIAL, NULL);
+    md_json_psets(md_cert_get_serial_number(cert, p), json, &MD_P_SERIAL);
     if (APR_SUCCESS != (rv = md_cert_to_sha256_fingerprint(&finger, cert, p))) goto leave;
-    md_json_sets(finger, json, MD_KEY_SHA256_FINGERPRINT, NULL);
+    md_json_psets(finger, json, &MD_P_SHA256_FINGERPRINT);
 
 #if MD_STATUS_WITH_SCTS
     do {
@@ -97,15 +99,11 @@ leave:
     return rv;
 }
 
-static int md_job_json_seems_valid(md_json_t *json, md_store_t *store,
-                                   md_store_group_t group, const char *name,
-                                   apr_pool_t *p)
+static int md_job_seems_valid(int finished, int notified_renewed, md_store_t *store,
+                              md_store_group_t group, const char *name,
+                              apr_pool_t *p)
 {
-
-    if (!json) return FALSE;
-    if ((group == MD_SG_STAGING) &&
-        md_json_getb(json, MD_KEY_FINISHED, NULL) &&
-        md_json_getb(json, MD_KEY_NOTIFIED_RENEWED, NULL)) {
+    if ((group == MD_SG_STAGING) && finished && notified_renewed) {
         md_t *md;
         /* A finished job in the staging area needs to have produced results */
         if(!md_exists(store, group, name, p)) return FALSE;
@@ -122,6 +120,16 @@ static int md_job_json_seems_valid(md_json_t *json, md_store_t *store,
     return TRUE;
 }
 
+static int md_job_json_seems_valid(md_json_t *json, md_store_t *store,
+                                   md_store_group_t group, const char *name,
+                                   apr_pool_t *p)
+{
+    if (!json) return FALSE;
+    return md_job_seems_valid(md_json_getb(json, MD_KEY_FINISHED, NULL),
+                              md_json_getb(json, MD_KEY_NOTIFIED_RENEWED, NULL),
+                              store, group, name, p);
+}
+
 static apr_status_t job_loadj(md_json_t **pjson, md_store_group_t group, const char *name,
                               struct md_reg_t *reg, int with_log, apr_pool_t *p)
 {
@@ -248,9 +256,15 @@ static apr_status_t get_staging_certs_json(md_json_t **pjson, const md_t *md,
     return status_get_certs_json(pjson, certs, 1, md, reg, NULL, 0, p);
 }
 
+/* Parts of an MD status that need more than the MD itself */
+#define STATUS_PART_CERT        0x01
+#define STATUS_PART_RENEW_AT    0x02
+#define STATUS_PART_RENEWAL     0x04
+#define STATUS_PART_ALL         0x07
+
 static apr_status_t status_get_md_json(md_json_t **pjson, const md_t *md, 
                                        md_reg_t *reg, md_ocsp_reg_t *ocsp, 
-                                       int with_logs, apr_pool_t *p)
+                                       int with_logs, int parts, apr_pool_t *p)
 {
     md_json_t *mdj, *certsj, *jobj = NULL;
     int renew;
@@ -262,27 +276,32 @@ static apr_status_t status_get_md_json(md_json_t **pjson, const md_t *md,
     int i;
 
     mdj = md_to_public_json(md, p);
-    certs = apr_array_make(p, 5, sizeof(md_cert_t*));
-    for (i = 0; i < get_cert_count(md, 0); ++i) {
-        cert = NULL;
-        if (APR_SUCCESS == md_reg_get_pubcert(&pubcert, reg, md, i, p)) {
-            cert = APR_ARRAY_IDX(pubcert->certs, 0, const md_cert_t*);
+    if (parts & STATUS_PART_CERT) {
+        certs = apr_array_make(p, 5, sizeof(md_cert_t*));
+        for (i = 0; i < get_cert_count(md, 0); ++i) {
+            cert = NULL;
+            if (APR_SUCCESS == md_reg_get_pubcert(&pubcert, reg, md, i, p)) {
+                cert = APR_ARRAY_IDX(pubcert->certs, 0, const md_cert_t*);
+            }
+            APR_ARRAY_PUSH(certs, const md_cert_t*) = cert;
         }
-        APR_ARRAY_PUSH(certs, const md_cert_t*) = cert;
+        
+        rv = status_get_certs_json(&certsj, certs, 0, md, reg, ocsp, with_logs, p);
+        if (APR_SUCCESS != rv) goto leave;
+        md_json_psetj(certsj, mdj, &MD_P_CERT);
     }
     
-    rv = status_get_certs_json(&certsj, certs, 0, md, reg, ocsp, with_logs, p);
-    if (APR_SUCCESS != rv) goto leave;
-    md_json_setj(certsj, mdj, MD_KEY_CERT, NULL);
-    
-    renew_at = md_reg_renew_at(reg, md, p);
-    if (renew_at > 0) {
-        md_json_set_time(renew_at, mdj, MD_KEY_RENEW_AT, NULL);
+    if (parts & STATUS_PART_RENEW_AT) {
+        renew_at = md_reg_renew_at(reg, md, p);
+        if (renew_at > 0) {
+            md_json_set_time(renew_at, mdj, MD_KEY_RENEW_AT, NULL);
+        }
     }
     
-    md_json_setb(md->stapling, mdj, MD_KEY_STAPLING, NULL);
-    md_json_setb(md->watched, mdj, MD_KEY_WATCHED, NULL);
+    md_json_psetb(md->stapling, mdj, &MD_P_STAPLING);
+    md_json_psetb(md->watched, mdj, &MD_P_WATCHED);
 
+    if (!(parts & STATUS_PART_RENEWAL)) goto leave;
     renew = FALSE;
     rv = job_loadj(&jobj, MD_SG_STAGING, md->name, reg, with_logs, p);
     if (rv == APR_SUCCESS)
@@ -295,18 +314,18 @@ static apr_status_t status_get_md_json(md_json_t **pjson, const md_t *md,
         goto leave;
 
     if (renew) {
-        md_json_setb(renew, mdj, MD_KEY_RENEW, NULL);
+        md_json_psetb(renew, mdj, &MD_P_RENEW);
         if (jobj) {
             if (APR_SUCCESS == get_staging_certs_json(&certsj, md, reg, p)) {
-                md_json_setj(certsj, jobj, MD_KEY_CERT, NULL);
+                md_json_psetj(certsj, jobj, &MD_P_CERT);
             }
-            md_json_setj(jobj, mdj, MD_KEY_RENEWAL, NULL);
+            md_json_psetj(jobj, mdj, &MD_P_RENEWAL);
         }
     }
 
 leave:
     if (APR_SUCCESS != rv) {
-        md_json_setl(rv, mdj, MD_KEY_ERROR, NULL);
+        md_json_psetl(rv, mdj, &MD_P_ERROR);
     }
     *pjson = mdj;
     return rv;
@@ -315,27 +334,377 @@ leave:
 apr_status_t md_status_get_md_json(md_json_t **pjson, const md_t *md, 
                                    md_reg_t *reg, md_ocsp_reg_t *ocsp, apr_pool_t *p)
 {
-    return status_get_md_json(pjson, md, reg, ocsp, 1, p);
+    return status_get_md_json(pjson, md, reg, ocsp, 1, STATUS_PART_ALL, p);
+}
+
+static void md_job_from_json(md_job_t *job, md_json_t *json, apr_pool_t *p);
+
+int md_status_classify(const md_t *md, const md_job_t *job, md_reg_t *reg, apr_pool_t *p)
+{
+    int states = 0;
+
+    switch (md->state) {
+        case MD_S_COMPLETE: states |= MD_STATUS_COMPLETE; /* fall through */
+        case MD_S_INCOMPLETE:
+            if (md_reg_should_renew(reg, md, p)) states |= MD_STATUS_RENEWING;
+            break;
+        default: states |= MD_STATUS_ERRORED; break;
+    }
+    if (job && (states & MD_STATUS_RENEWING)) {
+        if (job->error_runs > 0 
+            || (job->last_result && job->last_result->status != APR_SUCCESS)) {
+            states |= MD_STATUS_ERRORED;
+        }
+        else if (job->finished) {
+            states |= MD_STATUS_READY;
+        }
+    }
+    return states;
+}
+
+static int status_states(const md_t *md, md_reg_t *reg, int wanted, apr_pool_t *p)
+{
+    md_store_t *store;
+    md_json_t *jprops;
+    md_job_t *job;
+    int states;
+
+    states = md_status_classify(md, NULL, reg, p);
+    /* the job of a renewing MD is only loaded when it decides the match */
+    if ((states & MD_STATUS_RENEWING) && !(states & wanted)
+        && (wanted & (MD_STATUS_ERRORED|MD_STATUS_READY))) {
+        store = md_reg_store_get(reg);
+        if (APR_SUCCESS == md_store_load_json(store, MD_SG_STAGING, md->name, 
+                                              MD_FN_JOB, &jprops, p)
+            && md_job_json_seems_valid(jprops, store, MD_SG_STAGING, md->name, p)) {
+            job = md_reg_job_make(reg, md->name, p);
+            md_job_from_json(job, jprops, p);
+            states = md_status_classify(md, job, reg, p);
+        }
+    }
+    return states;
+}
+
+static int query_matches(const md_status_query_t *query, const md_t *md, 
+                         md_reg_t *reg, apr_pool_t *p)
+{
+    if (!query) return 1;
+    if (query->prefix && strncmp(md->name, query->prefix, strlen(query->prefix))) return 0;
+    if (query->states && !(status_states(md, reg, query->states, p) & query->states)) return 0;
+    return 1;
+}
+
+static int query_wants(const md_status_query_t *query, const char *key)
+{
+    int i;
+
+    if (!query || !query->fields) return 1;
+    for (i = 0; i < query->fields->nelts; ++i) {
+        if (!strcmp(key, APR_ARRAY_IDX(query->fields, i, const char*))) return 1;
+    }
+    return 0;
+}
+
+static int query_parts(const md_status_query_t *query)
+{
+    int parts = 0;
+
+    if (query_wants(query, MD_KEY_CERT)) parts |= STATUS_PART_CERT;
+    if (query_wants(query, MD_KEY_RENEW_AT)) parts |= STATUS_PART_RENEW_AT;
+    if (query_wants(query, MD_KEY_RENEW) || query_wants(query, MD_KEY_RENEWAL)) {
+        parts |= STATUS_PART_RENEWAL;
+    }
+    return parts;
+}
+
+typedef struct {
+    const md_status_query_t *query;
+    apr_array_header_t *unwanted;
+} query_select_ctx;
+
+static int collect_unwanted(void *baton, const char *key, md_json_t *json)
+{
+    query_select_ctx *ctx = baton;
+
+    (void)json;
+    if (!query_wants(ctx->query, key)) {
+        APR_ARRAY_PUSH(ctx->unwanted, const char*) = apr_pstrdup(ctx->unwanted->pool, key);
+    }
+    return 1;
+}
+
+static void query_select(md_json_t *mdj, const md_status_query_t *query, apr_pool_t *p)
+{
+    query_select_ctx ctx;
+    int i;
+
+    if (!query || !query->fields) return;
+    ctx.query = query;
+    ctx.unwanted = apr_array_make(p, 20, sizeof(const char*));
+    md_json_iterkey(collect_unwanted, &ctx, mdj, NULL);
+    for (i = 0; i < ctx.unwanted->nelts; ++i) {
+        md_json_del(mdj, APR_ARRAY_IDX(ctx.unwanted, i, const char*), NULL);
+    }
+}
+
+/* Get the status of the next MD selected by the query, starting at *pindex.
+ * *pskip counts down the offset. Returns NULL when there is none. */
+static md_json_t *query_next(int *pindex, int *pskip, apr_array_header_t *mds,
+                             md_reg_t *reg, md_ocsp_reg_t *ocsp, 
+                             const md_status_query_t *query, apr_pool_t *p)
+{
+    md_json_t *mdj;
+    const md_t *md;
+
+    while (*pindex < mds->nelts) {
+        md = APR_ARRAY_IDX(mds, (*pindex)++, const md_t *);
+        if (!query_matches(query, md, reg, p)) continue;
+        if (*pskip > 0) {
+            --(*pskip);
+            continue;
+        }
+        status_get_md_json(&mdj, md, reg, ocsp, 0, query_parts(query), p);
+        query_select(mdj, query, p);
+        return mdj;
+    }
+    return NULL;
 }
 
 apr_status_t md_status_get_json(md_json_t **pjson, apr_array_header_t *mds, 
-                                md_reg_t *reg, md_ocsp_reg_t *ocsp, apr_pool_t *p) 
+                                md_reg_t *reg, md_ocsp_reg_t *ocsp, 
+                                const md_status_query_t *query, apr_pool_t *p) 
 {
     md_json_t *json, *mdj;
-    const md_t *md;
-    int i;
+    int i = 0, n = 0, skip = query? query->offset : 0;
     
     json = md_json_create(p);
     md_json_sets(MOD_MD_VERSION, json, MD_KEY_VERSION, NULL);
-    for (i = 0; i < mds->nelts; ++i) {
-        md = APR_ARRAY_IDX(mds, i, const md_t *);
-        status_get_md_json(&mdj, md, reg, ocsp, 0, p);
+    while ((!query || query->limit < 0 || n < query->limit)
+           && (mdj = query_next(&i, &skip, mds, reg, ocsp, query, p))) {
         md_json_addj(mdj, json, MD_KEY_MDS, NULL);
+        ++n;
     }
     *pjson = json;
     return APR_SUCCESS;
 }
 
+apr_status_t md_status_stream_json(struct md_json_stream_t *stream, apr_array_header_t *mds, 
+                                   md_reg_t *reg, md_ocsp_reg_t *ocsp, 
+                                   const md_status_query_t *query, apr_pool_t *p)
+{
+    md_json_t *mdj;
+    apr_pool_t *ptemp;
+    apr_status_t rv;
+    int i = 0, n = 0, skip = query? query->offset : 0;
+
+    md_json_stream_open_obj(stream, NULL);
+    rv = md_json_stream_puts(stream, MD_KEY_VERSION, MOD_MD_VERSION);
+    if (APR_SUCCESS != rv) goto leave;
+
+    rv = apr_pool_create(&ptemp, p);
+    if (APR_SUCCESS != rv) goto leave;
+    while (APR_SUCCESS == rv && (!query || query->limit < 0 || n < query->limit)
+           && (mdj = query_next(&i, &skip, mds, reg, ocsp, query, ptemp))) {
+        /* like md_status_get_json(), no array without MDs */
+        if (n++ == 0) md_json_stream_open_arr(stream, MD_KEY_MDS);
+        rv = md_json_stream_putj(stream, NULL, mdj);
+        apr_pool_clear(ptemp);
+    }
+    apr_pool_destroy(ptemp);
+leave:
+    return md_json_stream_end(stream);
+}
+
+/**************************************************************************************************/
+/* job log */
+
+/* The log of a job is a ring of records, the oldest one is replaced when it is full.
+ * The strings of the records live in a subpool that is renewed, with the records
+ * still in the ring copied over, each time the ring has turned once. In the store,
+ * it is kept as before: MD_KEY_ENTRIES objects with the latest first. */
+
+typedef struct {
+    apr_time_t when;
+    const char *type;           /* NULL if not given */
+    const char *status;         /* NULL if not given */
+    const char *detail;         /* NULL if not given */
+} job_log_rec_t;
+
+typedef struct md_job_log_t {
+    job_log_rec_t *recs;
+    int capacity;
+    int head;                   /* slot of the next record */
+    int count;
+    int added;                  /* records added to strings_p */
+    apr_hash_t *latest;         /* type -> int* slot of its latest record, or -1 */
+    int latest_untyped;         /* slot of the latest record without type, or -1 */
+    apr_pool_t *p;
+    apr_pool_t *strings_p;      /* holds the strings of the records */
+} md_job_log_t;
+
+static void job_log_clear(md_job_log_t *log)
+{
+    apr_hash_index_t *hi;
+    void *val;
+
+    memset(log->recs, 0, (apr_size_t)log->capacity * sizeof(job_log_rec_t));
+    for (hi = apr_hash_first(NULL, log->latest); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, &val);
+        *(int*)val = -1;
+    }
+    log->latest_untyped = -1;
+    log->head = log->count = log->added = 0;
+    apr_pool_clear(log->strings_p);
+}
+
+static md_job_log_t *job_log_make(apr_pool_t *p, int capacity)
+{
+    md_job_log_t *log;
+
+    log = apr_pcalloc(p, sizeof(*log));
+    log->p = p;
+    log->capacity = (capacity > 0)? capacity : 1;
+    log->recs = apr_pcalloc(p, (apr_size_t)log->capacity * sizeof(job_log_rec_t));
+    log->latest = apr_hash_make(p);
+    log->latest_untyped = -1;
+    apr_pool_create(&log->strings_p, p);
+    apr_pool_tag(log->strings_p, "md_job_log");
+    return log;
+}
+
+/* Copy the strings of the records in the ring to a new subpool and drop the
+ * old one, with the strings of all replaced records. */
+static void job_log_renew_strings(md_job_log_t *log)
+{
+    apr_pool_t *strings_p;
+    job_log_rec_t *rec;
+    int i;
+
+    if (APR_SUCCESS != apr_pool_create(&strings_p, log->p)) return;
+    apr_pool_tag(strings_p, "md_job_log");
+    for (i = 0; i < log->capacity; ++i) {
+        rec = &log->recs[i];
+        if (rec->type) rec->type = apr_pstrdup(strings_p, rec->type);
+        if (rec->status) rec->status = apr_pstrdup(strings_p, rec->status);
+        if (rec->detail) rec->detail = apr_pstrdup(strings_p, rec->detail);
+    }
+    apr_pool_destroy(log->strings_p);
+    log->strings_p = strings_p;
+    log->added = 0;
+}
+
+static int *job_log_slot_of(md_job_log_t *log, const char *type)
+{
+    return type? apr_hash_get(log->latest, type, APR_HASH_KEY_STRING) : &log->latest_untyped;
+}
+
+static void job_log_add(md_job_log_t *log, apr_time_t when, const char *type, 
+                        const char *status, const char *detail)
+{
+    job_log_rec_t *rec = &log->recs[log->head];
+    int *pslot;
+
+    if (log->added >= log->capacity) job_log_renew_strings(log);
+    if (log->count == log->capacity) {
+        /* replacing the oldest record, its type has no record left if this was its latest */
+        pslot = job_log_slot_of(log, rec->type);
+        if (pslot && *pslot == log->head) *pslot = -1;
+    }
+    rec->when = when;
+    rec->type = type? apr_pstrdup(log->strings_p, type) : NULL;
+    rec->status = status? apr_pstrdup(log->strings_p, status) : NULL;
+    rec->detail = detail? apr_pstrdup(log->strings_p, detail) : NULL;
+    ++log->added;
+
+    pslot = job_log_slot_of(log, type);
+    if (!pslot) {
+        pslot = apr_palloc(log->p, sizeof(*pslot));
+        apr_hash_set(log->latest, apr_pstrdup(log->p, type), APR_HASH_KEY_STRING, pslot);
+    }
+    *pslot = log->head;
+
+    log->head = (log->head + 1) % log->capacity;
+    if (log->count < log->capacity) ++log->count;
+}
+
+/* Get the i-th latest record, 0 being the latest. */
+static job_log_rec_t *job_log_get(md_job_log_t *log, int i)
+{
+    if (i < 0 || i >= log->count) return NULL;
+    return &log->recs[(log->head - 1 - i + log->capacity) % log->capacity];
+}
+
+static job_log_rec_t *job_log_latest(md_job_log_t *log, const char *type)
+{
+    int *pslot = job_log_slot_of(log, type);
+    return (pslot && *pslot >= 0)? &log->recs[*pslot] : NULL;
+}
+
+static md_json_t *job_log_rec_to_json(job_log_rec_t *rec, apr_pool_t *p)
+{
+    md_json_t *entry;
+    char ts[APR_RFC822_DATE_LEN];
+
+    entry = md_json_create(p);
+    apr_rfc822_date(ts, rec->when);
+    md_json_sets(ts, entry, MD_KEY_WHEN, NULL);
+    if (rec->type) md_json_sets(rec->type, entry, MD_KEY_TYPE, NULL);
+    if (rec->status) md_json_sets(rec->status, entry, MD_KEY_STATUS, NULL);
+    if (rec->detail) md_json_sets(rec->detail, entry, MD_KEY_DETAIL, NULL);
+    return entry;
+}
+
+static md_json_t *job_log_to_json(md_job_log_t *log, apr_pool_t *p)
+{
+    job_log_rec_t *rec;
+    md_json_t *json;
+    int i;
+
+    json = md_json_create(p);
+    for (i = 0; (rec = job_log_get(log, i)); ++i) {
+        md_json_addj(job_log_rec_to_json(rec, p), json, MD_KEY_ENTRIES, NULL);
+    }
+    return json;
+}
+
+typedef struct {
+    const char *when, *type, *status, *detail;
+} job_log_entry_t;
+
+static int job_log_collect(void *baton, size_t index, md_json_t *entry)
+{
+    apr_array_header_t *entries = baton;
+    job_log_entry_t *e;
+
+    (void)index;
+    e = &APR_ARRAY_PUSH(entries, job_log_entry_t);
+    e->when = md_json_gets(entry, MD_KEY_WHEN, NULL);
+    e->type = md_json_gets(entry, MD_KEY_TYPE, NULL);
+    e->status = md_json_gets(entry, MD_KEY_STATUS, NULL);
+    e->detail = md_json_gets(entry, MD_KEY_DETAIL, NULL);
+    return 1;
+}
+
+/* Fill the log from its MD_KEY_ENTRIES, the latest first. */
+static void job_log_from_json(md_job_log_t *log, md_json_t *json)
+{
+    apr_array_header_t *entries;
+    job_log_entry_t *e;
+    apr_pool_t *ptemp;
+    int i;
+
+    job_log_clear(log);
+    if (APR_SUCCESS != apr_pool_create(&ptemp, log->p)) return;
+    entries = apr_array_make(ptemp, log->capacity, sizeof(job_log_entry_t));
+    md_json_itera(job_log_collect, entries, json, MD_KEY_ENTRIES, NULL);
+    for (i = entries->nelts - 1; i >= 0; --i) {
+        e = &APR_ARRAY_IDX(entries, i, job_log_entry_t);
+        job_log_add(log, e->when? apr_date_parse_rfc(e->when) : 0, 
+                    e->type, e->status, e->detail);
+    }
+    apr_pool_destroy(ptemp);
+}
+
 /**************************************************************************************************/
 /* drive job persistence */
 
@@ -348,7 +717,7 @@ md_job_t *md_job_make(apr_pool_t *p, md_store_t *store,
     job->mdomain = apr_pstrdup(p, name);
     job->store = store;
     job->p = p;
-    job->max_log = 128;
+    job->max_log = MD_JOB_LOG_MAX;
     job->min_delay = min_delay;
     return job;
 }
@@ -360,24 +729,110 @@ void md_job_set_group(md_job_t *job, md_store_group_t group)
 
 static void md_job_from_json(md_job_t *job, md_json_t *json, apr_pool_t *p)
 {
+    md_json_t *jlog;
     const char *s;
     
     /* not good, this is malloced from a temp pool */
     /*job->mdomain = md_json_gets(json, MD_KEY_NAME, NULL);*/
-    job->finished = md_json_getb(json, MD_KEY_FINISHED, NULL);
-    job->notified = md_json_getb(json, MD_KEY_NOTIFIED, NULL);
-    job->notified_renewed = md_json_getb(json, MD_KEY_NOTIFIED_RENEWED, NULL);
-    s = md_json_dups(p, json, MD_KEY_NEXT_RUN, NULL);
+    job->finished = md_json_pgetb(json, &MD_P_FINISHED);
+    job->notified = md_json_pgetb(json, &MD_P_NOTIFIED);
+    job->notified_renewed = md_json_pgetb(json, &MD_P_NOTIFIED_RENEWED);
+    s = md_json_pgets(json, &MD_P_NEXT_RUN);
     if (s && *s) job->next_run = apr_date_parse_rfc(s);
-    s = md_json_dups(p, json, MD_KEY_LAST_RUN, NULL);
+    s = md_json_pgets(json, &MD_P_LAST_RUN);
     if (s && *s) job->last_run = apr_date_parse_rfc(s);
-    s = md_json_dups(p, json, MD_KEY_VALID_FROM, NULL);
+    s = md_json_pgets(json, &MD_P_VALID_FROM);
     if (s && *s) job->valid_from = apr_date_parse_rfc(s);
-    job->error_runs = (int)md_json_getl(json, MD_KEY_ERRORS, NULL);
-    if (md_json_has_key(json, MD_KEY_LAST, NULL)) {
-        job->last_result = md_result_from_json(md_json_getcj(json, MD_KEY_LAST, NULL), p);
+    job->error_runs = (int)md_json_pgetl(json, &MD_P_ERRORS);
+    if (md_json_phas(json, &MD_P_LAST)) {
+        job->last_result = md_result_from_json(md_json_pgetj(json, &MD_P_LAST), p);
+    }
+    if ((jlog = md_json_pgetj(json, &MD_P_LOG))) {
+        if (!job->log) job->log = job_log_make(job->p, (int)job->max_log);
+        job_log_from_json(job->log, jlog);
     }
-    job->log = md_json_getj(json, MD_KEY_LOG, NULL);
+}
+
+/* job.json decoded, a JSON tree is only made for the last result */
+typedef struct {
+    int finished;
+    int notified;
+    int notified_renewed;
+    const char *next_run;
+    const char *last_run;
+    const char *valid_from;
+    int error_runs;
+    md_json_t *last;
+    md_json_t *log_entries;
+} job_props_t;
+
+static const md_json_field_t JOB_LOG_FIELDS[] = {
+    MD_JSON_FIELD(JSON, MD_KEY_ENTRIES, job_props_t, log_entries),
+    MD_JSON_FIELD_END
+};
+
+static const md_json_field_t JOB_FIELDS[] = {
+    MD_JSON_FIELD(BOOL, MD_KEY_FINISHED, job_props_t, finished),
+    MD_JSON_FIELD(BOOL, MD_KEY_NOTIFIED, job_props_t, notified),
+    MD_JSON_FIELD(BOOL, MD_KEY_NOTIFIED_RENEWED, job_props_t, notified_renewed),
+    MD_JSON_FIELD(STR, MD_KEY_NEXT_RUN, job_props_t, next_run),
+    MD_JSON_FIELD(STR, MD_KEY_LAST_RUN, job_props_t, last_run),
+    MD_JSON_FIELD(STR, MD_KEY_VALID_FROM, job_props_t, valid_from),
+    MD_JSON_FIELD(INT, MD_KEY_ERRORS, job_props_t, error_runs),
+    MD_JSON_FIELD(JSON, MD_KEY_LAST, job_props_t, last),
+    MD_JSON_FIELD_SUB(MD_KEY_LOG, JOB_LOG_FIELDS),
+    MD_JSON_FIELD_END
+};
+
+static void md_job_from_props(md_job_t *job, const job_props_t *props, apr_pool_t *p)
+{
+    md_json_t *jlog;
+
+    job->finished = props->finished;
+    job->notified = props->notified;
+    job->notified_renewed = props->notified_renewed;
+    if (props->next_run && *props->next_run) job->next_run = apr_date_parse_rfc(props->next_run);
+    if (props->last_run && *props->last_run) job->last_run = apr_date_parse_rfc(props->last_run);
+    if (props->valid_from && *props->valid_from) {
+        job->valid_from = apr_date_parse_rfc(props->valid_from);
+    }
+    job->error_runs = props->error_runs;
+    if (props->last) {
+        job->last_result = md_result_from_json(props->last, p);
+    }
+    if (props->log_entries) {
+        if (!job->log) job->log = job_log_make(job->p, (int)job->max_log);
+        jlog = md_json_create(p);
+        md_json_setj(props->log_entries, jlog, MD_KEY_ENTRIES, NULL);
+        job_log_from_json(job->log, jlog);
+    }
+}
+
+/* Fill the job from job.json as stored, if it seems valid. */
+static apr_status_t md_job_from_data(md_job_t *job, const md_data_t *data, apr_pool_t *p)
+{
+    job_props_t props;
+    md_json_t *jprops;
+    apr_pool_t *ptemp;
+    apr_status_t rv;
+
+    if (APR_SUCCESS != (rv = apr_pool_create(&ptemp, p))) return rv;
+    memset(&props, 0, sizeof(props));
+    rv = md_json_decode(&props, JOB_FIELDS, data->data, data->len, ptemp);
+    if (APR_SUCCESS == rv) {
+        if (md_job_seems_valid(props.finished, props.notified_renewed, job->store,
+                               job->group, job->mdomain, ptemp)) {
+            md_job_from_props(job, &props, p);
+        }
+    }
+    else if (APR_SUCCESS == (rv = md_json_readd(&jprops, ptemp, data->data, data->len))) {
+        /* not for the decoder, the JSON parser has the final word */
+        if (md_job_json_seems_valid(jprops, job->store, job->group, job->mdomain, ptemp)) {
+            md_job_from_json(job, jprops, p);
+        }
+    }
+    apr_pool_destroy(ptemp);
+    return rv;
 }
 
 static void job_to_json(md_json_t *json, const md_job_t *job, 
@@ -385,48 +840,55 @@ static void job_to_json(md_json_t *json, const md_job_t *job,
 {
     char ts[APR_RFC822_DATE_LEN];
 
-    md_json_sets(job->mdomain, json, MD_KEY_NAME, NULL);
-    md_json_setb(job->finished, json, MD_KEY_FINISHED, NULL);
-    md_json_setb(job->notified, json, MD_KEY_NOTIFIED, NULL);
-    md_json_setb(job->notified_renewed, json, MD_KEY_NOTIFIED_RENEWED, NULL);
+    md_json_psets(job->mdomain, json, &MD_P_NAME);
+    md_json_psetb(job->finished, json, &MD_P_FINISHED);
+    md_json_psetb(job->notified, json, &MD_P_NOTIFIED);
+    md_json_psetb(job->notified_renewed, json, &MD_P_NOTIFIED_RENEWED);
     if (job->next_run > 0) {
         apr_rfc822_date(ts, job->next_run);
-        md_json_sets(ts, json, MD_KEY_NEXT_RUN, NULL);
+        md_json_psets(ts, json, &MD_P_NEXT_RUN);
     }
     if (job->last_run > 0) {
         apr_rfc822_date(ts, job->last_run);
-        md_json_sets(ts, json, MD_KEY_LAST_RUN, NULL);
+        md_json_psets(ts, json, &MD_P_LAST_RUN);
     }
     if (job->valid_from > 0) {
         apr_rfc822_date(ts, job->valid_from);
-        md_json_sets(ts, json, MD_KEY_VALID_FROM, NULL);
+        md_json_psets(ts, json, &MD_P_VALID_FROM);
     }
-    md_json_setl(job->error_runs, json, MD_KEY_ERRORS, NULL);
+    md_json_psetl(job->error_runs, json, &MD_P_ERRORS);
     if (!result) result = job->last_result;
     if (result) {
-        md_json_setj(md_result_to_json(result, p), json, MD_KEY_LAST, NULL);
+        md_json_psetj(md_result_to_json(result, p), json, &MD_P_LAST);
+    }
+    if (job->log && job->log->count) {
+        md_json_psetj(job_log_to_json(job->log, p), json, &MD_P_LOG);
     }
-    if (job->log) md_json_setj(job->log, json, MD_KEY_LOG, NULL);
 }
 
 apr_status_t md_job_load(md_job_t *job)
 {
-    md_json_t *jprops;
+    md_data_t *data;
+    apr_pool_t *ptemp;
     apr_status_t rv;
     
-    rv = md_store_load_json(job->store, job->group, job->mdomain, MD_FN_JOB, &jprops, job->p);
-    if ((APR_SUCCESS == rv) &&
-        md_job_json_seems_valid(jprops, job->store, job->group, job->mdomain, job->p)) {
-        md_job_from_json(job, jprops, job->p);
-    }
+    if (APR_SUCCESS != (rv = apr_pool_create(&ptemp, job->p))) return rv;
+    rv = md_store_load(job->store, job->group, job->mdomain, MD_FN_JOB, MD_SV_DATA,
+                       (void**)&data, ptemp);
+    if (APR_SUCCESS == rv) rv = md_job_from_data(job, data, job->p);
+    apr_pool_destroy(ptemp);
     return rv;
 }
 
+static apr_status_t job_reg_save(md_job_reg_t *jobs, md_job_t *job, 
+                                 md_result_t *result, apr_pool_t *p);
+
 apr_status_t md_job_save(md_job_t *job, md_result_t *result, apr_pool_t *p)
 {
     md_json_t *jprops;
     apr_status_t rv;
     
+    if (job->jobs) return job_reg_save(job->jobs, job, result, p);
     jprops = md_json_create(p);
     job_to_json(jprops, job, result, p);
     rv = md_store_save_json(job->store, p, job->group, job->mdomain, MD_FN_JOB, jprops, 0);
@@ -437,65 +899,22 @@ apr_status_t md_job_save(md_job_t *job, md_result_t *result, apr_pool_t *p)
 void md_job_log_append(md_job_t *job, const char *type, 
                        const char *status, const char *detail)
 {
-    md_json_t *entry;
-    char ts[APR_RFC822_DATE_LEN];
-    
-    entry = md_json_create(job->p);
-    apr_rfc822_date(ts, apr_time_now());
-    md_json_sets(ts, entry, MD_KEY_WHEN, NULL);
-    md_json_sets(type, entry, MD_KEY_TYPE, NULL);
-    if (status) md_json_sets(status, entry, MD_KEY_STATUS, NULL);
-    if (detail) md_json_sets(detail, entry, MD_KEY_DETAIL, NULL);
-    if (!job->log) job->log = md_json_create(job->p);
-    md_json_insertj(entry, 0, job->log, MD_KEY_ENTRIES, NULL);
-    md_json_limita(job->max_log, job->log, MD_KEY_ENTRIES, NULL);
+    if (!job->log) job->log = job_log_make(job->p, (int)job->max_log);
+    job_log_add(job->log, apr_time_now(), type, status, detail);
     job->dirty = 1;
 }
 
-typedef struct {
-    md_job_t *job;
-    const char *type;
-    md_json_t *entry;
-    size_t index;
-} log_find_ctx;
-
-static int find_first_log_entry(void *baton, size_t index, md_json_t *entry)
-{
-    log_find_ctx *ctx = baton;
-    const char *etype;
-    
-    etype = md_json_gets(entry, MD_KEY_TYPE, NULL);
-    if (etype == ctx->type || (etype && ctx->type && !strcmp(etype, ctx->type))) {
-        ctx->entry = entry;
-        ctx->index = index;
-        return 0;
-    }
-    return 1;
-}
-
-md_json_t *md_job_log_get_latest(md_job_t *job, const char *type)
-
+md_json_t *md_job_log_get_latest(md_job_t *job, const char *type, apr_pool_t *p)
 {
-    log_find_ctx ctx;
-
-    memset(&ctx, 0, sizeof(ctx));
-    ctx.job = job;
-    ctx.type = type;
-    if (job->log) md_json_itera(find_first_log_entry, &ctx, job->log, MD_KEY_ENTRIES, NULL);
-    return ctx.entry;
+    job_log_rec_t *rec = job->log? job_log_latest(job->log, type) : NULL;
+    return rec? job_log_rec_to_json(rec, p) : NULL;
 }
 
 apr_time_t md_job_log_get_time_of_latest(md_job_t *job, const char *type)
 {
-    md_json_t *entry;
-    const char *s;
-    
-    entry = md_job_log_get_latest(job, type);
-    if (entry) {
-        s = md_json_gets(entry, MD_KEY_WHEN, NULL);
-        if (s) return apr_date_parse_rfc(s);
-    }
-    return 0;
+    job_log_rec_t *rec = job->log? job_log_latest(job->log, type) : NULL;
+    /* as read back from the log in the store, with a resolution of seconds */
+    return rec? apr_time_from_sec(apr_time_sec(rec->when)) : 0;
 }
 
 void  md_status_take_stock(md_json_t **pjson, apr_array_header_t *mds, 
@@ -503,32 +922,40 @@ void  md_status_take_stock(md_json_t **pjson, apr_array_header_t *mds,
 {
     const md_t *md;
     md_job_t *job;
-    int i, complete, renewing, errored, ready, total;
-    md_json_t *json;
+    md_store_t *store;
+    apr_array_header_t *renewals, *names, *jobs;
+    int i, states, complete, renewing, errored, ready, total;
+    md_json_t *json, *jprops;
 
     json = md_json_create(p);
+    store = md_reg_store_get(reg);
+    renewals = apr_array_make(p, mds->nelts, sizeof(const md_t*));
+    names = apr_array_make(p, mds->nelts, sizeof(const char*));
     complete = renewing = errored = ready = total = 0;
     for (i = 0; i < mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mds, i, const md_t *);
         ++total;
-        switch (md->state) {
-            case MD_S_COMPLETE: ++complete; /* fall through */
-            case MD_S_INCOMPLETE:
-                if (md_reg_should_renew(reg, md, p)) {
-                    ++renewing;
-                    job = md_reg_job_make(reg, md->name, p);
-                    if (APR_SUCCESS == md_job_load(job)) {
-                        if (job->error_runs > 0 
-                            || (job->last_result && job->last_result->status != APR_SUCCESS)) {
-                            ++errored;
-                        }
-                        else if (job->finished) {
-                            ++ready;
-                        }
-                    }
-                }
-                break;
-            default: ++errored; break;
+        states = md_status_classify(md, NULL, reg, p);
+        if (states & MD_STATUS_COMPLETE) ++complete;
+        if (states & MD_STATUS_ERRORED) ++errored;
+        if (states & MD_STATUS_RENEWING) {
+            ++renewing;
+            APR_ARRAY_PUSH(renewals, const md_t*) = md;
+            APR_ARRAY_PUSH(names, const char*) = md->name;
+        }
+    }
+    /* load the jobs of all renewing MDs in one go */
+    md_store_load_json_all(&jobs, store, p, MD_SG_STAGING, names, MD_FN_JOB,
+                           MD_STORE_BULK_WORKERS);
+    for (i = 0; i < renewals->nelts; ++i) {
+        md = APR_ARRAY_IDX(renewals, i, const md_t*);
+        jprops = APR_ARRAY_IDX(jobs, i, md_json_t*);
+        job = md_reg_job_make(reg, md->name, p);
+        if (jprops && md_job_json_seems_valid(jprops, store, job->group, job->mdomain, p)) {
+            md_job_from_json(job, jprops, p);
+            states = md_status_classify(md, job, reg, p);
+            if (states & MD_STATUS_ERRORED) ++errored;
+            else if (states & MD_STATUS_READY) ++ready;
         }
     }
     md_json_setl(total, json, MD_KEY_TOTAL, NULL);
@@ -539,6 +966,341 @@ void  md_status_take_stock(md_json_t **pjson, apr_array_header_t *mds,
     *pjson = json;
 }
 
+/**************************************************************************************************/
+/* job registry */
+
+struct md_job_reg_t {
+    apr_pool_t *p;              /* only used by the thread driving the jobs */
+    md_store_t *store;
+    md_store_group_t group;
+    apr_time_t min_delay;
+    apr_hash_t *jobs;           /* MD name -> md_job_t* */
+    apr_array_header_t *unwritten; /* md_job_t* with a saved state not in the store */
+    apr_time_t last_flush;
+};
+
+md_job_reg_t *md_job_reg_make(apr_pool_t *p, md_store_t *store, 
+                              md_store_group_t group, apr_time_t min_delay)
+{
+    md_job_reg_t *jobs;
+
+    jobs = apr_pcalloc(p, sizeof(*jobs));
+    apr_pool_create(&jobs->p, p);
+    apr_pool_tag(jobs->p, "md_job_reg");
+    jobs->store = store;
+    jobs->group = group;
+    jobs->min_delay = min_delay;
+    jobs->jobs = apr_hash_make(jobs->p);
+    jobs->unwritten = apr_array_make(jobs->p, 5, sizeof(md_job_t*));
+    return jobs;
+}
+
+md_job_t *md_job_reg_get(md_job_reg_t *jobs, const char *name)
+{
+    md_job_t *job;
+
+    job = apr_hash_get(jobs->jobs, name, APR_HASH_KEY_STRING);
+    if (!job) {
+        job = md_job_make(jobs->p, jobs->store, jobs->group, name, jobs->min_delay);
+        md_job_load(job);
+        job->jobs = jobs;
+        apr_hash_set(jobs->jobs, job->mdomain, APR_HASH_KEY_STRING, job);
+    }
+    return job;
+}
+
+apr_status_t md_job_reg_load(md_job_reg_t *jobs, apr_pool_t *p)
+{
+    apr_array_header_t *names, *datas;
+    apr_hash_index_t *hi;
+    md_data_t *data;
+    md_job_t *job;
+    const void *key;
+    apr_status_t rv;
+    int i;
+
+    names = apr_array_make(p, (int)apr_hash_count(jobs->jobs), sizeof(const char*));
+    for (hi = apr_hash_first(p, jobs->jobs); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, &key, NULL, NULL);
+        APR_ARRAY_PUSH(names, const char*) = key;
+    }
+    rv = md_store_load_data_all(&datas, jobs->store, p, jobs->group, names, MD_FN_JOB,
+                                MD_STORE_BULK_WORKERS);
+    if (APR_SUCCESS != rv) goto leave;
+    for (i = 0; i < names->nelts; ++i) {
+        job = apr_hash_get(jobs->jobs, APR_ARRAY_IDX(names, i, const char*), 
+                           APR_HASH_KEY_STRING);
+        data = APR_ARRAY_IDX(datas, i, md_data_t*);
+        job->unwritten = NULL;
+        if (data) md_job_from_data(job, data, job->p);
+    }
+    apr_array_clear(jobs->unwritten);
+leave:
+    return rv;
+}
+
+static apr_status_t job_reg_save(md_job_reg_t *jobs, md_job_t *job, 
+                                 md_result_t *result, apr_pool_t *p)
+{
+    apr_pool_t *saved_p;
+    md_json_t *jprops;
+
+    /* The saved state replaces the previous one, which may still be where 
+     * job->last_result lives. */
+    apr_pool_create(&saved_p, jobs->p);
+    jprops = md_json_create(saved_p);
+    job_to_json(jprops, job, result, saved_p);
+    if (result || job->last_result) {
+        job->last_result = md_result_from_json(md_json_getcj(jprops, MD_KEY_LAST, NULL), saved_p);
+    }
+    if (job->saved_p) apr_pool_destroy(job->saved_p);
+    job->saved_p = saved_p;
+
+    if (!job->unwritten) APR_ARRAY_PUSH(jobs->unwritten, md_job_t*) = job;
+    job->unwritten = jprops;
+    job->dirty = 0;
+
+    if (apr_time_now() - jobs->last_flush >= MD_JOB_REG_FLUSH_INTERVAL) {
+        return md_job_reg_flush(jobs, p);
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t md_job_reg_flush(md_job_reg_t *jobs, apr_pool_t *p)
+{
+    md_job_t *job;
+    apr_status_t rv = APR_SUCCESS, rv2;
+    int i, n = 0;
+
+    for (i = 0; i < jobs->unwritten->nelts; ++i) {
+        job = APR_ARRAY_IDX(jobs->unwritten, i, md_job_t*);
+        rv2 = md_store_save_json(jobs->store, p, job->group, job->mdomain, MD_FN_JOB,
+                                 job->unwritten, 0);
+        if (APR_SUCCESS == rv2) {
+            job->unwritten = NULL;
+        }
+        else {
+            /* keep it for the next flush */
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv2, p, 
+                          "%s: writing job", job->mdomain);
+            APR_ARRAY_IDX(jobs->unwritten, n++, md_job_t*) = job;
+            rv = rv2;
+        }
+    }
+    jobs->unwritten->nelts = n;
+    jobs->last_flush = apr_time_now();
+    return rv;
+}
+
+/**************************************************************************************************/
+/* status snapshot */
+
+#define MD_STATUS_SNAP_MAX_AGE      apr_time_from_sec(MD_SECS_PER_HOUR)
+
+typedef struct {
+    const md_t *md;
+    int idx;                    /* index of the MD's generation counter */
+    apr_uint32_t gen;           /* generation the status was made at */
+    apr_time_t expires;         /* when the status needs to be made again */
+    md_json_t *mdj;             /* status of the MD, NULL until made */
+    int states;                 /* MD_STATUS_* categories, from md_status_classify() */
+} snap_entry_t;
+
+struct md_status_snap_t {
+    apr_pool_t *p;              /* own allocator, used by the updating thread only */
+    apr_pool_t *jp;             /* child of p, holds the current JSON */
+    apr_thread_mutex_t *update_mutex; /* held by the thread updating the entries */
+    apr_thread_mutex_t *mutex;  /* protects json and stock */
+    apr_uint32_t made;          /* != 0 once json has been made */
+    md_reg_t *reg;
+    md_ocsp_reg_t *ocsp;
+    apr_uint32_t *gens;
+    apr_hash_t *idx_by_name;    /* MD name -> index in gens, read only */
+    snap_entry_t *entries;      /* sorted by MD name */
+    int nentries;
+    md_json_t *json;
+    md_json_t *stock;
+};
+
+apr_time_t md_status_expires(const md_t *md, md_reg_t *reg, apr_time_t now, apr_pool_t *p)
+{
+    apr_time_t expires = now + MD_STATUS_SNAP_MAX_AGE, renew_at;
+
+    renew_at = md_reg_renew_at(reg, md, p);
+    if (renew_at > now && renew_at < expires) expires = renew_at;
+    return expires;
+}
+
+static int snap_entry_cmp(const void *v1, const void *v2)
+{
+    return strcmp(((const snap_entry_t*)v1)->md->name, ((const snap_entry_t*)v2)->md->name);
+}
+
+apr_status_t md_status_snap_make(md_status_snap_t **psnap, apr_pool_t *p, 
+                                 apr_array_header_t *mds, md_reg_t *reg,
+                                 md_ocsp_reg_t *ocsp, apr_uint32_t *gens)
+{
+    md_status_snap_t *snap;
+    apr_allocator_t *allocator;
+    snap_entry_t *e;
+    apr_status_t rv;
+    int i;
+
+    snap = apr_pcalloc(p, sizeof(*snap));
+    snap->reg = reg;
+    snap->ocsp = ocsp;
+    snap->gens = gens;
+    rv = apr_thread_mutex_create(&snap->update_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (APR_SUCCESS != rv) goto leave;
+    rv = apr_thread_mutex_create(&snap->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (APR_SUCCESS != rv) goto leave;
+    if (APR_SUCCESS != (rv = apr_allocator_create(&allocator))) goto leave;
+    rv = apr_pool_create_ex(&snap->p, p, NULL, allocator);
+    if (APR_SUCCESS != rv) {
+        apr_allocator_destroy(allocator);
+        goto leave;
+    }
+    apr_allocator_owner_set(allocator, snap->p);
+    apr_pool_tag(snap->p, "md_status_snap");
+
+    snap->idx_by_name = apr_hash_make(p);
+    snap->nentries = mds->nelts;
+    snap->entries = apr_pcalloc(p, (apr_size_t)(mds->nelts + 1) * sizeof(snap_entry_t));
+    for (i = 0; i < mds->nelts; ++i) {
+        e = &snap->entries[i];
+        e->md = APR_ARRAY_IDX(mds, i, const md_t*);
+        e->idx = i;
+        apr_hash_set(snap->idx_by_name, e->md->name, APR_HASH_KEY_STRING, &e->idx);
+    }
+    qsort(snap->entries, (size_t)snap->nentries, sizeof(snap_entry_t), snap_entry_cmp);
+leave:
+    *psnap = (APR_SUCCESS == rv)? snap : NULL;
+    return rv;
+}
+
+void md_status_snap_changed(md_status_snap_t *snap, const char *name)
+{
+    int *pidx = apr_hash_get(snap->idx_by_name, name, APR_HASH_KEY_STRING);
+
+    if (pidx) apr_atomic_inc32(&snap->gens[*pidx]);
+}
+
+int md_status_snap_get_gen(apr_uint32_t *pgen, md_status_snap_t *snap, const char *name)
+{
+    int *pidx = apr_hash_get(snap->idx_by_name, name, APR_HASH_KEY_STRING);
+
+    if (!pidx) return 0;
+    *pgen = apr_atomic_read32(&snap->gens[*pidx]);
+    return 1;
+}
+
+static int snap_entry_is_current(snap_entry_t *e, md_status_snap_t *snap, apr_time_t now)
+{
+    return (e->mdj && e->gen == apr_atomic_read32(&snap->gens[e->idx]) && now < e->expires);
+}
+
+static void snap_entry_make(snap_entry_t *e, md_status_snap_t *snap, apr_time_t now,
+                            apr_pool_t *p, apr_pool_t *ptemp)
+{
+    const md_t *md = e->md;
+    md_json_t *mdj, *jobj;
+    md_job_t *job = NULL;
+
+    /* read the generation first, a change while we look is seen next time */
+    e->gen = apr_atomic_read32(&snap->gens[e->idx]);
+    status_get_md_json(&mdj, md, snap->reg, snap->ocsp, 0, STATUS_PART_ALL, ptemp);
+    e->mdj = md_json_dupj(p, mdj, NULL);
+
+    e->expires = md_status_expires(md, snap->reg, now, ptemp);
+
+    if ((jobj = md_json_getj(mdj, MD_KEY_RENEWAL, NULL))) {
+        /* the job was validated when loading it for the status */
+        job = md_reg_job_make(snap->reg, md->name, ptemp);
+        md_job_from_json(job, jobj, ptemp);
+    }
+    e->states = md_status_classify(md, job, snap->reg, ptemp);
+}
+
+/* Only called with the update_mutex held. Readers keep using the previous JSON
+ * while the status of changed MDs is made again. */
+static void snap_update(md_status_snap_t *snap)
+{
+    apr_pool_t *jp, *ptemp, *old_jp;
+    md_json_t *json, *stock;
+    snap_entry_t *e;
+    apr_time_t now = apr_time_now();
+    int i, made = 0, complete, renewing, errored, ready;
+
+    for (i = 0; i < snap->nentries; ++i) {
+        if (!snap_entry_is_current(&snap->entries[i], snap, now)) break;
+    }
+    if (snap->jp && i >= snap->nentries) return;
+
+    /* A new pool for the JSON. Unchanged MD status are shared with the old one. */
+    apr_pool_create(&jp, snap->p);
+    apr_pool_create(&ptemp, jp);
+    json = md_json_create(jp);
+    md_json_sets(MOD_MD_VERSION, json, MD_KEY_VERSION, NULL);
+    complete = renewing = errored = ready = 0;
+    for (i = 0; i < snap->nentries; ++i) {
+        e = &snap->entries[i];
+        if (snap_entry_is_current(e, snap, now)) {
+            e->mdj = md_json_dupj(jp, e->mdj, NULL);
+        }
+        else {
+            snap_entry_make(e, snap, now, jp, ptemp);
+            apr_pool_clear(ptemp);
+            ++made;
+        }
+        md_json_addj(e->mdj, json, MD_KEY_MDS, NULL);
+        if (e->states & MD_STATUS_COMPLETE) ++complete;
+        if (e->states & MD_STATUS_RENEWING) ++renewing;
+        if (e->states & MD_STATUS_ERRORED) ++errored;
+        if (e->states & MD_STATUS_READY) ++ready;
+    }
+    apr_pool_destroy(ptemp);
+
+    stock = md_json_create(jp);
+    md_json_setl(snap->nentries, stock, MD_KEY_TOTAL, NULL);
+    md_json_setl(complete, stock, MD_KEY_COMPLETE, NULL);
+    md_json_setl(renewing, stock, MD_KEY_RENEWING, NULL);
+    md_json_setl(errored, stock, MD_KEY_ERRORED, NULL);
+    md_json_setl(ready, stock, MD_KEY_READY, NULL);
+
+    apr_thread_mutex_lock(snap->mutex);
+    snap->json = json;
+    snap->stock = stock;
+    apr_thread_mutex_unlock(snap->mutex);
+    apr_atomic_set32(&snap->made, 1);
+    old_jp = snap->jp;
+    snap->jp = jp;
+    if (old_jp) apr_pool_destroy(old_jp);
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, jp, 
+                  "status snapshot updated, made %d of %d MDs", made, snap->nentries);
+}
+
+void md_status_snap_get(md_json_t **pjson, md_json_t **pstock,
+                        md_status_snap_t *snap, apr_pool_t *p)
+{
+    apr_status_t rv;
+
+    /* One thread at a time updates the snapshot. Others do not wait for it
+     * and take the previous one, unless there is none yet. */
+    rv = apr_thread_mutex_trylock(snap->update_mutex);
+    if (APR_STATUS_IS_EBUSY(rv) && !apr_atomic_read32(&snap->made)) {
+        rv = apr_thread_mutex_lock(snap->update_mutex);
+    }
+    if (APR_SUCCESS == rv) {
+        snap_update(snap);
+        apr_thread_mutex_unlock(snap->update_mutex);
+    }
+    /* copies, so that the caller does not share any JSON with the snapshot */
+    apr_thread_mutex_lock(snap->mutex);
+    *pjson = snap->json? md_json_clone(p, snap->json) : NULL;
+    *pstock = snap->stock? md_json_clone(p, snap->stock) : NULL;
+    apr_thread_mutex_unlock(snap->mutex);
+}
+
 typedef struct {
     apr_pool_t *p;
     md_job_t *job;
@@ -683,6 +1445,8 @@ void md_job_end_run(md_job_t *job, md_result_t *result)
         job->dirty = 1;
         job->next_run = apr_time_now() + md_job_delay_on_errors(job, job->error_runs, result->problem);
     }
+    /* the outcome of a run is not held back, the next save writes it */
+    if (job->jobs) job->jobs->last_flush = 0;
     job_observation_end(job);
 }
 
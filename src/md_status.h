@@ -18,6 +18,7 @@
 #define md_status_h
 
 struct md_json_t;
+struct md_json_stream_t;
 struct md_reg_t;
 struct md_result_t;
 struct md_ocsp_reg_t;
@@ -31,12 +32,49 @@ apr_status_t md_status_get_md_json(struct md_json_t **pjson, const md_t *md,
                                    struct md_reg_t *reg, struct md_ocsp_reg_t *ocsp,
                                    apr_pool_t *p);
 
+/* The categories md_status_take_stock() counts MDs in */
+#define MD_STATUS_COMPLETE          0x01
+#define MD_STATUS_RENEWING          0x02
+#define MD_STATUS_ERRORED           0x04
+#define MD_STATUS_READY             0x08
+
+/**
+ * Get the MD_STATUS_* categories of the MD. A renewing MD is also errored
+ * or ready depending on its renewal `job`. Without a job, only what the
+ * MD itself tells is returned.
+ */
+int md_status_classify(const md_t *md, const struct md_job_t *job, 
+                       struct md_reg_t *reg, apr_pool_t *p);
+
+/**
+ * Selects the MDs and the fields of their status to report. MDs are matched
+ * in the order given, then `offset` of them are skipped and at most `limit`
+ * reported. Status parts not in `fields` are not loaded from the store.
+ */
+typedef struct md_status_query_t md_status_query_t;
+struct md_status_query_t {
+    int states;                     /* MD_STATUS_* flags, one must match, 0 for all */
+    const char *prefix;             /* MD names must start with this, NULL for all */
+    int offset;                     /* number of matching MDs to skip */
+    int limit;                      /* max number of MDs reported, < 0 for all */
+    apr_array_header_t *fields;     /* top level keys to report, NULL for all */
+};
+
 /** 
- * Get a JSON summary of all MDs and their status.
+ * Get a JSON summary of all MDs and their status. With a `query`, only the
+ * MDs and fields selected by it.
  */
 apr_status_t md_status_get_json(struct md_json_t **pjson, apr_array_header_t *mds, 
                                 struct md_reg_t *reg, struct md_ocsp_reg_t *ocsp,
-                                apr_pool_t *p);
+                                const md_status_query_t *query, apr_pool_t *p);
+
+/** 
+ * Write the same as md_status_get_json() to the stream, one MD at a time. Only
+ * the JSON of the MD being written is kept in memory.
+ */
+apr_status_t md_status_stream_json(struct md_json_stream_t *stream, apr_array_header_t *mds, 
+                                   struct md_reg_t *reg, struct md_ocsp_reg_t *ocsp,
+                                   const md_status_query_t *query, apr_pool_t *p);
 
 /**
  * Take stock of all MDs given for a short overview. The JSON returned
@@ -46,6 +84,52 @@ apr_status_t md_status_get_json(struct md_json_t **pjson, apr_array_header_t *md
 void  md_status_take_stock(struct md_json_t **pjson, apr_array_header_t *mds, 
                            struct md_reg_t *reg, apr_pool_t *p);
 
+/**
+ * Get the time a status of the MD, made at `now`, needs to be made again:
+ * when the MD is due for renewal or after an hour, whatever comes first.
+ */
+apr_time_t md_status_expires(const md_t *md, struct md_reg_t *reg, apr_time_t now, 
+                             apr_pool_t *p);
+
+/**
+ * A snapshot of the status of all MDs, as md_status_get_json() and 
+ * md_status_take_stock() give it, for answering frequent status requests.
+ * The status of an MD is only made again when its generation counter
+ * changed or its renewal time has come, and kept for at most an hour.
+ */
+typedef struct md_status_snap_t md_status_snap_t;
+
+/**
+ * Create a snapshot for the MDs. `gens` has a generation counter for each
+ * MD, in the order of `mds`, and may be shared with other processes.
+ */
+apr_status_t md_status_snap_make(md_status_snap_t **psnap, apr_pool_t *p, 
+                                 apr_array_header_t *mds, struct md_reg_t *reg,
+                                 struct md_ocsp_reg_t *ocsp, apr_uint32_t *gens);
+
+/**
+ * Increase the generation of the MD with the given name, if there is one.
+ * This does not lock the snapshot and may be called from any thread.
+ */
+void md_status_snap_changed(md_status_snap_t *snap, const char *name);
+
+/**
+ * Get the generation of the MD with the given name. Returns 0 if the snapshot
+ * does not know the MD. This does not lock the snapshot and may be called 
+ * from any thread.
+ */
+int md_status_snap_get_gen(apr_uint32_t *pgen, md_status_snap_t *snap, const char *name);
+
+/**
+ * Get a copy of the snapshot, with MDs sorted by name, allocated from `p`.
+ * Unless another thread is already at it, the snapshot is brought up to
+ * date first. Otherwise, the previous one is returned without waiting.
+ */
+void md_status_snap_get(struct md_json_t **pjson, struct md_json_t **pstock,
+                        md_status_snap_t *snap, apr_pool_t *p);
+
+
+#define MD_JOB_LOG_MAX      128
 
 typedef struct md_job_t md_job_t;
 
@@ -63,12 +147,15 @@ struct md_job_t {
     apr_time_t valid_from; /* at which time the finished job results become valid, 0 if immediate */
     int error_runs;        /* Number of errored runs of an unfinished job */
     int fatal_error;       /* a fatal error is remedied by retrying */
-    md_json_t *log;        /* array of log objects with minimum fields
-                              MD_KEY_WHEN (timestamp) and MD_KEY_TYPE (string) */
+    struct md_job_log_t *log; /* ring of log records with a time and a type, 
+                              an optional status and detail */
     apr_size_t max_log;    /* max number of log entries, new ones replace oldest */
     int dirty;
     struct md_result_t *observing;
     apr_time_t min_delay;  /* smallest delay a repeated attempt should have */
+    struct md_job_reg_t *jobs; /* registry keeping the job in memory or NULL */
+    apr_pool_t *saved_p;   /* holds the last saved state of a job in a registry */
+    md_json_t *unwritten;  /* saved state not written to the store yet or NULL */
 };
 
 /**
@@ -87,7 +174,8 @@ void md_job_set_group(md_job_t *job, md_store_group_t group);
 apr_status_t md_job_load(md_job_t *job);
 
 /**
- * Update storage from job in <group>/job->mdomain.
+ * Update storage from job in <group>/job->mdomain. For a job in a registry,
+ * the state is kept and written with the next flush of the registry.
  */
 apr_status_t md_job_save(md_job_t *job, struct md_result_t *result, apr_pool_t *p);
 
@@ -101,9 +189,9 @@ void md_job_log_append(md_job_t *job, const char *type,
                        const char *status, const char *detail);
 
 /**
- * Retrieve the latest log entry of a certain type.
+ * Retrieve the latest log entry of a certain type, allocated from pool p.
  */
-md_json_t *md_job_log_get_latest(md_job_t *job, const char *type);
+md_json_t *md_job_log_get_latest(md_job_t *job, const char *type, apr_pool_t *p);
 
 /**
  * Get the time the latest log entry of the given type happened, or 0 if
@@ -123,4 +211,35 @@ apr_time_t md_job_delay_on_errors(md_job_t *job, int err_count, const char *last
 
 apr_status_t md_job_notify(md_job_t *job, const char *reason, struct md_result_t *result);
 
+/**
+ * The jobs of a store group, kept in memory by the single watchdog thread 
+ * that drives them. Jobs are loaded once per process and md_job_save() on
+ * them is written to the store in batches, on md_job_reg_flush(), on the
+ * first save after md_job_end_run() or when the last flush is longer ago 
+ * than MD_JOB_REG_FLUSH_INTERVAL. Other processes see the jobs in the store 
+ * as before.
+ */
+typedef struct md_job_reg_t md_job_reg_t;
+
+#define MD_JOB_REG_FLUSH_INTERVAL     apr_time_from_sec(5)
+
+md_job_reg_t *md_job_reg_make(apr_pool_t *p, md_store_t *store, 
+                              md_store_group_t group, apr_time_t min_delay);
+
+/**
+ * Get the job for the MD name, loaded from the store when first asked for.
+ */
+md_job_t *md_job_reg_get(md_job_reg_t *jobs, const char *name);
+
+/**
+ * Load all jobs known to the registry from the store, in one go. Any changes 
+ * not written yet are dropped.
+ */
+apr_status_t md_job_reg_load(md_job_reg_t *jobs, apr_pool_t *p);
+
+/**
+ * Write the saved state of all jobs that changed since the last flush.
+ */
+apr_status_t md_job_reg_flush(md_job_reg_t *jobs, apr_pool_t *p);
+
 #endif /* md_status_h */
@@ -159,7 +159,17 @@ apr_status_t md_store_remove_not_modified_since(md_store_t *store, apr_pool_t *p
                                                 const char *name, 
                                                 const char *aspect)
 {
-    return store->remove_nms(store, p, modified, group, name, aspect);
+    return store->remove_nms(store, p, modified, group, name, aspect, 0, NULL);
+}
+
+apr_status_t md_store_remove_some_not_modified_since(md_store_t *store, apr_pool_t *p, 
+                                                     apr_time_t modified,
+                                                     md_store_group_t group, 
+                                                     const char *name, 
+                                                     const char *aspect,
+                                                     int max_items, int *premoved)
+{
+    return store->remove_nms(store, p, modified, group, name, aspect, max_items, premoved);
 }
 
 apr_status_t md_store_rename(md_store_t *store, apr_pool_t *p,
@@ -185,15 +195,16 @@ int md_exists(md_store_t *store, md_store_group_t group,
 apr_status_t md_load(md_store_t *store, md_store_group_t group, 
                      const char *name, md_t **pmd, apr_pool_t *p)
 {
-    md_json_t *json;
+    md_data_t *data;
     apr_status_t rv;
     
-    rv = md_store_load_json(store, group, name, MD_FN_MD, pmd? &json : NULL, p);
-    if (APR_SUCCESS == rv) {
-        if (pmd) {
-            *pmd = md_from_json(json, p);
+    rv = md_store_load(store, group, name, MD_FN_MD, MD_SV_DATA, pmd? (void**)&data : NULL, p);
+    if (APR_SUCCESS == rv && pmd) {
+        rv = md_from_data(pmd, data, p);
+        if (APR_SUCCESS != rv) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "loading %s/%s/%s",
+                          md_store_group_name(group), name, MD_FN_MD);
         }
-        return APR_SUCCESS;
     }
     return rv;
 }
@@ -260,15 +271,18 @@ typedef struct {
     apr_array_header_t *mds;
 } md_load_ctx;
 
-static const char *pk_filename(const char *keyname, const char *base, apr_pool_t *p)
+static const char *pk_filename(const char *keyname, const char *base, 
+                               const char *rsa_fname, apr_pool_t *p)
 {
     char *s, *t;
+    
+    if (!keyname || !apr_cstr_casecmp("rsa", keyname)) {
+        return rsa_fname;
+    }
     /* We also run on various filesystems with difference upper/lower preserve matching
      * rules. Normalize the names we use, since private key specifications are basically
      * user input. */
-    s = (keyname && apr_cstr_casecmp("rsa", keyname))?
-        apr_pstrcat(p, base, ".", keyname, ".pem", NULL)
-        : apr_pstrcat(p, base, ".pem", NULL);
+    s = apr_pstrcat(p, base, ".", keyname, ".pem", NULL);
     for (t = s; *t; t++ )
         *t = (char)apr_tolower(*t);
     return s;
@@ -276,12 +290,12 @@ static const char *pk_filename(const char *keyname, const char *base, apr_pool_t
 
 const char *md_pkey_filename(md_pkey_spec_t *spec, apr_pool_t *p)
 {
-    return pk_filename(md_pkey_spec_name(spec), "privkey", p);
+    return pk_filename(md_pkey_spec_name(spec), "privkey", "privkey.pem", p);
 }
 
 const char *md_chain_filename(md_pkey_spec_t *spec, apr_pool_t *p)
 {
-    return pk_filename(md_pkey_spec_name(spec), "pubcert", p);
+    return pk_filename(md_pkey_spec_name(spec), "pubcert", "pubcert.pem", p);
 }
 
 apr_status_t md_pkey_load(md_store_t *store, md_store_group_t group, const char *name, 
@@ -352,6 +366,7 @@ typedef struct {
     const char *aspect;
     md_store_md_inspect *inspect;
     void *baton;
+    apr_status_t rv;
 } inspect_md_ctx;
 
 static int insp_md(void *baton, const char *name, const char *aspect, 
@@ -359,8 +374,14 @@ static int insp_md(void *baton, const char *name, const char *aspect,
 {
     inspect_md_ctx *ctx = baton;
     
-    if (!strcmp(MD_FN_MD, aspect) && vtype == MD_SV_JSON) {
-        md_t *md = md_from_json(value, ptemp);
+    if (!strcmp(MD_FN_MD, aspect) && vtype == MD_SV_DATA) {
+        md_t *md;
+        ctx->rv = md_from_data(&md, value, ptemp);
+        if (APR_SUCCESS != ctx->rv) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, ctx->rv, ptemp, "loading %s/%s/%s",
+                          md_store_group_name(ctx->group), name, MD_FN_MD);
+            return 0;
+        }
         md_log_perror(MD_LOG_MARK, MD_LOG_TRACE3, 0, ptemp, "inspecting md at: %s", name);
         return ctx->inspect(ctx->baton, ctx->store, md, ptemp);
     }
@@ -371,13 +392,166 @@ apr_status_t md_store_md_iter(md_store_md_inspect *inspect, void *baton, md_stor
                               apr_pool_t *p, md_store_group_t group, const char *pattern)
 {
     inspect_md_ctx ctx;
+    apr_status_t rv;
     
     ctx.store = store;
     ctx.group = group;
     ctx.inspect = inspect;
     ctx.baton = baton;
+    ctx.rv = APR_SUCCESS;
     
-    return md_store_iter(insp_md, &ctx, store, p, group, pattern, MD_FN_MD, MD_SV_JSON);
+    rv = md_store_iter(insp_md, &ctx, store, p, group, pattern, MD_FN_MD, MD_SV_DATA);
+    return (APR_SUCCESS != ctx.rv)? ctx.rv : rv;
+}
+
+/**************************************************************************************************/
+/* bulk loading */
+
+typedef struct {
+    md_store_t *store;
+    md_store_group_t group;
+    apr_array_header_t *names;
+    const char *aspect;
+    md_store_vtype_t vtype;
+    int as_md;
+    void **values;
+} bulk_load_ctx;
+
+static apr_status_t bulk_load(void *baton, int i, apr_pool_t *p)
+{
+    bulk_load_ctx *ctx = baton;
+    const char *name = APR_ARRAY_IDX(ctx->names, i, const char*);
+    md_data_t *data;
+    void *value;
+    apr_pool_t *ptemp;
+    apr_status_t rv;
+
+    if (!ctx->as_md) {
+        rv = md_store_load(ctx->store, ctx->group, name, ctx->aspect, ctx->vtype, &value, p);
+        if (APR_SUCCESS == rv) ctx->values[i] = value;
+        goto leave;
+    }
+    /* the file content is only needed for decoding, keep it out of the result pool */
+    if (APR_SUCCESS != (rv = apr_pool_create(&ptemp, p))) goto leave;
+    apr_pool_tag(ptemp, "md_store_bulk");
+    rv = md_store_load(ctx->store, ctx->group, name, ctx->aspect, MD_SV_DATA, 
+                       (void**)&data, ptemp);
+    if (APR_SUCCESS == rv) rv = md_from_data((md_t**)&ctx->values[i], data, p);
+    apr_pool_destroy(ptemp);
+leave:
+    if (APR_SUCCESS != rv && !APR_STATUS_IS_ENOENT(rv)) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "loading %s/%s/%s",
+                      md_store_group_name(ctx->group), name, ctx->aspect);
+    }
+    /* a single item failing does not fail the whole load */
+    return APR_SUCCESS;
+}
+
+static apr_status_t bulk_load_all(void ***pvalues, md_store_t *store, apr_pool_t *p,
+                                  md_store_group_t group, apr_array_header_t *names,
+                                  const char *aspect, md_store_vtype_t vtype, int as_md,
+                                  int max_workers)
+{
+    bulk_load_ctx ctx;
+    apr_status_t rv;
+
+    ctx.store = store;
+    ctx.group = group;
+    ctx.names = names;
+    ctx.aspect = aspect;
+    ctx.vtype = vtype;
+    ctx.as_md = as_md;
+    ctx.values = apr_pcalloc(p, (apr_size_t)(names->nelts + 1) * sizeof(void*));
+    rv = md_util_parallel_do(bulk_load, &ctx, names->nelts, max_workers, p);
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, rv, p, "bulk loaded %d items of %s/*/%s",
+                  names->nelts, md_store_group_name(group), aspect);
+    *pvalues = ctx.values;
+    return rv;
+}
+
+apr_status_t md_store_load_json_all(apr_array_header_t **pjsons, md_store_t *store,
+                                    apr_pool_t *p, md_store_group_t group,
+                                    apr_array_header_t *names, const char *aspect,
+                                    int max_workers)
+{
+    apr_array_header_t *jsons;
+    void **values;
+    apr_status_t rv;
+    int i;
+
+    rv = bulk_load_all(&values, store, p, group, names, aspect, MD_SV_JSON, 0, max_workers);
+    jsons = apr_array_make(p, names->nelts, sizeof(md_json_t*));
+    for (i = 0; i < names->nelts; ++i) {
+        APR_ARRAY_PUSH(jsons, md_json_t*) = values[i];
+    }
+    *pjsons = jsons;
+    return rv;
+}
+
+apr_status_t md_store_load_data_all(apr_array_header_t **pdatas, md_store_t *store,
+                                    apr_pool_t *p, md_store_group_t group,
+                                    apr_array_header_t *names, const char *aspect,
+                                    int max_workers)
+{
+    apr_array_header_t *datas;
+    void **values;
+    apr_status_t rv;
+    int i;
+
+    rv = bulk_load_all(&values, store, p, group, names, aspect, MD_SV_DATA, 0, max_workers);
+    datas = apr_array_make(p, names->nelts, sizeof(md_data_t*));
+    for (i = 0; i < names->nelts; ++i) {
+        APR_ARRAY_PUSH(datas, md_data_t*) = values[i];
+    }
+    *pdatas = datas;
+    return rv;
+}
+
+apr_status_t md_store_md_load_names(apr_array_header_t **pmds, md_store_t *store,
+                                    apr_pool_t *p, md_store_group_t group,
+                                    apr_array_header_t *names, int max_workers)
+{
+    apr_array_header_t *mds;
+    void **values;
+    apr_status_t rv;
+    int i;
+
+    rv = bulk_load_all(&values, store, p, group, names, MD_FN_MD, MD_SV_DATA, 1, max_workers);
+    mds = apr_array_make(p, names->nelts, sizeof(md_t*));
+    for (i = 0; i < names->nelts; ++i) {
+        if (values[i]) APR_ARRAY_PUSH(mds, md_t*) = values[i];
+    }
+    *pmds = mds;
+    return rv;
+}
+
+static int add_name(void *baton, const char *dir, const char *name,
+                    md_store_vtype_t vtype, void *value, apr_pool_t *ptemp)
+{
+    apr_array_header_t *names = baton;
+
+    (void)dir;
+    (void)vtype;
+    (void)value;
+    (void)ptemp;
+    APR_ARRAY_PUSH(names, const char*) = apr_pstrdup(names->pool, name);
+    return APR_SUCCESS;
+}
+
+apr_status_t md_store_md_load_all(apr_array_header_t **pmds, md_store_t *store,
+                                  apr_pool_t *p, md_store_group_t group,
+                                  const char *pattern, int max_workers)
+{
+    apr_array_header_t *names;
+    apr_status_t rv;
+
+    names = apr_array_make(p, 100, sizeof(const char*));
+    rv = md_store_iter_names(add_name, names, store, p, group, pattern);
+    if (APR_SUCCESS != rv) {
+        *pmds = apr_array_make(p, 0, sizeof(md_t*));
+        return rv;
+    }
+    return md_store_md_load_names(pmds, store, p, group, names, max_workers);
 }
 
 apr_status_t md_store_lock_global(md_store_t *store, apr_pool_t *p, apr_time_t max_wait)
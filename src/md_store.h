@@ -56,6 +56,7 @@ typedef enum {
     MD_SV_PKEY,         /* PEM private key, value is (md_pkey_t*) */
     MD_SV_CHAIN,        /* list of PEM x509 certificates, value is 
                            (apr_array_header_t*) of (md_cert*) */
+    MD_SV_DATA,         /* content as stored, value is (md_data_t*), load only */
 } md_store_vtype_t;
 
 /** Store storage groups */
@@ -75,6 +76,10 @@ typedef enum {
 #define MD_FN_JOB               "job.json"
 #define MD_FN_HTTPD_JSON        "httpd.json"
 
+/* Private keys at the top level of the store with this file name prefix
+ * are saved unencrypted, so that mod_ssl can read them. */
+#define MD_FN_FALLBACK_PKEY_PREFIX "fallback-"
+
 /* The corresponding names for current cert & key files are constructed
  * in md_store and md_crypt.
  */
@@ -144,6 +149,18 @@ apr_status_t md_store_remove_not_modified_since(md_store_t *store, apr_pool_t *p
                                                 const char *name, 
                                                 const char *aspect);
 
+/**
+ * As md_store_remove_not_modified_since(), but remove at most `max_items`.
+ * @param premoved the number of items removed, may be NULL
+ * @return APR_INCOMPLETE if the limit was reached before all matches were seen
+ */
+apr_status_t md_store_remove_some_not_modified_since(md_store_t *store, apr_pool_t *p, 
+                                                     apr_time_t modified,
+                                                     md_store_group_t group, 
+                                                     const char *name, 
+                                                     const char *aspect,
+                                                     int max_items, int *premoved);
+
 /**
  * inspect callback function. Invoked for each matched value. Values allocated from
  * ptemp may disappear any time after the call returned. If this function returns
@@ -242,6 +259,47 @@ typedef int md_store_md_inspect(void *baton, md_store_t *store, md_t *md, apr_po
 apr_status_t md_store_md_iter(md_store_md_inspect *inspect, void *baton, md_store_t *store, 
                               apr_pool_t *p, md_store_group_t group, const char *pattern);
 
+/**
+ * Default number of threads used for bulk loading from the store.
+ */
+#define MD_STORE_BULK_WORKERS       4
+
+/**
+ * Load the JSON stored under "group/name/aspect" for all `names` on up to `max_workers`
+ * threads. The returned array has an entry for each name, in the same order, which is
+ * NULL if the item could not be loaded.
+ */
+apr_status_t md_store_load_json_all(apr_array_header_t **pjsons, md_store_t *store,
+                                    apr_pool_t *p, md_store_group_t group,
+                                    apr_array_header_t *names, const char *aspect,
+                                    int max_workers);
+
+/**
+ * Load the content stored under "group/name/aspect" for all `names`, unparsed, 
+ * as md_store_load_json_all() does. Entries are (md_data_t*).
+ */
+apr_status_t md_store_load_data_all(apr_array_header_t **pdatas, md_store_t *store,
+                                    apr_pool_t *p, md_store_group_t group,
+                                    apr_array_header_t *names, const char *aspect,
+                                    int max_workers);
+
+/**
+ * Load the MDs stored under the given `names` in `group`, reading and parsing them
+ * on up to `max_workers` threads. The MDs are returned in the order of `names`. Names
+ * that do not exist or fail to load are skipped.
+ */
+apr_status_t md_store_md_load_names(apr_array_header_t **pmds, md_store_t *store,
+                                    apr_pool_t *p, md_store_group_t group,
+                                    apr_array_header_t *names, int max_workers);
+
+/**
+ * Load all MDs in `group` whose name matches `pattern`, as md_store_md_load_names()
+ * does. MDs are returned in the order their names are listed by the store.
+ */
+apr_status_t md_store_md_load_all(apr_array_header_t **pmds, md_store_t *store,
+                                  apr_pool_t *p, md_store_group_t group,
+                                  const char *pattern, int max_workers);
+
 
 const char *md_pkey_filename(struct md_pkey_spec_t *spec, apr_pool_t *p);
 const char *md_chain_filename(struct md_pkey_spec_t *spec, apr_pool_t *p);
@@ -320,7 +378,8 @@ typedef apr_time_t md_store_get_modified_cb(md_store_t *store, md_store_group_t
 
 typedef apr_status_t md_store_remove_nms_cb(md_store_t *store, apr_pool_t *p, 
                                             apr_time_t modified, md_store_group_t group, 
-                                            const char *name, const char *aspect);
+                                            const char *name, const char *aspect,
+                                            int max_items, int *premoved);
 typedef apr_status_t md_store_lock_global_cb(md_store_t *store, apr_pool_t *p, apr_time_t max_wait);
 typedef void md_store_unlock_global_cb(md_store_t *store, apr_pool_t *p);
 
@@ -25,6 +25,7 @@
 #include <apr_fnmatch.h>
 #include <apr_hash.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
 
 #include "md.h"
 #include "md_crypt.h"
@@ -46,6 +47,26 @@ typedef struct {
     apr_fileperms_t file;
 } perms_t;
 
+#define PK_CACHE_SIZE           16
+#define FN_CACHE_MAX            16384
+
+typedef struct {
+    const char *dname;          /* "base/group/name" */
+    apr_hash_t *fnames;         /* aspect -> "base/group/name/aspect" */
+} fn_dir_t;
+
+typedef struct {
+    apr_pool_t *pool;           /* owns the entry's data, NULL if the slot is free */
+    md_store_group_t group;
+    const char *name;
+    const char *aspect;
+    const char *fpath;
+    apr_time_t mtime;           /* of the file the key was loaded from */
+    apr_off_t size;
+    apr_uint64_t used;          /* for LRU eviction */
+    md_pkey_t *pkey;            /* decrypted key */
+} pk_entry_t;
+
 typedef struct md_store_fs_t md_store_fs_t;
 struct md_store_fs_t {
     md_store_t s;
@@ -63,6 +84,19 @@ struct md_store_fs_t {
     int port_443;
 
     apr_file_t *global_lock;
+
+    /* directory of each group and cached paths of items below it */
+    const char *group_dirs[MD_SG_COUNT];
+    apr_pool_t *fn_pool;
+    apr_thread_mutex_t *fn_mutex;
+    apr_hash_t *fn_dirs[MD_SG_COUNT];
+    int fn_count;
+
+    /* decrypted private keys from password protected groups, never written out */
+    apr_pool_t *pk_pool;
+    apr_thread_mutex_t *pk_mutex;
+    pk_entry_t pk_entries[PK_CACHE_SIZE];
+    apr_uint64_t pk_used;
 };
 
 #define FS_STORE(store)     (md_store_fs_t*)(((char*)store)-offsetof(md_store_fs_t, s))
@@ -82,7 +116,8 @@ static apr_status_t fs_purge(md_store_t *store, apr_pool_t *p,
                              md_store_group_t group, const char *name);
 static apr_status_t fs_remove_nms(md_store_t *store, apr_pool_t *p, 
                                   apr_time_t modified, md_store_group_t group, 
-                                  const char *name, const char *aspect);
+                                  const char *name, const char *aspect,
+                                  int max_items, int *premoved);
 static apr_status_t fs_move(md_store_t *store, apr_pool_t *p, 
                             md_store_group_t from, md_store_group_t to, 
                             const char *name, int archive);
@@ -296,6 +331,7 @@ apr_status_t md_store_fs_init(md_store_t **pstore, apr_pool_t *p, const char *pa
 {
     md_store_fs_t *s_fs;
     apr_status_t rv = APR_SUCCESS;
+    int i;
     
     s_fs = apr_pcalloc(p, sizeof(*s_fs));
 
@@ -332,6 +368,26 @@ apr_status_t md_store_fs_init(md_store_t **pstore, apr_pool_t *p, const char *pa
     s_fs->group_perms[MD_SG_OCSP].file = MD_FPROT_F_UALL_WREAD;
 
     s_fs->base = apr_pstrdup(p, path);
+    s_fs->group_dirs[MD_SG_NONE] = s_fs->base;
+    for (i = MD_SG_NONE + 1; i < MD_SG_COUNT; ++i) {
+        rv = md_util_path_merge(&s_fs->group_dirs[i], p, s_fs->base, 
+                                md_store_group_name((unsigned int)i), NULL);
+        if (APR_SUCCESS != rv) goto cleanup;
+    }
+    rv = apr_pool_create(&s_fs->fn_pool, p);
+    if (APR_SUCCESS != rv) goto cleanup;
+    apr_pool_tag(s_fs->fn_pool, "md_store_fnames");
+    rv = apr_thread_mutex_create(&s_fs->fn_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (APR_SUCCESS != rv) goto cleanup;
+    for (i = 0; i < MD_SG_COUNT; ++i) {
+        s_fs->fn_dirs[i] = apr_hash_make(s_fs->fn_pool);
+    }
+
+    rv = apr_pool_create(&s_fs->pk_pool, p);
+    if (APR_SUCCESS != rv) goto cleanup;
+    apr_pool_tag(s_fs->pk_pool, "md_store_pkeys");
+    rv = apr_thread_mutex_create(&s_fs->pk_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (APR_SUCCESS != rv) goto cleanup;
 
     rv = md_util_is_dir(s_fs->base, p);
     if (APR_STATUS_IS_ENOENT(rv)) {
@@ -402,17 +458,185 @@ static const perms_t *gperms(md_store_fs_t *s_fs, md_store_group_t group)
     return &s_fs->group_perms[group];
 }
 
+/**************************************************************************************************/
+/* private key cache */
+
+/* Decrypting a private key from a password protected group is slow on purpose
+ * and the same keys get loaded several times during a renewal. We keep a small
+ * number of decrypted keys, which are dropped when the file changes or when
+ * the item is modified through the store. The key material is freed, and cleared
+ * by the crypto library, once the last reference to it is gone. */
+
+static void pk_entry_clear(pk_entry_t *e)
+{
+    /* called with s_fs->pk_mutex held */
+    if (e->pool) {
+        apr_pool_destroy(e->pool);
+    }
+    memset(e, 0, sizeof(*e));
+}
+
+/* Evict the keys below "group/name/aspect". A NULL aspect evicts all keys 
+ * of "group/name", a NULL name all keys in the group. */
+static void pk_evict(md_store_fs_t *s_fs, md_store_group_t group, 
+                     const char *name, const char *aspect)
+{
+    pk_entry_t *e;
+    int i;
+    
+    apr_thread_mutex_lock(s_fs->pk_mutex);
+    for (i = 0; i < PK_CACHE_SIZE; ++i) {
+        e = &s_fs->pk_entries[i];
+        if (e->pool && e->group == group 
+            && (!name || !strcmp(name, e->name))
+            && (!aspect || !strcmp(aspect, e->aspect))) {
+            pk_entry_clear(e);
+        }
+    }
+    apr_thread_mutex_unlock(s_fs->pk_mutex);
+}
+
+static int pk_get(md_pkey_t **ppkey, md_store_fs_t *s_fs, const char *fpath, 
+                  const apr_finfo_t *info, apr_pool_t *p)
+{
+    pk_entry_t *e;
+    int i, found = 0;
+    
+    apr_thread_mutex_lock(s_fs->pk_mutex);
+    for (i = 0; i < PK_CACHE_SIZE; ++i) {
+        e = &s_fs->pk_entries[i];
+        if (e->pool && !strcmp(fpath, e->fpath)) {
+            if (e->mtime == info->mtime && e->size == info->size) {
+                *ppkey = md_pkey_share(e->pkey, p);
+                e->used = ++s_fs->pk_used;
+                found = 1;
+            }
+            else {
+                pk_entry_clear(e);
+            }
+            break;
+        }
+    }
+    apr_thread_mutex_unlock(s_fs->pk_mutex);
+    return found;
+}
+
+static void pk_put(md_store_fs_t *s_fs, md_store_group_t group, const char *name, 
+                   const char *aspect, const char *fpath, const apr_finfo_t *info, 
+                   md_pkey_t *pkey)
+{
+    pk_entry_t *e = NULL;
+    int i;
+    
+    apr_thread_mutex_lock(s_fs->pk_mutex);
+    for (i = 0; i < PK_CACHE_SIZE; ++i) {
+        pk_entry_t *c = &s_fs->pk_entries[i];
+        if (c->pool && !strcmp(fpath, c->fpath)) {
+            e = c;
+            break;
+        }
+        if (!e || (e->pool && (!c->pool || c->used < e->used))) {
+            e = c;
+        }
+    }
+    pk_entry_clear(e);
+    if (APR_SUCCESS == apr_pool_create(&e->pool, s_fs->pk_pool)) {
+        apr_pool_tag(e->pool, "md_store_pkey");
+        e->group = group;
+        e->name = apr_pstrdup(e->pool, name);
+        e->aspect = apr_pstrdup(e->pool, aspect);
+        e->fpath = apr_pstrdup(e->pool, fpath);
+        e->mtime = info->mtime;
+        e->size = info->size;
+        e->used = ++s_fs->pk_used;
+        e->pkey = md_pkey_share(pkey, e->pool);
+    }
+    else {
+        e->pool = NULL;
+    }
+    apr_thread_mutex_unlock(s_fs->pk_mutex);
+}
+
+/**************************************************************************************************/
+/* paths */
+
+/* Lookup the path of "group/name/aspect", or of the directory "group/name" with
+ * a NULL aspect, in the cache. Paths for plain names and aspects are composed
+ * from the group directory and kept for the lifetime of the store, so that 
+ * repeated lookups inside the store do not allocate anything.
+ * @return the path or NULL if it needs to be merged by the caller
+ */
+static const char *fn_lookup(md_store_fs_t *s_fs, md_store_group_t group, 
+                             const char *name, const char *aspect)
+{
+    fn_dir_t *dir;
+    const char *fname = NULL;
+    
+    if (group <= MD_SG_NONE || group >= MD_SG_COUNT 
+        || !md_util_is_plain_segment(name) 
+        || (aspect && !md_util_is_plain_segment(aspect))) {
+        return NULL;
+    }
+    apr_thread_mutex_lock(s_fs->fn_mutex);
+    dir = apr_hash_get(s_fs->fn_dirs[group], name, APR_HASH_KEY_STRING);
+    if (!dir) {
+        if (s_fs->fn_count >= FN_CACHE_MAX) goto leave;
+        dir = apr_pcalloc(s_fs->fn_pool, sizeof(*dir));
+        dir->dname = apr_pstrcat(s_fs->fn_pool, s_fs->group_dirs[group], "/", name, NULL);
+        dir->fnames = apr_hash_make(s_fs->fn_pool);
+        apr_hash_set(s_fs->fn_dirs[group], dir->dname + strlen(s_fs->group_dirs[group]) + 1, 
+                     APR_HASH_KEY_STRING, dir);
+        ++s_fs->fn_count;
+    }
+    if (!aspect) {
+        fname = dir->dname;
+        goto leave;
+    }
+    fname = apr_hash_get(dir->fnames, aspect, APR_HASH_KEY_STRING);
+    if (!fname && s_fs->fn_count < FN_CACHE_MAX) {
+        fname = apr_pstrcat(s_fs->fn_pool, dir->dname, "/", aspect, NULL);
+        apr_hash_set(dir->fnames, fname + strlen(dir->dname) + 1, APR_HASH_KEY_STRING, fname);
+        ++s_fs->fn_count;
+    }
+leave:
+    apr_thread_mutex_unlock(s_fs->fn_mutex);
+    return fname;
+}
+
+/* Get the path of "group/name/aspect". The path may be owned by the store and
+ * is only to be used inside the store, see fs_get_fname() for everyone else. */
+static apr_status_t fs_fname(const char **pfname, md_store_fs_t *s_fs, 
+                             md_store_group_t group, const char *name, 
+                             const char *aspect, apr_pool_t *p)
+{
+    if (group == MD_SG_NONE) {
+        return md_util_path_merge(pfname, p, s_fs->base, aspect, NULL);
+    }
+    if (group >= MD_SG_COUNT) {
+        return md_util_path_merge(pfname, p, 
+                                  s_fs->base, md_store_group_name(group), name, aspect, NULL);
+    }
+    if (aspect && (*pfname = fn_lookup(s_fs, group, name, aspect))) {
+        return APR_SUCCESS;
+    }
+    return md_util_path_merge(pfname, p, s_fs->group_dirs[group], name, aspect, NULL);
+}
+
 static apr_status_t fs_get_fname(const char **pfname, 
                                  md_store_t *store, md_store_group_t group, 
                                  const char *name, const char *aspect, 
                                  apr_pool_t *p)
 {
     md_store_fs_t *s_fs = FS_STORE(store);
-    if (group == MD_SG_NONE) {
-        return md_util_path_merge(pfname, p, s_fs->base, aspect, NULL);
+    const char *fname;
+    
+    /* callers own what they get, paths from the cache are copied into their pool */
+    if (group > MD_SG_NONE && group < MD_SG_COUNT && aspect
+        && (fname = fn_lookup(s_fs, group, name, aspect))) {
+        *pfname = apr_pstrdup(p, fname);
+        return APR_SUCCESS;
     }
-    return md_util_path_merge(pfname, p, 
-                              s_fs->base, md_store_group_name(group), name, aspect, NULL);
+    return fs_fname(pfname, s_fs, group, name, aspect, p);
 }
 
 static apr_status_t fs_get_dname(const char **pdname, 
@@ -424,13 +648,33 @@ static apr_status_t fs_get_dname(const char **pdname,
         *pdname = s_fs->base;
         return APR_SUCCESS;
     }
-    return md_util_path_merge(pdname, p, s_fs->base, md_store_group_name(group), name, NULL);
+    if (group >= MD_SG_COUNT) {
+        return md_util_path_merge(pdname, p, s_fs->base, md_store_group_name(group), name, NULL);
+    }
+    if (!name) {
+        *pdname = s_fs->group_dirs[group];
+        return APR_SUCCESS;
+    }
+    if ((*pdname = fn_lookup(s_fs, group, name, NULL))) {
+        return APR_SUCCESS;
+    }
+    return md_util_path_merge(pdname, p, s_fs->group_dirs[group], name, NULL);
+}
+
+static int pkey_is_plain(md_store_fs_t *s_fs, md_store_group_t group, const char *aspect)
+{
+    if (s_fs->plain_pkey[group]) return 1;
+    /* The shared fallback keys at the top level are read by mod_ssl, like the
+     * keys in domains. Any other key there stays encrypted. */
+    return (MD_SG_NONE == group && aspect
+            && !strncmp(MD_FN_FALLBACK_PKEY_PREFIX, aspect,
+                        sizeof(MD_FN_FALLBACK_PKEY_PREFIX)-1));
 }
 
-static void get_pass(const char **ppass, apr_size_t *plen, 
-                     md_store_fs_t *s_fs, md_store_group_t group)
+static void get_pass(const char **ppass, apr_size_t *plen, md_store_fs_t *s_fs, 
+                     md_store_group_t group, const char *aspect)
 {
-    if (s_fs->plain_pkey[group]) {
+    if (pkey_is_plain(s_fs, group, aspect)) {
         *ppass = NULL;
         *plen = 0;
     }
@@ -441,7 +685,8 @@ static void get_pass(const char **ppass, apr_size_t *plen,
 }
  
 static apr_status_t fs_fload(void **pvalue, md_store_fs_t *s_fs, const char *fpath, 
-                             md_store_group_t group, md_store_vtype_t vtype, 
+                             md_store_group_t group, const char *aspect,
+                             md_store_vtype_t vtype, 
                              apr_pool_t *p, apr_pool_t *ptemp)
 {
     apr_status_t rv;
@@ -460,12 +705,15 @@ static apr_status_t fs_fload(void **pvalue, md_store_fs_t *s_fs, const char *fpa
                 rv = md_cert_fload((md_cert_t **)pvalue, p, fpath);
                 break;
             case MD_SV_PKEY:
-                get_pass(&pass, &pass_len, s_fs, group);
+                get_pass(&pass, &pass_len, s_fs, group, aspect);
                 rv = md_pkey_fload((md_pkey_t **)pvalue, p, pass, pass_len, fpath);
                 break;
             case MD_SV_CHAIN:
                 rv = md_chain_fload((apr_array_header_t **)pvalue, p, fpath);
                 break;
+            case MD_SV_DATA:
+                rv = md_data_fread((md_data_t **)pvalue, p, fpath);
+                break;
             default:
                 rv = APR_ENOTIMPL;
                 break;
@@ -479,6 +727,27 @@ static apr_status_t fs_fload(void **pvalue, md_store_fs_t *s_fs, const char *fpa
     return rv;
 }
 
+static apr_status_t pk_load(md_pkey_t **ppkey, md_store_fs_t *s_fs, md_store_group_t group,
+                            const char *name, const char *aspect, const char *fpath,
+                            apr_pool_t *p, apr_pool_t *ptemp)
+{
+    apr_finfo_t info;
+    apr_status_t rv;
+    int have_info;
+    
+    /* stat before loading, so a key is never cached with a newer mtime than its content */
+    have_info = (APR_SUCCESS == apr_stat(&info, fpath, APR_FINFO_MTIME|APR_FINFO_SIZE, ptemp));
+    if (have_info && pk_get(ppkey, s_fs, fpath, &info, p)) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE3, 0, ptemp, "cached pkey for %s", fpath);
+        return APR_SUCCESS;
+    }
+    rv = fs_fload((void**)ppkey, s_fs, fpath, group, aspect, MD_SV_PKEY, p, ptemp);
+    if (APR_SUCCESS == rv && have_info) {
+        pk_put(s_fs, group, name, aspect, fpath, &info, *ppkey);
+    }
+    return rv;
+}
+
 static apr_status_t pfs_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
 {
     md_store_fs_t *s_fs = baton;
@@ -494,8 +763,13 @@ static apr_status_t pfs_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
     vtype = (md_store_vtype_t)va_arg(ap, int);
     pvalue= va_arg(ap, void **);
         
-    if (MD_OK(fs_get_fname(&fpath, &s_fs->s, group, name, aspect, ptemp))) {
-        rv = fs_fload(pvalue, s_fs, fpath, group, vtype, p, ptemp);
+    if (MD_OK(fs_fname(&fpath, s_fs, group, name, aspect, ptemp))) {
+        if (MD_SV_PKEY == vtype && pvalue && !pkey_is_plain(s_fs, group, aspect)) {
+            rv = pk_load((md_pkey_t **)pvalue, s_fs, group, name, aspect, fpath, p, ptemp);
+        }
+        else {
+            rv = fs_fload(pvalue, s_fs, fpath, group, aspect, vtype, p, ptemp);
+        }
     }
     return rv;
 }
@@ -544,12 +818,28 @@ cleanup:
     return rv;
 }
 
+static apr_status_t fs_get_mtime(apr_time_t *pmtime, md_store_fs_t *s_fs, 
+                                 md_store_group_t group, const char *name, 
+                                 const char *aspect, apr_pool_t *ptemp)
+{
+    const char *fname;
+    apr_finfo_t inf;
+    apr_status_t rv;
+    
+    *pmtime = 0;
+    if (   MD_OK(fs_fname(&fname, s_fs, group, name, aspect, ptemp))
+        && MD_OK(apr_stat(&inf, fname, APR_FINFO_MTIME, ptemp))) {
+        *pmtime = inf.mtime;
+    }
+    return rv;
+}
+
 static apr_status_t pfs_is_newer(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
 {
     md_store_fs_t *s_fs = baton;
-    const char *fname1, *fname2, *name, *aspect;
+    const char *name, *aspect;
     md_store_group_t group1, group2;
-    apr_finfo_t inf1, inf2;
+    apr_time_t mtime1, mtime2;
     int *pnewer;
     apr_status_t rv;
     
@@ -561,11 +851,9 @@ static apr_status_t pfs_is_newer(void *baton, apr_pool_t *p, apr_pool_t *ptemp,
     pnewer = va_arg(ap, int*);
     
     *pnewer = 0;
-    if (   MD_OK(fs_get_fname(&fname1, &s_fs->s, group1, name, aspect, ptemp))
-        && MD_OK(fs_get_fname(&fname2, &s_fs->s, group2, name, aspect, ptemp))
-        && MD_OK(apr_stat(&inf1, fname1, APR_FINFO_MTIME, ptemp))
-        && MD_OK(apr_stat(&inf2, fname2, APR_FINFO_MTIME, ptemp))) {
-        *pnewer = inf1.mtime > inf2.mtime;
+    if (   MD_OK(fs_get_mtime(&mtime1, s_fs, group1, name, aspect, ptemp))
+        && MD_OK(fs_get_mtime(&mtime2, s_fs, group2, name, aspect, ptemp))) {
+        *pnewer = mtime1 > mtime2;
     }
 
     return rv;
@@ -588,11 +876,9 @@ static int fs_is_newer(md_store_t *store, md_store_group_t group1, md_store_grou
 static apr_status_t pfs_get_modified(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
 {
     md_store_fs_t *s_fs = baton;
-    const char *fname, *name, *aspect;
+    const char *name, *aspect;
     md_store_group_t group;
-    apr_finfo_t inf;
     apr_time_t *pmtime;
-    apr_status_t rv;
     
     (void)p;
     group = (md_store_group_t)va_arg(ap, int);
@@ -600,13 +886,7 @@ static apr_status_t pfs_get_modified(void *baton, apr_pool_t *p, apr_pool_t *pte
     aspect = va_arg(ap, const char*);
     pmtime = va_arg(ap, apr_time_t*);
     
-    *pmtime = 0;
-    if (   MD_OK(fs_get_fname(&fname, &s_fs->s, group, name, aspect, ptemp))
-        && MD_OK(apr_stat(&inf, fname, APR_FINFO_MTIME, ptemp))) {
-        *pmtime = inf.mtime;
-    }
-
-    return rv;
+    return fs_get_mtime(pmtime, s_fs, group, name, aspect, ptemp);
 }
 
 static apr_time_t fs_get_modified(md_store_t *store, md_store_group_t group,  
@@ -667,7 +947,7 @@ static apr_status_t pfs_save(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
             case MD_SV_PKEY:
                 /* Take care that we write private key with access only to the user,
                  * unless we write the key encrypted */
-                get_pass(&pass, &pass_len, s_fs, group);
+                get_pass(&pass, &pass_len, s_fs, group, aspect);
                 rv = md_pkey_fsave((md_pkey_t *)value, ptemp, pass, pass_len, 
                                    fpath, (pass && pass_len)? perms->file : MD_FPROT_F_UONLY);
                 break;
@@ -678,6 +958,7 @@ static apr_status_t pfs_save(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
                 return APR_ENOTIMPL;
         }
         if (APR_SUCCESS == rv) {
+            pk_evict(s_fs, group, name, aspect);
             rv = dispatch(s_fs, MD_S_FS_EV_CREATED, group, fpath, APR_REG, p);
         }
     }
@@ -714,7 +995,10 @@ static apr_status_t pfs_remove(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va
         }
     
         rv = apr_file_remove(fpath, ptemp);
-        if (APR_ENOENT == rv && force) {
+        if (APR_SUCCESS == rv) {
+            pk_evict(s_fs, group, name, aspect);
+        }
+        else if (APR_ENOENT == rv && force) {
             rv = APR_SUCCESS;
         }
     }
@@ -761,7 +1045,9 @@ static apr_status_t pfs_purge(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_
 
     if (MD_OK(md_util_path_merge(&dir, ptemp, s_fs->base, groupname, name, NULL))) {
         /* Remove all files in dir, there should be no sub-dirs */
-        rv = md_util_rm_recursive(dir, ptemp, 1);
+        if (MD_OK(md_util_rm_recursive(dir, ptemp, 1))) {
+            pk_evict(s_fs, group, name, NULL);
+        }
     }
     if (!APR_STATUS_IS_ENOENT(rv)) {
         md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, rv, ptemp, "purge %s/%s (%s)", groupname, name, dir);
@@ -789,6 +1075,8 @@ typedef struct {
     const char *dirname;
     void *baton;
     apr_time_t ts;
+    int max_items;
+    int count;
 } inspect_ctx;
 
 static apr_status_t insp(void *baton, apr_pool_t *p, apr_pool_t *ptemp, 
@@ -802,7 +1090,7 @@ static apr_status_t insp(void *baton, apr_pool_t *p, apr_pool_t *ptemp,
     (void)ftype;   
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE3, 0, ptemp, "inspecting value at: %s/%s", dir, name);
     if (APR_SUCCESS == (rv = md_util_path_merge(&fpath, ptemp, dir, name, NULL))) {
-        rv = fs_fload(&value, ctx->s_fs, fpath, ctx->group, ctx->vtype, p, ptemp);
+        rv = fs_fload(&value, ctx->s_fs, fpath, ctx->group, name, ctx->vtype, p, ptemp);
         if (APR_SUCCESS == rv 
             && !ctx->inspect(ctx->baton, ctx->dirname, name, ctx->vtype, value, p)) {
             return APR_EOF;
@@ -898,9 +1186,17 @@ static apr_status_t remove_nms_file(void *baton, apr_pool_t *p, apr_pool_t *ptem
     if (APR_SUCCESS != (rv = md_util_path_merge(&fname, ptemp, dir, name, NULL))) goto leave;
     if (APR_SUCCESS != (rv = apr_stat(&inf, fname, APR_FINFO_MTIME, ptemp))) goto leave;
     if (inf.mtime >= ctx->ts) goto leave;
+    if (ctx->max_items > 0 && ctx->count >= ctx->max_items) {
+        rv = APR_INCOMPLETE;
+        goto leave;
+    }
 
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE3, 0, ptemp, "remove_nms file: %s/%s", dir, name);
     rv = apr_file_remove(fname, ptemp);
+    if (APR_SUCCESS == rv) {
+        ++ctx->count;
+        pk_evict(ctx->s_fs, ctx->group, ctx->dirname, name);
+    }
 
 leave:
     return rv;
@@ -927,20 +1223,24 @@ static apr_status_t remove_nms_dir(void *baton, apr_pool_t *p, apr_pool_t *ptemp
 
 static apr_status_t fs_remove_nms(md_store_t *store, apr_pool_t *p, 
                                   apr_time_t modified, md_store_group_t group, 
-                                  const char *name, const char *aspect)
+                                  const char *name, const char *aspect,
+                                  int max_items, int *premoved)
 {
     const char *groupname;
     apr_status_t rv;
     inspect_ctx ctx;
     
+    memset(&ctx, 0, sizeof(ctx));
     ctx.s_fs = FS_STORE(store);
     ctx.group = group;
     ctx.pattern = name;
     ctx.aspect = aspect;
     ctx.ts = modified;
+    ctx.max_items = max_items;
     groupname = md_store_group_name(group);
 
     rv = md_util_files_do(remove_nms_dir, &ctx, p, ctx.s_fs->base, groupname, name, NULL);
+    if (premoved) *premoved = ctx.count;
     
     return rv;
 }
@@ -1048,6 +1348,9 @@ static apr_status_t pfs_move(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
             apr_file_rename(narch_dir, to_dir, ptemp);
             goto out;
         }
+        pk_evict(s_fs, from, name, NULL);
+        pk_evict(s_fs, to, name, NULL);
+        pk_evict(s_fs, MD_SG_ARCHIVE, apr_psprintf(ptemp, "%s.%d", name, n), NULL);
         if (MD_OK(dispatch(s_fs, MD_S_FS_EV_MOVED, to, to_dir, APR_DIR, ptemp))) {
             rv = dispatch(s_fs, MD_S_FS_EV_MOVED, MD_SG_ARCHIVE, narch_dir, APR_DIR, ptemp);
         }
@@ -1058,6 +1361,8 @@ static apr_status_t pfs_move(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
                           from_dir, to_dir);
             goto out;
         }
+        pk_evict(s_fs, from, name, NULL);
+        pk_evict(s_fs, to, name, NULL);
     }
     else {
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "target is no dir: %s", to_dir);
@@ -1101,6 +1406,10 @@ static apr_status_t pfs_rename(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va
                       from_dir, to_dir);
         goto out;
     }
+    if (APR_SUCCESS == rv) {
+        pk_evict(s_fs, group, from, NULL);
+        pk_evict(s_fs, group, to, NULL);
+    }
 out:
     return rv;
 }
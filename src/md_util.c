@@ -22,12 +22,18 @@
 #include <apr_portable.h>
 #include <apr_file_info.h>
 #include <apr_fnmatch.h>
+#include <apr_hash.h>
 #include <apr_tables.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
 #include <apr_uri.h>
 
 #if APR_HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#if APR_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include "md.h"
 #include "md_log.h"
@@ -72,6 +78,130 @@ apr_status_t md_util_pool_vdo(md_util_vaction *cb, void *baton, apr_pool_t *p, .
     va_end(ap);
     return rv;
 }
+
+typedef struct {
+    md_util_work_cb *cb;
+    void *baton;
+    int n;
+    int next;
+    int failed_idx;
+    apr_status_t failed_rv;
+    apr_thread_mutex_t *mutex;
+} parallel_ctx;
+
+typedef struct {
+    parallel_ctx *ctx;
+    apr_pool_t *p;
+    apr_thread_t *thread;
+} parallel_worker;
+
+static void parallel_done(parallel_ctx *ctx, int i, apr_status_t rv)
+{
+    if (APR_SUCCESS != rv && (ctx->failed_idx < 0 || i < ctx->failed_idx)) {
+        ctx->failed_idx = i;
+        ctx->failed_rv = rv;
+    }
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC parallel_run(apr_thread_t *thread, void *data)
+{
+    parallel_worker *worker = data;
+    parallel_ctx *ctx = worker->ctx;
+    apr_status_t rv;
+    int i;
+
+    (void)thread;
+    apr_thread_mutex_lock(ctx->mutex);
+    while (ctx->next < ctx->n) {
+        i = ctx->next++;
+        apr_thread_mutex_unlock(ctx->mutex);
+        rv = ctx->cb(ctx->baton, i, worker->p);
+        apr_thread_mutex_lock(ctx->mutex);
+        parallel_done(ctx, i, rv);
+    }
+    apr_thread_mutex_unlock(ctx->mutex);
+    return NULL;
+}
+
+static int parallel_start(parallel_ctx *ctx, parallel_worker *workers, int max_workers,
+                          apr_pool_t *p)
+{
+    apr_allocator_t *allocator;
+    apr_status_t rv;
+    int started;
+
+    for (started = 0; started < max_workers; ++started) {
+        parallel_worker *worker = &workers[started];
+
+        worker->ctx = ctx;
+        /* Each worker allocates from its own allocator, as pool allocators are not
+         * synchronized. The pools are created here, before any thread runs. */
+        if (APR_SUCCESS != (rv = apr_allocator_create(&allocator))) goto leave;
+        rv = apr_pool_create_ex(&worker->p, p, NULL, allocator);
+        if (APR_SUCCESS != rv) {
+            apr_allocator_destroy(allocator);
+            goto leave;
+        }
+        apr_allocator_owner_set(allocator, worker->p);
+        apr_pool_tag(worker->p, "md_parallel_worker");
+        rv = apr_thread_create(&worker->thread, NULL, parallel_run, worker, worker->p);
+        if (APR_SUCCESS != rv) goto leave;
+    }
+    return started;
+leave:
+    md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p,
+                  "started only %d of %d worker threads", started, max_workers);
+    return started;
+}
+#endif /* APR_HAS_THREADS */
+
+apr_status_t md_util_parallel_do(md_util_work_cb *cb, void *baton, int n,
+                                 int max_workers, apr_pool_t *p)
+{
+    parallel_ctx ctx;
+    int i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.cb = cb;
+    ctx.baton = baton;
+    ctx.n = n;
+    ctx.failed_idx = -1;
+    ctx.failed_rv = APR_SUCCESS;
+
+#if APR_HAS_THREADS
+    if (max_workers > n) max_workers = n;
+    if (max_workers > 1
+        && APR_SUCCESS == apr_thread_mutex_create(&ctx.mutex, APR_THREAD_MUTEX_DEFAULT, p)) {
+        parallel_worker *workers;
+        apr_status_t trv;
+        int started;
+
+        workers = apr_pcalloc(p, (apr_size_t)max_workers * sizeof(*workers));
+        started = parallel_start(&ctx, workers, max_workers, p);
+        for (i = 0; i < started; ++i) {
+            apr_thread_join(&trv, workers[i].thread);
+        }
+        if (started > 0) return ctx.failed_rv;
+    }
+#else
+    (void)max_workers;
+#endif
+    for (i = 0; i < n; ++i) {
+        parallel_done(&ctx, i, cb(baton, i, p));
+    }
+    return ctx.failed_rv;
+}
+
+int md_util_cpu_count(void)
+{
+    int count = 0;
+#if APR_HAVE_UNISTD_H && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) count = (n > MD_UTIL_MAX_WORKERS)? MD_UTIL_MAX_WORKERS : (int)n;
+#endif
+    return (count > 0)? count : MD_UTIL_DEF_WORKERS;
+}
  
 /**************************************************************************************************/
 /* data chunks */
@@ -413,16 +543,54 @@ int md_file_exists(const char *fname, apr_pool_t *p)
     return (fname && *fname && APR_SUCCESS == md_util_is_file(fname, p));
 }
 
+int md_util_is_plain_segment(const char *segment)
+{
+    const char *s;
+    
+    if (!segment || !*segment || !strcmp(".", segment) || !strcmp("..", segment)) return 0;
+    for (s = segment; *s; ++s) {
+        if (*s == '/' || *s == '\\' || *s == ':' || *s == '*' || *s == '?') return 0;
+    }
+    return 1;
+}
+
 apr_status_t md_util_path_merge(const char **ppath, apr_pool_t *p, ...)
 {
     const char *segment, *path;
-    va_list ap;
+    apr_size_t len, plen;
+    char *buf;
+    va_list ap, ap2;
+    int i, nplain;
     apr_status_t rv = APR_SUCCESS;
     
     va_start(ap, p);
     path = va_arg(ap, char *);
     while (path && APR_SUCCESS == rv && (segment = va_arg(ap, char *))) {
         rv = apr_filepath_merge((char **)&path, path, segment, APR_FILEPATH_SECUREROOT , p);
+        if (APR_SUCCESS != rv) break;
+        /* `path` is canonical now and plain segments following it can
+         * be appended as they are, using a single allocation. */
+        plen = len = strlen(path);
+        nplain = 0;
+        va_copy(ap2, ap);
+        while ((segment = va_arg(ap2, char *)) && md_util_is_plain_segment(segment)) {
+            len += 1 + strlen(segment);
+            ++nplain;
+        }
+        va_end(ap2);
+        if (nplain > 0) {
+            buf = apr_palloc(p, len + 1);
+            memcpy(buf, path, plen);
+            for (i = 0; i < nplain; ++i) {
+                segment = va_arg(ap, char *);
+                if (plen > 0 && buf[plen-1] != '/') buf[plen++] = '/';
+                len = strlen(segment);
+                memcpy(buf + plen, segment, len);
+                plen += len;
+            }
+            buf[plen] = '\0';
+            path = buf;
+        }
     }
     va_end(ap);
     
@@ -488,6 +656,34 @@ apr_status_t md_text_fread8k(const char **ptext, apr_pool_t *p, const char *fpat
     return rv;
 }
 
+apr_status_t md_data_fread(md_data_t **pdata, apr_pool_t *p, const char *fpath)
+{
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    md_data_t *d;
+    char *buf;
+    apr_size_t len;
+    apr_status_t rv;
+
+    *pdata = NULL;
+    if (APR_SUCCESS != (rv = apr_file_open(&f, fpath, APR_FOPEN_READ, 0, p))) return rv;
+    if (APR_SUCCESS == (rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f))) {
+        len = (apr_size_t)finfo.size;
+        buf = apr_palloc(p, len + 1);
+        rv = apr_file_read_full(f, buf, len, &len);
+        /* the file may have become shorter meanwhile */
+        if (APR_SUCCESS == rv || APR_STATUS_IS_EOF(rv)) {
+            buf[len] = '\0';
+            d = apr_palloc(p, sizeof(*d));
+            md_data_init(d, buf, len);
+            *pdata = d;
+            rv = APR_SUCCESS;
+        }
+    }
+    apr_file_close(f);
+    return rv;
+}
+
 static apr_status_t write_text(void *baton, struct apr_file_t *f, apr_pool_t *p)
 {
     const char *text = baton;
@@ -867,38 +1063,178 @@ int md_dns_matches(const char *pattern, const char *domain)
     return 0;
 }
 
+/* Longest DNS name we look up without allocating. Longer names are not
+ * valid DNS names anyway and matched by comparing against all entries. */
+#define MD_DNS_KEY_MAX          256
+
+typedef struct {
+    const char *domain;         /* as added */
+    int idx;                    /* order of addition */
+} dns_entry_t;
+
+struct md_dns_set_t {
+    apr_pool_t *p;
+    apr_array_header_t *entries;    /* dns_entry_t* in order of addition */
+    apr_hash_t *names;              /* lower case domain -> first entry */
+    apr_hash_t *wild_parents;       /* ".example.org" -> first entry "*.example.org" */
+    apr_hash_t *parents;            /* ".example.org" -> first entry "a.example.org" */
+};
+
+static const char *dns_key(char *buf, const char *name)
+{
+    apr_size_t i;
+
+    for (i = 0; name[i]; ++i) {
+        if (i+1 >= MD_DNS_KEY_MAX) return NULL;
+        buf[i] = (char)apr_tolower(name[i]);
+    }
+    buf[i] = '\0';
+    return buf;
+}
+
+static void dns_index_add(apr_hash_t *index, const char *key, dns_entry_t *entry)
+{
+    if (key && !apr_hash_get(index, key, APR_HASH_KEY_STRING)) {
+        apr_hash_set(index, key, APR_HASH_KEY_STRING, entry);
+    }
+}
+
+static dns_entry_t *dns_first(dns_entry_t *e1, dns_entry_t *e2)
+{
+    if (!e1) return e2;
+    if (!e2) return e1;
+    return (e1->idx <= e2->idx)? e1 : e2;
+}
+
+md_dns_set_t *md_dns_set_make(apr_pool_t *p, int nelts)
+{
+    md_dns_set_t *set;
+
+    set = apr_pcalloc(p, sizeof(*set));
+    set->p = p;
+    set->entries = apr_array_make(p, nelts > 0? nelts : 5, sizeof(dns_entry_t*));
+    set->names = apr_hash_make(p);
+    set->wild_parents = apr_hash_make(p);
+    set->parents = apr_hash_make(p);
+    return set;
+}
+
+void md_dns_set_add(md_dns_set_t *set, const char *domain)
+{
+    dns_entry_t *entry;
+    char *key;
+
+    entry = apr_palloc(set->p, sizeof(*entry));
+    entry->domain = domain;
+    entry->idx = set->entries->nelts;
+    APR_ARRAY_PUSH(set->entries, dns_entry_t*) = entry;
+
+    key = md_util_str_tolower(apr_pstrdup(set->p, domain));
+    dns_index_add(set->names, key, entry);
+    if (key[0] == '*' && key[1] == '.') {
+        dns_index_add(set->wild_parents, key+1, entry);
+    }
+    dns_index_add(set->parents, strchr(key, '.'), entry);
+}
+
+md_dns_set_t *md_dns_set_of(apr_pool_t *p, const apr_array_header_t *domains)
+{
+    md_dns_set_t *set;
+    int i;
+
+    set = md_dns_set_make(p, domains->nelts);
+    for (i = 0; i < domains->nelts; ++i) {
+        md_dns_set_add(set, APR_ARRAY_IDX(domains, i, const char*));
+    }
+    return set;
+}
+
+int md_dns_set_count(const md_dns_set_t *set)
+{
+    return set->entries->nelts;
+}
+
+const char *md_dns_set_match(const md_dns_set_t *set, const char *name)
+{
+    char buf[MD_DNS_KEY_MAX];
+    const char *key, *parent;
+    dns_entry_t *entry;
+    int i;
+
+    if (NULL == (key = dns_key(buf, name))) {
+        for (i = 0; i < set->entries->nelts; ++i) {
+            entry = APR_ARRAY_IDX(set->entries, i, dns_entry_t*);
+            if (md_dns_matches(entry->domain, name)) return entry->domain;
+        }
+        return NULL;
+    }
+    entry = apr_hash_get(set->names, key, APR_HASH_KEY_STRING);
+    if ((parent = strchr(key, '.'))) {
+        entry = dns_first(entry, apr_hash_get(set->wild_parents, parent, APR_HASH_KEY_STRING));
+    }
+    return entry? entry->domain : NULL;
+}
+
+const char *md_dns_set_matched_by(const md_dns_set_t *set, const char *pattern)
+{
+    char buf[MD_DNS_KEY_MAX];
+    const char *key;
+    dns_entry_t *entry;
+    int i;
+
+    if (NULL == (key = dns_key(buf, pattern))) {
+        for (i = 0; i < set->entries->nelts; ++i) {
+            entry = APR_ARRAY_IDX(set->entries, i, dns_entry_t*);
+            if (md_dns_matches(pattern, entry->domain)) return entry->domain;
+        }
+        return NULL;
+    }
+    entry = apr_hash_get(set->names, key, APR_HASH_KEY_STRING);
+    if (key[0] == '*' && key[1] == '.') {
+        entry = dns_first(entry, apr_hash_get(set->parents, key+1, APR_HASH_KEY_STRING));
+    }
+    return entry? entry->domain : NULL;
+}
+
 apr_array_header_t *md_dns_make_minimal(apr_pool_t *p, apr_array_header_t *domains)
 {
     apr_array_header_t *minimal;
-    const char *domain, *pattern;
-    int i, j, duplicate;
+    md_dns_set_t *kept;
+    apr_hash_t *wild_last;
+    const char *domain, *parent;
+    char buf[MD_DNS_KEY_MAX];
+    int i, duplicate, *is_wild, *last;
+    
+    /* Where a wildcard occurs last, by its parent domain. A plain name
+     * is dropped if a wildcard matching it comes later in the list. */
+    wild_last = apr_hash_make(p);
+    is_wild = apr_pcalloc(p, (apr_size_t)(domains->nelts + 1) * sizeof(int));
+    for (i = 0; i < domains->nelts; ++i) {
+        domain = APR_ARRAY_IDX(domains, i, const char*);
+        /* is_wild[i] == i+1 for wildcards, so we can point to it */
+        if (md_dns_is_wildcard(p, domain)) {
+            is_wild[i] = i+1;
+            apr_hash_set(wild_last, md_util_str_tolower(apr_pstrdup(p, domain+1)), 
+                         APR_HASH_KEY_STRING, &is_wild[i]);
+        }
+    }
     
     minimal = apr_array_make(p, domains->nelts, sizeof(const char *));
+    kept = md_dns_set_make(p, domains->nelts);
     for (i = 0; i < domains->nelts; ++i) {
         domain = APR_ARRAY_IDX(domains, i, const char*);
-        duplicate = 0;
         /* is it matched in minimal already? */
-        for (j = 0; j < minimal->nelts; ++j) {
-            pattern = APR_ARRAY_IDX(minimal, j, const char*);
-            if (md_dns_matches(pattern, domain)) {
-                duplicate = 1;
-                break;
+        duplicate = (md_dns_set_match(kept, domain) != NULL);
+        if (!duplicate && !is_wild[i] && apr_hash_count(wild_last) > 0) {
+            /* plain name, will we see a wildcard that replaces it? */
+            if (dns_key(buf, domain) && (parent = strchr(buf, '.'))
+                && (last = apr_hash_get(wild_last, parent, APR_HASH_KEY_STRING))) {
+                duplicate = (*last > i+1);
             }
         }
         if (!duplicate) {
-            if (!md_dns_is_wildcard(p, domain)) {
-                /* plain name, will we see a wildcard that replaces it? */
-                for (j = i+1; j < domains->nelts; ++j) {
-                    pattern = APR_ARRAY_IDX(domains, j, const char*);
-                    if (md_dns_is_wildcard(p, pattern) && md_dns_matches(pattern, domain)) {
-                        duplicate = 1;
-                        break;
-                    }
-                }
-            }
-            if (!duplicate) {
-                APR_ARRAY_PUSH(minimal, const char *) = domain; 
-            }
+            APR_ARRAY_PUSH(minimal, const char *) = domain; 
+            md_dns_set_add(kept, domain);
         }
     }
     return minimal;
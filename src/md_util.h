@@ -40,7 +40,32 @@ typedef apr_status_t md_util_action(void *baton, apr_pool_t *p, apr_pool_t *ptem
 typedef apr_status_t md_util_vaction(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap);
 
 apr_status_t md_util_pool_do(md_util_action *cb, void *baton, apr_pool_t *p); 
-apr_status_t md_util_pool_vdo(md_util_vaction *cb, void *baton, apr_pool_t *p, ...); 
+apr_status_t md_util_pool_vdo(md_util_vaction *cb, void *baton, apr_pool_t *p, ...);
+
+/**
+ * Work callback for md_util_parallel_do(), invoked once for every index `i`.
+ * Invocations may run concurrently on different threads, each thread using its
+ * own pool `p`. Anything allocated from `p` lives as long as the parent pool.
+ */
+typedef apr_status_t md_util_work_cb(void *baton, int i, apr_pool_t *p);
+
+/**
+ * Invoke `cb` for all indices 0 <= i < n on at most `max_workers` threads.
+ * Without thread support, or when there is not enough work, all items are
+ * done sequentially on `p`. All items are processed, even when some fail.
+ * @return APR_SUCCESS or the status of the failed item with the lowest index
+ */
+apr_status_t md_util_parallel_do(md_util_work_cb *cb, void *baton, int n,
+                                 int max_workers, apr_pool_t *p);
+
+#define MD_UTIL_DEF_WORKERS     4
+#define MD_UTIL_MAX_WORKERS     16
+
+/**
+ * The number of online processors, limited to MD_UTIL_MAX_WORKERS, for sizing
+ * md_util_parallel_do() work. MD_UTIL_DEF_WORKERS if that cannot be determined.
+ */
+int md_util_cpu_count(void);
 
 /**************************************************************************************************/
 /* data chunks */
@@ -178,6 +203,42 @@ int md_dns_matches(const char *pattern, const char *domain);
 struct apr_array_header_t *md_dns_make_minimal(apr_pool_t *p, 
                                                struct apr_array_header_t *domains);
 
+/**
+ * A set of domain names and wildcards, for matching many names against
+ * it in constant time each, the same as md_dns_matches() does. Once all
+ * domains are added, a set may be read from several threads.
+ */
+typedef struct md_dns_set_t md_dns_set_t;
+
+/**
+ * Create an empty set, allocated from `p`, for about `nelts` domains.
+ */
+md_dns_set_t *md_dns_set_make(apr_pool_t *p, int nelts);
+
+/**
+ * Add a domain name or wildcard to the set. `domain` is not copied.
+ */
+void md_dns_set_add(md_dns_set_t *set, const char *domain);
+
+/**
+ * Create a set of all `domains`, allocated from `p`. The names are not copied.
+ */
+md_dns_set_t *md_dns_set_of(apr_pool_t *p, const apr_array_header_t *domains);
+
+int md_dns_set_count(const md_dns_set_t *set);
+
+/**
+ * @return the first added domain that matches `name` as in 
+ *         md_dns_matches(domain, name), or NULL if there is none
+ */
+const char *md_dns_set_match(const md_dns_set_t *set, const char *name);
+
+/**
+ * @return the first added domain that `pattern` matches as in 
+ *         md_dns_matches(pattern, domain), or NULL if there is none
+ */
+const char *md_dns_set_matched_by(const md_dns_set_t *set, const char *pattern);
+
 /**
  * Determine if the given domains cover the name, including wildcard matching.
  * @return != 0 iff name is matched by list of domains
@@ -202,6 +263,13 @@ apr_status_t md_util_fcreatex(struct apr_file_t **pf, const char *fn,
 
 apr_status_t md_util_path_merge(const char **ppath, apr_pool_t *p, ...);
 
+/**
+ * Return != 0 iff `segment` can be appended to a canonical path as is, e.g.
+ * it is not empty, not "." or ".." and contains no path or drive separator
+ * and no wildcard.
+ */
+int md_util_is_plain_segment(const char *segment);
+
 apr_status_t md_util_is_dir(const char *path, apr_pool_t *pool);
 apr_status_t md_util_is_file(const char *path, apr_pool_t *pool);
 apr_status_t md_util_is_unix_socket(const char *path, apr_pool_t *pool);
@@ -234,6 +302,8 @@ apr_status_t md_util_tree_do(md_util_fdo_cb *cb, void *baton, apr_pool_t *p,
 apr_status_t md_util_ftree_remove(const char *path, apr_pool_t *p);
 
 apr_status_t md_text_fread8k(const char **ptext, apr_pool_t *p, const char *fpath);
+/* Read the whole file into data allocated from `p`. */
+apr_status_t md_data_fread(md_data_t **pdata, apr_pool_t *p, const char *fpath);
 apr_status_t md_text_fcreatex(const char *fpath, apr_fileperms_t 
                               perms, apr_pool_t *p, const char *text);
 apr_status_t md_text_freplace(const char *fpath, apr_fileperms_t perms, 
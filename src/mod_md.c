@@ -16,6 +16,7 @@
 
 #include <assert.h>
 #include <apr_optional.h>
+#include <apr_shm.h>
 #include <apr_strings.h>
 
 #include <mpm_common.h>
@@ -39,6 +40,7 @@
 #include "md_store.h"
 #include "md_store_fs.h"
 #include "md_log.h"
+#include "md_metrics.h"
 #include "md_ocsp.h"
 #include "md_result.h"
 #include "md_reg.h"
@@ -229,18 +231,54 @@ static apr_status_t on_event(const char *event, const char *mdomain, void *baton
 /**************************************************************************************************/
 /* store setup */
 
+static int is_pem_file(const char *fname)
+{
+    apr_size_t len = strlen(fname);
+    return len > 4 && !apr_cstr_casecmp(".pem", fname + len - 4);
+}
+
+/* The name of the MD a store file or directory belongs to, e.g. "name" for
+ * ".../domains/name/pubcert.pem" and for ".../domains/name", or NULL. */
+static const char *store_ev_md_name(const char *fname, apr_filetype_e ftype, apr_pool_t *p)
+{
+    const char *end = (ftype == APR_DIR)? fname + strlen(fname) : strrchr(fname, '/');
+    const char *start = end;
+
+    while (start && start > fname && start[-1] != '/') --start;
+    return (start && start < end)? apr_pstrndup(p, start, (apr_size_t)(end - start)) : NULL;
+}
+
 static apr_status_t store_file_ev(void *baton, struct md_store_t *store,
                                     md_store_fs_ev_t ev, unsigned int group,
                                     const char *fname, apr_filetype_e ftype,
                                     apr_pool_t *p)
 {
     server_rec *s = baton;
+    md_srv_conf_t *sc;
+    const char *name;
     apr_status_t rv;
 
     (void)store;
     ap_log_error(APLOG_MARK, APLOG_TRACE3, 0, s, "store event=%d on %s %s (group %d)",
                  ev, (ftype == APR_DIR)? "dir" : "file", fname, group);
 
+    if (group == MD_SG_DOMAINS && (ftype == APR_DIR || is_pem_file(fname))) {
+        /* let the registry forget the certificates it has cached for the MD */
+        sc = md_config_get(s);
+        if (sc && sc->mc && sc->mc->reg && (name = store_ev_md_name(fname, ftype, p))) {
+            md_reg_certs_changed(sc->mc->reg, name);
+        }
+    }
+    if (ftype == APR_REG && (group == MD_SG_DOMAINS || group == MD_SG_STAGING
+                             || group == MD_SG_OCSP)) {
+        /* files of an MD, e.g. its job.json, changed its status */
+        sc = md_config_get(s);
+        if (sc && sc->mc && sc->mc->status_snap 
+            && (name = store_ev_md_name(fname, ftype, p))) {
+            md_status_snap_changed(sc->mc->status_snap, name);
+        }
+    }
+
     /* Directories in group CHALLENGES, STAGING and OCSP are written to
      * under a different user. Give her ownership.
      */
@@ -465,7 +503,8 @@ set_and_leave:
     return md_reg_set_props(mc->reg, p, mc->can_http, mc->can_https);
 }
 
-static server_rec *get_public_https_server(md_t *md, const char *domain, server_rec *base_server)
+static server_rec *get_public_https_server(md_t *md, const char *domain, server_rec *base_server,
+                                           apr_array_header_t *servers)
 {
     md_srv_conf_t *sc;
     md_mod_conf_t *mc;
@@ -487,45 +526,44 @@ static server_rec *get_public_https_server(md_t *md, const char *domain, server_
     if (check_port && !mc->can_https) return NULL;
 
     /* find an ssl server matching domain from MD */
-    for (s = base_server; s; s = s->next) {
+    for (i = 0; i < servers->nelts; ++i) {
+        s = APR_ARRAY_IDX(servers, i, server_rec*);
         sc = md_config_get(s);
-        if (!sc || !sc->is_ssl || !sc->assigned) continue;
+        if (!sc || !sc->is_ssl) continue;
         if (base_server == s && !mc->manage_base_server) continue;
         if (base_server != s && check_port && mc->local_443 > 0 && !uses_port(s, mc->local_443)) continue;
-        for (i = 0; i < sc->assigned->nelts; ++i) {
-            if (md == APR_ARRAY_IDX(sc->assigned, i, md_t*)) {
-                r.server = s;
-                if (ap_matches_request_vhost(&r, domain, s->port)) {
-                    if (check_port) {
-                        return s;
-                    }
-                    else {
-                        /* there may be multiple matching servers because we ignore the port.
-                           if possible, choose a server that supports the acme-tls/1 protocol */
-                        if (ap_is_allowed_protocol(NULL, NULL, s, PROTO_ACME_TLS_1)) {
-                            return s;
-                        }
-                        res = s;
-                    }
+        r.server = s;
+        if (ap_matches_request_vhost(&r, domain, s->port)) {
+            if (check_port) {
+                return s;
+            }
+            else {
+                /* there may be multiple matching servers because we ignore the port.
+                   if possible, choose a server that supports the acme-tls/1 protocol */
+                if (ap_is_allowed_protocol(NULL, NULL, s, PROTO_ACME_TLS_1)) {
+                    return s;
                 }
+                res = s;
             }
         }
     }
     return res;
 }
 
-static apr_status_t auto_add_domains(md_t *md, server_rec *base_server, apr_pool_t *p)
+static apr_status_t auto_add_domains(md_t *md, server_rec *base_server, 
+                                     apr_array_header_t *servers, apr_pool_t *p)
 {
     md_srv_conf_t *sc;
     server_rec *s;
     apr_status_t rv = APR_SUCCESS;
-    int updates;
+    int i, updates;
 
     /* Ad all domain names used in SSL VirtualHosts, if not already there */
     ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, base_server,
                  "md[%s]: auto add domains", md->name);
     updates = 0;
-    for (s = base_server; s; s = s->next) {
+    for (i = 0; i < servers->nelts; ++i) {
+        s = APR_ARRAY_IDX(servers, i, server_rec*);
         sc = md_config_get(s);
         if (!sc || !sc->is_ssl || !sc->assigned || sc->assigned->nelts != 1) continue;
         if (md != APR_ARRAY_IDX(sc->assigned, 0, md_t*)) continue;
@@ -536,7 +574,8 @@ static apr_status_t auto_add_domains(md_t *md, server_rec *base_server, apr_pool
     return rv;
 }
 
-static void init_acme_tls_1_domains(md_t *md, server_rec *base_server)
+static void init_acme_tls_1_domains(md_t *md, server_rec *base_server, 
+                                    apr_array_header_t *servers)
 {
     md_srv_conf_t *sc;
     md_mod_conf_t *mc;
@@ -552,7 +591,7 @@ static void init_acme_tls_1_domains(md_t *md, server_rec *base_server)
     apr_array_clear(md->acme_tls_1_domains);
     for (i = 0; i < md->domains->nelts; ++i) {
         domain = APR_ARRAY_IDX(md->domains, i, const char*);
-        s = get_public_https_server(md, domain, base_server);
+        s = get_public_https_server(md, domain, base_server, servers);
         /* If we did not find a specific virtualhost for md and manage
          * the base_server, that one is inspected */
         if (NULL == s && mc->manage_base_server) s = base_server;
@@ -571,108 +610,324 @@ static void init_acme_tls_1_domains(md_t *md, server_rec *base_server)
     }
 }
 
-static apr_status_t link_md_to_servers(md_mod_conf_t *mc, md_t *md, server_rec *base_server,
-                                       apr_pool_t *p)
+/* Index over the names of all server_rec, so that linking an MD only
+ * looks at the servers that can match one of its domains. Keys are
+ * lower case, values are arrays of server numbers in config order. */
+typedef struct {
+    int nservers;
+    server_rec **servers;       /* all servers, in config order */
+    apr_hash_t *names;          /* ServerName, ServerAlias and <VirtualHost> names */
+    apr_hash_t *hostnames;      /* ServerName only */
+    apr_hash_t *host_parents;   /* ServerName without its first label, e.g. ".example.org" */
+    apr_hash_t *wild_suffixes;  /* ServerAlias "*.example.org" as ".example.org" */
+    apr_array_header_t *wild_others; /* servers with other ServerAlias patterns */
+    int *match;                 /* per server, index of first matching domain or -1 */
+} vhost_index_t;
+
+static void vhost_index_add(apr_hash_t *index, const char *name, int n, apr_pool_t *p)
 {
-    server_rec *s;
-    request_rec r;
-    md_srv_conf_t *sc;
-    int i;
-    const char *domain, *uri;
+    apr_array_header_t *servers;
+    char *key;
 
-    sc = md_config_get(base_server);
+    if (!name || !*name) return;
+    key = md_util_str_tolower(apr_pstrdup(p, name));
+    servers = apr_hash_get(index, key, APR_HASH_KEY_STRING);
+    if (!servers) {
+        servers = apr_array_make(p, 1, sizeof(int));
+        apr_hash_set(index, key, APR_HASH_KEY_STRING, servers);
+    }
+    else if (APR_ARRAY_IDX(servers, servers->nelts-1, int) == n) {
+        return;
+    }
+    APR_ARRAY_PUSH(servers, int) = n;
+}
 
-    /* Assign the MD to all server_rec configs that it matches. If there already
-     * is an assigned MD not equal this one, the configuration is in error.
-     */
-    memset(&r, 0, sizeof(r));
-    for (s = base_server; s; s = s->next) {
+static int is_wild_suffix(const char *pattern)
+{
+    /* "*.example.org" matches exactly all names ending in ".example.org" */
+    return pattern[0] == '*' && pattern[1] == '.' && pattern[2]
+        && !strchr(pattern+1, '*') && !strchr(pattern+1, '?');
+}
+
+static void vhost_index_make(vhost_index_t *vi, md_mod_conf_t *mc, 
+                             server_rec *base_server, apr_pool_t *p)
+{
+    server_rec *s;
+    server_addr_rec *sar;
+    const char *name;
+    int n, i, has_others;
+
+    memset(vi, 0, sizeof(*vi));
+    for (s = base_server; s; s = s->next) ++vi->nservers;
+    vi->servers = apr_pcalloc(p, (apr_size_t)vi->nservers * sizeof(server_rec*));
+    vi->match = apr_palloc(p, (apr_size_t)vi->nservers * sizeof(int));
+    vi->names = apr_hash_make(p);
+    vi->hostnames = apr_hash_make(p);
+    vi->host_parents = apr_hash_make(p);
+    vi->wild_suffixes = apr_hash_make(p);
+    vi->wild_others = apr_array_make(p, 5, sizeof(int));
+
+    for (s = base_server, n = 0; s; s = s->next, ++n) {
+        vi->servers[n] = s;
+        vi->match[n] = -1;
         if (!mc->manage_base_server && s == base_server) {
             /* we shall not assign ourselves to the base server */
             continue;
         }
+        /* what ap_matches_request_vhost() looks at, see link_md_to_servers() */
+        for (sar = s->addrs; sar; sar = sar->next) {
+            if (sar->host_port == 0 || sar->host_port == s->port) {
+                vhost_index_add(vi->names, sar->virthost, n, p);
+            }
+        }
+        vhost_index_add(vi->names, s->server_hostname, n, p);
+        for (i = 0; s->names && i < s->names->nelts; ++i) {
+            vhost_index_add(vi->names, APR_ARRAY_IDX(s->names, i, const char*), n, p);
+        }
+        has_others = 0;
+        for (i = 0; s->wild_names && i < s->wild_names->nelts; ++i) {
+            name = APR_ARRAY_IDX(s->wild_names, i, const char*);
+            if (is_wild_suffix(name)) {
+                vhost_index_add(vi->wild_suffixes, name+1, n, p);
+            }
+            else if (!has_others) {
+                APR_ARRAY_PUSH(vi->wild_others, int) = n;
+                has_others = 1;
+            }
+        }
+        /* what md_dns_matches() looks at */
+        if (s->server_hostname) {
+            vhost_index_add(vi->hostnames, s->server_hostname, n, p);
+            vhost_index_add(vi->host_parents, strchr(s->server_hostname, '.'), n, p);
+        }
+    }
+}
 
-        r.server = s;
-        for (i = 0; i < md->domains->nelts; ++i) {
-            domain = APR_ARRAY_IDX(md->domains, i, const char*);
-
-            if ((mc->match_mode == MD_MATCH_ALL &&
-                 ap_matches_request_vhost(&r, domain, s->port))
-                || (((mc->match_mode == MD_MATCH_SERVERNAMES) || md_dns_is_wildcard(p, domain)) &&
-                    md_dns_matches(domain, s->server_hostname))) {
-                /* Create a unique md_srv_conf_t record for this server, if there is none yet */
-                sc = md_config_get_unique(s, p);
-                if (!sc->assigned) sc->assigned = apr_array_make(p, 2, sizeof(md_t*));
-                if (sc->assigned->nelts == 1 && mc->match_mode == MD_MATCH_SERVERNAMES) {
-                    /* there is already an MD assigned for this server. But in
-                     * this match mode, wildcard matches are pre-empted by non-wildcards */
-                    int existing_wild = md_is_wild_match(
-                          APR_ARRAY_IDX(sc->assigned, 0, const md_t*)->domains,
-                          s->server_hostname);
-                    if (!existing_wild && md_dns_is_wildcard(p, domain))
-                        continue;  /* do not add */
-                    if (existing_wild && !md_dns_is_wildcard(p, domain))
-                        sc->assigned->nelts = 0;  /* overwrite existing */
-                }
-                APR_ARRAY_PUSH(sc->assigned, md_t*) = md;
-                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10041)
-                             "Server %s:%d matches md %s (config %s, match-mode=%d) "
-                             "for domain %s, has now %d MDs",
-                             s->server_hostname, s->port, md->name, sc->name,
-                             mc->match_mode, domain, (int)sc->assigned->nelts);
-
-                if (md->contacts && md->contacts->nelts > 0) {
-                    /* set explicitly */
-                }
-                else if (sc->ca_contact && sc->ca_contact[0]) {
-                    uri = md_util_schemify(p, sc->ca_contact, "mailto");
-                    if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
-                        APR_ARRAY_PUSH(md->contacts, const char *) = uri;
-                        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10044)
-                                     "%s: added contact %s", md->name, uri);
-                    }
+static void vhost_index_mark(vhost_index_t *vi, apr_hash_t *index, const char *key,
+                             int domain_idx, apr_array_header_t *matched)
+{
+    apr_array_header_t *servers;
+    int i, n;
+
+    servers = apr_hash_get(index, key, APR_HASH_KEY_STRING);
+    for (i = 0; servers && i < servers->nelts; ++i) {
+        n = APR_ARRAY_IDX(servers, i, int);
+        if (vi->match[n] < 0) {
+            vi->match[n] = domain_idx;
+            APR_ARRAY_PUSH(matched, int) = n;
+        }
+    }
+}
+
+static int vhost_index_has_wild_match(server_rec *s, const char *domain)
+{
+    int i;
+
+    for (i = 0; s->wild_names && i < s->wild_names->nelts; ++i) {
+        if (!ap_strcasecmp_match(domain, APR_ARRAY_IDX(s->wild_names, i, const char*))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int int_cmp(const void *v1, const void *v2)
+{
+    return *(const int*)v1 - *(const int*)v2;
+}
+
+/* Collect the numbers of all servers that match a domain of the md,
+ * in config order, with vi->match set to the first matching domain. */
+static void vhost_index_find(apr_array_header_t *matched, vhost_index_t *vi, 
+                             md_mod_conf_t *mc, md_t *md, apr_pool_t *p)
+{
+    const char *domain, *s;
+    char *key;
+    int i, j, n;
+
+    apr_array_clear(matched);
+    for (i = 0; i < md->domains->nelts; ++i) {
+        domain = APR_ARRAY_IDX(md->domains, i, const char*);
+        key = md_util_str_tolower(apr_pstrdup(p, domain));
+
+        if (mc->match_mode == MD_MATCH_ALL) {
+            vhost_index_mark(vi, vi->names, key, i, matched);
+            for (s = strchr(key, '.'); s; s = strchr(s+1, '.')) {
+                vhost_index_mark(vi, vi->wild_suffixes, s, i, matched);
+            }
+            for (j = 0; j < vi->wild_others->nelts; ++j) {
+                n = APR_ARRAY_IDX(vi->wild_others, j, int);
+                if (vi->match[n] < 0 && vhost_index_has_wild_match(vi->servers[n], domain)) {
+                    vi->match[n] = i;
+                    APR_ARRAY_PUSH(matched, int) = n;
                 }
-                else if (s->server_admin && strcmp(DEFAULT_ADMIN, s->server_admin)) {
-                    uri = md_util_schemify(p, s->server_admin, "mailto");
-                    if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
-                        APR_ARRAY_PUSH(md->contacts, const char *) = uri;
-                        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10237)
-                                     "%s: added contact %s", md->name, uri);
-                    }
+            }
+        }
+        if (mc->match_mode == MD_MATCH_SERVERNAMES || md_dns_is_wildcard(p, domain)) {
+            vhost_index_mark(vi, vi->hostnames, key, i, matched);
+            if (key[0] == '*' && key[1] == '.') {
+                vhost_index_mark(vi, vi->host_parents, key+1, i, matched);
+            }
+        }
+    }
+    qsort(matched->elts, (size_t)matched->nelts, sizeof(int), int_cmp);
+}
+
+/* Index of the first domain of the md, starting at `start`, that matches the 
+ * ServerName of `s`, or -1. */
+static int next_servername_match(md_t *md, int start, server_rec *s)
+{
+    int i;
+
+    for (i = start; i < md->domains->nelts; ++i) {
+        if (md_dns_matches(APR_ARRAY_IDX(md->domains, i, const char*), s->server_hostname)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static apr_status_t link_md_to_servers(md_mod_conf_t *mc, md_t *md, server_rec *base_server,
+                                       vhost_index_t *vi, apr_array_header_t *matched,
+                                       apr_pool_t *p, apr_pool_t *ptemp)
+{
+    server_rec *s;
+    md_srv_conf_t *sc;
+    int i, j, n;
+    const char *domain, *uri;
+
+    /* Assign the MD to all server_rec configs that it matches. If there already
+     * is an assigned MD not equal this one, the configuration is in error.
+     * A server matches if ap_matches_request_vhost() is true for one of the
+     * MD's domains (in match mode 'all') or if md_dns_matches() the ServerName
+     * with a wildcard domain or in match mode 'servernames'. The index finds
+     * those servers directly, the first matching domain is the one that counts.
+     */
+    vhost_index_find(matched, vi, mc, md, ptemp);
+    for (i = 0; i < matched->nelts; ++i) {
+        n = APR_ARRAY_IDX(matched, i, int);
+        s = vi->servers[n];
+        j = vi->match[n];
+        vi->match[n] = -1;
+        domain = APR_ARRAY_IDX(md->domains, j, const char*);
+
+        /* Create a unique md_srv_conf_t record for this server, if there is none yet */
+        sc = md_config_get_unique(s, p);
+        if (!sc->assigned) sc->assigned = apr_array_make(p, 2, sizeof(md_t*));
+        if (sc->assigned->nelts == 1 && mc->match_mode == MD_MATCH_SERVERNAMES) {
+            /* there is already an MD assigned for this server. But in
+             * this match mode, wildcard matches are pre-empted by non-wildcards */
+            int existing_wild = md_is_wild_match(
+                  APR_ARRAY_IDX(sc->assigned, 0, const md_t*)->domains,
+                  s->server_hostname);
+            if (!existing_wild) {
+                /* a pre-empted wildcard leaves the next domain matching
+                 * the ServerName to be considered */
+                while (j >= 0 && md_dns_is_wildcard(p, APR_ARRAY_IDX(md->domains, j, const char*))) {
+                    j = next_servername_match(md, j + 1, s);
                 }
-                break;
+                if (j < 0) continue;  /* do not add */
+                domain = APR_ARRAY_IDX(md->domains, j, const char*);
+            }
+            else if (!md_dns_is_wildcard(p, domain)) {
+                sc->assigned->nelts = 0;  /* overwrite existing */
+            }
+        }
+        APR_ARRAY_PUSH(sc->assigned, md_t*) = md;
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10041)
+                     "Server %s:%d matches md %s (config %s, match-mode=%d) "
+                     "for domain %s, has now %d MDs",
+                     s->server_hostname, s->port, md->name, sc->name,
+                     mc->match_mode, domain, (int)sc->assigned->nelts);
+
+        if (md->contacts && md->contacts->nelts > 0) {
+            /* set explicitly */
+        }
+        else if (sc->ca_contact && sc->ca_contact[0]) {
+            uri = md_util_schemify(p, sc->ca_contact, "mailto");
+            if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
+                APR_ARRAY_PUSH(md->contacts, const char *) = uri;
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10044)
+                             "%s: added contact %s", md->name, uri);
+            }
+        }
+        else if (s->server_admin && strcmp(DEFAULT_ADMIN, s->server_admin)) {
+            uri = md_util_schemify(p, s->server_admin, "mailto");
+            if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
+                APR_ARRAY_PUSH(md->contacts, const char *) = uri;
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10237)
+                             "%s: added contact %s", md->name, uri);
             }
         }
     }
     return APR_SUCCESS;
 }
 
-static apr_status_t link_mds_to_servers(md_mod_conf_t *mc, server_rec *s, apr_pool_t *p)
+static apr_status_t link_mds_to_servers(md_mod_conf_t *mc, server_rec *s, 
+                                        apr_pool_t *p, apr_pool_t *ptemp)
 {
     int i;
     md_t *md;
+    vhost_index_t vi;
+    apr_array_header_t *matched;
+    apr_pool_t *pmd;
     apr_status_t rv = APR_SUCCESS;
 
     apr_array_clear(mc->unused_names);
+    vhost_index_make(&vi, mc, s, ptemp);
+    matched = apr_array_make(ptemp, 10, sizeof(int));
+    apr_pool_create(&pmd, ptemp);
     for (i = 0; i < mc->mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mc->mds, i, md_t*);
-        if (APR_SUCCESS != (rv = link_md_to_servers(mc, md, s, p))) {
-            goto leave;
-        }
+        rv = link_md_to_servers(mc, md, s, &vi, matched, p, pmd);
+        apr_pool_clear(pmd);
+        if (APR_SUCCESS != rv) goto leave;
     }
 leave:
+    apr_pool_destroy(pmd);
     return rv;
 }
 
-static apr_status_t merge_mds_with_conf(md_mod_conf_t *mc, apr_pool_t *p,
+/* Find an MD in `completed` that contains one of the domains of `md`, the
+ * same as md_common_name(md, omd) would, then add the domains of `md`.
+ * `completed` maps lower case domain names to the first MD having it. */
+static md_t *find_overlap_md(apr_hash_t *completed, md_t *md, apr_pool_t *p)
+{
+    md_t *omd = NULL;
+    const char *domain, *parent;
+    char *key;
+    int i;
+
+    for (i = 0; i < md->domains->nelts && !omd; ++i) {
+        domain = APR_ARRAY_IDX(md->domains, i, const char*);
+        key = md_util_str_tolower(apr_pstrdup(p, domain));
+        omd = apr_hash_get(completed, key, APR_HASH_KEY_STRING);
+        if (!omd && (parent = strchr(key, '.')) != NULL) {
+            /* covered by a wildcard domain of another MD? */
+            omd = apr_hash_get(completed, apr_pstrcat(p, "*", parent, NULL), 
+                               APR_HASH_KEY_STRING);
+        }
+    }
+    for (i = 0; i < md->domains->nelts && !omd; ++i) {
+        domain = APR_ARRAY_IDX(md->domains, i, const char*);
+        key = md_util_str_tolower(apr_pstrdup(p, domain));
+        if (!apr_hash_get(completed, key, APR_HASH_KEY_STRING)) {
+            apr_hash_set(completed, key, APR_HASH_KEY_STRING, md);
+        }
+    }
+    return omd;
+}
+
+static apr_status_t merge_mds_with_conf(md_mod_conf_t *mc, apr_pool_t *p, apr_pool_t *ptemp,
                                         server_rec *base_server, int log_level)
 {
     md_srv_conf_t *base_conf;
     md_t *md, *omd;
     const char *domain;
     md_timeslice_t *ts;
+    apr_hash_t *completed;
     apr_status_t rv = APR_SUCCESS;
-    int i, j;
+    int i;
 
     /* The global module configuration 'mc' keeps a list of all configured MDomains
      * in the server. This list is collected during configuration processing and,
@@ -688,22 +943,21 @@ static apr_status_t merge_mds_with_conf(md_mod_conf_t *mc, apr_pool_t *p,
     /* Complete the properties of the MDs, now that we have the complete, merged
      * server configurations.
      */
+    completed = apr_hash_make(ptemp);
     for (i = 0; i < mc->mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mc->mds, i, md_t*);
         merge_srv_config(md, base_conf, p);
 
         if (mc->match_mode == MD_MATCH_ALL) {
           /* Check that we have no overlap with the MDs already completed */
-          for (j = 0; j < i; ++j) {
-              omd = APR_ARRAY_IDX(mc->mds, j, md_t*);
-              if ((domain = md_common_name(md, omd)) != NULL) {
-                  ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO(10038)
-                               "two Managed Domains have an overlap in domain '%s'"
-                               ", first definition in %s(line %d), second in %s(line %d)",
-                               domain, md->defn_name, md->defn_line_number,
-                               omd->defn_name, omd->defn_line_number);
-                  return APR_EINVAL;
-              }
+          if ((omd = find_overlap_md(completed, md, ptemp)) != NULL) {
+              domain = md_common_name(md, omd);
+              ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO(10038)
+                           "two Managed Domains have an overlap in domain '%s'"
+                           ", first definition in %s(line %d), second in %s(line %d)",
+                           domain, md->defn_name, md->defn_line_number,
+                           omd->defn_name, omd->defn_line_number);
+              return APR_EINVAL;
           }
         }
 
@@ -759,28 +1013,50 @@ static apr_status_t check_invalid_duplicates(server_rec *base_server)
     return APR_SUCCESS;
 }
 
-static apr_status_t check_usage(md_mod_conf_t *mc, md_t *md, server_rec *base_server,
-                                apr_pool_t *p, apr_pool_t *ptemp)
+/* Map each MD to the servers it has been assigned to, in config order. */
+static apr_hash_t *get_md_servers(server_rec *base_server, apr_pool_t *p)
 {
+    apr_hash_t *md_servers;
+    apr_array_header_t *servers;
     server_rec *s;
     md_srv_conf_t *sc;
-    apr_status_t rv = APR_SUCCESS;
-    int i, has_ssl;
-    apr_array_header_t *servers;
+    md_t *md, **pmd;
+    int i;
 
-    (void)p;
-    servers = apr_array_make(ptemp, 5, sizeof(server_rec*));
-    has_ssl = 0;
+    md_servers = apr_hash_make(p);
     for (s = base_server; s; s = s->next) {
         sc = md_config_get(s);
         if (!sc || !sc->assigned) continue;
         for (i = 0; i < sc->assigned->nelts; ++i) {
-            if (md == APR_ARRAY_IDX(sc->assigned, i, md_t*)) {
-                APR_ARRAY_PUSH(servers, server_rec*) = s;
-                if (sc->is_ssl) has_ssl = 1;
+            md = APR_ARRAY_IDX(sc->assigned, i, md_t*);
+            servers = apr_hash_get(md_servers, &md, sizeof(md));
+            if (!servers) {
+                servers = apr_array_make(p, 2, sizeof(server_rec*));
+                pmd = apr_palloc(p, sizeof(*pmd));
+                *pmd = md;
+                apr_hash_set(md_servers, pmd, sizeof(*pmd), servers);
             }
+            else if (APR_ARRAY_IDX(servers, servers->nelts-1, server_rec*) == s) {
+                continue;
+            }
+            APR_ARRAY_PUSH(servers, server_rec*) = s;
         }
     }
+    return md_servers;
+}
+
+static apr_status_t check_usage(md_mod_conf_t *mc, md_t *md, server_rec *base_server,
+                                apr_array_header_t *servers)
+{
+    md_srv_conf_t *sc;
+    apr_status_t rv = APR_SUCCESS;
+    int i, has_ssl;
+
+    has_ssl = 0;
+    for (i = 0; i < servers->nelts && !has_ssl; ++i) {
+        sc = md_config_get(APR_ARRAY_IDX(servers, i, server_rec*));
+        if (sc && sc->is_ssl) has_ssl = 1;
+    }
 
     if (!has_ssl && md->require_https > MD_REQUIRE_OFF) {
         /* We require https for this MD, but do we have a SSL vhost? */
@@ -808,6 +1084,9 @@ static int init_cert_watch_status(md_mod_conf_t *mc, apr_pool_t *p, apr_pool_t *
     /* Calculate the list of MD names which we need to watch:
      * - all MDs that are used somewhere
      * - all MDs in drive mode 'AUTO' that are not in 'unused_names'
+     * This runs sequentially: the test inits share the registry, its drivers
+     * and mc->env. The certificates they look at are already in the registry's 
+     * cache, loaded in parallel by md_reg_preload_pubcerts().
      */
     count = 0;
     result = md_result_make(ptemp, APR_SUCCESS);
@@ -845,6 +1124,243 @@ static int init_cert_watch_status(md_mod_conf_t *mc, apr_pool_t *p, apr_pool_t *
     return count;
 }
 
+static void fallback_fnames(apr_pool_t *p, md_pkey_spec_t *kspec, int shared,
+                            char **keyfn, char **certfn)
+{
+    *keyfn  = apr_pstrcat(p, MD_FN_FALLBACK_PKEY_PREFIX, md_pkey_filename(kspec, p), NULL);
+    *certfn = apr_pstrcat(p, shared? "fallback-shared-" : "fallback-",
+                          md_chain_filename(kspec, p), NULL);
+}
+
+/* A fallback key used for the fallback certificates of all MDs, per key file name. */
+typedef struct {
+    const char *keyfile;
+    md_pkey_t *pkey;
+    int created;                       /* != 0 iff generated in this server generation */
+} md_fallback_key_t;
+
+static md_fallback_key_t *get_fallback_key(md_mod_conf_t *mc, md_store_t *store,
+                                           md_pkey_spec_t *kspec, server_rec *s,
+                                           apr_pool_t *ptemp)
+{
+    apr_pool_t *p;
+    md_fallback_key_t *fk;
+    char *keyfn, *crtfn;
+    apr_status_t rv;
+
+    fallback_fnames(ptemp, kspec, 1, &keyfn, &crtfn);
+    fk = apr_hash_get(mc->fallback_keys, keyfn, APR_HASH_KEY_STRING);
+    if (fk) return fk;
+
+    /* only ever gets here single threaded */
+    p = apr_hash_pool_get(mc->fallback_keys);
+    keyfn = apr_pstrdup(p, keyfn);
+    fk = apr_pcalloc(p, sizeof(*fk));
+    rv = md_store_get_fname(&fk->keyfile, store, MD_SG_NONE, NULL, keyfn, p);
+    if (APR_SUCCESS != rv) goto leave;
+    if (APR_SUCCESS == md_store_load(store, MD_SG_NONE, NULL, keyfn, MD_SV_PKEY,
+                                     (void**)&fk->pkey, p)) {
+        goto leave;
+    }
+    /* The store keeps this key unencrypted, as mod_ssl needs to read it.
+     * It only ever signs our self-signed fallback certificates. */
+    fk->created = 1;
+    if (APR_SUCCESS == (rv = md_pkey_gen(&fk->pkey, p, kspec))) {
+        rv = md_store_save(store, p, MD_SG_NONE, NULL, keyfn, MD_SV_PKEY, (void*)fk->pkey, 0);
+    }
+leave:
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10519)
+                     "make shared fallback %s key", md_pkey_spec_name(kspec));
+        return NULL;
+    }
+    apr_hash_set(mc->fallback_keys, keyfn, APR_HASH_KEY_STRING, fk);
+    return fk;
+}
+
+/* The fallback certificate of an MD for one key spec, and what it takes to make it. */
+typedef struct {
+    const md_t *md;
+    md_pkey_spec_t *kspec;
+    char *keyfn, *crtfn;
+    md_fallback_key_t *fk;             /* the shared key, NULL for individual keys */
+    const char *keyfile;
+    const char *chainfile;
+    md_pkey_t *pkey;                   /* made by fallback_make() */
+    md_cert_t *cert;
+    apr_status_t rv;
+} md_fallback_t;
+
+/* Look for the fallback files of certificate `i` of the MD. APR_ENOENT when
+ * they need to be made. */
+static apr_status_t fallback_check(md_fallback_t *fb, md_mod_conf_t *mc, md_store_t *store,
+                                   const md_t *md, int i, server_rec *s, apr_pool_t *p)
+{
+    apr_array_header_t *chain;
+
+    memset(fb, 0, sizeof(*fb));
+    fb->md = md;
+    fb->kspec = md_pkeys_spec_get(md->pks, i);
+    fallback_fnames(p, fb->kspec, mc->fallback_shared_keys, &fb->keyfn, &fb->crtfn);
+    if (mc->fallback_shared_keys) {
+        if (!(fb->fk = get_fallback_key(mc, store, fb->kspec, s, p))) return APR_EGENERAL;
+        fb->keyfile = fb->fk->keyfile;
+    }
+    else {
+        md_store_get_fname(&fb->keyfile, store, MD_SG_DOMAINS, md->name, fb->keyfn, p);
+    }
+    md_store_get_fname(&fb->chainfile, store, MD_SG_DOMAINS, md->name, fb->crtfn, p);
+    if (md_file_exists(fb->keyfile, p) && md_file_exists(fb->chainfile, p)) {
+        if (!fb->fk || !fb->fk->created) return APR_SUCCESS;
+        /* a new shared key, certificates made for a previous one are of no use */
+        if (APR_SUCCESS == md_chain_fload(&chain, p, fb->chainfile)
+            && APR_SUCCESS == md_check_cert_and_pkey(chain, fb->fk->pkey)) {
+            return APR_SUCCESS;
+        }
+    }
+    return APR_ENOENT;
+}
+
+/* Make the key, unless it is shared, and the self-signed certificate. Does not
+ * touch the store, so this may run on several threads at once. */
+static apr_status_t fallback_make(md_fallback_t *fb, apr_pool_t *p)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if (fb->fk) {
+        fb->pkey = fb->fk->pkey;
+    }
+    else {
+        rv = md_pkey_gen(&fb->pkey, p, fb->kspec);
+    }
+    if (APR_SUCCESS == rv) {
+        rv = md_cert_self_sign(&fb->cert, "Apache Managed Domain Fallback", fb->md->domains,
+                               fb->pkey, apr_time_from_sec(14 * MD_SECS_PER_DAY), p);
+    }
+    fb->rv = rv;
+    return rv;
+}
+
+/* Save what fallback_make() produced to the store. Only from one thread. */
+static apr_status_t fallback_save(md_fallback_t *fb, md_store_t *store, server_rec *s,
+                                  apr_pool_t *p)
+{
+    apr_status_t rv = fb->rv;
+
+    if (APR_SUCCESS == rv && !fb->fk) {
+        rv = md_store_save(store, p, MD_SG_DOMAINS, fb->md->name, fb->keyfn,
+                           MD_SV_PKEY, (void*)fb->pkey, 0);
+    }
+    if (APR_SUCCESS == rv) {
+        rv = md_store_save(store, p, MD_SG_DOMAINS, fb->md->name, fb->crtfn,
+                           MD_SV_CERT, (void*)fb->cert, 0);
+    }
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10174)
+                     "%s: make fallback %s certificate", fb->md->name,
+                     md_pkey_spec_name(fb->kspec));
+    }
+    return rv;
+}
+
+/* Get the fallback files for certificate `i` of the MD, creating them as needed. */
+static apr_status_t get_fallback_files(md_mod_conf_t *mc, md_store_t *store, const md_t *md,
+                                       int i, server_rec *s, apr_pool_t *p,
+                                       const char **pkeyfile, const char **pchainfile)
+{
+    md_fallback_t fb;
+    apr_status_t rv;
+
+    rv = fallback_check(&fb, mc, store, md, i, s, p);
+    if (APR_STATUS_IS_ENOENT(rv)) {
+        fallback_make(&fb, p);
+        rv = fallback_save(&fb, store, s, p);
+    }
+    *pkeyfile = fb.keyfile;
+    *pchainfile = fb.chainfile;
+    return rv;
+}
+
+static apr_status_t fallback_make_cb(void *baton, int i, apr_pool_t *p)
+{
+    apr_array_header_t *todo = baton;
+
+    return fallback_make(APR_ARRAY_IDX(todo, i, md_fallback_t*), p);
+}
+
+/* mod_ssl asks for fallback certificates one server at a time. Make the ones
+ * that will most likely be needed now: keys and certificates are generated on
+ * several threads, all store access happens here. */
+static void prepare_fallbacks(md_mod_conf_t *mc, server_rec *base_server, apr_pool_t *ptemp)
+{
+    md_store_t *store = md_reg_store_get(mc->reg);
+    apr_array_header_t *todo;
+    apr_hash_t *seen;
+    server_rec *s;
+    md_srv_conf_t *sc;
+    const md_t *md;
+    md_fallback_t *fb;
+    const char *keyfile, *chainfile;
+    int i, has_cert;
+
+    todo = apr_array_make(ptemp, 10, sizeof(md_fallback_t*));
+    seen = apr_hash_make(ptemp);
+    for (s = base_server; s; s = s->next) {
+        sc = md_config_get(s);
+        if (!sc || !sc->assigned || sc->assigned->nelts != 1) continue;
+        if (mc->local_443 > 0 && !uses_port(s, mc->local_443)) continue;
+        md = APR_ARRAY_IDX(sc->assigned, 0, const md_t*);
+        if (apr_hash_get(seen, md->name, APR_HASH_KEY_STRING)) continue;
+        apr_hash_set(seen, md->name, APR_HASH_KEY_STRING, md);
+        if (md->cert_files && md->cert_files->nelts) continue;
+
+        for (i = 0, has_cert = 0; i < md_cert_count(md) && !has_cert; ++i) {
+            has_cert = (APR_SUCCESS == md_reg_get_cred_files(&keyfile, &chainfile, mc->reg,
+                                        MD_SG_DOMAINS, md, md_pkeys_spec_get(md->pks, i),
+                                        ptemp));
+        }
+        if (has_cert) continue;
+        for (i = 0; i < md_cert_count(md); ++i) {
+            fb = apr_palloc(ptemp, sizeof(*fb));
+            if (APR_STATUS_IS_ENOENT(fallback_check(fb, mc, store, md, i, base_server, ptemp))) {
+                APR_ARRAY_PUSH(todo, md_fallback_t*) = fb;
+            }
+        }
+    }
+    if (todo->nelts > 0) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server,
+                     "preparing %d fallback certificates", todo->nelts);
+        md_util_parallel_do(fallback_make_cb, todo, todo->nelts, md_util_cpu_count(), ptemp);
+        for (i = 0; i < todo->nelts; ++i) {
+            fallback_save(APR_ARRAY_IDX(todo, i, md_fallback_t*), store, base_server, ptemp);
+        }
+    }
+}
+
+/* The registry memo lives in the process pool, so it is there on the next reload. */
+static md_reg_memo_t *get_reg_memo(server_rec *s)
+{
+    const char *key = "mod_md_reg_memo";
+    void *data = NULL;
+
+    apr_pool_userdata_get(&data, key, s->process->pool);
+    if (!data) {
+        data = md_reg_memo_make(s->process->pool);
+        apr_pool_userdata_set(data, key, apr_pool_cleanup_null, s->process->pool);
+    }
+    return data;
+}
+
+/* Log how long the post config `phase` took since `*pstart` and start the next. */
+static void log_phase(server_rec *s, const char *phase, apr_time_t *pstart)
+{
+    apr_time_t now = apr_time_now();
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, "post config %s: %" APR_TIME_T_FMT " ms",
+                 phase, apr_time_as_msec(now - *pstart));
+    *pstart = now;
+}
+
 static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
                                               apr_pool_t *ptemp, server_rec *s)
 {
@@ -858,6 +1374,7 @@ static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
     const char *proxy_url;
     const char *ca_certs;
     const char *proxy_ca_certs;
+    apr_time_t start = apr_time_now();
 
     apr_pool_userdata_get(&data, mod_md_init_key, s->process->pool);
     if (data == NULL) {
@@ -907,6 +1424,7 @@ static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10072) "setup md registry");
         goto leave;
     }
+    md_reg_set_memo(mc->reg, get_reg_memo(s));
 
     /* renew on 30% remaining /*/
     rv = md_ocsp_reg_make(&mc->ocsp, p, store, mc->ocsp_renew_window,
@@ -918,6 +1436,7 @@ static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
     }
 
     init_ssl();
+    log_phase(s, "setup", &start);
 
     /* How to bootstrap this module:
      * 1. find out if we know if http: and/or https: requests will arrive
@@ -941,9 +1460,10 @@ static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
     /*1*/
     if (APR_SUCCESS != (rv = detect_supported_protocols(mc, s, p, log_level))) goto leave;
     /*2*/
-    if (APR_SUCCESS != (rv = merge_mds_with_conf(mc, p, s, log_level))) goto leave;
+    if (APR_SUCCESS != (rv = merge_mds_with_conf(mc, p, ptemp, s, log_level))) goto leave;
     /*3*/
-    if (APR_SUCCESS != (rv = link_mds_to_servers(mc, s, p))) goto leave;
+    if (APR_SUCCESS != (rv = link_mds_to_servers(mc, s, p, ptemp))) goto leave;
+    log_phase(s, "merge and link", &start);
     /*4*/
     if (APR_SUCCESS != (rv = md_reg_lock_global(mc->reg, ptemp))) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10398)
@@ -959,14 +1479,68 @@ static apr_status_t md_post_config_before_ssl(apr_pool_t *p, apr_pool_t *plog,
                      "syncing %d mds to registry", mc->mds->nelts);
         goto leave;
     }
+    log_phase(s, "sync start", &start);
     /*5*/
     md_reg_load_stagings(mc->reg, mc->mds, mc->env, p);
+    log_phase(s, "load stagings", &start);
+    prepare_fallbacks(mc, s, ptemp);
+    log_phase(s, "prepare fallbacks", &start);
 leave:
     if (mc->reg)
         md_reg_unlock_global(mc->reg, ptemp);
     return rv;
 }
 
+static void init_status_snap(md_mod_conf_t *mc, server_rec *s, apr_pool_t *p)
+{
+    apr_shm_t *shm;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* A generation counter per MD, shared by all children. A status change 
+     * seen in one of them makes all snapshots update that MD. */
+    len = (apr_size_t)mc->mds->nelts * sizeof(apr_uint32_t);
+    rv = apr_shm_create(&shm, len, NULL, p);
+    if (APR_SUCCESS == rv) {
+        memset(apr_shm_baseaddr_get(shm), 0, len);
+        rv = md_status_snap_make(&mc->status_snap, p, mc->mds, mc->reg, mc->ocsp,
+                                 apr_shm_baseaddr_get(shm));
+    }
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s,
+                     "no status snapshot, status will be collected on each request");
+        mc->status_snap = NULL;
+    }
+}
+
+static void init_metrics(md_mod_conf_t *mc, server_rec *s, apr_pool_t *p, apr_pool_t *ptemp)
+{
+    md_metrics_t *metrics;
+    const md_t *md;
+    apr_status_t rv;
+    int i, slot;
+
+    md_metrics_make(&metrics, p);
+    for (i = 0; i < mc->mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mc->mds, i, const md_t *);
+        slot = md_metrics_add(metrics, md->name, NULL);
+        md_metrics_set_time(metrics, slot, MD_METRIC_CERT_EXPIRES, 
+                            md_reg_valid_until(mc->reg, md, ptemp));
+        md_metrics_set_time(metrics, slot, MD_METRIC_RENEW_AT, 
+                            md_reg_renew_at(mc->reg, md, ptemp));
+    }
+    if (mc->ocsp) md_ocsp_set_metrics(mc->ocsp, metrics);
+    /* Only the child running the watchdogs updates them, all others need
+     * to see that. */
+    rv = md_metrics_share(metrics, p);
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s,
+                     "metrics not in shared memory, md-metrics will only report "
+                     "the values of the child process answering it");
+    }
+    mc->metrics = metrics;
+}
+
 static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
                                              apr_pool_t *ptemp, server_rec *s)
 {
@@ -975,8 +1549,10 @@ static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
     md_mod_conf_t *mc;
     int watched, i;
     md_t *md;
+    apr_hash_t *md_servers;
+    apr_array_header_t *servers, *no_servers;
+    apr_time_t start = apr_time_now();
 
-    (void)ptemp;
     (void)plog;
     sc = md_config_get(s);
 
@@ -988,17 +1564,26 @@ static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
     if (APR_SUCCESS != (rv = check_invalid_duplicates(s))) {
         goto leave;
     }
+    /* load all certificates in parallel, the checks below then use the cache.
+     * mod_ssl has already asked for its files, but get_certificates() only
+     * looks at file names and does not parse certificates. */
+    md_reg_preload_pubcerts(mc->reg, mc->mds, md_util_cpu_count(), ptemp);
+    log_phase(s, "load certificates", &start);
     apr_array_clear(mc->unused_names);
+    md_servers = get_md_servers(s, ptemp);
+    no_servers = apr_array_make(ptemp, 1, sizeof(server_rec*));
     for (i = 0; i < mc->mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mc->mds, i, md_t *);
+        servers = apr_hash_get(md_servers, &md, sizeof(md));
+        if (!servers) servers = no_servers;
 
         ap_log_error( APLOG_MARK, APLOG_TRACE2, rv, s, "md{%s}: auto_add", md->name);
-        if (APR_SUCCESS != (rv = auto_add_domains(md, s, p))) {
+        if (APR_SUCCESS != (rv = auto_add_domains(md, s, servers, p))) {
             goto leave;
         }
-        init_acme_tls_1_domains(md, s);
+        init_acme_tls_1_domains(md, s, servers);
         ap_log_error( APLOG_MARK, APLOG_TRACE2, rv, s, "md{%s}: check_usage", md->name);
-        if (APR_SUCCESS != (rv = check_usage(mc, md, s, p, ptemp))) {
+        if (APR_SUCCESS != (rv = check_usage(mc, md, s, servers))) {
             goto leave;
         }
         ap_log_error( APLOG_MARK, APLOG_TRACE2, rv, s, "md{%s}: sync_finish", md->name);
@@ -1008,9 +1593,11 @@ static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
             goto leave;
         }
     }
+    log_phase(s, "sync finish", &start);
     /*8*/
     ap_log_error( APLOG_MARK, APLOG_TRACE2, rv, s, "init_cert_watch");
     watched = init_cert_watch_status(mc, p, ptemp, s);
+    log_phase(s, "init watch", &start);
     /*9*/
     ap_log_error( APLOG_MARK, APLOG_TRACE2, rv, s, "cleanup challenges");
     md_reg_cleanup_challenges(mc->reg, p, ptemp, mc->mds);
@@ -1018,6 +1605,12 @@ static apr_status_t md_post_config_after_ssl(apr_pool_t *p, apr_pool_t *plog,
     /* From here on, the domains in the registry are readonly
      * and only staging/challenges may be manipulated */
     md_reg_freeze_domains(mc->reg, mc->mds);
+    log_phase(s, "cleanup and freeze", &start);
+    if ((mc->server_status_enabled || mc->certificate_status_enabled) && mc->mds->nelts > 0) {
+        init_status_snap(mc, s, p);
+    }
+    md_cert_status_init(mc, s, p);
+    init_metrics(mc, s, p, ptemp);
 
     if (watched) {
         /*10*/
@@ -1101,48 +1694,91 @@ static int md_protocol_switch(conn_rec *c, request_rec *r, server_rec *s,
 /**************************************************************************************************/
 /* Access API to other httpd components */
 
-static void fallback_fnames(apr_pool_t *p, md_pkey_spec_t *kspec, char **keyfn, char **certfn )
+/* The certificate files of an MD, resolved once for all servers it is assigned to. */
+typedef struct {
+    apr_uint32_t gen;                  /* certificate generation of the registry */
+    apr_status_t rv;                   /* APR_EAGAIN when the files are fallbacks */
+    apr_array_header_t *key_files;
+    apr_array_header_t *chain_files;
+} md_cred_files_t;
+
+static apr_status_t resolve_cred_files(md_cred_files_t *cf, md_mod_conf_t *mc, const md_t *md,
+                                       server_rec *s, apr_pool_t *p, int fallback)
 {
-    *keyfn  = apr_pstrcat(p, "fallback-", md_pkey_filename(kspec, p), NULL);
-    *certfn = apr_pstrcat(p, "fallback-", md_chain_filename(kspec, p), NULL);
-}
+    apr_status_t rv = APR_ENOENT;
+    md_reg_t *reg = mc->reg;
+    md_store_t *store;
+    md_pkey_spec_t *spec;
+    const char *keyfile, *chainfile;
+    int i;
 
-static apr_status_t make_fallback_cert(md_store_t *store, const md_t *md, md_pkey_spec_t *kspec,
-                                       server_rec *s, apr_pool_t *p, char *keyfn, char *crtfn)
-{
-    md_pkey_t *pkey;
-    md_cert_t *cert;
-    apr_status_t rv;
+    cf->key_files = apr_array_make(p, md_cert_count(md) + 1, sizeof(const char*));
+    cf->chain_files = apr_array_make(p, md_cert_count(md) + 1, sizeof(const char*));
+    if (md->cert_files && md->cert_files->nelts) {
+        apr_array_cat(cf->chain_files, md->cert_files);
+        apr_array_cat(cf->key_files, md->pkey_files);
+        rv = APR_SUCCESS;
+        goto leave;
+    }
 
-    if (APR_SUCCESS != (rv = md_pkey_gen(&pkey, p, kspec))
-        || APR_SUCCESS != (rv = md_store_save(store, p, MD_SG_DOMAINS, md->name,
-                                keyfn, MD_SV_PKEY, (void*)pkey, 0))
-        || APR_SUCCESS != (rv = md_cert_self_sign(&cert, "Apache Managed Domain Fallback",
-                                    md->domains, pkey, apr_time_from_sec(14 * MD_SECS_PER_DAY), p))
-        || APR_SUCCESS != (rv = md_store_save(store, p, MD_SG_DOMAINS, md->name,
-                                crtfn, MD_SV_CERT, (void*)cert, 0))) {
-        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10174)
-                     "%s: make fallback %s certificate", md->name, md_pkey_spec_name(kspec));
+    for (i = 0; i < md_cert_count(md); ++i) {
+        spec = md_pkeys_spec_get(md->pks, i);
+        rv = md_reg_get_cred_files(&keyfile, &chainfile, reg, MD_SG_DOMAINS, md, spec, p);
+        if (APR_SUCCESS == rv) {
+            APR_ARRAY_PUSH(cf->key_files, const char*) = keyfile;
+            APR_ARRAY_PUSH(cf->chain_files, const char*) = chainfile;
+        }
+        else if (APR_STATUS_IS_ENOENT(rv)) {
+            /* certificate for this pkey is not available, others might
+             * if pkeys have been added for a running mdomain.
+             * see issue #260 */
+            rv = APR_SUCCESS;
+        }
+        else {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10110)
+                         "retrieving credentials for MD %s (%s)",
+                         md->name, md_pkey_spec_name(spec));
+            return rv;
+        }
+    }
+
+    if (md_array_is_empty(cf->key_files) && fallback) {
+        /* Provide temporary, self-signed certificate as fallback, so that
+         * clients do not get obscure TLS handshake errors or will see a fallback
+         * virtual host that is not intended to be served here. */
+        store = md_reg_store_get(reg);
+        assert(store);
+
+        for (i = 0; i < md_cert_count(md); ++i) {
+            rv = get_fallback_files(mc, store, md, i, s, p, &keyfile, &chainfile);
+            if (APR_SUCCESS != rv) return rv;
+            APR_ARRAY_PUSH(cf->key_files, const char*) = keyfile;
+            APR_ARRAY_PUSH(cf->chain_files, const char*) = chainfile;
+        }
+        rv = APR_EAGAIN;
+    }
+leave:
+    if (APR_SUCCESS == rv
+        && (md_array_is_empty(cf->key_files) || md_array_is_empty(cf->chain_files))) {
+        rv = APR_ENOENT;
     }
+    cf->rv = rv;
     return rv;
 }
 
-static apr_status_t get_certificates(server_rec *s, apr_pool_t *p, int fallback,
+static apr_status_t get_certificates(server_rec *s, int fallback,
                                      apr_array_header_t **pcert_files,
                                      apr_array_header_t **pkey_files)
 {
-    apr_status_t rv = APR_ENOENT;
+    apr_status_t rv;
     md_srv_conf_t *sc;
     md_reg_t *reg;
-    md_store_t *store;
     const md_t *md;
-    apr_array_header_t *key_files, *chain_files;
-    const char *keyfile, *chainfile;
+    md_cred_files_t *cf, **slots;
+    apr_pool_t *pool;
     int i;
 
     *pkey_files = *pcert_files = NULL;
-    key_files = apr_array_make(p, 5, sizeof(const char*));
-    chain_files = apr_array_make(p, 5, sizeof(const char*));
 
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10113)
                  "get_certificates called for vhost %s.", s->server_hostname);
@@ -1177,77 +1813,44 @@ static apr_status_t get_certificates(server_rec *s, apr_pool_t *p, int fallback,
     }
     md = APR_ARRAY_IDX(sc->assigned, 0, const md_t*);
 
-    if (md->cert_files && md->cert_files->nelts) {
-        apr_array_cat(chain_files, md->cert_files);
-        apr_array_cat(key_files, md->pkey_files);
-        rv = APR_SUCCESS;
-    }
-    else {
-        md_pkey_spec_t *spec;
-        
-        for (i = 0; i < md_cert_count(md); ++i) {
-            spec = md_pkeys_spec_get(md->pks, i);
-            rv = md_reg_get_cred_files(&keyfile, &chainfile, reg, MD_SG_DOMAINS, md, spec, p);
-            if (APR_SUCCESS == rv) {
-                APR_ARRAY_PUSH(key_files, const char*) = keyfile;
-                APR_ARRAY_PUSH(chain_files, const char*) = chainfile;
-            }
-            else if (APR_STATUS_IS_ENOENT(rv)) {
-                /* certificate for this pkey is not available, others might
-                 * if pkeys have been added for a running mdomain.
-                 * see issue #260 */
-                rv = APR_SUCCESS;
-            }
-            else if (!APR_STATUS_IS_ENOENT(rv)) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10110)
-                             "retrieving credentials for MD %s (%s)",
-                             md->name, md_pkey_spec_name(spec));
-                return rv;
-            }
+    /* Many servers share an MD, resolve its files only once. The arrays are
+     * only read by our callers. */
+    pool = apr_hash_pool_get(sc->mc->cred_files);
+    slots = apr_hash_get(sc->mc->cred_files, md->name, APR_HASH_KEY_STRING);
+    if (!slots) {
+        slots = apr_pcalloc(pool, 2 * sizeof(*slots));
+        apr_hash_set(sc->mc->cred_files, apr_pstrdup(pool, md->name),
+                     APR_HASH_KEY_STRING, slots);
+    }
+    cf = slots[fallback? 1 : 0];
+    if (!cf || cf->gen != md_reg_certs_gen(reg, md->name)) {
+        cf = apr_pcalloc(pool, sizeof(*cf));
+        rv = resolve_cred_files(cf, sc->mc, md, s, pool, fallback);
+        if (APR_SUCCESS != rv && APR_EAGAIN != rv && !APR_STATUS_IS_ENOENT(rv)) {
+            return rv;
         }
+        /* creating fallback files changes the generation, they are what we have */
+        cf->gen = md_reg_certs_gen(reg, md->name);
+        slots[fallback? 1 : 0] = cf;
+    }
 
-        if (md_array_is_empty(key_files)) {
-            if (fallback) {
-                /* Provide temporary, self-signed certificate as fallback, so that
-                 * clients do not get obscure TLS handshake errors or will see a fallback
-                 * virtual host that is not intended to be served here. */
-                char *kfn, *cfn;
-
-                store = md_reg_store_get(reg);
-                assert(store);
-
-                for (i = 0; i < md_cert_count(md); ++i) {
-                    spec = md_pkeys_spec_get(md->pks, i);
-                    fallback_fnames(p, spec, &kfn, &cfn);
-
-                    md_store_get_fname(&keyfile, store, MD_SG_DOMAINS, md->name, kfn, p);
-                    md_store_get_fname(&chainfile, store, MD_SG_DOMAINS, md->name, cfn, p);
-                    if (!md_file_exists(keyfile, p) || !md_file_exists(chainfile, p)) {
-                        if (APR_SUCCESS != (rv = make_fallback_cert(store, md, spec, s, p, kfn, cfn))) {
-                            return rv;
-                        }
-                    }
-                    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10116)
-                                 "%s: providing %s fallback certificate for server %s",
-                                 md->name, md_pkey_spec_name(spec), s->server_hostname);
-                    APR_ARRAY_PUSH(key_files, const char*) = keyfile;
-                    APR_ARRAY_PUSH(chain_files, const char*) = chainfile;
-                }
-                rv = APR_EAGAIN;
-                goto leave;
-            }
+    rv = cf->rv;
+    if (APR_EAGAIN == rv) {
+        for (i = 0; i < md_cert_count(md); ++i) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10116)
+                         "%s: providing %s fallback certificate for server %s",
+                         md->name, md_pkey_spec_name(md_pkeys_spec_get(md->pks, i)),
+                         s->server_hostname);
         }
     }
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(10077)
-                 "%s[state=%d]: providing certificates for server %s",
-                 md->name, md->state, s->server_hostname);
-leave:
-    if (!md_array_is_empty(key_files) && !md_array_is_empty(chain_files)) {
-        *pkey_files = key_files;
-        *pcert_files = chain_files;
-    }
     else if (APR_SUCCESS == rv) {
-        rv = APR_ENOENT;
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(10077)
+                     "%s[state=%d]: providing certificates for server %s",
+                     md->name, md->state, s->server_hostname);
+    }
+    if (APR_SUCCESS == rv || APR_EAGAIN == rv) {
+        *pkey_files = cf->key_files;
+        *pcert_files = cf->chain_files;
     }
     return rv;
 }
@@ -1260,9 +1863,10 @@ static int md_add_cert_files(server_rec *s, apr_pool_t *p,
     apr_array_header_t *md_key_files;
     apr_status_t rv;
 
+    (void)p;
     ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s, "hook ssl_add_cert_files for %s",
                  s->server_hostname);
-    rv = get_certificates(s, p, 0, &md_cert_files, &md_key_files);
+    rv = get_certificates(s, 0, &md_cert_files, &md_key_files);
     if (APR_SUCCESS == rv) {
         if (!apr_is_empty_array(cert_files)) {
             /* downgraded fromm WARNING to DEBUG, since installing separate certificates
@@ -1292,9 +1896,10 @@ static int md_add_fallback_cert_files(server_rec *s, apr_pool_t *p,
     apr_array_header_t *md_key_files;
     apr_status_t rv;
 
+    (void)p;
     ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s, "hook ssl_add_fallback_cert_files for %s",
                  s->server_hostname);
-    rv = get_certificates(s, p, 1, &md_cert_files, &md_key_files);
+    rv = get_certificates(s, 1, &md_cert_files, &md_key_files);
     if (APR_EAGAIN == rv) {
         apr_array_cat(cert_files, md_cert_files);
         apr_array_cat(key_files, md_key_files);
@@ -1592,6 +2197,7 @@ static void md_hooks(apr_pool_t *pool)
     APR_OPTIONAL_HOOK(ap, status_hook, md_domains_status_hook, NULL, NULL, APR_HOOK_MIDDLE);
     APR_OPTIONAL_HOOK(ap, status_hook, md_ocsp_status_hook, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_handler(md_status_handler, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(md_metrics_handler, NULL, NULL, APR_HOOK_MIDDLE);
 
     ap_hook_ssl_answer_challenge(md_answer_challenge, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_ssl_add_cert_files(md_add_cert_files, NULL, NULL, APR_HOOK_MIDDLE);
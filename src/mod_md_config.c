@@ -72,12 +72,18 @@ static md_mod_conf_t defmc = {
     NULL,                      /* hsts headers */
     NULL,                      /* unused names */
     NULL,                      /* init errors hash */
+    NULL,                      /* resolved certificate files */
+    0,                         /* fallback keys per MD */
+    NULL,                      /* shared fallback keys */
     NULL,                      /* notify cmd */
     NULL,                      /* message cmd */
     NULL,                      /* env table */
     0,                         /* dry_run flag */
     1,                         /* server_status_enabled */
+    NULL,                      /* server status snapshot */
+    NULL,                      /* metrics */
     1,                         /* certificate_status_enabled */
+    NULL,                      /* certificate status cache */
     &def_ocsp_keep_window,     /* default time to keep ocsp responses */
     &def_ocsp_renew_window,    /* default time to renew ocsp responses */
     "crt.sh",                  /* default cert checker site name */
@@ -155,6 +161,8 @@ static md_mod_conf_t *md_mod_conf_get(apr_pool_t *pool, int create)
         mod_md_config->unused_names = apr_array_make(pool, 5, sizeof(const md_t *));
         mod_md_config->env = apr_table_make(pool, 10);
         mod_md_config->init_errors = apr_hash_make(pool);
+        mod_md_config->cred_files = apr_hash_make(pool);
+        mod_md_config->fallback_keys = apr_hash_make(pool);
          
         apr_pool_cleanup_register(pool, NULL, cleanup_mod_config, apr_pool_cleanup_null);
     }
@@ -666,7 +674,15 @@ static const char *md_config_set_staple_others(cmd_parms *cmd, void *dc, const c
     if ((err = md_conf_check_location(cmd, MD_LOC_ALL))) {
         return err;
     }
-    return set_on_off(&config->staple_others, value, cmd->pool);
+    if (!apr_cstr_casecmp("lazy", value)) {
+        config->staple_others = MD_STAPLE_OTHERS_LAZY;
+        return NULL;
+    }
+    else if (set_on_off(&config->staple_others, value, cmd->pool)) {
+        return apr_pstrcat(cmd->pool, "unknown '", value,
+                           "', supported parameter values are 'on', 'off' and 'lazy'", NULL);
+    }
+    return NULL;
 }
 
 static const char *md_config_set_ari(cmd_parms *cmd, void *dc, const char *value)
@@ -812,6 +828,27 @@ static const char *md_config_set_match_mode(cmd_parms *cmd, void *dc, const char
     return NULL;
 }
 
+static const char *md_config_set_fallback_keys(cmd_parms *cmd, void *dc, const char *s)
+{
+    md_srv_conf_t *config = md_config_get(cmd->server);
+    const char *err = md_conf_check_location(cmd, MD_LOC_NOT_MD);
+
+    (void)dc;
+    if (err) {
+        return err;
+    }
+    else if (!apr_cstr_casecmp("individual", s)) {
+        config->mc->fallback_shared_keys = 0;
+    }
+    else if (!apr_cstr_casecmp("shared", s)) {
+        config->mc->fallback_shared_keys = 1;
+    }
+    else {
+        return "invalid argument, must be a 'individual' or 'shared'";
+    }
+    return NULL;
+}
+
 static const char *md_config_set_require_https(cmd_parms *cmd, void *dc, const char *value)
 {
     md_srv_conf_t *config = md_config_get(cmd->server);
@@ -1424,7 +1461,8 @@ const command_rec md_cmds[] = {
     AP_INIT_TAKE1("MDStapling", md_config_set_stapling, NULL, RSRC_CONF, 
                   "Enable/Disable OCSP Stapling for this/all Managed Domain(s)."),
     AP_INIT_TAKE1("MDStapleOthers", md_config_set_staple_others, NULL, RSRC_CONF, 
-                  "Enable/Disable OCSP Stapling for certificates not in Managed Domains."),
+                  "Enable/Disable OCSP Stapling for certificates not in Managed Domains, "
+                  "'lazy' to only start when first needed."),
     AP_INIT_TAKE1("MDStaplingKeepResponse", md_config_set_ocsp_keep_window, NULL, RSRC_CONF, 
                   "The amount of time to keep an OCSP response in the store."),
     AP_INIT_TAKE1("MDStaplingRenewWindow", md_config_set_ocsp_renew_window, NULL, RSRC_CONF, 
@@ -1447,6 +1485,8 @@ const command_rec md_cmds[] = {
                   "Configure locking of store for updates."),
     AP_INIT_TAKE1("MDMatchNames", md_config_set_match_mode, NULL, RSRC_CONF,
                   "Determines how DNS names are matched to vhosts."),
+    AP_INIT_TAKE1("MDFallbackKeys", md_config_set_fallback_keys, NULL, RSRC_CONF,
+                  "Determines if fallback certificates share their private keys."),
     AP_INIT_TAKE1("MDInitialDelay", md_config_set_initial_delay, NULL, RSRC_CONF,
                   "How long to delay the first certificate check."),
     AP_INIT_TAKE1("MDCheckInterval", md_config_set_check_interval, NULL, RSRC_CONF,
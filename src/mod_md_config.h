@@ -22,6 +22,9 @@ struct md_store_t;
 struct md_reg_t;
 struct md_ocsp_reg_t;
 struct md_pkeys_spec_t;
+struct md_status_snap_t;
+struct md_metrics_t;
+struct md_cert_status_cache_t;
 
 typedef enum {
     MD_CONFIG_CA_CONTACT,
@@ -48,6 +51,12 @@ typedef enum {
     MD_MATCH_SERVERNAMES,
 } md_match_mode_t;
 
+typedef enum {
+    MD_STAPLE_OTHERS_OFF,
+    MD_STAPLE_OTHERS_ON,
+    MD_STAPLE_OTHERS_LAZY,             /* responses only fetched once a handshake asks */
+} md_staple_others_t;
+
 typedef struct md_mod_conf_t md_mod_conf_t;
 struct md_mod_conf_t {
     apr_array_header_t *mds;           /* all md_t* defined in the config, shared */
@@ -64,13 +73,19 @@ struct md_mod_conf_t {
     const char *hsts_header;           /* computed HTST header to use or NULL */
     apr_array_header_t *unused_names;  /* post config, names of all MDs not assigned to a vhost */
     struct apr_hash_t *init_errors;    /* init errors reported with MD name as key */
+    struct apr_hash_t *cred_files;     /* certificate files resolved for mod_ssl, by MD name */
+    int fallback_shared_keys;          /* != 0 iff fallback certificates share their keys */
+    struct apr_hash_t *fallback_keys;  /* shared fallback keys, by key file name */
 
     const char *notify_cmd;            /* notification command to execute on signup/renew */
     const char *message_cmd;           /* message command to execute on signup/renew/warnings */
     struct apr_table_t *env;           /* environment for operation */
     int dry_run;                       /* != 0 iff config dry run */
     int server_status_enabled;         /* if module should add to server-status handler */
+    struct md_status_snap_t *status_snap; /* status of all MDs for server- and certificate-status or NULL */
+    struct md_metrics_t *metrics;      /* metrics of MDs and OCSP for md-metrics or NULL */
     int certificate_status_enabled;    /* if module should expose /.httpd/certificate-status */
+    struct md_cert_status_cache_t *cert_status_cache; /* certificate-status responses or NULL */
     md_timeslice_t *ocsp_keep_window;  /* time that we keep ocsp responses around */
     md_timeslice_t *ocsp_renew_window; /* time before exp. that we start renewing ocsp resp. */
     const char *cert_check_name;       /* name of the linked certificate check site */
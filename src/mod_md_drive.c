@@ -34,6 +34,7 @@
 #include "md_event.h"
 #include "md_http.h"
 #include "md_json.h"
+#include "md_metrics.h"
 #include "md_status.h"
 #include "md_store.h"
 #include "md_store_fs.h"
@@ -66,6 +67,7 @@ struct md_renew_ctx_t {
     md_mod_conf_t *mc;
     ap_watchdog_t *watchdog;
     
+    md_job_reg_t *job_reg;
     apr_array_header_t *jobs;
 };
 
@@ -75,8 +77,7 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
     md_result_t *result = NULL;
     apr_status_t rv;
     
-    md_job_load(job);
-    /* Evaluate again on loaded value. Values will change when watchdog switches child process */
+    /* The job is kept in memory, loaded when the watchdog started in this child. */
     if (apr_time_now() < job->next_run) return;
     
     job->next_run = 0;
@@ -105,13 +106,15 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
          * Only returns SUCCESS when the renewal is complete, e.g. STAGING has a
          * complete set of new credentials.
          */
-        apr_time_t renew_at, now;
+        apr_time_t renew_at, now, started;
         const char *ari_explain_url = NULL;
+        int slot = md_metrics_get_slot(dctx->mc->metrics, md->name);
 
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10052)
                      "md(%s): state=%d, driving", job->mdomain, md->state);
 
         renew_at = md_reg_renew_at(dctx->mc->reg, md, ptemp);
+        md_metrics_set_time(dctx->mc->metrics, slot, MD_METRIC_RENEW_AT, renew_at);
         now = apr_time_now();
 
         if (md->stapling && dctx->mc->ocsp &&
@@ -187,8 +190,15 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
             md_result_printf(result, 0,
                              "Renewal triggered by CA via ARI, explanation at %s",
                              ari_explain_url);
+        started = apr_time_now();
         md_reg_renew(dctx->mc->reg, md, dctx->mc->env, 0, job->error_runs, result, ptemp);
         md_job_end_run(job, result);
+        md_metrics_inc(dctx->mc->metrics, slot, MD_METRIC_RENEWAL_RUNS);
+        md_metrics_set_duration(dctx->mc->metrics, slot, MD_METRIC_RENEWAL_DURATION,
+                                apr_time_now() - started);
+        if (APR_SUCCESS != result->status) {
+            md_metrics_inc(dctx->mc->metrics, slot, MD_METRIC_RENEWAL_ERRORS);
+        }
         
         if (APR_SUCCESS == result->status) {
             /* Finished jobs might take a while before the results become valid.
@@ -266,6 +276,9 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
         case AP_WATCHDOG_STATE_STARTING:
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10054)
                          "md watchdog start, auto drive %d mds", dctx->jobs->nelts);
+            /* Another child may have driven the jobs before, what we have
+             * in memory is from the server start. */
+            md_job_reg_load(dctx->job_reg, ptemp);
             break;
             
         case AP_WATCHDOG_STATE_RUNNING:
@@ -288,6 +301,8 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
                     next_run = job->next_run;
                 }
             }
+            /* write all jobs that changed in this run */
+            md_job_reg_flush(dctx->job_reg, ptemp);
 
             wait_time = next_run - apr_time_now();
             if (APLOGdebug(dctx->s)) {
@@ -300,6 +315,7 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
         case AP_WATCHDOG_STATE_STOPPING:
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10058)
                          "md watchdog stopping");
+            md_job_reg_flush(dctx->job_reg, ptemp);
             break;
     }
     
@@ -364,17 +380,17 @@ apr_status_t md_renew_start_watching(md_mod_conf_t *mc, server_rec *s, apr_pool_
     dctx->s = s;
     dctx->mc = mc;
     
+    dctx->job_reg = md_reg_job_reg_make(mc->reg, dctx->p);
     dctx->jobs = apr_array_make(dctx->p, mc->mds->nelts, sizeof(md_job_t *));
     for (i = 0; i < mc->mds->nelts; ++i) {
         md = APR_ARRAY_IDX(mc->mds, i, md_t*);
         if (!md || !md->watched) continue;
         
-        job = md_reg_job_make(mc->reg, md->name, p);
+        job = md_job_reg_get(dctx->job_reg, md->name);
         APR_ARRAY_PUSH(dctx->jobs, md_job_t*) = job;
         ap_log_error( APLOG_MARK, APLOG_TRACE1, 0, dctx->s,  
                      "md(%s): state=%d, created drive job", md->name, md->state);
         
-        md_job_load(job);
         if (job->error_runs) {
             /* Server has just restarted. If we encounter an MD job with errors
              * on a previous driving, we purge its STAGING area.
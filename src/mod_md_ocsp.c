@@ -60,6 +60,7 @@ int md_ocsp_prime_status(server_rec *s, apr_pool_t *p,
     const md_t *md;
     apr_array_header_t *chain;
     apr_status_t rv = APR_ENOENT;
+    int lazy;
 
     ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s, "ocsp prime status call for: %s",
                  s->server_hostname);
@@ -90,9 +91,10 @@ int md_ocsp_prime_status(server_rec *s, apr_pool_t *p,
         goto cleanup;
     }
 
+    lazy = (!md && md_config_geti(sc, MD_CONFIG_STAPLE_OTHERS) == MD_STAPLE_OTHERS_LAZY);
     rv = md_ocsp_prime(sc->mc->ocsp, id, id_len,
                        APR_ARRAY_IDX(chain, 0, md_cert_t*),
-                       APR_ARRAY_IDX(chain, 1, md_cert_t*), md);
+                       APR_ARRAY_IDX(chain, 1, md_cert_t*), md, lazy);
     ap_log_error(APLOG_MARK, APLOG_TRACE1, rv, s, "init stapling for: %s",
                  md? md->name : s->server_hostname);
 
@@ -135,6 +137,11 @@ declined:
 
 #define MD_OCSP_WATCHDOG_NAME   "_md_ocsp_"
 
+/* removal of old responses: files per watchdog run and the delay between runs
+ * while a sweep is ongoing */
+#define MD_OCSP_GC_MAX_FILES    100
+#define MD_OCSP_GC_DELAY        apr_time_from_sec(5)
+
 static APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
 static APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
 static APR_OPTIONAL_FN_TYPE(ap_watchdog_set_callback_interval) *wd_set_interval;
@@ -146,6 +153,7 @@ struct md_ocsp_ctx_t {
     server_rec *s;
     md_mod_conf_t *mc;
     ap_watchdog_t *watchdog;
+    apr_time_t gc_due;
 };
 
 static apr_time_t next_run_default(void)
@@ -154,6 +162,36 @@ static apr_time_t next_run_default(void)
     return apr_time_now() + apr_time_from_sec(MD_SECS_PER_HOUR);
 }
 
+/* House keeping of the responses in our store:
+ * - we store OCSP responses for each certificate individually by its SHA-1 id
+ * - this means, as long as certificate do not change, the number of response
+ *   files remains stable.
+ * - But when a certificate changes (is replaced), the response is obsolete
+ * - we do not get notified when a certificate is no longer used. An admin
+ *   might just reconfigure or change the content of a file (backup/restore etc.)
+ * - also, certificates might be added by some openssl config commands or other
+ *   modules that we do not immediately see right at startup. We cannot assume
+ *   that any OCSP response we cannot relate to a certificate RIGHT NOW, is no
+ *   longer needed.
+ * - since the response files are relatively small, we have no problem with
+ *   keeping them around for a while. We just do not want an ever growing store. 
+ * - The simplest and effective way seems to be to just remove files older
+ *   a certain amount of time. Take a 7 day default and let the admin configure
+ *   it for very special setups. 
+ * - Large stores are swept in steps, so this never holds up a (re)start or
+ *   the renewal of responses.
+ */ 
+static apr_status_t ocsp_remove_old_responses(md_mod_conf_t *mc, apr_pool_t *p)
+{
+    md_timeperiod_t keep_norm, keep;
+    
+    keep_norm.end = apr_time_now();
+    keep_norm.start = keep_norm.end - MD_TIME_OCSP_KEEP_NORM;
+    keep = md_timeperiod_slice_before_end(&keep_norm, mc->ocsp_keep_window);
+    /* remove ocsp responses older than keep.start, a limited amount at a time */
+    return md_ocsp_remove_responses_step(mc->ocsp, p, keep.start, MD_OCSP_GC_MAX_FILES);
+}
+
 static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
 {
     md_ocsp_ctx_t *octx = baton;
@@ -183,6 +221,18 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
             
             md_ocsp_renew(octx->mc->ocsp, octx->p, ptemp, &next_run);
             
+            if (octx->gc_due <= apr_time_now()) {
+                if (APR_STATUS_IS_INCOMPLETE(ocsp_remove_old_responses(octx->mc, ptemp))) {
+                    /* more to do, continue soon */
+                    if (next_run > apr_time_now() + MD_OCSP_GC_DELAY) {
+                        next_run = apr_time_now() + MD_OCSP_GC_DELAY;
+                    }
+                }
+                else {
+                    octx->gc_due = apr_time_now() + apr_time_from_sec(MD_SECS_PER_DAY);
+                }
+            }
+            
             wait_time = next_run - apr_time_now();
             if (APLOGdebug(octx->s)) {
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, octx->s, APLOGNO(10199)
@@ -201,17 +251,6 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
     return APR_SUCCESS;
 }
 
-static apr_status_t ocsp_remove_old_responses(md_mod_conf_t *mc, apr_pool_t *p)
-{
-    md_timeperiod_t keep_norm, keep;
-    
-    keep_norm.end = apr_time_now();
-    keep_norm.start = keep_norm.end - MD_TIME_OCSP_KEEP_NORM;
-    keep = md_timeperiod_slice_before_end(&keep_norm, mc->ocsp_keep_window);
-    /* remove any ocsp response older than keep.start */
-    return md_ocsp_remove_responses_older_than(mc->ocsp, p, keep.start);
-}
-
 apr_status_t md_ocsp_start_watching(md_mod_conf_t *mc, server_rec *s, apr_pool_t *p)
 {
     apr_allocator_t *allocator;
@@ -247,25 +286,6 @@ apr_status_t md_ocsp_start_watching(md_mod_conf_t *mc, server_rec *s, apr_pool_t
     octx->s = s;
     octx->mc = mc;
     
-    /* Time for some house keeping, before the server goes live (again):
-     * - we store OCSP responses for each certificate individually by its SHA-1 id
-     * - this means, as long as certificate do not change, the number of response
-     *   files remains stable.
-     * - But when a certificate changes (is replaced), the response is obsolete
-     * - we do not get notified when a certificate is no longer used. An admin
-     *   might just reconfigure or change the content of a file (backup/restore etc.)
-     * - also, certificates might be added by some openssl config commands or other
-     *   modules that we do not immediately see right at startup. We cannot assume
-     *   that any OCSP response we cannot relate to a certificate RIGHT NOW, is no
-     *   longer needed.
-     * - since the response files are relatively small, we have no problem with
-     *   keeping them around for a while. We just do not want an ever growing store. 
-     * - The simplest and effective way seems to be to just remove files older
-     *   a certain amount of time. Take a 7 day default and let the admin configure
-     *   it for very special setups. 
-     */ 
-    ocsp_remove_old_responses(mc, octx->p);
-    
     rv = wd_get_instance(&octx->watchdog, MD_OCSP_WATCHDOG_NAME, 0, 1, octx->p);
     if (APR_SUCCESS != rv) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10202) 
@@ -15,16 +15,20 @@
  */
 
 #include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <apr_optional.h>
 #include <apr_time.h>
 #include <apr_date.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
 
 #include <httpd.h>
 #include <http_core.h>
 #include <http_protocol.h>
 #include <http_request.h>
 #include <http_log.h>
+#include <util_script.h>
 
 #include "mod_status.h"
 
@@ -32,6 +36,7 @@
 #include "md_curl.h"
 #include "md_crypt.h"
 #include "md_http.h"
+#include "md_metrics.h"
 #include "md_ocsp.h"
 #include "md_json.h"
 #include "md_status.h"
@@ -57,16 +62,198 @@
 #define MD_STATUS_RESOURCE          APACHE_PREFIX"certificate-status"
 #define HTML_STATUS(X)              (!((X)->flags & AP_STATUS_SHORT))
 
-int md_http_cert_status(request_rec *r)
+static apr_status_t pass_json(void *baton, apr_bucket_brigade *bb)
 {
-    int i;
-    md_json_t *resp, *mdj, *cj;
-    const md_srv_conf_t *sc;
+    request_rec *r = baton;
+    apr_status_t rv;
+
+    rv = ap_pass_brigade(r->output_filters, bb);
+    apr_brigade_cleanup(bb);
+    return rv;
+}
+
+/* The certificate-status of an MD is cached in each child. It is made again when
+ * a file of the MD has been written, as seen in its generation, or as
+ * md_status_expires() says. */
+typedef struct {
+    apr_pool_t *p;              /* holds etag and body, NULL when nothing is cached */
+    apr_uint32_t gen;
+    apr_time_t expires;
+    const char *etag;
+    const char *body;
+    apr_size_t len;
+} cert_status_entry_t;
+
+struct md_cert_status_cache_t {
+    apr_pool_t *p;              /* own allocator, parent of entry pools, used under mutex only */
+    apr_thread_mutex_t *mutex;
+    md_status_snap_t *snap;     /* has the generations of the MDs */
+    apr_hash_t *entries;        /* MD name -> cert_status_entry_t, read only */
+};
+
+void md_cert_status_init(md_mod_conf_t *mc, server_rec *s, apr_pool_t *p)
+{
+    md_cert_status_cache_t *cache;
+    apr_allocator_t *allocator;
     const md_t *md;
+    apr_status_t rv;
+    int i;
+
+    mc->cert_status_cache = NULL;
+    if (!mc->certificate_status_enabled || !mc->status_snap) return;
+
+    cache = apr_pcalloc(p, sizeof(*cache));
+    rv = apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (APR_SUCCESS == rv && APR_SUCCESS == (rv = apr_allocator_create(&allocator))) {
+        rv = apr_pool_create_ex(&cache->p, p, NULL, allocator);
+        if (APR_SUCCESS != rv) apr_allocator_destroy(allocator);
+    }
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s,
+                     "no certificate-status cache, responses are made on each request");
+        return;
+    }
+    apr_allocator_owner_set(allocator, cache->p);
+    apr_pool_tag(cache->p, "md_cert_status");
+    cache->snap = mc->status_snap;
+    cache->entries = apr_hash_make(p);
+    for (i = 0; i < mc->mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mc->mds, i, const md_t*);
+        apr_hash_set(cache->entries, md->name, APR_HASH_KEY_STRING, 
+                     apr_pcalloc(p, sizeof(cert_status_entry_t)));
+    }
+    mc->cert_status_cache = cache;
+}
+
+static apr_status_t cert_status_make(const char **pbody, apr_size_t *plen, 
+                                     const md_t *md, md_json_t *mdj, request_rec *r)
+{
+    int i;
+    md_json_t *cj;
+    md_json_stream_t *stream;
     md_pkey_spec_t *spec;
     const char *keyname;
     apr_bucket_brigade *bb;
+    char *body;
+    apr_status_t rv;
+
+    /* Write the public parts of the status directly, without copying them
+     * into a response object first. */
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    md_json_stream_make(&stream, r->pool, MD_JSON_FMT_INDENT, bb, NULL, NULL);
+    md_json_stream_open_obj(stream, NULL);
+
+    if ((cj = md_json_getj(mdj, MD_KEY_CERT, MD_KEY_VALID, NULL))) {
+        md_json_stream_putj(stream, MD_KEY_VALID, cj);
+    }
+
+    for (i = 0; i < md_cert_count(md); ++i) {
+        spec = md_pkeys_spec_get(md->pks, i);
+        keyname = md_pkey_spec_name(spec);
+        md_json_stream_open_obj(stream, keyname);
+
+        if ((cj = md_json_getj(mdj, MD_KEY_CERT, keyname, MD_KEY_VALID, NULL))) {
+            md_json_stream_putj(stream, MD_KEY_VALID, cj);
+        }
+        if (md_json_has_key(mdj, MD_KEY_CERT, keyname, MD_KEY_SERIAL, NULL)) {
+            md_json_stream_puts(stream, MD_KEY_SERIAL,
+                                md_json_gets(mdj, MD_KEY_CERT, keyname, MD_KEY_SERIAL, NULL));
+        }
+        if (md_json_has_key(mdj, MD_KEY_CERT, keyname, MD_KEY_SHA256_FINGERPRINT, NULL)) {
+            md_json_stream_puts(stream, MD_KEY_SHA256_FINGERPRINT,
+                                md_json_gets(mdj, MD_KEY_CERT, keyname, 
+                                             MD_KEY_SHA256_FINGERPRINT, NULL));
+        }
+        md_json_stream_close(stream);
+    }
+
+    if (md_json_has_key(mdj, MD_KEY_RENEWAL, NULL)) {
+           /* copy over the information we want to make public about this:
+            *  - when not finished, add an empty object to indicate something is going on
+            *  - when a certificate is staged, add the information from that */
+           md_json_stream_open_obj(stream, MD_KEY_RENEWAL);
+           if ((cj = md_json_getj(mdj, MD_KEY_RENEWAL, MD_KEY_CERT, NULL))) {
+               md_json_stream_putj(stream, MD_KEY_CERT, cj);
+           }
+           else {
+               md_json_stream_open_obj(stream, MD_KEY_CERT);
+               md_json_stream_close(stream);
+           }
+           md_json_stream_close(stream);
+     }
+
+    rv = md_json_stream_end(stream);
+    if (APR_SUCCESS == rv) {
+        rv = apr_brigade_pflatten(bb, &body, plen, r->pool);
+        *pbody = body;
+    }
+    apr_brigade_destroy(bb);
+    return rv;
+}
+
+static const char *cert_status_etag(const char *body, apr_size_t len, apr_pool_t *p)
+{
+    md_data_t data;
+    const char *hex;
+
+    md_data_init(&data, body, len);
+    if (APR_SUCCESS != md_crypt_sha256_digest_hex(&hex, p, &data)) return NULL;
+    return apr_pstrcat(p, "\"", hex, "\"", NULL);
+}
+
+static int cert_status_get(const char **pbody, apr_size_t *plen, const char **petag,
+                           cert_status_entry_t *e, md_cert_status_cache_t *cache, 
+                           apr_uint32_t gen, request_rec *r)
+{
+    int found = 0;
+
+    apr_thread_mutex_lock(cache->mutex);
+    if (e->p && e->gen == gen && apr_time_now() < e->expires) {
+        *pbody = apr_pmemdup(r->pool, e->body, e->len);
+        *plen = e->len;
+        *petag = apr_pstrdup(r->pool, e->etag);
+        found = 1;
+    }
+    apr_thread_mutex_unlock(cache->mutex);
+    return found;
+}
+
+/* Replace what is cached for an MD. Readers copy the cached values, so the 
+ * pool holding the old ones is destroyed right away. */
+static void cert_status_set(cert_status_entry_t *e, md_cert_status_cache_t *cache, 
+                            apr_uint32_t gen, apr_time_t expires, 
+                            const char *body, apr_size_t len, const char *etag)
+{
+    apr_pool_t *p;
+
+    apr_thread_mutex_lock(cache->mutex);
+    if (APR_SUCCESS == apr_pool_create(&p, cache->p)) {
+        apr_pool_tag(p, "md_cert_status_entry");
+        if (e->p) apr_pool_destroy(e->p);
+        e->p = p;
+        e->body = apr_pmemdup(p, body, len);
+        e->len = len;
+        e->etag = apr_pstrdup(p, etag);
+        e->gen = gen;
+        e->expires = expires;
+    }
+    apr_thread_mutex_unlock(cache->mutex);
+}
+
+int md_http_cert_status(request_rec *r)
+{
+    md_json_t *mdj;
+    const md_srv_conf_t *sc;
+    const md_t *md;
+    md_cert_status_cache_t *cache;
+    cert_status_entry_t *e = NULL;
+    const char *body = NULL, *etag = NULL;
+    apr_size_t len = 0;
+    apr_uint32_t gen = 0;
+    apr_time_t now;
+    apr_bucket_brigade *bb;
     apr_status_t rv;
+    int status;
 
     if (!r->parsed_uri.path || strcmp(MD_STATUS_RESOURCE, r->parsed_uri.path))
         return DECLINED;
@@ -89,59 +276,59 @@ int md_http_cert_status(request_rec *r)
     ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
                   "requesting status for MD: %s", md->name);
 
-    rv = md_status_get_md_json(&mdj, md, sc->mc->reg, sc->mc->ocsp, r->pool);
-    if (APR_SUCCESS != rv) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10204)
-                      "loading md status for %s", md->name);
-        return HTTP_INTERNAL_SERVER_ERROR;
+    cache = sc->mc->cert_status_cache;
+    if (cache && (e = apr_hash_get(cache->entries, md->name, APR_HASH_KEY_STRING))
+        && !md_status_snap_get_gen(&gen, cache->snap, md->name)) {
+        e = NULL;
     }
+    if (e && cert_status_get(&body, &len, &etag, e, cache, gen, r)) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, 
+                      "md[%s]: status from cache", md->name);
+    }
+    else {
+        /* the generation was read before we look, a change while we do is
+         * seen on the next request. */
+        now = apr_time_now();
+        rv = md_status_get_md_json(&mdj, md, sc->mc->reg, sc->mc->ocsp, r->pool);
+        if (APR_SUCCESS != rv) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10204)
+                          "loading md status for %s", md->name);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
 
-    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
-                  "status for MD: %s is %s", md->name, md_json_writep(mdj, r->pool, MD_JSON_FMT_INDENT));
-
-    resp = md_json_create(r->pool);
-
-    if (md_json_has_key(mdj, MD_KEY_CERT, MD_KEY_VALID, NULL)) {
-         md_json_setj(md_json_getj(mdj, MD_KEY_CERT, MD_KEY_VALID, NULL), resp, MD_KEY_VALID, NULL);
-     }
-
-    for (i = 0; i < md_cert_count(md); ++i) {
-        spec = md_pkeys_spec_get(md->pks, i);
-        keyname = md_pkey_spec_name(spec);
-        cj = md_json_create(r->pool);
-
-        if (md_json_has_key(mdj, MD_KEY_CERT, keyname, MD_KEY_VALID, NULL)) {
-            md_json_setj(md_json_getj(mdj, MD_KEY_CERT, keyname, MD_KEY_VALID, NULL),
-                         cj, MD_KEY_VALID, NULL);
+        if (APLOGrtrace2(r)) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "status for MD: %s is %s", 
+                          md->name, md_json_writep(mdj, r->pool, MD_JSON_FMT_INDENT));
         }
 
-        if (md_json_has_key(mdj, MD_KEY_CERT, keyname, MD_KEY_SERIAL, NULL)) {
-            md_json_sets(md_json_gets(mdj, MD_KEY_CERT, keyname, MD_KEY_SERIAL, NULL),
-                         cj, MD_KEY_SERIAL, NULL);
+        rv = cert_status_make(&body, &len, md, mdj, r);
+        if (APR_SUCCESS != rv || !(etag = cert_status_etag(body, len, r->pool))) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, "md[%s]: making status", md->name);
+            return HTTP_INTERNAL_SERVER_ERROR;
         }
-        if (md_json_has_key(mdj, MD_KEY_CERT, keyname, MD_KEY_SHA256_FINGERPRINT, NULL)) {
-            md_json_sets(md_json_gets(mdj, MD_KEY_CERT, keyname, MD_KEY_SHA256_FINGERPRINT, NULL),
-                         cj, MD_KEY_SHA256_FINGERPRINT, NULL);
+
+        if (e) {
+            cert_status_set(e, cache, gen, md_status_expires(md, sc->mc->reg, now, r->pool),
+                            body, len, etag);
         }
-        md_json_setj(cj, resp, keyname, NULL );
     }
 
-    if (md_json_has_key(mdj, MD_KEY_RENEWAL, NULL)) {
-           /* copy over the information we want to make public about this:
-            *  - when not finished, add an empty object to indicate something is going on
-            *  - when a certificate is staged, add the information from that */
-           cj = md_json_getj(mdj, MD_KEY_RENEWAL, MD_KEY_CERT, NULL);
-           cj = cj? cj : md_json_create(r->pool);
-           md_json_setj(cj, resp, MD_KEY_RENEWAL, MD_KEY_CERT, NULL);
-     }
+    apr_table_set(r->headers_out, "ETag", etag);
+    status = ap_meets_conditions(r);
+    if (OK != status) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, 
+                      "md[%s]: status not sent, %d", md->name, status);
+        return status;
+    }
 
     ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "md[%s]: sending status", md->name);
     apr_table_set(r->headers_out, "Content-Type", "application/json");
     bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
-    md_json_writeb(resp, MD_JSON_FMT_INDENT, bb);
-    ap_pass_brigade(r->output_filters, bb);
-    apr_brigade_cleanup(bb);
-
+    apr_brigade_write(bb, NULL, NULL, body, len);
+    rv = pass_json(r, bb);
+    if (APR_SUCCESS != rv) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, "md[%s]: writing status", md->name);
+    }
     return DONE;
 }
 
@@ -739,14 +926,55 @@ static int md_name_cmp(const void *v1, const void *v2)
     return strcmp((*(const md_t**)v1)->name, (*(const md_t**)v2)->name);
 }
 
+static void add_domains_status(status_ctx *ctx, request_rec *r,
+                               md_json_t *jstatus, md_json_t *jstock)
+{
+    int i;
+
+    if (!HTML_STATUS(ctx)) {
+        int total = 0, complete = 0, renewing = 0, errored = 0, ready = 0;
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "no-html managed domain status summary");
+        if (jstock) {
+            total = (int)md_json_getl(jstock, MD_KEY_TOTAL, NULL);
+            complete = (int)md_json_getl(jstock, MD_KEY_COMPLETE, NULL);
+            renewing = (int)md_json_getl(jstock, MD_KEY_RENEWING, NULL);
+            errored = (int)md_json_getl(jstock, MD_KEY_ERRORED, NULL);
+            ready = (int)md_json_getl(jstock, MD_KEY_READY, NULL);
+        }
+        apr_brigade_printf(ctx->bb, NULL, NULL, "%sTotal: %d\n", ctx->prefix, total);
+        apr_brigade_printf(ctx->bb, NULL, NULL, "%sOK: %d\n", ctx->prefix, complete);
+        apr_brigade_printf(ctx->bb, NULL, NULL, "%sRenew: %d\n", ctx->prefix, renewing);
+        apr_brigade_printf(ctx->bb, NULL, NULL, "%sErrored: %d\n", ctx->prefix, errored);
+        apr_brigade_printf(ctx->bb, NULL, NULL, "%sReady: %d\n", ctx->prefix, ready);
+    }
+    if (jstatus) {
+        if (HTML_STATUS(ctx)) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "html managed domain status table");
+            apr_brigade_puts(ctx->bb, NULL, NULL,
+                             "<hr>\n<h3>Managed Certificates</h3>\n<table class='md_status'><thead><tr>\n");
+            for (i = 0; i < (int)(sizeof(status_infos)/sizeof(status_infos[0])); ++i) {
+                si_add_header(ctx, &status_infos[i]);
+            }
+            apr_brigade_puts(ctx->bb, NULL, NULL, "</tr>\n</thead><tbody>");
+        }
+        else {
+            ctx->prefix = "ManagedDomain";
+        }
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "iterating JSON managed domain status");
+        md_json_itera(add_md_row, ctx, jstatus, MD_KEY_MDS, NULL);
+        if (HTML_STATUS(ctx)) {
+            apr_brigade_puts(ctx->bb, NULL, NULL, "</td></tr>\n</tbody>\n</table>\n");
+        }
+    }
+}
+
 int md_domains_status_hook(request_rec *r, int flags)
 {
     const md_srv_conf_t *sc;
     const md_mod_conf_t *mc;
-    int i;
     status_ctx ctx;
     apr_array_header_t *mds;
-    md_json_t *jstatus, *jstock;
+    md_json_t *jstatus = NULL, *jstock = NULL;
 
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "server-status for managed domains, start");
     sc = ap_get_module_config(r->server->module_config, &md_module);
@@ -761,47 +989,24 @@ int md_domains_status_hook(request_rec *r, int flags)
     ctx.prefix = "ManagedCertificates";
     ctx.separator = " ";
 
-    mds = apr_array_copy(r->pool, mc->mds);
-    qsort(mds->elts, (size_t)mds->nelts, sizeof(md_t *), md_name_cmp);
-
-    if (!HTML_STATUS(&ctx)) {
-        int total = 0, complete = 0, renewing = 0, errored = 0, ready = 0;
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "no-html managed domain status summary");
-        if (mc->mds->nelts > 0) {
+    if (mc->status_snap) {
+        md_status_snap_get(&jstatus, &jstock, mc->status_snap, r->pool);
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "got managed domain status snapshot");
+        add_domains_status(&ctx, r, jstatus, jstock);
+    }
+    else if (mc->mds->nelts > 0) {
+        mds = apr_array_copy(r->pool, mc->mds);
+        qsort(mds->elts, (size_t)mds->nelts, sizeof(md_t *), md_name_cmp);
+        if (!HTML_STATUS(&ctx)) {
             md_status_take_stock(&jstock, mds, mc->reg, r->pool);
             ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "got JSON managed domain status summary");
-            total = (int)md_json_getl(jstock, MD_KEY_TOTAL, NULL);
-            complete = (int)md_json_getl(jstock, MD_KEY_COMPLETE, NULL);
-            renewing = (int)md_json_getl(jstock, MD_KEY_RENEWING, NULL);
-            errored = (int)md_json_getl(jstock, MD_KEY_ERRORED, NULL);
-            ready = (int)md_json_getl(jstock, MD_KEY_READY, NULL);
         }
-        apr_brigade_printf(ctx.bb, NULL, NULL, "%sTotal: %d\n", ctx.prefix, total);
-        apr_brigade_printf(ctx.bb, NULL, NULL, "%sOK: %d\n", ctx.prefix, complete);
-        apr_brigade_printf(ctx.bb, NULL, NULL, "%sRenew: %d\n", ctx.prefix, renewing);
-        apr_brigade_printf(ctx.bb, NULL, NULL, "%sErrored: %d\n", ctx.prefix, errored);
-        apr_brigade_printf(ctx.bb, NULL, NULL, "%sReady: %d\n", ctx.prefix, ready);
-    }
-    if (mc->mds->nelts > 0) {
-        md_status_get_json(&jstatus, mds, mc->reg, mc->ocsp, r->pool);
+        md_status_get_json(&jstatus, mds, mc->reg, mc->ocsp, NULL, r->pool);
         ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "got JSON managed domain status");
-        if (HTML_STATUS(&ctx)) {
-            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "html managed domain status table");
-            apr_brigade_puts(ctx.bb, NULL, NULL,
-                             "<hr>\n<h3>Managed Certificates</h3>\n<table class='md_status'><thead><tr>\n");
-            for (i = 0; i < (int)(sizeof(status_infos)/sizeof(status_infos[0])); ++i) {
-                si_add_header(&ctx, &status_infos[i]);
-            }
-            apr_brigade_puts(ctx.bb, NULL, NULL, "</tr>\n</thead><tbody>");
-        }
-        else {
-            ctx.prefix = "ManagedDomain";
-        }
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "iterating JSON managed domain status");
-        md_json_itera(add_md_row, &ctx, jstatus, MD_KEY_MDS, NULL);
-        if (HTML_STATUS(&ctx)) {
-            apr_brigade_puts(ctx.bb, NULL, NULL, "</td></tr>\n</tbody>\n</table>\n");
-        }
+        add_domains_status(&ctx, r, jstatus, jstock);
+    }
+    else {
+        add_domains_status(&ctx, r, NULL, NULL);
     }
 
     ap_pass_brigade(r->output_filters, ctx.bb);
@@ -930,15 +1135,77 @@ int md_ocsp_status_hook(request_rec *r, int flags)
 /**************************************************************************************************/
 /* Status handlers */
 
+static const char *parse_count(int *pcount, const char *s)
+{
+    char *end;
+    long n;
+
+    n = strtol(s, &end, 10);
+    if (end == s || *end || n < 0 || n > INT_MAX) return "not a non-negative number";
+    *pcount = (int)n;
+    return NULL;
+}
+
+/* The listing of all MDs can be restricted by query parameters:
+ *   state=<complete|renewing|errored|ready>[,...]  MDs in one of these states
+ *   prefix=<name>                                 MDs whose name starts with this
+ *   offset=<n>, limit=<n>                         paging over the matching MDs
+ *   fields=<key>[,...]                            only these fields of each MD */
+static const char *parse_status_query(md_status_query_t **pquery, request_rec *r)
+{
+    md_status_query_t *query;
+    apr_table_t *args;
+    const char *s, *err = NULL;
+    char *list, *tok, *last;
+
+    *pquery = NULL;
+    if (!r->args || !*r->args) return NULL;
+
+    ap_args_to_table(r, &args);
+    query = apr_pcalloc(r->pool, sizeof(*query));
+    query->limit = -1;
+    if ((s = apr_table_get(args, "state"))) {
+        list = apr_pstrdup(r->pool, s);
+        for (tok = apr_strtok(list, ",", &last); tok; tok = apr_strtok(NULL, ",", &last)) {
+            if (!strcmp(MD_KEY_COMPLETE, tok)) query->states |= MD_STATUS_COMPLETE;
+            else if (!strcmp(MD_KEY_RENEWING, tok)) query->states |= MD_STATUS_RENEWING;
+            else if (!strcmp(MD_KEY_ERRORED, tok)) query->states |= MD_STATUS_ERRORED;
+            else if (!strcmp(MD_KEY_READY, tok)) query->states |= MD_STATUS_READY;
+            else return apr_psprintf(r->pool, "unknown state '%s'", tok);
+        }
+    }
+    if ((s = apr_table_get(args, "prefix")) && *s) {
+        query->prefix = s;
+    }
+    if ((s = apr_table_get(args, "offset")) && (err = parse_count(&query->offset, s))) {
+        return apr_psprintf(r->pool, "offset: %s", err);
+    }
+    if ((s = apr_table_get(args, "limit")) && (err = parse_count(&query->limit, s))) {
+        return apr_psprintf(r->pool, "limit: %s", err);
+    }
+    if ((s = apr_table_get(args, "fields"))) {
+        query->fields = apr_array_make(r->pool, 10, sizeof(const char*));
+        list = apr_pstrdup(r->pool, s);
+        for (tok = apr_strtok(list, ",", &last); tok; tok = apr_strtok(NULL, ",", &last)) {
+            APR_ARRAY_PUSH(query->fields, const char*) = tok;
+        }
+    }
+    *pquery = query;
+    return NULL;
+}
+
 int md_status_handler(request_rec *r)
 {
     const md_srv_conf_t *sc;
     const md_mod_conf_t *mc;
     apr_array_header_t *mds;
     md_json_t *jstatus;
+    md_json_stream_t *stream;
+    md_status_query_t *query;
     apr_bucket_brigade *bb;
     const md_t *md;
-    const char *name;
+    const char *name, *err;
+    apr_status_t rv;
 
     if (strcmp(r->handler, "md-status")) {
         return DECLINED;
@@ -962,15 +1229,25 @@ int md_status_handler(request_rec *r)
         if (!md) md = md_get_by_domain(mc->mds, name);
     }
 
-    if (md) {
-        md_status_get_md_json(&jstatus, md, mc->reg, mc->ocsp, r->pool);
-    }
-    else {
+    if (!md) {
+        /* All MDs, written one by one as the status of many gets large */
+        if ((err = parse_status_query(&query, r))) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, "md-status query: %s", err);
+            return HTTP_BAD_REQUEST;
+        }
         mds = apr_array_copy(r->pool, mc->mds);
         qsort(mds->elts, (size_t)mds->nelts, sizeof(md_t *), md_name_cmp);
-        md_status_get_json(&jstatus, mds, mc->reg, mc->ocsp, r->pool);
+        apr_table_set(r->headers_out, "Content-Type", "application/json");
+        bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+        md_json_stream_make(&stream, r->pool, MD_JSON_FMT_INDENT, bb, pass_json, r);
+        rv = md_status_stream_json(stream, mds, mc->reg, mc->ocsp, query, r->pool);
+        if (APR_SUCCESS != rv) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, "writing md-status");
+        }
+        return DONE;
     }
 
+    md_status_get_md_json(&jstatus, md, mc->reg, mc->ocsp, r->pool);
     if (jstatus) {
         apr_table_set(r->headers_out, "Content-Type", "application/json");
         bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
@@ -983,3 +1260,35 @@ int md_status_handler(request_rec *r)
     return DECLINED;
 }
 
+int md_metrics_handler(request_rec *r)
+{
+    const md_srv_conf_t *sc;
+    const md_mod_conf_t *mc;
+    apr_bucket_brigade *bb;
+    apr_status_t rv;
+
+    if (strcmp(r->handler, "md-metrics")) {
+        return DECLINED;
+    }
+
+    sc = ap_get_module_config(r->server->module_config, &md_module);
+    if (!sc) return DECLINED;
+    mc = sc->mc;
+    if (!mc || !mc->metrics) return DECLINED;
+
+    if (r->method_number != M_GET) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "md-metrics supports only GET");
+        return HTTP_NOT_IMPLEMENTED;
+    }
+
+    ap_set_content_type(r, "application/openmetrics-text; version=1.0.0; charset=utf-8");
+    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
+    rv = md_metrics_write(mc->metrics, bb);
+    if (APR_SUCCESS != rv) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, "writing md-metrics");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    ap_pass_brigade(r->output_filters, bb);
+    apr_brigade_cleanup(bb);
+    return DONE;
+}
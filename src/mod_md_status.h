@@ -17,11 +17,22 @@
 #ifndef mod_md_md_status_h
 #define mod_md_md_status_h
 
+struct md_mod_conf_t;
+
+typedef struct md_cert_status_cache_t md_cert_status_cache_t;
+
+/**
+ * Set up the cache for certificate-status responses, when enabled and the
+ * MDs have a status snapshot.
+ */
+void md_cert_status_init(struct md_mod_conf_t *mc, server_rec *s, apr_pool_t *p);
+
 int md_http_cert_status(request_rec *r);
 
 int md_domains_status_hook(request_rec *r, int flags);
 int md_ocsp_status_hook(request_rec *r, int flags);
 
 int md_status_handler(request_rec *r);
+int md_metrics_handler(request_rec *r);
 
 #endif /* mod_md_md_status_h */
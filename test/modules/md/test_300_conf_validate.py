@@ -585,3 +585,68 @@ class TestConf:
         r = env.apache_restart()
         env.purge_store()
         assert r != 0, f'{env.apachectl_stderr}'
+
+    # test case: MDs are linked to the vhosts whose names they match
+    def test_md_300_032(self, env):
+        env.purge_store()
+        count = 20
+        conf = MDConf(env)
+        conf.add_drive_mode("manual")
+        conf.add("LogLevel md:debug")
+        for i in range(count):
+            domain = f"md{i:02d}.{self.test_domain}"
+            conf.add_md([domain, f"www.{domain}"])
+        conf.add_md([f"x.wild.{self.test_domain}"])
+        for i in range(count):
+            domain = f"md{i:02d}.{self.test_domain}"
+            conf.add_vhost([f"www.{domain}", domain], port=env.http_port, with_ssl=False)
+        conf.add_vhost([f"other.{self.test_domain}", f"*.wild.{self.test_domain}"],
+                       port=env.http_port, with_ssl=False)
+        conf.add_vhost([f"nomd.{self.test_domain}"], port=env.http_port, with_ssl=False)
+        conf.install()
+        env.httpd_error_log.clear_log()
+        assert env.apache_restart() == 0, f'{env.apachectl_stderr}'
+        linked = {}
+        p = re.compile(r'.*AH10041: Server (\S+):\d+ matches md (\S+) ')
+        with open(env.httpd_error_log.path) as fd:
+            for line in fd:
+                m = p.match(line)
+                if m:
+                    linked.setdefault(m.group(1), set()).add(m.group(2))
+        for i in range(count):
+            domain = f"md{i:02d}.{self.test_domain}"
+            assert linked[f"www.{domain}"] == {domain}
+        assert linked[f"other.{self.test_domain}"] == {f"x.wild.{self.test_domain}"}
+        assert f"nomd.{self.test_domain}" not in linked
+        env.httpd_error_log.ignore_recent(
+            lognos=[
+                "AH10040",  # ServerAlias not covered
+            ]
+        )
+        env.purge_store()
+
+    # test case: with MDMatchNames servernames, a wildcard pre-empted by another
+    # MD lets the next domain of the MD that matches the ServerName count
+    def test_md_300_033(self, env):
+        env.purge_store()
+        domain = self.test_domain
+        conf = MDConf(env)
+        conf.add("MDMembers manual")
+        conf.add("MDMatchNames servernames")
+        conf.add(f"""
+            MDomain a.{domain}
+            MDomain y.{domain} *.{domain} a.{domain}
+            <VirtualHost 10.0.0.1:{env.https_port}>
+              ServerName a.{domain}
+              SSLEngine on
+            </VirtualHost>
+            """)
+        conf.install()
+        # the 2nd MD matches with 'a.{domain}', both MDs are on the same vhost
+        assert env.apache_fail() == 0
+        env.httpd_error_log.ignore_recent(
+            lognos=[
+                "AH10042",  # 2 MDs match the same vhost
+            ]
+        )
+        env.purge_store()
@@ -253,6 +253,34 @@ class TestAutov2:
             ]
         )
 
+    # test case: like 005, with fallback certificates sharing their key
+    def test_md_702_007(self, env):
+        domain = self.test_domain
+        name_a = "test-a." + domain
+        name_b = "test-b." + domain
+        #
+        # generate 2 MDs and 2 vhosts
+        conf = MDConf(env, admin="admin@" + domain)
+        conf.add_drive_mode("manual")
+        conf.add("MDFallbackKeys shared")
+        conf.add_md([name_a])
+        conf.add_md([name_b])
+        conf.add_vhost(name_a, doc_root="htdocs/a")
+        conf.add_vhost(name_b, doc_root="htdocs/b")
+        conf.install()
+        assert env.apache_restart() == 0, f'{env.apachectl_stderr}'
+        #
+        # check: both serve their own certificate with the same key
+        cert_a = env.get_cert(name_a)
+        cert_b = env.get_cert(name_b)
+        assert name_a in cert_a.get_san_list()
+        assert name_b in cert_b.get_san_list()
+        assert not cert_a.same_serial_as(cert_b)
+        assert cert_a.cert.public_key().public_numbers() == \
+               cert_b.cert.public_key().public_numbers()
+        assert os.path.exists(os.path.join(env.store_dir, 'fallback-privkey.pem'))
+        assert not os.path.exists(env.path_fallback_cert(name_a))
+
     # Specify a non-working http proxy
     def test_md_702_008(self, env):
         domain = self.test_domain
@@ -451,3 +451,38 @@ class TestStapling:
         else:
             assert stat['ocsp'] == "successful (0x0)"
             assert stat['verify'] == "0 (ok)"
+
+    # test MDStapleOthers lazy: responses are only asked for once a
+    # handshake wants them, which is marked in shared memory
+    @pytest.mark.skipif(MDTestEnv.lacks_ocsp(), reason="no OCSP responder")
+    def test_md_801_013(self, env):
+        env.clear_ocsp_store()
+        md = self.mdA
+        conf = self.configure_httpd(env, std_vhosts=False)
+        conf.add("MDStapling on")
+        conf.add("MDStapleOthers lazy")
+        conf.add("LogLevel md:debug")
+        conf.add([
+            "<Location /md-metrics>",
+            "    SetHandler md-metrics",
+            "</Location>",
+        ])
+        conf.start_vhost(md)
+        conf.add_certificate(env.store_domain_file(md, 'pubcert.pem'),
+                             env.store_domain_file(md, 'privkey.pem'))
+        conf.end_vhost()
+        conf.install()
+        env.httpd_error_log.clear_log()
+        assert env.apache_restart() == 0, f'{env.apachectl_stderr}'
+        assert env.httpd_error_log.scan_recent(
+            pattern=re.compile(r'.*md\[other]: adding lazy ocsp info'))
+        dirpath = os.path.join(env.store_dir, 'ocsp', 'other')
+        time.sleep(1)
+        assert not os.path.exists(dirpath) or \
+            not [n for n in os.listdir(dirpath) if n.startswith("ocsp-")]
+        # the first handshake has nothing to staple, but marks the use
+        stat = env.get_ocsp_status(md)
+        assert stat['ocsp'] == "no response sent"
+        metrics = env.get_content(md, "/md-metrics")
+        assert re.search(r'md_ocsp_last_used_timestamp_seconds{md="other",certid="\w+"} \d+\n',
+                         metrics), metrics
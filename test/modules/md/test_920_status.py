@@ -2,6 +2,7 @@
 
 import os
 import re
+import time
 from datetime import timedelta
 
 import pytest
@@ -256,3 +257,66 @@ Protocols h2 http/1.1 acme-tls/1
                 r'.*certificate with serial \w+ has no OCSP responder URL.*'
             ]
         )
+
+    # OpenMetrics from md-metrics, the same in all child processes
+    def test_md_920_030(self, env):
+        domain = self.test_domain
+        domains = [domain]
+        conf = MDConf(env)
+        conf.add([
+            "<Location /md-metrics>",
+            "    SetHandler md-metrics",
+            "</Location>",
+        ])
+        conf.add_md(domains)
+        conf.add_vhost(domain)
+        conf.install()
+        assert env.apache_restart() == 0, f'{env.apachectl_stderr}'
+        assert env.await_completion([domain], restart=False)
+        for _ in range(5):
+            metrics = env.get_content(domain, "/md-metrics")
+            assert metrics.endswith("# EOF\n")
+            assert "# TYPE md_renewal_runs counter" in metrics
+            assert re.search(rf'md_renewal_runs_total{{md="{domain}"}} [1-9]\d*\n', metrics)
+            assert f'md_renewal_errors_total{{md="{domain}"}} 0\n' in metrics
+            assert re.search(rf'md_renewal_last_duration_seconds{{md="{domain}"}} \d+\.\d{{3}}\n',
+                             metrics), metrics
+        # activated, the certificate has an expiry time
+        assert env.apache_restart() == 0, f'{env.apachectl_stderr}'
+        metrics = env.get_content(domain, "/md-metrics")
+        m = re.search(rf'md_cert_expiry_timestamp_seconds{{md="{domain}"}} (\d+)\n', metrics)
+        assert m, metrics
+        assert int(m.group(1)) > time.time()
+        assert f'md_renewal_runs_total{{md="{domain}"}} 0\n' in metrics
+
+    # certificate-status carries an ETag and answers 304 while it is unchanged
+    def test_md_920_031(self, env):
+        domain = self.test_domain
+        domains = [domain]
+        conf = MDConf(env)
+        conf.add_md(domains)
+        conf.add_vhost(domain)
+        conf.install()
+        assert env.apache_restart() == 0, f'{env.apachectl_stderr}'
+        assert env.await_completion([domain], restart=False)
+        url = f"https://{domain}:{env.https_port}/.httpd/certificate-status"
+        r = env.curl_get(url, insecure=True)
+        assert r.exit_code == 0
+        assert r.response['status'] == 200
+        etag = r.response['header']['etag']
+        assert re.match(r'^"[0-9a-f]+"$', etag), etag
+        for _ in range(3):
+            r = env.curl_get(url, insecure=True, options=['-H', f'If-None-Match: {etag}'])
+            assert r.exit_code == 0
+            assert r.response['status'] == 304
+            assert r.response['header']['etag'] == etag
+        r = env.curl_get(url, insecure=True, options=['-H', 'If-None-Match: "other", *'])
+        assert r.response['status'] == 304
+        # activating the staged certificate changes the status and its ETag
+        assert env.apache_restart() == 0, f'{env.apachectl_stderr}'
+        r = env.curl_get(url, insecure=True, options=['-H', f'If-None-Match: {etag}'])
+        assert r.exit_code == 0
+        assert r.response['status'] == 200
+        assert r.response['header']['etag'] != etag
+        assert 'renewal' not in r.json
+        assert 'sha256-fingerprint' in r.json['rsa']
@@ -22,6 +22,7 @@ static Suite *main_test_suite(void)
 
     suite_add_tcase(suite, md_json_test_case());
     suite_add_tcase(suite, md_util_test_case());
+    suite_add_tcase(suite, md_store_test_case());
 
     return suite;
 }
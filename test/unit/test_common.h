@@ -41,4 +41,5 @@
  */
 
 TCase *md_json_test_case(void);
+TCase *md_store_test_case(void);
 TCase *md_util_test_case(void);
@@ -13,9 +13,16 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+
+#include <apr_buckets.h>
+#include <apr_strings.h>
 
 #include "test_common.h"
+#include "md.h"
+#include "md_crypt.h"
 #include "md_json.h"
+#include "md_util.h"
 
 /*
  * XXX To inspect pieces of the md_json_t struct, we need to include the jansson
@@ -52,6 +59,47 @@ static void noop_free(void *unused)
     (void) unused;
 }
 
+/* Something the size of an MD status. */
+static md_json_t *make_md_status(apr_pool_t *p, int i)
+{
+    md_json_t *json = md_json_create(p), *cert = md_json_create(p);
+    apr_array_header_t *domains = apr_array_make(p, 2, sizeof(const char *));
+    const char *name = apr_psprintf(p, "md%05d.example.org", i);
+
+    APR_ARRAY_PUSH(domains, const char *) = name;
+    APR_ARRAY_PUSH(domains, const char *) = apr_pstrcat(p, "www.", name, NULL);
+    md_json_sets(name, json, "name", NULL);
+    md_json_setsa(domains, json, "domains", NULL);
+    md_json_setl(2, json, "state", NULL);
+    md_json_sets("Mon, 01 Jan 2024 00:00:00 GMT", cert, "valid", "from", NULL);
+    md_json_sets("Sun, 31 Mar 2024 00:00:00 GMT", cert, "valid", "until", NULL);
+    md_json_sets("03039C464D454EDE79FCD2CAE859F668F269", cert, "serial", NULL);
+    md_json_sets("9b5bd1bb1fc2e0c3a6b1d6bbd11e4ac2b5fcf84e13bd1c3ebd9c8f1f6b2a7c11",
+                 cert, "sha256-fingerprint", NULL);
+    md_json_setj(cert, json, "cert", "rsa", NULL);
+    md_json_setb(1, json, "stapling", NULL);
+    return json;
+}
+
+typedef struct {
+    apr_pool_t *p;
+    const char *text;
+    int flushes;
+} stream_sink_t;
+
+static apr_status_t sink_flush(void *baton, apr_bucket_brigade *bb)
+{
+    stream_sink_t *sink = baton;
+    char *s;
+    apr_size_t len;
+
+    apr_brigade_pflatten(bb, &s, &len, sink->p);
+    sink->text = apr_pstrcat(sink->p, sink->text, apr_pstrndup(sink->p, s, len), NULL);
+    ++sink->flushes;
+    apr_brigade_cleanup(bb);
+    return APR_SUCCESS;
+}
+
 /*
  * Test Fixture -- runs once per test
  */
@@ -362,6 +410,320 @@ START_TEST(json_writep_returns_NULL_for_corrupted_json_struct)
 }
 END_TEST
 
+static const char *stream_sample(md_json_fmt_t fmt, apr_pool_t *p)
+{
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(p);
+    apr_bucket_brigade *bb = apr_brigade_create(p, ba);
+    md_json_stream_t *stream;
+    md_json_t *json = md_json_create(p);
+    char *s;
+    apr_size_t len;
+
+    md_json_setl(1, json, "a", NULL);
+    md_json_sets("x\ny", json, "b", "c", NULL);
+
+    md_json_stream_make(&stream, p, fmt, bb, NULL, NULL);
+    md_json_stream_open_obj(stream, NULL);
+    md_json_stream_puts(stream, "version", "1.0");
+    md_json_stream_open_arr(stream, "list");
+    md_json_stream_putj(stream, NULL, json);
+    md_json_stream_putj(stream, NULL, json);
+    md_json_stream_close(stream);
+    md_json_stream_open_obj(stream, "empty");
+    md_json_stream_close(stream);
+    md_json_stream_puts(stream, "quote\"", "\"");
+    ck_assert_int_eq(md_json_stream_end(stream), APR_SUCCESS);
+    /* closing more than was opened is an error and stays one */
+    ck_assert_int_ne(md_json_stream_close(stream), APR_SUCCESS);
+    ck_assert_int_ne(md_json_stream_puts(stream, "more", "x"), APR_SUCCESS);
+
+    apr_brigade_pflatten(bb, &s, &len, p);
+    return apr_pstrndup(p, s, len);
+}
+
+START_TEST(json_stream_writes_like_tree)
+{
+    md_json_t *json = md_json_create(g_pool);
+    md_json_t *item = md_json_create(g_pool);
+    md_json_fmt_t fmt;
+
+    md_json_setl(1, item, "a", NULL);
+    md_json_sets("x\ny", item, "b", "c", NULL);
+    md_json_sets("1.0", json, "version", NULL);
+    md_json_addj(item, json, "list", NULL);
+    md_json_addj(item, json, "list", NULL);
+    md_json_setj(md_json_create(g_pool), json, "empty", NULL);
+    md_json_sets("\"", json, "quote\"", NULL);
+
+    for (fmt = MD_JSON_FMT_COMPACT; fmt <= MD_JSON_FMT_INDENT; ++fmt) {
+        ck_assert_str_eq(stream_sample(fmt, g_pool), md_json_writep(json, g_pool, fmt));
+    }
+}
+END_TEST
+
+START_TEST(json_stream_flushes_like_tree)
+{
+    apr_bucket_alloc_t *ba = apr_bucket_alloc_create(g_pool);
+    apr_bucket_brigade *bb = apr_brigade_create(g_pool, ba);
+    md_json_stream_t *stream;
+    md_json_t *json;
+    stream_sink_t sink;
+    apr_pool_t *ptemp;
+    int i, count = 100;
+
+    /* the whole status as one tree */
+    json = md_json_create(g_pool);
+    md_json_sets("1.0", json, "version", NULL);
+    for (i = 0; i < count; ++i) {
+        md_json_addj(make_md_status(g_pool, i), json, "managed-domains", NULL);
+    }
+
+    /* streamed, one MD at a time, passed on in several chunks */
+    sink.p = g_pool;
+    sink.text = "";
+    sink.flushes = 0;
+    apr_pool_create(&ptemp, g_pool);
+    md_json_stream_make(&stream, g_pool, MD_JSON_FMT_INDENT, bb, sink_flush, &sink);
+    md_json_stream_open_obj(stream, NULL);
+    md_json_stream_puts(stream, "version", "1.0");
+    md_json_stream_open_arr(stream, "managed-domains");
+    for (i = 0; i < count; ++i) {
+        md_json_stream_putj(stream, NULL, make_md_status(ptemp, i));
+        apr_pool_clear(ptemp);
+    }
+    ck_assert_int_eq(md_json_stream_end(stream), APR_SUCCESS);
+    apr_pool_destroy(ptemp);
+
+    ck_assert_int_gt(sink.flushes, 1);
+    ck_assert_str_eq(sink.text, md_json_writep(json, g_pool, MD_JSON_FMT_INDENT));
+}
+END_TEST
+
+static const md_json_path_t P_T_NAME = MD_JSON_PATH1("name");
+static const md_json_path_t P_T_CA_URL = MD_JSON_PATH2("ca", "url");
+static const md_json_path_t P_T_CA_URLS = MD_JSON_PATH2("ca", "urls");
+static const md_json_path_t P_T_DEEP = MD_JSON_PATH3("a", "b", "c");
+
+START_TEST(json_paths)
+{
+    md_json_t *json = md_json_create(g_pool), *part;
+    apr_array_header_t *a = apr_array_make(g_pool, 5, sizeof(const char *));
+
+    ck_assert(!md_json_phas(json, &P_T_NAME));
+    ck_assert_ptr_eq(md_json_pgets(json, &P_T_CA_URL), NULL);
+    ck_assert_int_eq(md_json_pgetl(json, &P_T_DEEP), 0);
+
+    /* paths set what the varargs accessors see, and the other way around */
+    ck_assert_int_eq(md_json_psets("md.example.org", json, &P_T_NAME), APR_SUCCESS);
+    ck_assert_int_eq(md_json_psets("https://ca.example.org", json, &P_T_CA_URL), APR_SUCCESS);
+    ck_assert_int_eq(md_json_psetl(42, json, &P_T_DEEP), APR_SUCCESS);
+    ck_assert_str_eq(md_json_gets(json, "name", NULL), "md.example.org");
+    ck_assert_str_eq(md_json_gets(json, "ca", "url", NULL), "https://ca.example.org");
+    ck_assert_int_eq(md_json_getl(json, "a", "b", "c", NULL), 42);
+    md_json_setb(1, json, "a", "b", "c", NULL);
+    ck_assert(md_json_pgetb(json, &P_T_DEEP));
+    ck_assert_int_eq(md_json_pgetl(json, &P_T_DEEP), 0);
+
+    APR_ARRAY_PUSH(a, const char *) = "https://ca1.example.org";
+    APR_ARRAY_PUSH(a, const char *) = "https://ca2.example.org";
+    ck_assert_int_eq(md_json_psetsa(a, json, &P_T_CA_URLS), APR_SUCCESS);
+    apr_array_clear(a);
+    ck_assert_int_eq(md_json_pdupsa(a, g_pool, json, &P_T_CA_URLS), APR_SUCCESS);
+    ck_assert_int_eq(a->nelts, 2);
+    ck_assert_str_eq(APR_ARRAY_IDX(a, 1, const char *), "https://ca2.example.org");
+
+    part = md_json_pgetj(json, &P_T_CA_URL);
+    ck_assert_ptr_nonnull(part);
+    ck_assert_int_eq(md_json_psetj(part, json, &P_T_NAME), APR_SUCCESS);
+    ck_assert_str_eq(md_json_pgets(json, &P_T_NAME), "https://ca.example.org");
+    ck_assert_int_eq(md_json_psetj(NULL, json, &P_T_NAME), APR_SUCCESS);
+    ck_assert(!md_json_phas(json, &P_T_NAME));
+
+    /* a path through a non-object does not reach anything */
+    md_json_sets("flat", json, "a", NULL);
+    ck_assert(!md_json_phas(json, &P_T_DEEP));
+    ck_assert_int_eq(md_json_psetl(1, json, &P_T_DEEP), APR_EINVAL);
+}
+END_TEST
+
+/* An MD with everything set that md.json has. */
+static md_t *make_md(apr_pool_t *p, int i)
+{
+    apr_array_header_t *domains = apr_array_make(p, 2, sizeof(const char *));
+    const char *name = apr_psprintf(p, "md%05d.example.org", i);
+    md_t *md;
+
+    APR_ARRAY_PUSH(domains, const char *) = name;
+    APR_ARRAY_PUSH(domains, const char *) = apr_pstrcat(p, "www.", name, NULL);
+    md = md_create(p, domains);
+    APR_ARRAY_PUSH(md->contacts, const char *) = "mailto:admin@example.org";
+    md->ca_proto = "ACME";
+    md->ca_effective = "https://acme-v02.api.letsencrypt.org/directory";
+    md->ca_urls = apr_array_make(p, 1, sizeof(const char *));
+    APR_ARRAY_PUSH(md->ca_urls, const char *) = md->ca_effective;
+    md->ca_account = "ACME-acme-v02.api.letsencrypt.org-0000";
+    md->ca_agreement = "accepted";
+    md->ca_challenges = apr_array_make(p, 2, sizeof(const char *));
+    APR_ARRAY_PUSH(md->ca_challenges, const char *) = "tls-alpn-01";
+    APR_ARRAY_PUSH(md->ca_challenges, const char *) = "http-01";
+    md->state = MD_S_COMPLETE;
+    md->require_https = MD_REQUIRE_PERMANENT;
+    md->transitive = 1;
+    md->stapling = 1;
+    md->must_staple = 0;
+    md->profile = "tlsserver";
+    md->ca_eab_kid = "kid-1";
+    md->ca_eab_hmac = "secret";
+    return md;
+}
+
+START_TEST(json_md_round_trip)
+{
+    const md_t *md;
+    md_json_t *json;
+
+    json = md_to_json(make_md(g_pool, 7), g_pool);
+    ck_assert_str_eq(md_json_gets(json, MD_KEY_CA, MD_KEY_URL, NULL),
+                     "https://acme-v02.api.letsencrypt.org/directory");
+    md = md_from_json(json, g_pool);
+    ck_assert_str_eq(md->name, "md00007.example.org");
+    ck_assert_int_eq(md->domains->nelts, 2);
+    ck_assert_int_eq(md->ca_challenges->nelts, 2);
+    ck_assert_str_eq(md->ca_account, "ACME-acme-v02.api.letsencrypt.org-0000");
+    ck_assert_str_eq(md->ca_eab_hmac, "secret");
+    ck_assert_int_eq(md->state, MD_S_COMPLETE);
+    ck_assert_int_eq(md->require_https, MD_REQUIRE_PERMANENT);
+    ck_assert_int_eq(md->stapling, 1);
+}
+END_TEST
+
+typedef struct {
+    const char *name;
+    apr_array_header_t *tags;
+    int count;
+    int flag;
+    const char *inner;
+    md_json_t *extra;
+} dec_test_t;
+
+static const md_json_field_t T_INNER_FIELDS[] = {
+    MD_JSON_FIELD(STR, "s", dec_test_t, inner),
+    MD_JSON_FIELD_END
+};
+
+static const md_json_field_t T_FIELDS[] = {
+    MD_JSON_FIELD(STR, "name", dec_test_t, name),
+    MD_JSON_FIELD(STRA, "tags", dec_test_t, tags),
+    MD_JSON_FIELD(INT, "count", dec_test_t, count),
+    MD_JSON_FIELD(BOOL, "flag", dec_test_t, flag),
+    MD_JSON_FIELD_SUB("inner", T_INNER_FIELDS),
+    MD_JSON_FIELD(JSON, "extra", dec_test_t, extra),
+    MD_JSON_FIELD_END
+};
+
+static apr_status_t decode_str(dec_test_t *t, const char *s)
+{
+    memset(t, 0, sizeof(*t));
+    return md_json_decode(t, T_FIELDS, s, strlen(s), g_pool);
+}
+
+START_TEST(json_decode)
+{
+    dec_test_t t;
+    const char *s;
+
+    ck_assert_int_eq(decode_str(&t, "{\"name\": \"a\\\"b\\\\c\\n\\u00e4\\ud83d\\ude00\", "
+                     "\"tags\": [\"x\", \"y\"], \"count\": -17, \"flag\": true, "
+                     "\"unknown\": {\"a\": [1, 2.5e3, null, {\"b\": \"}\"}]}, "
+                     "\"inner\": {\"skip\": [], \"s\": \"in\"}, "
+                     "\"extra\": {\"k\": \"v\"}}"), APR_SUCCESS);
+    ck_assert_str_eq(t.name, "a\"b\\c\n\xc3\xa4\xf0\x9f\x98\x80");
+    ck_assert_int_eq(t.tags->nelts, 2);
+    ck_assert_str_eq(APR_ARRAY_IDX(t.tags, 1, const char *), "y");
+    ck_assert_int_eq(t.count, -17);
+    ck_assert_int_eq(t.flag, 1);
+    ck_assert_str_eq(t.inner, "in");
+    ck_assert_ptr_nonnull(t.extra);
+    ck_assert_str_eq(md_json_gets(t.extra, "k", NULL), "v");
+
+    /* values of the wrong type leave strings alone and give 0 for the rest */
+    s = "{\"count\": \"1\", \"flag\": 1, \"name\": 2}";
+    t.count = t.flag = 5;
+    ck_assert_int_eq(md_json_decode(&t, T_FIELDS, s, strlen(s), g_pool), APR_SUCCESS);
+    ck_assert_int_eq(t.count, 0);
+    ck_assert_int_eq(t.flag, 0);
+    ck_assert_str_eq(t.name, "a\"b\\c\n\xc3\xa4\xf0\x9f\x98\x80");
+
+    /* what jansson would not accept either */
+    ck_assert_int_eq(decode_str(&t, ""), APR_EINVAL);
+    ck_assert_int_eq(decode_str(&t, "[]"), APR_EINVAL);
+    ck_assert_int_eq(decode_str(&t, "{\"name\": \"a\",}"), APR_EINVAL);
+    ck_assert_int_eq(decode_str(&t, "{\"name\": \"a\"} x"), APR_EINVAL);
+    ck_assert_int_eq(decode_str(&t, "{\"name\": \"a\\u0000b\"}"), APR_EINVAL);
+    ck_assert_int_eq(decode_str(&t, "{\"name\": \"\\ud83d\"}"), APR_EINVAL);
+    ck_assert_int_eq(decode_str(&t, "{\"name\": \"\xc3\x28\"}"), APR_EINVAL);
+    ck_assert_int_eq(decode_str(&t, "{\"count\": 99999999999999999999}"), APR_EINVAL);
+    ck_assert_int_eq(decode_str(&t, "{\"name\": \"a\""), APR_EINVAL);
+}
+END_TEST
+
+static void assert_md_eq(const md_t *a, const md_t *b)
+{
+    int i;
+
+    ck_assert_str_eq(a->name, b->name);
+    ck_assert_int_eq(a->domains->nelts, b->domains->nelts);
+    for (i = 0; i < a->domains->nelts; ++i) {
+        ck_assert_str_eq(APR_ARRAY_IDX(a->domains, i, const char *), 
+                         APR_ARRAY_IDX(b->domains, i, const char *));
+    }
+    ck_assert_int_eq(a->contacts->nelts, b->contacts->nelts);
+    ck_assert_int_eq(a->ca_urls->nelts, b->ca_urls->nelts);
+    ck_assert_str_eq(APR_ARRAY_IDX(a->ca_urls, 0, const char *), 
+                     APR_ARRAY_IDX(b->ca_urls, 0, const char *));
+    ck_assert_str_eq(a->ca_effective, b->ca_effective);
+    ck_assert_str_eq(a->ca_account, b->ca_account);
+    ck_assert_str_eq(a->ca_agreement, b->ca_agreement);
+    ck_assert_int_eq(a->ca_challenges->nelts, b->ca_challenges->nelts);
+    ck_assert_int_eq(a->state, b->state);
+    ck_assert_int_eq(a->renew_mode, b->renew_mode);
+    ck_assert_int_eq(a->require_https, b->require_https);
+    ck_assert_int_eq(a->transitive, b->transitive);
+    ck_assert_int_eq(a->must_staple, b->must_staple);
+    ck_assert_int_eq(a->stapling, b->stapling);
+    ck_assert(md_pkeys_spec_eq(a->pks, b->pks));
+    ck_assert_str_eq(a->profile, b->profile);
+    ck_assert_str_eq(a->ca_eab_kid, b->ca_eab_kid);
+    ck_assert_str_eq(a->ca_eab_hmac, b->ca_eab_hmac);
+}
+
+START_TEST(json_decode_md)
+{
+    md_data_t data;
+    md_json_t *json;
+    md_t *md;
+    const char *s;
+
+    json = md_to_json(make_md(g_pool, 1), g_pool);
+    s = md_json_writep(json, g_pool, MD_JSON_FMT_INDENT);
+    md_data_init(&data, s, strlen(s));
+    ck_assert_int_eq(md_from_data(&md, &data, g_pool), APR_SUCCESS);
+    assert_md_eq(md, md_from_json(json, g_pool));
+
+    /* md.json written by older versions only has "ca.url" */
+    md_json_del(json, "ca", "urls", NULL);
+    s = md_json_writep(json, g_pool, MD_JSON_FMT_COMPACT);
+    md_data_init(&data, s, strlen(s));
+    ck_assert_int_eq(md_from_data(&md, &data, g_pool), APR_SUCCESS);
+    assert_md_eq(md, md_from_json(json, g_pool));
+    ck_assert_int_eq(md->ca_urls->nelts, 1);
+
+    /* what the decoder does not take goes through jansson, which fails on garbage */
+    md_data_init_str(&data, "{\"name\": \"a\",}");
+    ck_assert_int_ne(md_from_data(&md, &data, g_pool), APR_SUCCESS);
+}
+END_TEST
+
 TCase *md_json_test_case(void)
 {
     TCase *testcase = tcase_create("md_json");
@@ -382,6 +744,12 @@ TCase *md_json_test_case(void)
     tcase_add_test(testcase, copies);
 
     tcase_add_test(testcase, json_writep_returns_NULL_for_corrupted_json_struct);
+    tcase_add_test(testcase, json_stream_writes_like_tree);
+    tcase_add_test(testcase, json_stream_flushes_like_tree);
+    tcase_add_test(testcase, json_paths);
+    tcase_add_test(testcase, json_md_round_trip);
+    tcase_add_test(testcase, json_decode);
+    tcase_add_test(testcase, json_decode_md);
 
     return testcase;
 }
@@ -0,0 +1,887 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr_date.h>
+#include <apr_file_info.h>
+#include <apr_file_io.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_time.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_crypt.h"
+#include "md_json.h"
+#include "md_reg.h"
+#include "md_result.h"
+#include "md_status.h"
+#include "md_store.h"
+#include "md_store_fs.h"
+#include "md_util.h"
+
+/*
+ * Helpers
+ */
+
+static void store_add_mds(md_store_t *store, int count, apr_pool_t *p)
+{
+    apr_array_header_t *domains;
+    md_t *md;
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        domains = apr_array_make(p, 2, sizeof(const char*));
+        APR_ARRAY_PUSH(domains, const char*) = apr_psprintf(p, "md%05d.example.org", i);
+        APR_ARRAY_PUSH(domains, const char*) = apr_psprintf(p, "www.md%05d.example.org", i);
+        md = md_create(p, domains);
+        ck_assert_ptr_nonnull(md);
+        ck_assert_int_eq(md_save(store, p, MD_SG_DOMAINS, md, 1), APR_SUCCESS);
+    }
+}
+
+static apr_array_header_t *make_mds(int count, int renamed, apr_pool_t *p)
+{
+    apr_array_header_t *mds, *domains;
+    int i;
+
+    /* every renamed MD has its www domain first, which becomes its name */
+    mds = apr_array_make(p, count, sizeof(md_t*));
+    for (i = 0; i < count; ++i) {
+        domains = apr_array_make(p, 2, sizeof(const char*));
+        if (i < renamed) {
+            APR_ARRAY_PUSH(domains, const char*) = apr_psprintf(p, "www.md%05d.example.org", i);
+        }
+        APR_ARRAY_PUSH(domains, const char*) = apr_psprintf(p, "md%05d.example.org", i);
+        if (i >= renamed) {
+            APR_ARRAY_PUSH(domains, const char*) = apr_psprintf(p, "www.md%05d.example.org", i);
+        }
+        APR_ARRAY_PUSH(mds, md_t*) = md_create(p, domains);
+    }
+    return mds;
+}
+
+static void save_self_signed(md_store_t *store, md_t *md, apr_pool_t *p)
+{
+    md_pkey_spec_t *spec = md_pkeys_spec_get(md->pks, 0);
+    md_pkey_t *pkey;
+    md_cert_t *cert;
+    apr_array_header_t *chain;
+
+    ck_assert_int_eq(md_pkey_gen(&pkey, p, spec), APR_SUCCESS);
+    ck_assert_int_eq(md_cert_self_sign(&cert, md->name, md->domains, pkey,
+                                       apr_time_from_sec(3600), p), APR_SUCCESS);
+    chain = apr_array_make(p, 1, sizeof(md_cert_t*));
+    APR_ARRAY_PUSH(chain, md_cert_t*) = cert;
+    ck_assert_int_eq(md_pubcert_save(store, p, MD_SG_DOMAINS, md->name, spec, chain, 0),
+                     APR_SUCCESS);
+}
+
+static apr_array_header_t *make_ec_mds(int count, apr_pool_t *p)
+{
+    apr_array_header_t *mds = make_mds(count, 0, p);
+    md_t *md;
+    int i;
+
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, md_t*);
+        md->pks = md_pkeys_spec_make(p);
+        md_pkeys_spec_add_ec(md->pks, "P-256");
+    }
+    return mds;
+}
+
+static md_reg_t *sync_with_memo(md_store_t *store, md_reg_memo_t *memo, 
+                                apr_array_header_t *mds, apr_pool_t *p)
+{
+    md_reg_t *reg;
+    int i;
+
+    ck_assert_int_eq(md_reg_create(&reg, p, store, NULL, NULL, NULL, 0, 0, 0, 0), APR_SUCCESS);
+    md_reg_set_memo(reg, memo);
+    ck_assert_int_eq(md_reg_sync_start(reg, mds, p), APR_SUCCESS);
+    for (i = 0; i < mds->nelts; ++i) {
+        ck_assert_int_eq(md_reg_sync_finish(reg, APR_ARRAY_IDX(mds, i, md_t*), p, p),
+                         APR_SUCCESS);
+    }
+    return reg;
+}
+
+static int store_has(md_store_t *store, const char *name, apr_pool_t *p)
+{
+    return md_load(store, MD_SG_DOMAINS, name, NULL, p) == APR_SUCCESS;
+}
+
+static int count_md_until(void *baton, md_reg_t *reg, md_t *md)
+{
+    int *pcount = baton;
+
+    (void)reg;
+    (void)md;
+    return --(*pcount) > 0;
+}
+
+static int count_md(void *baton, md_store_t *store, md_t *md, apr_pool_t *ptemp)
+{
+    int *pcount = baton;
+
+    (void)store;
+    (void)md;
+    (void)ptemp;
+    ++(*pcount);
+    return 1;
+}
+
+static apr_status_t add_index(void *baton, int i, apr_pool_t *p)
+{
+    apr_uint32_t *sums = baton;
+
+    (void)p;
+    sums[i] = (apr_uint32_t)i + 1;
+    return (i == 7 || i == 3)? APR_EGENERAL + i : APR_SUCCESS;
+}
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+static const char *g_dir;
+static md_store_t *g_store;
+
+static void md_store_setup(void)
+{
+    const char *tmp;
+
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS
+        || apr_temp_dir_get(&tmp, g_pool) != APR_SUCCESS) {
+        exit(1);
+    }
+    g_dir = apr_psprintf(g_pool, "%s/md_store_test.%" APR_TIME_T_FMT, tmp, apr_time_now());
+    if (apr_dir_make_recursive(g_dir, APR_FPROT_OS_DEFAULT, g_pool) != APR_SUCCESS
+        || md_store_fs_init(&g_store, g_pool, g_dir) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void md_store_teardown(void)
+{
+    md_util_rm_recursive(g_dir, g_pool, 5);
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * Tests
+ */
+START_TEST(md_util_parallel_do_all)
+{
+    apr_uint32_t sums[100];
+    int i;
+
+    memset(sums, 0, sizeof(sums));
+    ck_assert_int_eq(md_util_parallel_do(add_index, sums, 100, 4, g_pool), APR_EGENERAL + 3);
+    for (i = 0; i < 100; ++i) {
+        ck_assert_int_eq(sums[i], i + 1);
+    }
+    memset(sums, 0, sizeof(sums));
+    ck_assert_int_eq(md_util_parallel_do(add_index, sums, 3, 1, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(sums[2], 3);
+    ck_assert_int_eq(sums[3], 0);
+}
+END_TEST
+
+START_TEST(md_store_bulk_load)
+{
+    apr_array_header_t *mds, *names, *jsons;
+    md_t *md;
+    int i;
+
+    store_add_mds(g_store, 50, g_pool);
+    ck_assert_int_eq(md_store_md_load_all(&mds, g_store, g_pool, MD_SG_DOMAINS, "*", 4),
+                     APR_SUCCESS);
+    ck_assert_int_eq(mds->nelts, 50);
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, md_t*);
+        ck_assert_int_eq(md->domains->nelts, 2);
+        ck_assert_str_eq(md->name, APR_ARRAY_IDX(md->domains, 0, const char*));
+    }
+
+    names = apr_array_make(g_pool, 3, sizeof(const char*));
+    APR_ARRAY_PUSH(names, const char*) = "md00042.example.org";
+    APR_ARRAY_PUSH(names, const char*) = "not-there.example.org";
+    APR_ARRAY_PUSH(names, const char*) = "md00007.example.org";
+    ck_assert_int_eq(md_store_md_load_names(&mds, g_store, g_pool, MD_SG_DOMAINS, names, 4),
+                     APR_SUCCESS);
+    ck_assert_int_eq(mds->nelts, 2);
+    ck_assert_str_eq(APR_ARRAY_IDX(mds, 0, md_t*)->name, "md00042.example.org");
+    ck_assert_str_eq(APR_ARRAY_IDX(mds, 1, md_t*)->name, "md00007.example.org");
+
+    ck_assert_int_eq(md_store_load_json_all(&jsons, g_store, g_pool, MD_SG_DOMAINS,
+                                            names, MD_FN_MD, 2), APR_SUCCESS);
+    ck_assert_int_eq(jsons->nelts, 3);
+    ck_assert_ptr_nonnull(APR_ARRAY_IDX(jsons, 0, md_json_t*));
+    ck_assert(APR_ARRAY_IDX(jsons, 1, md_json_t*) == NULL);
+    ck_assert_ptr_nonnull(APR_ARRAY_IDX(jsons, 2, md_json_t*));
+}
+END_TEST
+
+START_TEST(md_store_md_iter_broken)
+{
+    int n = 0;
+
+    store_add_mds(g_store, 3, g_pool);
+    ck_assert_int_eq(md_store_md_iter(count_md, &n, g_store, g_pool, MD_SG_DOMAINS, "*"),
+                     APR_SUCCESS);
+    ck_assert_int_eq(n, 3);
+
+    /* an md.json that does not parse is an error, as with md_load() */
+    ck_assert_int_eq(md_store_save(g_store, g_pool, MD_SG_DOMAINS, "broken.example.org", 
+                                   MD_FN_MD, MD_SV_TEXT, "{\"name\": ", 0), APR_SUCCESS);
+    ck_assert_int_ne(md_store_md_iter(count_md, &n, g_store, g_pool, MD_SG_DOMAINS, "*"),
+                     APR_SUCCESS);
+}
+END_TEST
+
+START_TEST(md_reg_do_stops_early)
+{
+    md_reg_t *reg;
+    int n = 3;
+
+    store_add_mds(g_store, 10, g_pool);
+    ck_assert_int_eq(md_reg_create(&reg, g_pool, g_store, NULL, NULL, NULL, 0, 0, 0, 0),
+                     APR_SUCCESS);
+    md_reg_do(count_md_until, &n, reg, g_pool);
+    ck_assert_int_eq(n, 0);
+    ck_assert_ptr_nonnull(md_reg_find(reg, "www.md00004.example.org", g_pool));
+    ck_assert(md_reg_find(reg, "nowhere.example.org", g_pool) == NULL);
+}
+END_TEST
+
+START_TEST(md_reg_get_all_states)
+{
+    apr_array_header_t *mds;
+    md_reg_t *reg;
+    md_t *md;
+    int i;
+
+    store_add_mds(g_store, 20, g_pool);
+    ck_assert_int_eq(md_reg_create(&reg, g_pool, g_store, NULL, NULL, NULL, 0, 0, 0, 0),
+                     APR_SUCCESS);
+    ck_assert_int_eq(md_reg_get_all(&mds, reg, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(mds->nelts, 20);
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, md_t*);
+        ck_assert_int_eq(md->state, md_reg_get(reg, md->name, g_pool)->state);
+    }
+}
+END_TEST
+
+START_TEST(md_store_pkey_cached)
+{
+    md_pkey_spec_t spec;
+    md_pkey_t *pkey, *loaded1, *loaded2;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.type = MD_PKEY_TYPE_EC;
+    spec.params.ec.curve = "P-256";
+    ck_assert_int_eq(md_crypt_init(g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_pkey_gen(&pkey, g_pool, &spec), APR_SUCCESS);
+
+    /* staging keys are stored encrypted and get cached once decrypted */
+    ck_assert_int_eq(md_pkey_save(g_store, g_pool, MD_SG_STAGING, "a.example.org",
+                                  &spec, pkey, 1), APR_SUCCESS);
+    ck_assert_int_eq(md_pkey_load(g_store, MD_SG_STAGING, "a.example.org", &spec,
+                                  &loaded1, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_pkey_load(g_store, MD_SG_STAGING, "a.example.org", &spec,
+                                  &loaded2, g_pool), APR_SUCCESS);
+    ck_assert_ptr_eq(md_pkey_get_EVP_PKEY(loaded1), md_pkey_get_EVP_PKEY(loaded2));
+
+    /* saving through the store evicts the cached key */
+    ck_assert_int_eq(md_pkey_save(g_store, g_pool, MD_SG_STAGING, "a.example.org",
+                                  &spec, pkey, 0), APR_SUCCESS);
+    ck_assert_int_eq(md_pkey_load(g_store, MD_SG_STAGING, "a.example.org", &spec,
+                                  &loaded2, g_pool), APR_SUCCESS);
+    ck_assert(md_pkey_get_EVP_PKEY(loaded1) != md_pkey_get_EVP_PKEY(loaded2));
+}
+END_TEST
+
+START_TEST(md_store_plain_fallback_pkey)
+{
+    md_pkey_spec_t spec;
+    md_pkey_t *pkey, *loaded;
+    const char *fpath, *text;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.type = MD_PKEY_TYPE_EC;
+    spec.params.ec.curve = "P-256";
+    ck_assert_int_eq(md_crypt_init(g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_pkey_gen(&pkey, g_pool, &spec), APR_SUCCESS);
+
+    /* at the top level, only the fallback keys are saved unencrypted */
+    ck_assert_int_eq(md_store_save(g_store, g_pool, MD_SG_NONE, NULL,
+                                   MD_FN_FALLBACK_PKEY_PREFIX "privkey.pem", MD_SV_PKEY,
+                                   pkey, 0), APR_SUCCESS);
+    ck_assert_int_eq(md_store_get_fname(&fpath, g_store, MD_SG_NONE, NULL,
+                                        MD_FN_FALLBACK_PKEY_PREFIX "privkey.pem", g_pool),
+                     APR_SUCCESS);
+    ck_assert_int_eq(md_text_fread8k(&text, g_pool, fpath), APR_SUCCESS);
+    ck_assert(!strstr(text, "ENCRYPTED"));
+    ck_assert_int_eq(md_store_load(g_store, MD_SG_NONE, NULL,
+                                   MD_FN_FALLBACK_PKEY_PREFIX "privkey.pem", MD_SV_PKEY,
+                                   (void**)&loaded, g_pool), APR_SUCCESS);
+
+    ck_assert_int_eq(md_store_save(g_store, g_pool, MD_SG_NONE, NULL, "other-privkey.pem",
+                                   MD_SV_PKEY, pkey, 0), APR_SUCCESS);
+    ck_assert_int_eq(md_store_get_fname(&fpath, g_store, MD_SG_NONE, NULL,
+                                        "other-privkey.pem", g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_text_fread8k(&text, g_pool, fpath), APR_SUCCESS);
+    ck_assert(strstr(text, "ENCRYPTED") != NULL);
+    ck_assert_int_eq(md_store_load(g_store, MD_SG_NONE, NULL, "other-privkey.pem",
+                                   MD_SV_PKEY, (void**)&loaded, g_pool), APR_SUCCESS);
+}
+END_TEST
+
+START_TEST(md_store_remove_some_nms)
+{
+    md_json_t *json;
+    apr_time_t later;
+    int i, removed;
+
+    json = md_json_create(g_pool);
+    for (i = 0; i < 5; ++i) {
+        ck_assert_int_eq(md_store_save_json(g_store, g_pool, MD_SG_OCSP, "a.example.org",
+                                            apr_psprintf(g_pool, "ocsp-%d.json", i), json, 1),
+                         APR_SUCCESS);
+    }
+    later = apr_time_now() + apr_time_from_sec(60);
+    ck_assert_int_eq(md_store_remove_some_not_modified_since(g_store, g_pool, later, MD_SG_OCSP,
+                                                             "*", "ocsp*.json", 2, &removed),
+                     APR_INCOMPLETE);
+    ck_assert_int_eq(removed, 2);
+    ck_assert_int_eq(md_store_remove_some_not_modified_since(g_store, g_pool, later, MD_SG_OCSP,
+                                                             "*", "ocsp*.json", 2, &removed),
+                     APR_INCOMPLETE);
+    ck_assert_int_eq(removed, 2);
+    ck_assert_int_eq(md_store_remove_some_not_modified_since(g_store, g_pool, later, MD_SG_OCSP,
+                                                             "*", "ocsp*.json", 2, &removed),
+                     APR_SUCCESS);
+    ck_assert_int_eq(removed, 1);
+}
+END_TEST
+
+START_TEST(md_store_fname_fast)
+{
+    const char *fname1, *fname2, *merged, *dname;
+
+    ck_assert_int_eq(md_store_get_fname(&fname1, g_store, MD_SG_DOMAINS, "a.example.org",
+                                        MD_FN_PRIVKEY, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_util_path_merge(&merged, g_pool, g_dir, "domains",
+                                        "a.example.org", MD_FN_PRIVKEY, NULL), APR_SUCCESS);
+    ck_assert_str_eq(fname1, merged);
+    /* repeated lookups come from the cache, the caller still gets a path of its own */
+    ck_assert_int_eq(md_store_get_fname(&fname2, g_store, MD_SG_DOMAINS, "a.example.org",
+                                        MD_FN_PRIVKEY, g_pool), APR_SUCCESS);
+    ck_assert_str_eq(fname2, merged);
+    ck_assert_int_eq(md_store_get_fname(&dname, g_store, MD_SG_DOMAINS, "a.example.org",
+                                        NULL, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_util_path_merge(&merged, g_pool, g_dir, "domains",
+                                        "a.example.org", NULL), APR_SUCCESS);
+    ck_assert_str_eq(dname, merged);
+    /* segments that are not plain are still merged */
+    ck_assert_int_eq(md_store_get_fname(&fname2, g_store, MD_SG_DOMAINS, "a.example.org",
+                                        "../x.json", g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_util_path_merge(&merged, g_pool, g_dir, "domains",
+                                        "a.example.org", "../x.json", NULL), APR_SUCCESS);
+    ck_assert_str_eq(fname2, merged);
+    ck_assert(!md_util_is_plain_segment("*.json"));
+    ck_assert(!md_util_is_plain_segment("md?.example.org"));
+    ck_assert_int_eq(md_store_get_fname(&fname2, g_store, MD_SG_DOMAINS, "*",
+                                        MD_FN_MD, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_util_path_merge(&merged, g_pool, g_dir, "domains",
+                                        "*", MD_FN_MD, NULL), APR_SUCCESS);
+    ck_assert_str_eq(fname2, merged);
+}
+END_TEST
+
+START_TEST(md_reg_sync_renames)
+{
+    md_reg_t *reg;
+    apr_array_header_t *mds, *domains;
+
+    store_add_mds(g_store, 10, g_pool);
+    ck_assert_int_eq(md_reg_create(&reg, g_pool, g_store, NULL, NULL, NULL, 0, 0, 0, 0),
+                     APR_SUCCESS);
+    mds = make_mds(10, 3, g_pool);
+    /* an MD with a name and domains the store has never seen */
+    domains = apr_array_make(g_pool, 1, sizeof(const char*));
+    APR_ARRAY_PUSH(domains, const char*) = "new.example.org";
+    APR_ARRAY_PUSH(mds, md_t*) = md_create(g_pool, domains);
+
+    ck_assert_int_eq(md_reg_sync_start(reg, mds, g_pool), APR_SUCCESS);
+    ck_assert(store_has(g_store, "www.md00000.example.org", g_pool));
+    ck_assert(store_has(g_store, "www.md00002.example.org", g_pool));
+    ck_assert(!store_has(g_store, "md00000.example.org", g_pool));
+    ck_assert(!store_has(g_store, "md00002.example.org", g_pool));
+    ck_assert(store_has(g_store, "md00003.example.org", g_pool));
+    ck_assert(!store_has(g_store, "www.md00003.example.org", g_pool));
+    ck_assert(!store_has(g_store, "new.example.org", g_pool));
+}
+END_TEST
+
+START_TEST(md_reg_pubcert_cached)
+{
+    md_reg_t *reg;
+    md_t *md;
+    md_pkey_spec_t *spec;
+    md_pkey_t *pkey;
+    md_cert_t *cert;
+    apr_array_header_t *domains, *chain, *mds;
+    const md_pubcert_t *pub1, *pub2;
+
+    domains = apr_array_make(g_pool, 1, sizeof(const char*));
+    APR_ARRAY_PUSH(domains, const char*) = "a.example.org";
+    md = md_create(g_pool, domains);
+    md->pks = md_pkeys_spec_make(g_pool);
+    md_pkeys_spec_add_ec(md->pks, "P-256");
+    spec = md_pkeys_spec_get(md->pks, 0);
+    ck_assert_int_eq(md_save(g_store, g_pool, MD_SG_DOMAINS, md, 1), APR_SUCCESS);
+    ck_assert_int_eq(md_reg_create(&reg, g_pool, g_store, NULL, NULL, NULL, 0, 0, 0, 0),
+                     APR_SUCCESS);
+
+    /* missing certificates are remembered as such */
+    ck_assert_int_eq(md_reg_get_pubcert(&pub1, reg, md, 0, g_pool), APR_ENOENT);
+    ck_assert_int_eq(md_crypt_init(g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_pkey_gen(&pkey, g_pool, spec), APR_SUCCESS);
+    ck_assert_int_eq(md_cert_self_sign(&cert, "a.example.org", domains, pkey,
+                                       apr_time_from_sec(3600), g_pool), APR_SUCCESS);
+    chain = apr_array_make(g_pool, 1, sizeof(md_cert_t*));
+    APR_ARRAY_PUSH(chain, md_cert_t*) = cert;
+    ck_assert_int_eq(md_pubcert_save(g_store, g_pool, MD_SG_DOMAINS, md->name, spec, chain, 0),
+                     APR_SUCCESS);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub1, reg, md, 0, g_pool), APR_ENOENT);
+
+    /* until the registry learns about a change to this MD */
+    md_reg_certs_changed(reg, "b.example.org");
+    ck_assert_int_eq(md_reg_get_pubcert(&pub1, reg, md, 0, g_pool), APR_ENOENT);
+    md_reg_certs_changed(reg, md->name);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub1, reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub2, reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert_ptr_eq(pub1, pub2);
+    ck_assert_int_eq(pub1->certs->nelts, 1);
+    /* a pubcert handed out stays valid when a new one is loaded */
+    md_reg_certs_changed(reg, NULL);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub2, reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert(pub1 != pub2);
+    ck_assert_int_eq(pub1->certs->nelts, 1);
+    ck_assert(md_certs_are_equal(APR_ARRAY_IDX(pub1->certs, 0, md_cert_t*),
+                                 APR_ARRAY_IDX(pub2->certs, 0, md_cert_t*)));
+    pub1 = pub2;
+    /* once the domains are frozen, nothing is loaded any more */
+    mds = apr_array_make(g_pool, 1, sizeof(md_t*));
+    APR_ARRAY_PUSH(mds, md_t*) = md;
+    ck_assert_int_eq(md_reg_freeze_domains(reg, mds), APR_SUCCESS);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub1, reg, md, 0, g_pool), APR_SUCCESS);
+    md_reg_certs_changed(reg, NULL);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub2, reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert_ptr_eq(pub1, pub2);
+}
+END_TEST
+
+START_TEST(md_reg_pubcert_preload)
+{
+    md_reg_t *reg;
+    md_t *md;
+    apr_array_header_t *mds;
+    const md_pubcert_t *pub;
+    int i;
+
+    ck_assert_int_eq(md_crypt_init(g_pool), APR_SUCCESS);
+    mds = make_ec_mds(8, g_pool);
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, md_t*);
+        ck_assert_int_eq(md_save(g_store, g_pool, MD_SG_DOMAINS, md, 1), APR_SUCCESS);
+        if (i % 2) save_self_signed(g_store, md, g_pool);
+    }
+    ck_assert_int_eq(md_reg_create(&reg, g_pool, g_store, NULL, NULL, NULL, 0, 0, 0, 0),
+                     APR_SUCCESS);
+    ck_assert_int_eq(md_reg_preload_pubcerts(reg, mds, 4, g_pool), APR_SUCCESS);
+
+    /* certificates appearing later are not seen, the registry answers from
+     * what it preloaded */
+    for (i = 0; i < mds->nelts; i += 2) {
+        save_self_signed(g_store, APR_ARRAY_IDX(mds, i, md_t*), g_pool);
+    }
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, md_t*);
+        ck_assert_int_eq(md_reg_get_pubcert(&pub, reg, md, 0, g_pool),
+                         (i % 2)? APR_SUCCESS : APR_ENOENT);
+    }
+}
+END_TEST
+
+START_TEST(md_reg_memo_reuse)
+{
+    md_reg_memo_t *memo;
+    md_reg_t *reg;
+    apr_array_header_t *mds;
+    const md_pubcert_t *pub, *pub0, *pub1;
+    md_pkey_spec_t *spec;
+    md_pkey_t *pkey;
+    md_t *md;
+
+    ck_assert_int_eq(md_crypt_init(g_pool), APR_SUCCESS);
+    memo = md_reg_memo_make(g_pool);
+    mds = make_ec_mds(2, g_pool);
+    save_self_signed(g_store, APR_ARRAY_IDX(mds, 0, md_t*), g_pool);
+    reg = sync_with_memo(g_store, memo, mds, g_pool);
+    ck_assert_int_eq(APR_ARRAY_IDX(mds, 0, md_t*)->state, MD_S_COMPLETE);
+    ck_assert_int_eq(APR_ARRAY_IDX(mds, 1, md_t*)->state, MD_S_INCOMPLETE);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub0, reg, APR_ARRAY_IDX(mds, 0, md_t*), 0, g_pool),
+                     APR_SUCCESS);
+    ck_assert_int_eq(md_reg_freeze_domains(reg, mds), APR_SUCCESS);
+
+    /* the next generation, with the same config and store */
+    mds = make_ec_mds(2, g_pool);
+    reg = sync_with_memo(g_store, memo, mds, g_pool);
+    ck_assert_int_eq(APR_ARRAY_IDX(mds, 0, md_t*)->state, MD_S_COMPLETE);
+    ck_assert_int_eq(APR_ARRAY_IDX(mds, 1, md_t*)->state, MD_S_INCOMPLETE);
+    ck_assert_ptr_nonnull(APR_ARRAY_IDX(mds, 1, md_t*)->state_descr);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub, reg, APR_ARRAY_IDX(mds, 0, md_t*), 0, g_pool),
+                     APR_SUCCESS);
+    ck_assert_ptr_eq(pub, pub0);
+    ck_assert_int_eq(md_reg_freeze_domains(reg, mds), APR_SUCCESS);
+
+    /* a new private key makes the certificates load again */
+    mds = make_ec_mds(2, g_pool);
+    md = APR_ARRAY_IDX(mds, 0, md_t*);
+    spec = md_pkeys_spec_get(md->pks, 0);
+    ck_assert_int_eq(md_pkey_gen(&pkey, g_pool, spec), APR_SUCCESS);
+    ck_assert_int_eq(md_pkey_save(g_store, g_pool, MD_SG_DOMAINS, md->name, spec, pkey, 0),
+                     APR_SUCCESS);
+    reg = sync_with_memo(g_store, memo, mds, g_pool);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub, reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert(pub != pub0);
+    ck_assert_int_eq(md_reg_freeze_domains(reg, mds), APR_SUCCESS);
+
+    /* a new certificate in the store and a changed config are both seen */
+    mds = make_ec_mds(2, g_pool);
+    save_self_signed(g_store, APR_ARRAY_IDX(mds, 1, md_t*), g_pool);
+    APR_ARRAY_IDX(mds, 0, md_t*)->must_staple = 1;
+    reg = sync_with_memo(g_store, memo, mds, g_pool);
+    ck_assert_int_eq(APR_ARRAY_IDX(mds, 0, md_t*)->state, MD_S_INCOMPLETE);
+    md = APR_ARRAY_IDX(mds, 1, md_t*);
+    ck_assert_int_eq(md->state, MD_S_COMPLETE);
+    ck_assert_int_eq(md_reg_get_pubcert(&pub1, reg, md, 0, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(pub1->certs->nelts, 1);
+}
+END_TEST
+
+START_TEST(md_status_snap_changes)
+{
+    md_reg_t *reg;
+    apr_array_header_t *mds;
+    md_status_snap_t *snap;
+    apr_uint32_t gens[3] = { 0, 0, 0 }, gen;
+    md_json_t *jstatus, *jstock, *jprops;
+    const char *name;
+
+    ck_assert_int_eq(md_crypt_init(g_pool), APR_SUCCESS);
+    mds = make_ec_mds(3, g_pool);
+    reg = sync_with_memo(g_store, NULL, mds, g_pool);
+    ck_assert_int_eq(md_reg_freeze_domains(reg, mds), APR_SUCCESS);
+    ck_assert_int_eq(md_status_snap_make(&snap, g_pool, mds, reg, NULL, gens), APR_SUCCESS);
+
+    md_status_snap_get(&jstatus, &jstock, snap, g_pool);
+    ck_assert_int_eq(md_json_getl(jstock, MD_KEY_TOTAL, NULL), 3);
+    ck_assert_int_eq(md_json_getl(jstock, MD_KEY_RENEWING, NULL), 3);
+    ck_assert_int_eq(md_json_getl(jstock, MD_KEY_READY, NULL), 0);
+
+    /* a finished renewal only shows once its MD is marked as changed */
+    name = APR_ARRAY_IDX(mds, 1, md_t*)->name;
+    jprops = md_json_create(g_pool);
+    md_json_setb(1, jprops, MD_KEY_FINISHED, NULL);
+    ck_assert_int_eq(md_store_save_json(g_store, g_pool, MD_SG_STAGING, name, MD_FN_JOB,
+                                        jprops, 0), APR_SUCCESS);
+    md_status_snap_get(&jstatus, &jstock, snap, g_pool);
+    ck_assert_int_eq(md_json_getl(jstock, MD_KEY_READY, NULL), 0);
+
+    md_status_snap_changed(snap, name);
+    md_status_snap_changed(snap, "not-an-md.example.org");
+    ck_assert_int_eq(gens[1], 1);
+    ck_assert(md_status_snap_get_gen(&gen, snap, name));
+    ck_assert_int_eq(gen, 1);
+    ck_assert(!md_status_snap_get_gen(&gen, snap, "not-an-md.example.org"));
+    md_status_snap_get(&jstatus, &jstock, snap, g_pool);
+    ck_assert_int_eq(md_json_getl(jstock, MD_KEY_READY, NULL), 1);
+    ck_assert_int_eq(md_json_getl(jstock, MD_KEY_TOTAL, NULL), 3);
+
+    /* callers get copies, changing them leaves the snapshot as it is */
+    md_json_setl(0, jstock, MD_KEY_TOTAL, NULL);
+    md_json_del(jstatus, MD_KEY_MDS, NULL);
+    md_status_snap_get(&jstatus, &jstock, snap, g_pool);
+    ck_assert_int_eq(md_json_getl(jstock, MD_KEY_TOTAL, NULL), 3);
+    ck_assert_ptr_nonnull(md_json_getj(jstatus, MD_KEY_MDS, NULL));
+}
+END_TEST
+
+typedef struct {
+    apr_array_header_t *names;          /* name of each MD reported */
+    int max_keys;                       /* most fields reported for an MD */
+} query_result_t;
+
+static int count_key(void *baton, const char *key, md_json_t *json)
+{
+    (void)key;
+    (void)json;
+    ++(*(int *)baton);
+    return 1;
+}
+
+static int collect_status(void *baton, size_t index, md_json_t *json)
+{
+    query_result_t *res = baton;
+    int keys = 0;
+
+    (void)index;
+    APR_ARRAY_PUSH(res->names, const char*) = md_json_dups(g_pool, json, MD_KEY_NAME, NULL);
+    md_json_iterkey(count_key, &keys, json, NULL);
+    if (keys > res->max_keys) res->max_keys = keys;
+    return 1;
+}
+
+static query_result_t *query_mds(md_status_query_t *query, apr_array_header_t *mds, 
+                                 md_reg_t *reg)
+{
+    query_result_t *res = apr_pcalloc(g_pool, sizeof(*res));
+    md_json_t *json;
+
+    ck_assert_int_eq(md_status_get_json(&json, mds, reg, NULL, query, g_pool), APR_SUCCESS);
+    res->names = apr_array_make(g_pool, 10, sizeof(const char*));
+    md_json_itera(collect_status, res, json, MD_KEY_MDS, NULL);
+    return res;
+}
+
+START_TEST(md_status_query_select)
+{
+    md_reg_t *reg;
+    apr_array_header_t *mds;
+    md_status_query_t query;
+    query_result_t *res;
+
+    ck_assert_int_eq(md_crypt_init(g_pool), APR_SUCCESS);
+    mds = make_ec_mds(12, g_pool);
+    reg = sync_with_memo(g_store, NULL, mds, g_pool);
+
+    memset(&query, 0, sizeof(query));
+    query.limit = -1;
+    ck_assert_int_eq(query_mds(&query, mds, reg)->names->nelts, 12);
+    query.prefix = "md0001";
+    ck_assert_int_eq(query_mds(&query, mds, reg)->names->nelts, 2);
+    query.prefix = NULL;
+
+    query.offset = 1;
+    query.limit = 2;
+    res = query_mds(&query, mds, reg);
+    ck_assert_int_eq(res->names->nelts, 2);
+    ck_assert_str_eq(APR_ARRAY_IDX(res->names, 0, const char*), "md00001.example.org");
+    ck_assert_str_eq(APR_ARRAY_IDX(res->names, 1, const char*), "md00002.example.org");
+    query.offset = 11;
+    query.limit = -1;
+    ck_assert_int_eq(query_mds(&query, mds, reg)->names->nelts, 1);
+    query.offset = 0;
+
+    /* none of them has a certificate yet, so all are renewing */
+    query.states = MD_STATUS_COMPLETE;
+    ck_assert_int_eq(query_mds(&query, mds, reg)->names->nelts, 0);
+    query.states = MD_STATUS_COMPLETE|MD_STATUS_RENEWING;
+    ck_assert_int_eq(query_mds(&query, mds, reg)->names->nelts, 12);
+    query.states = 0;
+
+    query.fields = apr_array_make(g_pool, 2, sizeof(const char*));
+    APR_ARRAY_PUSH(query.fields, const char*) = MD_KEY_NAME;
+    APR_ARRAY_PUSH(query.fields, const char*) = MD_KEY_CERT;
+    res = query_mds(&query, mds, reg);
+    ck_assert_int_eq(res->names->nelts, 12);
+    ck_assert_int_eq(res->max_keys, 2);
+}
+END_TEST
+
+static int stored_job_errors(const char *name)
+{
+    md_json_t *json;
+
+    if (APR_SUCCESS != md_store_load_json(g_store, MD_SG_STAGING, name, MD_FN_JOB, 
+                                          &json, g_pool)) {
+        return -1;
+    }
+    return (int)md_json_getl(json, MD_KEY_ERRORS, NULL);
+}
+
+START_TEST(md_job_reg_coalesces)
+{
+    md_job_reg_t *jobs, *jobs2;
+    md_job_t *job;
+    md_result_t *result;
+    const char *name = "job.example.org";
+
+    jobs = md_job_reg_make(g_pool, g_store, MD_SG_STAGING, apr_time_from_sec(5));
+    job = md_job_reg_get(jobs, name);
+    ck_assert_ptr_eq(job, md_job_reg_get(jobs, name));
+    ck_assert_int_eq(stored_job_errors(name), -1);
+
+    /* the first save goes to the store, the next ones wait for the flush */
+    result = md_result_make(g_pool, APR_EGENERAL);
+    job->error_runs = 1;
+    ck_assert_int_eq(md_job_save(job, result, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(stored_job_errors(name), 1);
+    job->error_runs = 2;
+    ck_assert_int_eq(md_job_save(job, NULL, g_pool), APR_SUCCESS);
+    job->error_runs = 3;
+    ck_assert_int_eq(md_job_save(job, NULL, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(stored_job_errors(name), 1);
+    ck_assert_ptr_nonnull(job->last_result);
+    ck_assert_int_eq(job->last_result->status, APR_EGENERAL);
+
+    ck_assert_int_eq(md_job_reg_flush(jobs, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(stored_job_errors(name), 3);
+    ck_assert_ptr_null(job->unwritten);
+
+    /* another process sees what was written */
+    jobs2 = md_job_reg_make(g_pool, g_store, MD_SG_STAGING, apr_time_from_sec(5));
+    ck_assert_int_eq(md_job_reg_get(jobs2, name)->error_runs, 3);
+    job->error_runs = 4;
+    md_job_save(job, NULL, g_pool);
+    md_job_reg_flush(jobs, g_pool);
+    ck_assert_int_eq(md_job_reg_get(jobs2, name)->error_runs, 3);
+    ck_assert_int_eq(md_job_reg_load(jobs2, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_job_reg_get(jobs2, name)->error_runs, 4);
+
+    /* the outcome of a run is written on the next save */
+    md_job_start_run(job, result, g_store);
+    md_job_end_run(job, result);
+    ck_assert_int_eq(md_job_save(job, result, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(stored_job_errors(name), 5);
+    ck_assert_ptr_null(job->unwritten);
+}
+END_TEST
+
+static int collect_log_type(void *baton, size_t index, md_json_t *entry)
+{
+    apr_array_header_t *types = baton;
+
+    (void)index;
+    APR_ARRAY_PUSH(types, const char*) = md_json_gets(entry, MD_KEY_TYPE, NULL);
+    return 1;
+}
+
+START_TEST(md_job_log_ring)
+{
+    md_job_t *job, *job2;
+    md_json_t *json, *entry;
+    apr_array_header_t *types;
+    const char *name = "log.example.org";
+    int i;
+
+    job = md_job_make(g_pool, g_store, MD_SG_STAGING, name, apr_time_from_sec(5));
+    job->max_log = 4;
+    md_job_log_append(job, "starting", NULL, NULL);
+    for (i = 0; i < 5; ++i) {
+        md_job_log_append(job, "progress", NULL, apr_psprintf(g_pool, "step %d", i));
+    }
+    /* "starting" has been replaced, the latest "progress" is found */
+    ck_assert_ptr_null(md_job_log_get_latest(job, "starting", g_pool));
+    ck_assert_int_eq(md_job_log_get_time_of_latest(job, "starting"), 0);
+    entry = md_job_log_get_latest(job, "progress", g_pool);
+    ck_assert_ptr_nonnull(entry);
+    ck_assert_str_eq(md_json_gets(entry, MD_KEY_DETAIL, NULL), "step 4");
+    ck_assert_int_ne(md_job_log_get_time_of_latest(job, "progress"), 0);
+
+    /* entries without a type are found as such */
+    md_job_log_append(job, NULL, NULL, "untyped");
+    ck_assert_str_eq(md_json_gets(md_job_log_get_latest(job, NULL, g_pool), 
+                                  MD_KEY_DETAIL, NULL), "untyped");
+
+    /* stored as entries, latest first */
+    md_job_log_append(job, "finished", "ok", NULL);
+    ck_assert_int_eq(md_job_save(job, NULL, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_store_load_json(g_store, MD_SG_STAGING, name, MD_FN_JOB, 
+                                        &json, g_pool), APR_SUCCESS);
+    types = apr_array_make(g_pool, 4, sizeof(const char*));
+    md_json_itera(collect_log_type, types, json, MD_KEY_LOG, MD_KEY_ENTRIES, NULL);
+    ck_assert_int_eq(types->nelts, 4);
+    ck_assert_str_eq(APR_ARRAY_IDX(types, 0, const char*), "finished");
+    ck_assert_ptr_null(APR_ARRAY_IDX(types, 1, const char*));
+    ck_assert_str_eq(APR_ARRAY_IDX(types, 3, const char*), "progress");
+
+    job2 = md_job_make(g_pool, g_store, MD_SG_STAGING, name, apr_time_from_sec(5));
+    ck_assert_int_eq(md_job_load(job2), APR_SUCCESS);
+    entry = md_job_log_get_latest(job2, "finished", g_pool);
+    ck_assert_ptr_nonnull(entry);
+    ck_assert_str_eq(md_json_gets(entry, MD_KEY_STATUS, NULL), "ok");
+    ck_assert(!md_json_has_key(entry, MD_KEY_DETAIL, NULL));
+    ck_assert_ptr_nonnull(md_job_log_get_latest(job2, NULL, g_pool));
+    ck_assert_str_eq(md_json_gets(md_job_log_get_latest(job2, "progress", g_pool), 
+                                  MD_KEY_DETAIL, NULL), "step 4");
+
+    /* logs written elsewhere, latest first, are read */
+    json = md_json_create(g_pool);
+    entry = md_json_create(g_pool);
+    md_json_sets("Thu, 02 May 2019 21:54:22 GMT", entry, MD_KEY_WHEN, NULL);
+    md_json_sets("renewed", entry, MD_KEY_TYPE, NULL);
+    md_json_addj(entry, json, MD_KEY_LOG, MD_KEY_ENTRIES, NULL);
+    entry = md_json_create(g_pool);
+    md_json_sets("Wed, 01 May 2019 21:54:22 GMT", entry, MD_KEY_WHEN, NULL);
+    md_json_sets("starting", entry, MD_KEY_TYPE, NULL);
+    md_json_addj(entry, json, MD_KEY_LOG, MD_KEY_ENTRIES, NULL);
+    ck_assert_int_eq(md_store_save_json(g_store, g_pool, MD_SG_STAGING, name, MD_FN_JOB,
+                                        json, 0), APR_SUCCESS);
+    job2 = md_job_make(g_pool, g_store, MD_SG_STAGING, name, apr_time_from_sec(5));
+    ck_assert_int_eq(md_job_load(job2), APR_SUCCESS);
+    ck_assert_int_eq(md_job_log_get_time_of_latest(job2, "renewed"), 
+                     apr_date_parse_rfc("Thu, 02 May 2019 21:54:22 GMT"));
+    ck_assert_int_eq(md_job_log_get_time_of_latest(job2, "starting"), 
+                     apr_date_parse_rfc("Wed, 01 May 2019 21:54:22 GMT"));
+}
+END_TEST
+
+TCase *md_store_test_case(void)
+{
+    TCase *testcase = tcase_create("md_store");
+
+    tcase_add_checked_fixture(testcase, md_store_setup, md_store_teardown);
+    tcase_set_timeout(testcase, 300);
+
+    tcase_add_test(testcase, md_util_parallel_do_all);
+    tcase_add_test(testcase, md_store_bulk_load);
+    tcase_add_test(testcase, md_store_md_iter_broken);
+    tcase_add_test(testcase, md_reg_do_stops_early);
+    tcase_add_test(testcase, md_reg_get_all_states);
+    tcase_add_test(testcase, md_store_pkey_cached);
+    tcase_add_test(testcase, md_store_plain_fallback_pkey);
+    tcase_add_test(testcase, md_store_remove_some_nms);
+    tcase_add_test(testcase, md_store_fname_fast);
+    tcase_add_test(testcase, md_reg_sync_renames);
+    tcase_add_test(testcase, md_reg_pubcert_cached);
+    tcase_add_test(testcase, md_reg_pubcert_preload);
+    tcase_add_test(testcase, md_reg_memo_reuse);
+    tcase_add_test(testcase, md_status_snap_changes);
+    tcase_add_test(testcase, md_status_query_select);
+    tcase_add_test(testcase, md_job_reg_coalesces);
+    tcase_add_test(testcase, md_job_log_ring);
+
+    return testcase;
+}
@@ -14,6 +14,8 @@
 
 #include <stdlib.h>
 
+#include <apr_strings.h>
+
 #include "test_common.h"
 #include "md_util.h"
 
@@ -21,6 +23,76 @@
  * Helpers
  */
 
+static apr_array_header_t *str_array(apr_pool_t *p, const char *s, ...)
+{
+    apr_array_header_t *a;
+    va_list ap;
+
+    a = apr_array_make(p, 5, sizeof(const char*));
+    va_start(ap, s);
+    for (; s; s = va_arg(ap, const char*)) {
+        APR_ARRAY_PUSH(a, const char*) = s;
+    }
+    va_end(ap);
+    return a;
+}
+
+/* the straightforward O(n^2) way, to compare md_dns_make_minimal() with */
+static apr_array_header_t *minimal_by_pairs(apr_pool_t *p, apr_array_header_t *domains)
+{
+    apr_array_header_t *minimal;
+    const char *domain, *pattern;
+    int i, j, duplicate;
+
+    minimal = apr_array_make(p, domains->nelts, sizeof(const char *));
+    for (i = 0; i < domains->nelts; ++i) {
+        domain = APR_ARRAY_IDX(domains, i, const char*);
+        duplicate = 0;
+        for (j = 0; j < minimal->nelts && !duplicate; ++j) {
+            duplicate = md_dns_matches(APR_ARRAY_IDX(minimal, j, const char*), domain);
+        }
+        if (!duplicate && !md_dns_is_wildcard(p, domain)) {
+            for (j = i+1; j < domains->nelts && !duplicate; ++j) {
+                pattern = APR_ARRAY_IDX(domains, j, const char*);
+                duplicate = md_dns_is_wildcard(p, pattern) && md_dns_matches(pattern, domain);
+            }
+        }
+        if (!duplicate) APR_ARRAY_PUSH(minimal, const char *) = domain;
+    }
+    return minimal;
+}
+
+/* names as in a large SAN list: subdomains of a few zones, some wildcards */
+static apr_array_header_t *make_sans(apr_pool_t *p, int count)
+{
+    apr_array_header_t *a;
+    int i;
+
+    a = apr_array_make(p, count, sizeof(const char*));
+    for (i = 0; i < count; ++i) {
+        if (i % 97 == 0) {
+            APR_ARRAY_PUSH(a, const char*) = apr_psprintf(p, "*.z%d.example.org", i % 13);
+        }
+        else if (i % 5 == 0) {
+            APR_ARRAY_PUSH(a, const char*) = apr_psprintf(p, "H%d.Z%d.example.org", i % 50, i % 13);
+        }
+        else {
+            APR_ARRAY_PUSH(a, const char*) = apr_psprintf(p, "h%d.z%d.example.org", i, i % 13);
+        }
+    }
+    return a;
+}
+
+static void assert_str_array_eq(apr_array_header_t *a1, apr_array_header_t *a2)
+{
+    int i;
+
+    ck_assert_int_eq(a1->nelts, a2->nelts);
+    for (i = 0; i < a1->nelts; ++i) {
+        ck_assert_str_eq(APR_ARRAY_IDX(a1, i, const char*), APR_ARRAY_IDX(a2, i, const char*));
+    }
+}
+
 /*
  * Test Fixture -- runs once per test
  */
@@ -99,6 +171,78 @@ START_TEST(base64_md_util_largetrip)
 }
 END_TEST
 
+START_TEST(dns_md_util_minimal)
+{
+    apr_array_header_t *domains;
+
+    domains = str_array(g_pool, "a.example.org", "*.example.org", "b.example.org", NULL);
+    assert_str_array_eq(md_dns_make_minimal(g_pool, domains),
+                        str_array(g_pool, "*.example.org", NULL));
+    domains = str_array(g_pool, "*.example.org", "A.example.org", "x.y.example.org", 
+                        "example.org", NULL);
+    assert_str_array_eq(md_dns_make_minimal(g_pool, domains),
+                        str_array(g_pool, "*.example.org", "x.y.example.org", "example.org", NULL));
+    domains = str_array(g_pool, "a.org", "A.ORG", "b.org", "*.org", NULL);
+    assert_str_array_eq(md_dns_make_minimal(g_pool, domains),
+                        str_array(g_pool, "a.org", "b.org", "*.org", NULL));
+    domains = make_sans(g_pool, 500);
+    assert_str_array_eq(md_dns_make_minimal(g_pool, domains), minimal_by_pairs(g_pool, domains));
+}
+END_TEST
+
+START_TEST(dns_md_util_set)
+{
+    md_dns_set_t *set;
+
+    set = md_dns_set_make(g_pool, 3);
+    md_dns_set_add(set, "a.example.org");
+    md_dns_set_add(set, "*.test.org");
+    md_dns_set_add(set, "B.example.org");
+    ck_assert_int_eq(md_dns_set_count(set), 3);
+
+    ck_assert_str_eq(md_dns_set_match(set, "A.Example.Org"), "a.example.org");
+    ck_assert_str_eq(md_dns_set_match(set, "b.example.org"), "B.example.org");
+    ck_assert_str_eq(md_dns_set_match(set, "www.test.org"), "*.test.org");
+    ck_assert_str_eq(md_dns_set_match(set, "*.test.org"), "*.test.org");
+    ck_assert(md_dns_set_match(set, "x.www.test.org") == NULL);
+    ck_assert(md_dns_set_match(set, "c.example.org") == NULL);
+    ck_assert(md_dns_set_match(set, "*.example.org") == NULL);
+
+    ck_assert_str_eq(md_dns_set_matched_by(set, "*.example.org"), "a.example.org");
+    ck_assert_str_eq(md_dns_set_matched_by(set, "b.EXAMPLE.org"), "B.example.org");
+    ck_assert_str_eq(md_dns_set_matched_by(set, "*.test.org"), "*.test.org");
+    ck_assert(md_dns_set_matched_by(set, "www.test.org") == NULL);
+    ck_assert(md_dns_set_matched_by(set, "*.org") == NULL);
+}
+END_TEST
+
+START_TEST(dns_md_util_set_of)
+{
+    apr_array_header_t *domains, *names;
+    md_dns_set_t *set;
+    const char *name;
+    int i;
+
+    domains = make_sans(g_pool, 500);
+    set = md_dns_set_of(g_pool, domains);
+    ck_assert_int_eq(md_dns_set_count(set), domains->nelts);
+    names = str_array(g_pool, "a.z0.EXAMPLE.org", "x.a.z0.example.org", "z0.example.org",
+                      "*.z0.example.org", "*.z1.example.org", "*.example.org", "example.org",
+                      "nosuchdomain", "", apr_psprintf(g_pool, "%0300d.z0.example.org", 0),
+                      NULL);
+    for (i = 0; i < domains->nelts; ++i) {
+        APR_ARRAY_PUSH(names, const char*) = APR_ARRAY_IDX(domains, i, const char*);
+        APR_ARRAY_PUSH(names, const char*) = apr_psprintf(g_pool, "w.%s",
+                                                          APR_ARRAY_IDX(domains, i, const char*));
+    }
+    for (i = 0; i < names->nelts; ++i) {
+        name = APR_ARRAY_IDX(names, i, const char*);
+        ck_assert_int_eq(md_dns_set_match(set, name) != NULL,
+                         md_dns_domains_match(domains, name));
+    }
+}
+END_TEST
+
 TCase *md_util_test_case(void)
 {
     TCase *testcase = tcase_create("md_util");
@@ -107,6 +251,9 @@ TCase *md_util_test_case(void)
 
     tcase_add_test(testcase, base64_md_util_roundtrip);
     tcase_add_test(testcase, base64_md_util_largetrip);
+    tcase_add_test(testcase, dns_md_util_minimal);
+    tcase_add_test(testcase, dns_md_util_set);
+    tcase_add_test(testcase, dns_md_util_set_of);
 
     return testcase;
 }